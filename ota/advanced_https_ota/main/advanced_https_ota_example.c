@@ -12,12 +12,14 @@
 #include "freertos/event_groups.h"
 
 #include "esp_system.h"
-#include "esp_wifi.h"
-#include "esp_event_loop.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_http_client.h"
-#include "esp_https_ota.h"
+#include "ota_engine.h"
+#include "connectivity.h"
+#ifdef CONFIG_OTA_ROLLOUT
+#include "ota_rollout.h"
+#endif
 
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -26,130 +28,95 @@ static const char *TAG = "advanced_https_ota_example";
 extern const uint8_t server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
 
-/* FreeRTOS event group to signal when we are connected & ready to make a request */
-static EventGroupHandle_t wifi_event_group;
+#define NETWORK_WAIT_MS 30000
+#define OTA_RESUME_ATTEMPTS 10
+#define OTA_RESUME_DELAY_MS 1000
 
-/* The event group allows multiple bits for each event,
-   but we only care about one event - are we connected
-   to the AP with an IP? */
-const int CONNECTED_BIT = BIT0;
-
-static esp_err_t event_handler(void *ctx, system_event_t *event)
-{
-    switch (event->event_id) {
-    case SYSTEM_EVENT_STA_START:
-        esp_wifi_connect();
-        break;
-    case SYSTEM_EVENT_STA_GOT_IP:
-        xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
-        break;
-    case SYSTEM_EVENT_STA_DISCONNECTED:
-        /* This is a workaround as ESP32 WiFi libs don't currently
-           auto-reassociate. */
-        esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
-        break;
-    default:
-        break;
-    }
-    return ESP_OK;
-}
-
-static void initialise_wifi(void)
+//Waits for the network, which connectivity keeps reconnecting, logging while it takes long
+static void wait_for_network(void)
 {
-    tcpip_adapter_init();
-    wifi_event_group = xEventGroupCreate();
-    ESP_ERROR_CHECK( esp_event_loop_init(event_handler, NULL) );
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
-    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = CONFIG_WIFI_SSID,
-            .password = CONFIG_WIFI_PASSWORD,
-        },
-    };
-    ESP_LOGI(TAG, "Setting WiFi configuration SSID %s", wifi_config.sta.ssid);
-    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
-    ESP_ERROR_CHECK( esp_wifi_start() );
-}
-
-static esp_err_t validate_image_header(esp_app_desc_t *new_app_info)
-{
-    if (new_app_info == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    const esp_partition_t *running = esp_ota_get_running_partition();
-    esp_app_desc_t running_app_info;
-    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) {
-        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
+    while (connectivity_wait(pdMS_TO_TICKS(NETWORK_WAIT_MS)) != ESP_OK) {
+        ESP_LOGW(TAG, "Still not connected to %s", CONFIG_WIFI_SSID);
     }
-
-    if (memcmp(new_app_info->version, running_app_info.version, sizeof(new_app_info->version)) == 0) {
-        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
-        return ESP_FAIL;
-    }
-    return ESP_OK;
 }
 
 void advanced_ota_example_task(void * pvParameter)
 {
     ESP_LOGI(TAG, "Starting Advanced OTA example");
 
-    xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT,
-                        false, true, portMAX_DELAY);
+    wait_for_network();
     ESP_LOGI(TAG, "Connected to WiFi network! Attempting to connect to server...");
     
-    esp_err_t ota_finish_err = ESP_OK;
     esp_http_client_config_t config = {
         .url = CONFIG_FIRMWARE_UPGRADE_URL,
         .cert_pem = (char *)server_cert_pem_start,
     };
     
-    esp_https_ota_config_t ota_config = {
+#ifdef CONFIG_OTA_ROLLOUT
+    ota_rollout_target_t rollout_target;
+    ota_rollout_wait((const char *)server_cert_pem_start, esp_ota_get_app_description()->version, &rollout_target);
+    config.url = rollout_target.url;
+    config.event_handler = ota_rollout_http_event_handler;
+#endif
+
+    ota_engine_config_t engine_config = {
         .http_config = &config,
     };
-    
-    esp_https_ota_handle_t https_ota_handle = NULL;
-    esp_err_t err = esp_https_ota_begin(&ota_config, &https_ota_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "ESP HTTPS OTA Begin failed");
-        vTaskDelete(NULL);
+    ota_engine_handle_t engine;
+    ESP_ERROR_CHECK(ota_engine_init(&engine_config, &engine));
+    if (ota_engine_get_state(engine) == OTA_ENGINE_STATE_CONFIRM) {
+        //First boot of this app with rollback enabled, it connected, that is enough to keep it
+        ota_engine_confirm(engine, true);
     }
 
+    //The engine compares the version of the new image with the running and the last rolled back one
     esp_app_desc_t app_desc;
-    err = esp_https_ota_get_img_desc(https_ota_handle, &app_desc);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_https_ota_read_img_desc failed");
-        goto ota_end;
+    esp_err_t err = ota_engine_check(engine, &app_desc);
+#ifdef CONFIG_OTA_ROLLOUT
+    for (int attempts = 1; err == ESP_ERR_OTA_ENGINE_BUSY && attempts < CONFIG_OTA_ROLLOUT_BUSY_ATTEMPTS; attempts++) {
+        ota_rollout_backoff(ota_engine_get_http_status(engine));
+        err = ota_engine_check(engine, &app_desc);
     }
-    err = validate_image_header(&app_desc);
+#endif
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "image header verification failed");
-        goto ota_end;
+        vTaskDelete(NULL);
     }
+    ESP_LOGI(TAG, "New firmware %s %s, built %s %s", app_desc.project_name, app_desc.version, app_desc.date, app_desc.time);
 
+    int resumes = 0;
     while (1) {
-        err = esp_https_ota_perform(https_ota_handle);
-        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+        err = ota_engine_perform(engine);
+        if (err == ESP_ERR_OTA_ENGINE_PAUSED && resumes++ < OTA_RESUME_ATTEMPTS) {
+            //The download continues where it stopped once the network is back
+            wait_for_network();
+            vTaskDelay(pdMS_TO_TICKS(OTA_RESUME_DELAY_MS));
+            continue;
+        }
+        if (err != ESP_ERR_OTA_ENGINE_IN_PROGRESS) {
             break;
         }
-        // esp_https_ota_perform returns after every read operation which gives user the ability to
-        // monitor the status of OTA upgrade by calling esp_https_ota_get_image_len_read, which gives length of image
-        // data read so far.
-        ESP_LOGD(TAG, "Image bytes read: %d", esp_https_ota_get_image_len_read(https_ota_handle));
+        // ota_engine_perform returns after every read operation which gives user the ability to
+        // monitor the status of OTA upgrade by calling ota_engine_get_stats, which gives length of image
+        // data written so far.
+        ota_engine_stats_t stats;
+        ota_engine_get_stats(engine, &stats);
+        ESP_LOGD(TAG, "Image bytes written: %d", stats.image_len);
     }
 
-ota_end:
-    ota_finish_err = esp_https_ota_finish(https_ota_handle);
-    if ((err == ESP_OK) && (ota_finish_err == ESP_OK)) {
-        ESP_LOGI(TAG, "ESP_HTTPS_OTA upgrade successful. Rebooting ...");
+    if (err == ESP_OK) {
+        err = ota_engine_verify(engine);
+    }
+    if (err == ESP_OK) {
+        err = ota_engine_activate(engine);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "OTA upgrade successful. Rebooting ...");
         vTaskDelay(1000 / portTICK_PERIOD_MS);
         esp_restart();
     } else {
-        ESP_LOGE(TAG, "ESP_HTTPS_OTA upgrade failed...");
+        ESP_LOGE(TAG, "OTA upgrade failed in state %s (%s)",
+                 ota_engine_state_name(ota_engine_get_state(engine)), esp_err_to_name(ota_engine_get_error(engine)));
     }
 
     while (1) {
@@ -171,7 +138,11 @@ void app_main()
     }
     ESP_ERROR_CHECK( err );
 
-    initialise_wifi();
+    connectivity_config_t connectivity_config = {
+        .ssid = CONFIG_WIFI_SSID,
+        .password = CONFIG_WIFI_PASSWORD,
+    };
+    connectivity_start(&connectivity_config);
     xTaskCreate(&advanced_ota_example_task, "advanced_ota_example_task", 1024 * 8, NULL, 5, NULL);
 }
 
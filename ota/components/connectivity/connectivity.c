@@ -0,0 +1,254 @@
+/* Wi-Fi connectivity
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "tcpip_adapter.h"
+#include "nvs.h"
+#include "connectivity.h"
+
+#define UP_BIT              BIT0
+#define NVS_NAMESPACE       "connectivity"
+#define NVS_KEY_AP          "ap"
+#define CACHED_AP_ATTEMPTS  2           //Failed connections to the cached AP before scanning again
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} cached_ap_t;
+
+ESP_EVENT_DEFINE_BASE(CONNECTIVITY_EVENT);
+
+static const char *TAG = "connectivity";
+static EventGroupHandle_t s_event_group;
+static esp_timer_handle_t s_reconnect_timer;
+static wifi_config_t s_wifi_config;
+static cached_ap_t s_cached_ap;
+static bool s_have_cached_ap;
+static bool s_use_cached_ap;            //The configuration targets the cached AP
+static int s_failures;                  //Connection attempts since the last success
+static int64_t s_start_time;
+static int64_t s_down_time;             //Since when the connection is lost, 0 while up and before the first connection
+static bool s_up;
+static connectivity_stats_t s_stats;
+
+static void load_cached_ap(void)
+{
+#ifdef CONFIG_CONNECTIVITY_CACHE_AP
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(s_cached_ap);
+    s_have_cached_ap = nvs_get_blob(handle, NVS_KEY_AP, &s_cached_ap, &len) == ESP_OK && len == sizeof(s_cached_ap);
+    s_use_cached_ap = s_have_cached_ap;
+    nvs_close(handle);
+#endif
+}
+
+static void save_cached_ap(void)
+{
+#ifdef CONFIG_CONNECTIVITY_CACHE_AP
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    if (s_have_cached_ap && memcmp(ap.bssid, s_cached_ap.bssid, sizeof(ap.bssid)) == 0
+            && ap.primary == s_cached_ap.channel) {
+        return;
+    }
+    memcpy(s_cached_ap.bssid, ap.bssid, sizeof(ap.bssid));
+    s_cached_ap.channel = ap.primary;
+    s_have_cached_ap = true;
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, NVS_KEY_AP, &s_cached_ap, sizeof(s_cached_ap)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+#endif
+}
+
+//Connect straight to the cached AP, or scan for the SSID
+static void apply_config(void)
+{
+    s_wifi_config.sta.bssid_set = s_use_cached_ap;
+    memcpy(s_wifi_config.sta.bssid, s_cached_ap.bssid, sizeof(s_wifi_config.sta.bssid));
+    s_wifi_config.sta.channel = s_use_cached_ap ? s_cached_ap.channel : 0;
+    ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &s_wifi_config) );
+}
+
+static void reconnect(void *arg)
+{
+    s_failures++;
+    esp_wifi_connect();
+}
+
+//Full jitter: uniform in [0, min(max, min * 2^failures)]
+static uint32_t backoff_ms(void)
+{
+    uint32_t ceiling = CONFIG_CONNECTIVITY_BACKOFF_MIN_MS;
+    for (int i = 0; i < s_failures && ceiling < CONFIG_CONNECTIVITY_BACKOFF_MAX_MS; i++) {
+        ceiling = ceiling > 0 ? ceiling * 2 : 1;
+    }
+    if (ceiling > CONFIG_CONNECTIVITY_BACKOFF_MAX_MS) {
+        ceiling = CONFIG_CONNECTIVITY_BACKOFF_MAX_MS;
+    }
+    return esp_random() % (ceiling + 1);
+}
+
+static void set_up(void)
+{
+    if (s_up) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (s_stats.start_to_up_us == 0) {
+        s_stats.boot_to_up_us = now;
+        s_stats.start_to_up_us = now - s_start_time;
+        ESP_LOGW(TAG, "boot_to_connected=%lld start_to_connected=%lld%s", s_stats.boot_to_up_us,
+                 s_stats.start_to_up_us, s_use_cached_ap ? " (cached AP)" : "");
+    } else {
+        s_stats.last_reconnect_us = now - s_down_time;
+        if (s_stats.last_reconnect_us > s_stats.max_reconnect_us) {
+            s_stats.max_reconnect_us = s_stats.last_reconnect_us;
+        }
+        ESP_LOGW(TAG, "reconnect=%lld after %d attempts%s", s_stats.last_reconnect_us, s_failures + 1,
+                 s_use_cached_ap ? " (cached AP)" : "");
+    }
+    s_stats.cached_ap = s_use_cached_ap;
+    s_up = true;
+    s_down_time = 0;
+    s_failures = 0;
+    save_cached_ap();
+    xEventGroupSetBits(s_event_group, UP_BIT);
+    esp_event_post(CONNECTIVITY_EVENT, CONNECTIVITY_EVENT_UP, NULL, 0, 0);
+}
+
+static void set_down(void)
+{
+    if (!s_up) {
+        return;
+    }
+    s_up = false;
+    s_down_time = esp_timer_get_time();
+    s_stats.disconnects++;
+    xEventGroupClearBits(s_event_group, UP_BIT);
+    esp_event_post(CONNECTIVITY_EVENT, CONNECTIVITY_EVENT_DOWN, NULL, 0, 0);
+}
+
+static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    switch (event_id) {
+    case WIFI_EVENT_STA_START:
+        esp_wifi_connect();
+        break;
+#ifdef CONFIG_CONNECTIVITY_STATIC_IP
+    case WIFI_EVENT_STA_CONNECTED: {
+        //The address is set once the interface is up, tcpip_adapter then posts IP_EVENT_STA_GOT_IP
+        tcpip_adapter_ip_info_t ip_info;
+        ip4addr_aton(CONFIG_CONNECTIVITY_STATIC_IP_ADDR, &ip_info.ip);
+        ip4addr_aton(CONFIG_CONNECTIVITY_STATIC_IP_NETMASK, &ip_info.netmask);
+        ip4addr_aton(CONFIG_CONNECTIVITY_STATIC_IP_GW, &ip_info.gw);
+        ESP_ERROR_CHECK( tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info) );
+        break;
+    }
+#endif
+    case WIFI_EVENT_STA_DISCONNECTED: {
+        const wifi_event_sta_disconnected_t *event = event_data;
+        set_down();
+        if (s_use_cached_ap && (event->reason == WIFI_REASON_NO_AP_FOUND || s_failures + 1 >= CACHED_AP_ATTEMPTS)) {
+            ESP_LOGI(TAG, "Cached AP not reachable (reason %d), scanning", event->reason);
+            s_use_cached_ap = false;
+            apply_config();
+        } else if (!s_use_cached_ap && s_have_cached_ap && s_failures == 0) {
+            //Lost a connection found by scanning: try the AP it was on first
+            s_use_cached_ap = true;
+            apply_config();
+        }
+        //esp_wifi_connect() can fail right after a disconnection, the timer
+        //also spaces the attempts
+        uint32_t delay_ms = backoff_ms();
+        ESP_LOGI(TAG, "Disconnected (reason %d), reconnecting in %u ms", event->reason, delay_ms);
+        esp_timer_start_once(s_reconnect_timer, delay_ms * 1000 + 1);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_id == IP_EVENT_STA_GOT_IP) {
+        set_up();
+    } else if (event_id == IP_EVENT_STA_LOST_IP) {
+        set_down();
+    }
+}
+
+void connectivity_start(const connectivity_config_t *config)
+{
+    s_start_time = esp_timer_get_time();
+    s_event_group = xEventGroupCreate();
+    tcpip_adapter_init();
+    esp_err_t err = esp_event_loop_create_default();
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK( err );
+    }
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect,
+        .name = "reconnect",
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &s_reconnect_timer) );
+    ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL) );
+    ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler, NULL) );
+
+#ifdef CONFIG_CONNECTIVITY_STATIC_IP
+    tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+    tcpip_adapter_dns_info_t dns_info = { 0 };
+    dns_info.ip.type = IPADDR_TYPE_V4;
+    ip4addr_aton(CONFIG_CONNECTIVITY_STATIC_IP_DNS, &dns_info.ip.u_addr.ip4);
+    tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dns_info);
+#endif
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
+    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
+    strlcpy((char *)s_wifi_config.sta.ssid, config->ssid, sizeof(s_wifi_config.sta.ssid));
+    strlcpy((char *)s_wifi_config.sta.password, config->password, sizeof(s_wifi_config.sta.password));
+    load_cached_ap();
+    ESP_LOGI(TAG, "Setting WiFi configuration SSID %s%s", s_wifi_config.sta.ssid, s_use_cached_ap ? " (cached AP)" : "");
+    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
+    apply_config();
+    ESP_ERROR_CHECK( esp_wifi_start() );
+}
+
+esp_err_t connectivity_wait(TickType_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(s_event_group, UP_BIT, false, true, timeout);
+    return bits & UP_BIT ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+bool connectivity_is_up(void)
+{
+    return s_up;
+}
+
+void connectivity_get_stats(connectivity_stats_t *stats)
+{
+    *stats = s_stats;
+}
\ No newline at end of file
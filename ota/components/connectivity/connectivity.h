@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_event.h"
+
+ESP_EVENT_DECLARE_BASE(CONNECTIVITY_EVENT);
+
+typedef enum {
+    CONNECTIVITY_EVENT_UP,      //Associated with the AP and has an IP address
+    CONNECTIVITY_EVENT_DOWN,    //Lost the AP or the address, reconnecting
+} connectivity_event_t;
+
+typedef struct {
+    const char *ssid;
+    const char *password;
+} connectivity_config_t;
+
+typedef struct {
+    int64_t boot_to_up_us;      //From boot to the first connection
+    int64_t start_to_up_us;     //From connectivity_start() to the first connection
+    int64_t last_reconnect_us;  //From the last loss of the connection until it was back
+    int64_t max_reconnect_us;
+    uint32_t disconnects;
+    bool cached_ap;             //The current or last connection went to the cached BSSID and channel
+} connectivity_stats_t;
+
+/**
+ * @brief   Start Wi-Fi in station mode and keep it connected.
+ *
+ * Creates the default event loop if needed. NVS must be initialised before.
+ * Lost connections are retried after an exponential backoff, and
+ * CONNECTIVITY_EVENT_UP and CONNECTIVITY_EVENT_DOWN are posted to the default
+ * event loop whenever the connection comes and goes.
+ */
+void connectivity_start(const connectivity_config_t *config);
+
+/**
+ * @brief   Wait for the connection.
+ *
+ * @return
+ *  - ESP_OK                Connected
+ *  - ESP_ERR_TIMEOUT       Still not connected after timeout
+ */
+esp_err_t connectivity_wait(TickType_t timeout);
+
+bool connectivity_is_up(void);
+
+void connectivity_get_stats(connectivity_stats_t *stats);
\ No newline at end of file
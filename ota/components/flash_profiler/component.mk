@@ -0,0 +1,11 @@
+COMPONENT_SRCDIRS := .
+COMPONENT_ADD_INCLUDEDIRS := .
+
+ifndef CONFIG_FLASH_PROFILER
+COMPONENT_OBJEXCLUDE := flash_profiler.o
+else
+COMPONENT_ADD_LDFLAGS += -Wl,--wrap=esp_partition_read -Wl,--wrap=esp_partition_write -Wl,--wrap=esp_partition_erase_range \
+                         -Wl,--wrap=esp_ota_write \
+                         -Wl,--wrap=spi_flash_disable_interrupts_caches_and_other_cpu \
+                         -Wl,--wrap=spi_flash_enable_interrupts_caches_and_other_cpu
+endif
\ No newline at end of file
@@ -0,0 +1,122 @@
+/* Flash profiler
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "flash_profiler.h"
+
+#define REPORT_LEN  1024
+
+static const char *TAG = "flash_profiler";
+static flash_profiler_stats_t s_stats;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+//Start of the current cache disabled period, nested calls are counted once
+static int64_t s_cache_disabled_start;
+static int s_cache_disable_depth;
+
+esp_err_t __real_esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t __real_esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t __real_esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size);
+esp_err_t __real_esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+void __real_spi_flash_disable_interrupts_caches_and_other_cpu(void);
+void __real_spi_flash_enable_interrupts_caches_and_other_cpu(void);
+
+static void record(flash_profiler_op_t op, size_t bytes, int64_t time_start, esp_err_t err)
+{
+    uint32_t us = esp_timer_get_time() - time_start;
+    portENTER_CRITICAL(&s_lock);
+    flash_profiler_stat_add(&s_stats.ops[op], bytes, us, err == ESP_OK);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+esp_err_t __wrap_esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = __real_esp_partition_read(partition, src_offset, dst, size);
+    record(FLASH_PROFILER_OP_READ, size, time_start, err);
+    return err;
+}
+
+esp_err_t __wrap_esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = __real_esp_partition_write(partition, dst_offset, src, size);
+    record(partition->encrypted ? FLASH_PROFILER_OP_WRITE_ENCRYPTED : FLASH_PROFILER_OP_WRITE, size, time_start, err);
+    return err;
+}
+
+esp_err_t __wrap_esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size)
+{
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = __real_esp_partition_erase_range(partition, start_addr, size);
+    record(FLASH_PROFILER_OP_ERASE, size, time_start, err);
+    return err;
+}
+
+esp_err_t __wrap_esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = __real_esp_ota_write(handle, data, size);
+    record(FLASH_PROFILER_OP_OTA_WRITE, size, time_start, err);
+    return err;
+}
+
+//Called by every flash operation, of the partition API or not (NVS, the
+//erase of esp_ota_begin(), ...). Runs from IRAM: between these two calls
+//nothing may be fetched through the cache, esp_timer_get_time() is in IRAM.
+void IRAM_ATTR __wrap_spi_flash_disable_interrupts_caches_and_other_cpu(void)
+{
+    __real_spi_flash_disable_interrupts_caches_and_other_cpu();
+    if (s_cache_disable_depth++ == 0) {
+        s_cache_disabled_start = esp_timer_get_time();
+    }
+}
+
+void IRAM_ATTR __wrap_spi_flash_enable_interrupts_caches_and_other_cpu(void)
+{
+    //Interrupts are still disabled on this core and the other core is parked
+    if (--s_cache_disable_depth == 0) {
+        flash_profiler_stat_add(&s_stats.ops[FLASH_PROFILER_OP_CACHE_DISABLED], 0,
+                                esp_timer_get_time() - s_cache_disabled_start, true);
+    }
+    __real_spi_flash_enable_interrupts_caches_and_other_cpu();
+}
+
+void flash_profiler_reset(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void flash_profiler_get_stats(flash_profiler_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void flash_profiler_print(void)
+{
+    flash_profiler_stats_t *stats = malloc(sizeof(flash_profiler_stats_t));
+    char *report = malloc(REPORT_LEN);
+    if (stats != NULL && report != NULL) {
+        flash_profiler_get_stats(stats);
+        flash_profiler_format(stats, report, REPORT_LEN);
+        ESP_LOGW(TAG, "flash operations:\n%s", report);
+    }
+    free(stats);
+    free(report);
+}
\ No newline at end of file
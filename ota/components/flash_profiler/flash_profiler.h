@@ -0,0 +1,23 @@
+#pragma once
+
+#include "flash_profiler_core.h"
+
+/**
+ * The profiler wraps esp_partition_read(), esp_partition_write(),
+ * esp_partition_erase_range() and esp_ota_write() at link time
+ * (-Wl,--wrap, added by the component with CONFIG_FLASH_PROFILER), and the
+ * functions disabling and enabling the cache of both cores around flash
+ * operations. Nothing needs to be called to start it.
+ */
+
+/**
+ * @brief   Clear the statistics, e.g. before an update.
+ */
+void flash_profiler_reset(void);
+
+void flash_profiler_get_stats(flash_profiler_stats_t *stats);
+
+/**
+ * @brief   Log the statistics as a table.
+ */
+void flash_profiler_print(void);
\ No newline at end of file
@@ -0,0 +1,85 @@
+/* Flash profiler statistics
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include "esp_attr.h"
+#include "flash_profiler_core.h"
+
+static const char *s_op_names[FLASH_PROFILER_OP_MAX] = {
+    [FLASH_PROFILER_OP_READ] = "read",
+    [FLASH_PROFILER_OP_WRITE] = "write",
+    [FLASH_PROFILER_OP_WRITE_ENCRYPTED] = "write_encrypted",
+    [FLASH_PROFILER_OP_ERASE] = "erase",
+    [FLASH_PROFILER_OP_OTA_WRITE] = "ota_write",
+    [FLASH_PROFILER_OP_CACHE_DISABLED] = "cache_disabled",
+};
+
+int IRAM_ATTR flash_profiler_bucket(uint32_t us)
+{
+    if (us == 0) {
+        return 0;
+    }
+    int bucket = 31 - __builtin_clz(us);
+    return bucket < FLASH_PROFILER_BUCKETS ? bucket : FLASH_PROFILER_BUCKETS - 1;
+}
+
+void IRAM_ATTR flash_profiler_stat_add(flash_profiler_stat_t *stat, size_t bytes, uint32_t us, bool ok)
+{
+    stat->count++;
+    if (!ok) {
+        stat->errors++;
+    }
+    stat->bytes += bytes;
+    stat->total_us += us;
+    if (us > stat->max_us) {
+        stat->max_us = us;
+    }
+    stat->histogram[flash_profiler_bucket(us)]++;
+}
+
+uint32_t flash_profiler_percentile(const flash_profiler_stat_t *stat, int permille)
+{
+    if (stat->count == 0) {
+        return 0;
+    }
+    uint64_t target = ((uint64_t)stat->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < FLASH_PROFILER_BUCKETS - 1; i++) {
+        seen += stat->histogram[i];
+        if (seen >= target) {
+            //The max is a tighter bound for the bucket holding it
+            uint32_t bound = 2u << i;
+            return bound < stat->max_us ? bound : stat->max_us;
+        }
+    }
+    return stat->max_us;
+}
+
+const char *flash_profiler_op_name(flash_profiler_op_t op)
+{
+    return op < FLASH_PROFILER_OP_MAX ? s_op_names[op] : "?";
+}
+
+int flash_profiler_format(const flash_profiler_stats_t *stats, char *buf, size_t len)
+{
+    int total = snprintf(buf, len, "%-16s %8s %6s %10s %10s %8s %8s %8s %8s\n",
+                         "op", "count", "errors", "bytes", "total_us", "mean_us", "p50_us", "p99_us", "max_us");
+    for (int op = 0; op < FLASH_PROFILER_OP_MAX; op++) {
+        const flash_profiler_stat_t *stat = &stats->ops[op];
+        if (stat->count == 0) {
+            continue;
+        }
+        size_t used = total < len ? total : len;
+        total += snprintf(buf + used, len - used, "%-16s %8u %6u %10llu %10llu %8llu %8u %8u %8u\n",
+                          s_op_names[op], stat->count, stat->errors, (unsigned long long)stat->bytes,
+                          (unsigned long long)stat->total_us, (unsigned long long)(stat->total_us / stat->count),
+                          flash_profiler_percentile(stat, 500), flash_profiler_percentile(stat, 990), stat->max_us);
+    }
+    return total;
+}
\ No newline at end of file
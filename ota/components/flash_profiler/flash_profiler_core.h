@@ -0,0 +1,56 @@
+#pragma once
+
+//Statistics of the flash profiler, without ESP-IDF dependencies, built on the host by host_test
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    FLASH_PROFILER_OP_READ,
+    FLASH_PROFILER_OP_WRITE,
+    FLASH_PROFILER_OP_WRITE_ENCRYPTED,  //esp_partition_write() to an encrypted partition
+    FLASH_PROFILER_OP_ERASE,
+    FLASH_PROFILER_OP_OTA_WRITE,        //esp_ota_write() as a whole, including its own writes and erases
+    FLASH_PROFILER_OP_CACHE_DISABLED,   //Both cores stalled, cache disabled for a flash operation
+    FLASH_PROFILER_OP_MAX,
+} flash_profiler_op_t;
+
+//Bucket i counts latencies in [2^i, 2^(i+1)) us, bucket 0 also [0, 1) and the last one everything above
+#define FLASH_PROFILER_BUCKETS  20
+
+typedef struct {
+    uint32_t count;
+    uint32_t errors;
+    uint64_t bytes;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t histogram[FLASH_PROFILER_BUCKETS];
+} flash_profiler_stat_t;
+
+typedef struct {
+    flash_profiler_stat_t ops[FLASH_PROFILER_OP_MAX];
+} flash_profiler_stats_t;
+
+/**
+ * @brief   Account one operation. Placed in IRAM, safe with the cache disabled.
+ */
+void flash_profiler_stat_add(flash_profiler_stat_t *stat, size_t bytes, uint32_t us, bool ok);
+
+int flash_profiler_bucket(uint32_t us);
+
+/**
+ * @brief   Latency below which a fraction of the operations completed, from the histogram.
+ *
+ * @return  Upper bound of the bucket reaching permille/1000 of the operations, 0 without operations
+ */
+uint32_t flash_profiler_percentile(const flash_profiler_stat_t *stat, int permille);
+
+const char *flash_profiler_op_name(flash_profiler_op_t op);
+
+/**
+ * @brief   Write a table of the statistics, one line per operation with any count.
+ *
+ * @return  Length of the report, as snprintf()
+ */
+int flash_profiler_format(const flash_profiler_stats_t *stats, char *buf, size_t len);
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdio.h>
+
+#define ESP_LOGW(tag, format, ...) printf("W %s: " format "\n", tag, ##__VA_ARGS__)
\ No newline at end of file
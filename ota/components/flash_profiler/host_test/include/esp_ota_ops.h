@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef uint32_t esp_ota_handle_t;
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+//Virtual time of the mock flash, advanced by the latency of each operation
+int64_t esp_timer_get_time(void);
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+//Single threaded host test, the critical sections do nothing
+
+typedef int portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(mux)         (void)(mux)
+#define portEXIT_CRITICAL(mux)          (void)(mux)
\ No newline at end of file
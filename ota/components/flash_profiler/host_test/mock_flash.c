@@ -0,0 +1,81 @@
+/* Mock flash for the host test of the flash profiler
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "esp_timer.h"
+#include "mock_flash.h"
+
+static uint8_t s_flash[MOCK_FLASH_SIZE];
+static int64_t s_now;
+
+int64_t esp_timer_get_time(void)
+{
+    return s_now;
+}
+
+void mock_flash_advance(int64_t us)
+{
+    s_now += us;
+}
+
+static bool in_partition(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return offset <= partition->size && size <= partition->size - offset
+           && partition->address + partition->size <= MOCK_FLASH_SIZE;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (!in_partition(partition, src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, s_flash + partition->address + src_offset, size);
+    s_now += MOCK_READ_US(size);
+    return ESP_OK;
+}
+
+//As in ESP-IDF, the cache is disabled around the programming and the erase,
+//the calls go through the linker wrappers since they are in another file
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (!in_partition(partition, dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t *dst = s_flash + partition->address + dst_offset;
+    spi_flash_disable_interrupts_caches_and_other_cpu();
+    //NOR flash only clears bits
+    for (size_t i = 0; i < size; i++) {
+        dst[i] &= ((const uint8_t *)src)[i];
+    }
+    s_now += MOCK_WRITE_US(size);
+    spi_flash_enable_interrupts_caches_and_other_cpu();
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size)
+{
+    if (start_addr % MOCK_SECTOR_SIZE != 0 || size % MOCK_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!in_partition(partition, start_addr, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    spi_flash_disable_interrupts_caches_and_other_cpu();
+    memset(s_flash + partition->address + start_addr, 0xff, size);
+    s_now += MOCK_ERASE_US(size);
+    spi_flash_enable_interrupts_caches_and_other_cpu();
+    return ESP_OK;
+}
+
+void mock_flash_init(const esp_partition_t *partition)
+{
+    memset(s_flash, 0xff, sizeof(s_flash));
+    s_now = 0;
+    mock_ota_init(partition);
+}
\ No newline at end of file
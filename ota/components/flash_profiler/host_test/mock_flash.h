@@ -0,0 +1,26 @@
+#pragma once
+
+//RAM backed flash with NOR semantics and a latency model in virtual time
+
+#include "esp_partition.h"
+
+#define MOCK_FLASH_SIZE         (1024 * 1024)
+#define MOCK_SECTOR_SIZE        4096
+
+#define MOCK_READ_US(size)      (2 + (size) / 32)           //About 32 MB/s
+#define MOCK_WRITE_US(size)     (20 + (size) * 2)           //About 500 KB/s
+#define MOCK_ERASE_US(size)     ((size) / MOCK_SECTOR_SIZE * 40000)
+
+//Erase the whole flash, reset the virtual time and esp_ota_write() to the start of partition
+void mock_flash_init(const esp_partition_t *partition);
+
+void mock_ota_init(const esp_partition_t *partition);
+
+//Advance the virtual time, as spent outside of the flash
+void mock_flash_advance(int64_t us);
+
+//Calls of the cache disabling function, as seen by the real implementation
+int mock_flash_cache_disable_count(void);
+
+void spi_flash_disable_interrupts_caches_and_other_cpu(void);
+void spi_flash_enable_interrupts_caches_and_other_cpu(void);
\ No newline at end of file
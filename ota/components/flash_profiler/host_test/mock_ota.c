@@ -0,0 +1,55 @@
+/* Mock esp_ota_write() for the host test of the flash profiler
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include "esp_ota_ops.h"
+#include "mock_flash.h"
+
+static const esp_partition_t *s_partition;
+static size_t s_wrote;
+static int s_cache_disable_count;
+
+void mock_ota_init(const esp_partition_t *partition)
+{
+    s_partition = partition;
+    s_wrote = 0;
+    s_cache_disable_count = 0;
+}
+
+//Like app_update: erase each sector when the write reaches it, then write.
+//In a file of its own so that its calls go through the profiler.
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    size_t end = s_wrote + size;
+    for (size_t sector = (s_wrote + MOCK_SECTOR_SIZE - 1) / MOCK_SECTOR_SIZE * MOCK_SECTOR_SIZE; sector < end;
+            sector += MOCK_SECTOR_SIZE) {
+        esp_err_t err = esp_partition_erase_range(s_partition, sector, MOCK_SECTOR_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    esp_err_t err = esp_partition_write(s_partition, s_wrote, data, size);
+    if (err == ESP_OK) {
+        s_wrote = end;
+    }
+    return err;
+}
+
+void spi_flash_disable_interrupts_caches_and_other_cpu(void)
+{
+    s_cache_disable_count++;
+}
+
+void spi_flash_enable_interrupts_caches_and_other_cpu(void)
+{
+}
+
+int mock_flash_cache_disable_count(void)
+{
+    return s_cache_disable_count;
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+/* Host test of the flash profiler, over a mock flash
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "flash_profiler.h"
+#include "mock_flash.h"
+#include "check.h"
+
+static const esp_partition_t s_partition = {
+    .address = 0x10000,
+    .size = 0x80000,
+    .label = "scratch",
+};
+
+static const esp_partition_t s_encrypted_partition = {
+    .address = 0x90000,
+    .size = 0x10000,
+    .label = "encrypted",
+    .encrypted = true,
+};
+
+static flash_profiler_stats_t get_stats(void)
+{
+    flash_profiler_stats_t stats;
+    flash_profiler_get_stats(&stats);
+    return stats;
+}
+
+static void test_buckets(void)
+{
+    static const struct {
+        uint32_t us;
+        int bucket;
+    } cases[] = {
+        { 0, 0 }, { 1, 0 }, { 2, 1 }, { 3, 1 }, { 4, 2 }, { 1023, 9 }, { 1024, 10 },
+        { 40000, 15 }, { 1u << (FLASH_PROFILER_BUCKETS - 1), FLASH_PROFILER_BUCKETS - 1 },
+        { 0xffffffff, FLASH_PROFILER_BUCKETS - 1 },
+    };
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        CHECK(flash_profiler_bucket(cases[i].us) == cases[i].bucket, "bucket of %u us: %d, expected %d",
+              cases[i].us, flash_profiler_bucket(cases[i].us), cases[i].bucket);
+    }
+
+    flash_profiler_stat_t stat = { 0 };
+    CHECK(flash_profiler_percentile(&stat, 500) == 0, "percentile without operations");
+    for (int i = 0; i < 99; i++) {
+        flash_profiler_stat_add(&stat, 0, 10, true);
+    }
+    flash_profiler_stat_add(&stat, 0, 5000, true);
+    CHECK(flash_profiler_percentile(&stat, 500) == 16, "p50: %u", flash_profiler_percentile(&stat, 500));
+    CHECK(flash_profiler_percentile(&stat, 990) == 16, "p99: %u", flash_profiler_percentile(&stat, 990));
+    CHECK(flash_profiler_percentile(&stat, 1000) == 5000, "p100: %u", flash_profiler_percentile(&stat, 1000));
+}
+
+static void test_partition_ops(void)
+{
+    uint8_t buf[1024];
+    mock_flash_init(&s_partition);
+    flash_profiler_reset();
+
+    CHECK(esp_partition_erase_range(&s_partition, 0, 2 * MOCK_SECTOR_SIZE) == ESP_OK, "erase");
+    CHECK(esp_partition_erase_range(&s_partition, 100, MOCK_SECTOR_SIZE) == ESP_ERR_INVALID_ARG, "misaligned erase");
+    memset(buf, 0x5a, sizeof(buf));
+    CHECK(esp_partition_write(&s_partition, 0, buf, sizeof(buf)) == ESP_OK, "write");
+    CHECK(esp_partition_write(&s_partition, 3, buf, 16) == ESP_OK, "unaligned write");
+    CHECK(esp_partition_write(&s_encrypted_partition, 0, buf, 32) == ESP_OK, "encrypted write");
+    memset(buf, 0, sizeof(buf));
+    CHECK(esp_partition_read(&s_partition, 0, buf, 256) == ESP_OK && buf[0] == 0x5a, "read");
+
+    flash_profiler_stats_t stats = get_stats();
+    const flash_profiler_stat_t *erase = &stats.ops[FLASH_PROFILER_OP_ERASE];
+    CHECK(erase->count == 2 && erase->errors == 1 && erase->bytes == 3 * MOCK_SECTOR_SIZE, "erase: %u ops, %u errors, %llu bytes",
+          erase->count, erase->errors, (unsigned long long)erase->bytes);
+    CHECK(erase->max_us == MOCK_ERASE_US(2 * MOCK_SECTOR_SIZE)
+          && erase->histogram[flash_profiler_bucket(MOCK_ERASE_US(2 * MOCK_SECTOR_SIZE))] == 1, "erase latency: %u", erase->max_us);
+    const flash_profiler_stat_t *write = &stats.ops[FLASH_PROFILER_OP_WRITE];
+    CHECK(write->count == 2 && write->bytes == 1024 + 16
+          && write->total_us == MOCK_WRITE_US(1024) + MOCK_WRITE_US(16), "write: %u ops, %llu us",
+          write->count, (unsigned long long)write->total_us);
+    const flash_profiler_stat_t *encrypted = &stats.ops[FLASH_PROFILER_OP_WRITE_ENCRYPTED];
+    CHECK(encrypted->count == 1 && encrypted->bytes == 32, "encrypted write: %u ops", encrypted->count);
+    const flash_profiler_stat_t *read = &stats.ops[FLASH_PROFILER_OP_READ];
+    CHECK(read->count == 1 && read->bytes == 256 && read->max_us == MOCK_READ_US(256), "read: %u ops", read->count);
+    //The failed erase returns before disabling the cache
+    const flash_profiler_stat_t *cache = &stats.ops[FLASH_PROFILER_OP_CACHE_DISABLED];
+    CHECK(cache->count == 4 && cache->count == mock_flash_cache_disable_count(), "cache disabled: %u times", cache->count);
+    CHECK(cache->total_us == MOCK_ERASE_US(2 * MOCK_SECTOR_SIZE) + MOCK_WRITE_US(1024) + MOCK_WRITE_US(16) + MOCK_WRITE_US(32),
+          "cache disabled: %llu us", (unsigned long long)cache->total_us);
+
+    flash_profiler_reset();
+    stats = get_stats();
+    CHECK(stats.ops[FLASH_PROFILER_OP_ERASE].count == 0 && stats.ops[FLASH_PROFILER_OP_CACHE_DISABLED].histogram[0] == 0, "reset");
+}
+
+static void test_ota_write(void)
+{
+    uint8_t chunk[1000];
+    memset(chunk, 0xa5, sizeof(chunk));
+    mock_flash_init(&s_partition);
+    flash_profiler_reset();
+    const int chunks = 50;
+    for (int i = 0; i < chunks; i++) {
+        CHECK(esp_ota_write(0, chunk, sizeof(chunk)) == ESP_OK, "esp_ota_write %d", i);
+        mock_flash_advance(100);
+    }
+
+    flash_profiler_stats_t stats = get_stats();
+    const flash_profiler_stat_t *ota = &stats.ops[FLASH_PROFILER_OP_OTA_WRITE];
+    const flash_profiler_stat_t *erase = &stats.ops[FLASH_PROFILER_OP_ERASE];
+    const flash_profiler_stat_t *write = &stats.ops[FLASH_PROFILER_OP_WRITE];
+    const int sectors = (chunks * sizeof(chunk) + MOCK_SECTOR_SIZE - 1) / MOCK_SECTOR_SIZE;
+    CHECK(ota->count == chunks && ota->bytes == chunks * sizeof(chunk), "ota_write: %u ops", ota->count);
+    CHECK(erase->count == sectors && write->count == chunks, "%u erases, %u writes", erase->count, write->count);
+    //esp_ota_write() is made of the erases and writes, the time outside is not counted
+    CHECK(ota->total_us == erase->total_us + write->total_us, "ota_write %llu us, erase + write %llu us",
+          (unsigned long long)ota->total_us, (unsigned long long)(erase->total_us + write->total_us));
+    CHECK(ota->max_us == MOCK_ERASE_US(MOCK_SECTOR_SIZE) + MOCK_WRITE_US(sizeof(chunk)), "ota_write max %u us", ota->max_us);
+    CHECK(flash_profiler_percentile(ota, 500) == 2048, "ota_write p50 %u us", flash_profiler_percentile(ota, 500));
+
+    char report[1024];
+    int len = flash_profiler_format(&stats, report, sizeof(report));
+    CHECK(len > 0 && len < sizeof(report) && strstr(report, "ota_write") != NULL && strstr(report, "read") == NULL,
+          "report:\n%s", report);
+    char small[40];
+    CHECK(flash_profiler_format(&stats, small, sizeof(small)) == len && strlen(small) == sizeof(small) - 1, "truncated report");
+}
+
+int main(int argc, char **argv)
+{
+    test_buckets();
+    test_partition_ops();
+    test_ota_write();
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+        flash_profiler_print();
+    }
+    printf("%s\n", s_failures ? "FAILED" : "OK");
+    return s_failures ? 1 : 0;
+}
\ No newline at end of file
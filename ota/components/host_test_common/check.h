@@ -0,0 +1,17 @@
+#pragma once
+
+//Failure counting of the host tests: CHECK() reports a failed condition and carries on,
+//main() prints OK or FAILED from s_failures and returns it as the exit status
+
+#include <stdio.h>
+
+static int s_failures;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            s_failures++; \
+        } \
+    } while (0)
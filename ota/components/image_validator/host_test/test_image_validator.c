@@ -0,0 +1,241 @@
+/* Host test of the streaming image validator
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "image_validator.h"
+#include "check.h"
+
+#define MAX_IMAGE_LEN   0x30000
+#define DROM_ADDR       0x3F400000
+#define IROM_ADDR       0x400D0000
+#define DRAM_ADDR       0x3FFB0000
+#define IRAM_ADDR       0x40080000
+
+//Not SHA-256, but position dependent like it: enough to catch a changed byte
+typedef struct {
+    uint8_t state[IMAGE_VALIDATOR_HASH_LEN];
+    size_t len;
+} test_hash_t;
+
+static void test_hash_update(void *ctx, const uint8_t *data, size_t len)
+{
+    test_hash_t *hash = ctx;
+    for (size_t i = 0; i < len; i++, hash->len++) {
+        uint8_t *s = &hash->state[hash->len % IMAGE_VALIDATOR_HASH_LEN];
+        *s = (uint8_t)((*s * 31) ^ data[i] ^ hash->len);
+    }
+}
+
+static void test_hash_finish(void *ctx, uint8_t *digest)
+{
+    memcpy(digest, ((test_hash_t *)ctx)->state, IMAGE_VALIDATOR_HASH_LEN);
+}
+
+static test_hash_t s_hash;
+
+static const image_validator_hash_t s_hash_ops = {
+    .ctx = &s_hash,
+    .update = test_hash_update,
+    .finish = test_hash_finish,
+};
+
+static uint8_t s_image[MAX_IMAGE_LEN];
+
+typedef struct {
+    uint32_t load_addr;
+    uint32_t len;
+} segment_t;
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+//Lays out an image as esptool does: header, segments, padding, checksum and optional hash
+static size_t build_image(const segment_t *segments, int segment_num, int hash_appended)
+{
+    memset(s_image, 0, sizeof(s_image));
+    s_image[0] = 0xE9;
+    s_image[1] = segment_num;
+    s_image[23] = hash_appended;
+    size_t offset = 24;
+    uint8_t checksum = 0xEF;
+    for (int i = 0; i < segment_num; i++) {
+        put_u32(&s_image[offset], segments[i].load_addr);
+        put_u32(&s_image[offset + 4], segments[i].len);
+        offset += 8;
+        for (uint32_t j = 0; j < segments[i].len; j++) {
+            s_image[offset] = (uint8_t)(j * 7 + i);
+            checksum ^= s_image[offset++];
+        }
+    }
+    offset = (offset + 1 + 15) / 16 * 16;
+    s_image[offset - 1] = checksum;
+    if (hash_appended) {
+        test_hash_t hash = { 0 };
+        test_hash_update(&hash, s_image, offset);
+        test_hash_finish(&hash, &s_image[offset]);
+        offset += IMAGE_VALIDATOR_HASH_LEN;
+    }
+    return offset;
+}
+
+static void start(image_validator_t *v, size_t max_len)
+{
+    memset(&s_hash, 0, sizeof(s_hash));
+    image_validator_init(v, &s_hash_ops, image_validator_esp32_regions, image_validator_esp32_region_num, max_len);
+}
+
+//Feeds the image in chunks of chunk_len, stops at the first error
+static esp_err_t feed(image_validator_t *v, size_t len, size_t chunk_len, size_t *fed)
+{
+    esp_err_t err = ESP_OK;
+    size_t offset = 0;
+    while (offset < len && err == ESP_OK) {
+        size_t n = len - offset < chunk_len ? len - offset : chunk_len;
+        err = image_validator_feed(v, &s_image[offset], n);
+        offset += n;
+    }
+    if (fed != NULL) {
+        *fed = offset;
+    }
+    return err;
+}
+
+//Segments as in an app: mapped data, RAM, padding, mapped code
+static const segment_t s_app[] = {
+    { DROM_ADDR + 0x20, 0x1000 },
+    { DRAM_ADDR, 0x204 },
+    { IRAM_ADDR, 0x3f8 },
+    { 0, 0xe9e4 },
+    { IROM_ADDR + 0x10020, 0x2000 },
+};
+
+static void test_valid(void)
+{
+    size_t len = build_image(s_app, 5, 1);
+    const size_t chunks[] = { 1, 7, 1024, len };
+    for (int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        image_validator_t v;
+        start(&v, MAX_IMAGE_LEN);
+        esp_err_t err = feed(&v, len, chunks[i], NULL);
+        CHECK(err == ESP_OK && image_validator_finish(&v) == ESP_OK, "chunks of %zu: 0x%x", chunks[i], err);
+        CHECK(image_validator_image_len(&v) == len, "image length %zu, expected %zu", image_validator_image_len(&v), len);
+        CHECK(image_validator_digest(&v) != NULL && memcmp(image_validator_digest(&v), &s_image[len - 32], 32) == 0,
+              "digest");
+    }
+
+    //A signature block or padding after the image is ignored
+    image_validator_t v;
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len + 68, 100, NULL) == ESP_OK && image_validator_image_len(&v) == len, "trailing data");
+
+    len = build_image(s_app, 5, 0);
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len, 512, NULL) == ESP_OK && image_validator_is_done(&v), "no hash");
+    CHECK(image_validator_digest(&v) == NULL, "no digest without hash");
+}
+
+static void test_header(void)
+{
+    size_t len = build_image(s_app, 5, 1);
+    image_validator_t v;
+
+    s_image[0] = 0xE8;
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(image_validator_feed(&v, s_image, 23) == ESP_OK, "header incomplete");
+    CHECK(image_validator_feed(&v, &s_image[23], 1) == ESP_ERR_IMAGE_VALIDATOR_HEADER, "bad magic");
+    CHECK(image_validator_feed(&v, &s_image[24], len - 24) == ESP_ERR_IMAGE_VALIDATOR_HEADER, "error is sticky");
+    CHECK(image_validator_finish(&v) == ESP_ERR_IMAGE_VALIDATOR_HEADER, "finish after error");
+
+    build_image(s_app, 5, 1);
+    s_image[1] = IMAGE_VALIDATOR_MAX_SEGMENTS + 1;
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len, 4096, NULL) == ESP_ERR_IMAGE_VALIDATOR_HEADER, "too many segments");
+}
+
+//Bad segments are rejected with their header, before their data
+static void check_bad_segment(const segment_t *segments, int segment_num, size_t max_len, const char *what)
+{
+    size_t len = build_image(segments, segment_num, 1);
+    image_validator_t v;
+    size_t fed;
+    start(&v, max_len);
+    esp_err_t err = feed(&v, len, 4, &fed);
+    size_t bad_header_end = 24;
+    for (int i = 0; i < segment_num - 1; i++) {
+        bad_header_end += 8 + segments[i].len;
+    }
+    bad_header_end += 8;
+    CHECK(err == ESP_ERR_IMAGE_VALIDATOR_SEGMENT && fed == bad_header_end, "%s: 0x%x after %zu bytes", what, err, fed);
+}
+
+static void test_segments(void)
+{
+    const segment_t unknown_addr[] = { { DRAM_ADDR, 0x100 }, { 0x60000000, 0x100 } };
+    check_bad_segment(unknown_addr, 2, MAX_IMAGE_LEN, "unknown address");
+    const segment_t beyond_region[] = { { 0x400A0000 - 0x100, 0x200 } };
+    check_bad_segment(beyond_region, 1, MAX_IMAGE_LEN, "beyond region");
+    const segment_t misaligned[] = { { DROM_ADDR, 0x100 } };
+    check_bad_segment(misaligned, 1, MAX_IMAGE_LEN, "mapped segment misaligned");
+    const segment_t unaligned_len[] = { { DRAM_ADDR, 0x102 } };
+    check_bad_segment(unaligned_len, 1, MAX_IMAGE_LEN, "length not a multiple of 4");
+    const segment_t too_long[] = { { DRAM_ADDR, 0x100 }, { IRAM_ADDR, 0x1000 } };
+    check_bad_segment(too_long, 2, 0x1000, "beyond the partition");
+
+    //The checksum and the hash must fit as well
+    const segment_t fits[] = { { DRAM_ADDR, 0x1000 - 32 } };
+    size_t len = build_image(fits, 1, 1);
+    image_validator_t v;
+    start(&v, len - 1);
+    CHECK(feed(&v, len, 256, NULL) == ESP_ERR_IMAGE_VALIDATOR_SEGMENT, "hash beyond the partition");
+    start(&v, len);
+    CHECK(feed(&v, len, 256, NULL) == ESP_OK && image_validator_is_done(&v), "image filling the partition");
+}
+
+static void test_corrupted(void)
+{
+    size_t len = build_image(s_app, 5, 1);
+    image_validator_t v;
+
+    s_image[24 + 8 + 0x800] ^= 0x10;
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len, 1000, NULL) == ESP_ERR_IMAGE_VALIDATOR_CHECKSUM, "data changed");
+
+    //Changed twice, the checksum still matches but the hash does not
+    build_image(s_app, 5, 1);
+    s_image[24 + 8 + 0x800] ^= 0x10;
+    s_image[24 + 8 + 0x804] ^= 0x10;
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len, 1000, NULL) == ESP_ERR_IMAGE_VALIDATOR_HASH, "data changed twice");
+
+    build_image(s_app, 5, 1);
+    s_image[len - 1] ^= 1;
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len, 1000, NULL) == ESP_ERR_IMAGE_VALIDATOR_HASH, "hash changed");
+
+    build_image(s_app, 5, 1);
+    start(&v, MAX_IMAGE_LEN);
+    CHECK(feed(&v, len - 1, 1000, NULL) == ESP_OK, "truncated image fed");
+    CHECK(!image_validator_is_done(&v) && image_validator_finish(&v) == ESP_ERR_IMAGE_VALIDATOR_TRUNCATED, "truncated");
+}
+
+int main(void)
+{
+    test_valid();
+    test_header();
+    test_segments();
+    test_corrupted();
+    printf("%s\n", s_failures ? "FAILED" : "OK");
+    return s_failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,205 @@
+/* Streaming app image validator
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "image_validator.h"
+
+//Layout of esp_image_header_t and esp_image_segment_header_t, read byte by
+//byte so the host test needs no ESP-IDF headers
+#define IMAGE_HEADER_LEN            24
+#define IMAGE_HEADER_MAGIC          0xE9
+#define IMAGE_HEADER_SEGMENT_COUNT  1
+#define IMAGE_HEADER_HASH_APPENDED  23
+#define SEGMENT_HEADER_LEN          8
+#define CHECKSUM_SEED               0xEF
+#define MMU_PAGE_SIZE               0x10000
+
+const image_validator_region_t image_validator_esp32_regions[] = {
+    { 0x3F400000, 0x3F800000, true },   //DROM
+    { 0x3FF80000, 0x3FF82000, false },  //RTC fast memory, data bus
+    { 0x3FFAE000, 0x40000000, false },  //DRAM
+    { 0x40080000, 0x400A0000, false },  //IRAM
+    { 0x400C0000, 0x400C2000, false },  //RTC fast memory, instruction bus
+    { 0x400D0000, 0x40400000, true },   //IROM
+    { 0x50000000, 0x50002000, false },  //RTC slow memory
+};
+const size_t image_validator_esp32_region_num = sizeof(image_validator_esp32_regions) / sizeof(image_validator_esp32_regions[0]);
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t set_error(image_validator_t *v, esp_err_t err)
+{
+    v->error = err;
+    return err;
+}
+
+//Collects a header or the hash, which may be split over several chunks
+static size_t collect(image_validator_t *v, const uint8_t *data, size_t len, size_t field_len)
+{
+    size_t n = field_len - v->field_len < len ? field_len - v->field_len : len;
+    memcpy(v->field + v->field_len, data, n);
+    v->field_len += n;
+    return n;
+}
+
+static esp_err_t check_header(image_validator_t *v)
+{
+    v->segment_count = v->field[IMAGE_HEADER_SEGMENT_COUNT];
+    v->hash_appended = v->field[IMAGE_HEADER_HASH_APPENDED] == 1;
+    if (v->field[0] != IMAGE_HEADER_MAGIC || v->segment_count == 0
+            || v->segment_count > IMAGE_VALIDATOR_MAX_SEGMENTS) {
+        return ESP_ERR_IMAGE_VALIDATOR_HEADER;
+    }
+    v->field_len = 0;
+    v->step = IMAGE_VALIDATOR_STEP_SEGMENT_HEADER;
+    return ESP_OK;
+}
+
+static void next_segment(image_validator_t *v)
+{
+    v->step = ++v->segment == v->segment_count ? IMAGE_VALIDATOR_STEP_CHECKSUM : IMAGE_VALIDATOR_STEP_SEGMENT_HEADER;
+}
+
+//data_offset is where the data of the segment starts in the image
+static esp_err_t check_segment(image_validator_t *v, size_t data_offset)
+{
+    uint32_t load_addr = read_u32(v->field);
+    uint32_t data_len = read_u32(v->field + 4);
+    if (data_len % 4 != 0 || data_len > v->max_len || data_offset + data_len > v->max_len) {
+        return ESP_ERR_IMAGE_VALIDATOR_SEGMENT;
+    }
+    //esptool pads with segments loaded to address 0 to align the mapped ones, they are never loaded
+    bool valid = load_addr == 0;
+    for (size_t i = 0; i < v->region_num && !valid; i++) {
+        const image_validator_region_t *region = &v->regions[i];
+        if (load_addr >= region->start && load_addr < region->end) {
+            valid = load_addr + data_len <= region->end
+                    && (!region->mapped || load_addr % MMU_PAGE_SIZE == data_offset % MMU_PAGE_SIZE);
+            break;
+        }
+    }
+    if (!valid) {
+        return ESP_ERR_IMAGE_VALIDATOR_SEGMENT;
+    }
+    v->field_len = 0;
+    v->segment_remaining = data_len;
+    v->step = IMAGE_VALIDATOR_STEP_SEGMENT_DATA;
+    if (data_len == 0) {
+        next_segment(v);
+    }
+    return ESP_OK;
+}
+
+void image_validator_init(image_validator_t *v, const image_validator_hash_t *hash,
+                          const image_validator_region_t *regions, size_t region_num, size_t max_len)
+{
+    memset(v, 0, sizeof(*v));
+    v->hash = *hash;
+    v->regions = regions;
+    v->region_num = region_num;
+    v->max_len = max_len;
+    v->checksum = CHECKSUM_SEED;
+}
+
+esp_err_t image_validator_feed(image_validator_t *v, const uint8_t *data, size_t len)
+{
+    while (len > 0 && v->error == ESP_OK && v->step != IMAGE_VALIDATOR_STEP_DONE) {
+        //The hash covers the image up to the checksum
+        bool hashed = v->step != IMAGE_VALIDATOR_STEP_HASH;
+        bool hash_end = false;
+        esp_err_t err = ESP_OK;
+        size_t n;
+        switch (v->step) {
+        case IMAGE_VALIDATOR_STEP_HEADER:
+            n = collect(v, data, len, IMAGE_HEADER_LEN);
+            if (v->field_len == IMAGE_HEADER_LEN) {
+                err = check_header(v);
+            }
+            break;
+        case IMAGE_VALIDATOR_STEP_SEGMENT_HEADER:
+            n = collect(v, data, len, SEGMENT_HEADER_LEN);
+            if (v->field_len == SEGMENT_HEADER_LEN) {
+                err = check_segment(v, v->offset + n);
+            }
+            break;
+        case IMAGE_VALIDATOR_STEP_SEGMENT_DATA:
+            n = v->segment_remaining < len ? v->segment_remaining : len;
+            for (size_t i = 0; i < n; i++) {
+                v->checksum ^= data[i];
+            }
+            v->segment_remaining -= n;
+            if (v->segment_remaining == 0) {
+                next_segment(v);
+            }
+            break;
+        case IMAGE_VALIDATOR_STEP_CHECKSUM:
+            //Zero padding, then the checksum in the last byte of a 16 byte block
+            n = 16 - v->offset % 16 < len ? 16 - v->offset % 16 : len;
+            if ((v->offset + n) % 16 == 0) {
+                if (data[n - 1] != v->checksum) {
+                    err = ESP_ERR_IMAGE_VALIDATOR_CHECKSUM;
+                }
+                hash_end = v->hash_appended;
+                v->step = v->hash_appended ? IMAGE_VALIDATOR_STEP_HASH : IMAGE_VALIDATOR_STEP_DONE;
+            }
+            break;
+        default:
+            n = collect(v, data, len, IMAGE_VALIDATOR_HASH_LEN);
+            if (v->field_len == IMAGE_VALIDATOR_HASH_LEN) {
+                if (memcmp(v->field, v->digest, IMAGE_VALIDATOR_HASH_LEN) != 0) {
+                    err = ESP_ERR_IMAGE_VALIDATOR_HASH;
+                }
+                v->step = IMAGE_VALIDATOR_STEP_DONE;
+            }
+            break;
+        }
+        if (err != ESP_OK) {
+            return set_error(v, err);
+        }
+        if (hashed) {
+            v->hash.update(v->hash.ctx, data, n);
+        }
+        if (hash_end) {
+            v->hash.finish(v->hash.ctx, v->digest);
+        }
+        v->offset += n;
+        data += n;
+        len -= n;
+        if (v->offset > v->max_len) {
+            return set_error(v, ESP_ERR_IMAGE_VALIDATOR_SEGMENT);
+        }
+    }
+    return v->error;
+}
+
+bool image_validator_is_done(const image_validator_t *v)
+{
+    return v->error == ESP_OK && v->step == IMAGE_VALIDATOR_STEP_DONE;
+}
+
+esp_err_t image_validator_finish(const image_validator_t *v)
+{
+    if (v->error != ESP_OK) {
+        return v->error;
+    }
+    return v->step == IMAGE_VALIDATOR_STEP_DONE ? ESP_OK : ESP_ERR_IMAGE_VALIDATOR_TRUNCATED;
+}
+
+size_t image_validator_image_len(const image_validator_t *v)
+{
+    return v->offset;
+}
+
+const uint8_t *image_validator_digest(const image_validator_t *v)
+{
+    return image_validator_is_done(v) && v->hash_appended ? v->digest : NULL;
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+//Streaming check of an app image, fed with the image as it is received. It
+//has no ESP-IDF dependencies but esp_err.h and is built on the host by host_test.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define ESP_ERR_IMAGE_VALIDATOR_BASE        0x9200
+#define ESP_ERR_IMAGE_VALIDATOR_HEADER      (ESP_ERR_IMAGE_VALIDATOR_BASE + 1)  //Bad magic byte or segment count
+#define ESP_ERR_IMAGE_VALIDATOR_SEGMENT     (ESP_ERR_IMAGE_VALIDATOR_BASE + 2)  //Segment address or size out of range
+#define ESP_ERR_IMAGE_VALIDATOR_CHECKSUM    (ESP_ERR_IMAGE_VALIDATOR_BASE + 3)
+#define ESP_ERR_IMAGE_VALIDATOR_HASH        (ESP_ERR_IMAGE_VALIDATOR_BASE + 4)  //Appended SHA-256 does not match
+#define ESP_ERR_IMAGE_VALIDATOR_TRUNCATED   (ESP_ERR_IMAGE_VALIDATOR_BASE + 5)  //Image ended before its checksum or hash
+
+#define IMAGE_VALIDATOR_MAX_SEGMENTS    16      //ESP_IMAGE_MAX_SEGMENTS
+#define IMAGE_VALIDATOR_HASH_LEN        32
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    bool mapped;            //Mapped from flash by the MMU: the load address and the file offset must agree modulo 64 KiB
+} image_validator_region_t;
+
+//Hash of the image, SHA-256 on the target
+typedef struct {
+    void *ctx;
+    void (*update)(void *ctx, const uint8_t *data, size_t len);
+    void (*finish)(void *ctx, uint8_t *digest);
+} image_validator_hash_t;
+
+typedef enum {
+    IMAGE_VALIDATOR_STEP_HEADER,
+    IMAGE_VALIDATOR_STEP_SEGMENT_HEADER,
+    IMAGE_VALIDATOR_STEP_SEGMENT_DATA,
+    IMAGE_VALIDATOR_STEP_CHECKSUM,      //Zero padding to 16 bytes, the last one is the checksum
+    IMAGE_VALIDATOR_STEP_HASH,
+    IMAGE_VALIDATOR_STEP_DONE,          //Anything after the image (signature) is ignored
+} image_validator_step_t;
+
+typedef struct {
+    image_validator_hash_t hash;
+    const image_validator_region_t *regions;
+    size_t region_num;
+    size_t max_len;                     //Size of the partition receiving the image
+    image_validator_step_t step;
+    esp_err_t error;                    //First error, every later feed returns it
+    size_t offset;                      //Bytes of the image consumed
+    uint8_t field[IMAGE_VALIDATOR_HASH_LEN];    //Header or hash being collected
+    size_t field_len;
+    uint8_t segment_count;
+    uint8_t segment;
+    uint32_t segment_remaining;
+    uint8_t checksum;
+    bool hash_appended;
+    uint8_t digest[IMAGE_VALIDATOR_HASH_LEN];
+} image_validator_t;
+
+//Memory of the ESP32 an app segment may be loaded to
+extern const image_validator_region_t image_validator_esp32_regions[];
+extern const size_t image_validator_esp32_region_num;
+
+/**
+ * @brief   Start checking an image.
+ *
+ * @param   hash        Hash started by the caller, fed with the image up to the appended hash
+ * @param   max_len     The image and its segments must end within max_len bytes
+ */
+void image_validator_init(image_validator_t *v, const image_validator_hash_t *hash,
+                          const image_validator_region_t *regions, size_t region_num, size_t max_len);
+
+/**
+ * @brief   Check the next bytes of the image.
+ *
+ * Headers are checked as soon as they are complete, so a bad image fails on
+ * its first chunks instead of after the download.
+ *
+ * @return
+ *  - ESP_OK                            Success, more data expected or image complete
+ *  - ESP_ERR_IMAGE_VALIDATOR_HEADER    Bad image header
+ *  - ESP_ERR_IMAGE_VALIDATOR_SEGMENT   Segment out of the memory regions, unaligned or beyond max_len
+ *  - ESP_ERR_IMAGE_VALIDATOR_CHECKSUM  Checksum mismatch
+ *  - ESP_ERR_IMAGE_VALIDATOR_HASH      SHA-256 mismatch
+ */
+esp_err_t image_validator_feed(image_validator_t *v, const uint8_t *data, size_t len);
+
+/**
+ * @brief   Whole image seen: segments, checksum and hash, if appended.
+ */
+bool image_validator_is_done(const image_validator_t *v);
+
+/**
+ * @brief   Result at the end of the data.
+ *
+ * @return
+ *  - ESP_OK                                The image is complete and valid
+ *  - ESP_ERR_IMAGE_VALIDATOR_TRUNCATED     The data ended before the image
+ *  - other                                 Error returned by image_validator_feed()
+ */
+esp_err_t image_validator_finish(const image_validator_t *v);
+
+/**
+ * @brief   Size of the image, with the checksum and the appended hash. Valid once done.
+ */
+size_t image_validator_image_len(const image_validator_t *v);
+
+/**
+ * @brief   SHA-256 of the image, as appended to it and checked.
+ *
+ * @return  NULL if the image has no appended hash or is not done
+ */
+const uint8_t *image_validator_digest(const image_validator_t *v);
\ No newline at end of file
@@ -0,0 +1,6 @@
+COMPONENT_SRCDIRS := .
+COMPONENT_ADD_INCLUDEDIRS := .
+
+ifndef CONFIG_OTA_BUNDLE
+COMPONENT_OBJEXCLUDE := ota_bundle.o
+endif
\ No newline at end of file
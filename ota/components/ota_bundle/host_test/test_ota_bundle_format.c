@@ -0,0 +1,241 @@
+/* Host test of the streaming parser of OTA bundles
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "ota_bundle_format.h"
+#include "check.h"
+
+#define APP_SIZE        1000
+#define MODEL_SIZE      300
+#define WWW_SIZE        17
+#define ERR_CALLBACK    0x7777
+
+typedef struct {
+    uint8_t images[OTA_BUNDLE_MAX_IMAGES][APP_SIZE];
+    size_t sizes[OTA_BUNDLE_MAX_IMAGES];
+    int begins;
+    int ends;
+    int order_errors;
+    int fail_image;                 //Image whose data callback fails, -1 for none
+} received_t;
+
+static esp_err_t on_begin(void *ctx, int index, const ota_bundle_entry_t *entry)
+{
+    received_t *r = ctx;
+    if (index != r->begins || r->begins != r->ends) {
+        r->order_errors++;
+    }
+    r->begins++;
+    return ESP_OK;
+}
+
+static esp_err_t on_data(void *ctx, int index, const uint8_t *data, size_t len)
+{
+    received_t *r = ctx;
+    if (index == r->fail_image) {
+        return ERR_CALLBACK;
+    }
+    if (index != r->begins - 1 || r->sizes[index] + len > APP_SIZE) {
+        r->order_errors++;
+        return ESP_OK;
+    }
+    memcpy(r->images[index] + r->sizes[index], data, len);
+    r->sizes[index] += len;
+    return ESP_OK;
+}
+
+static esp_err_t on_end(void *ctx, int index)
+{
+    received_t *r = ctx;
+    if (index != r->ends || index != r->begins - 1) {
+        r->order_errors++;
+    }
+    r->ends++;
+    return ESP_OK;
+}
+
+static const ota_bundle_callbacks_t s_callbacks = {
+    .image_begin = on_begin,
+    .image_data = on_data,
+    .image_end = on_end,
+};
+
+static uint8_t s_bundle[sizeof(ota_bundle_table_t) + APP_SIZE + MODEL_SIZE + WWW_SIZE + 16];
+static const size_t s_sizes[] = { APP_SIZE, MODEL_SIZE, WWW_SIZE };
+static const char *s_names[] = { "", "model", "www" };
+
+static uint8_t pattern(int image, size_t offset)
+{
+    return (uint8_t)(image * 71 + offset * 13 + (offset >> 8));
+}
+
+static ota_bundle_entry_t *entries(void)
+{
+    return (ota_bundle_entry_t *)(s_bundle + sizeof(ota_bundle_header_t));
+}
+
+static void update_crc(int image_num)
+{
+    ota_bundle_header_t header;
+    memcpy(&header, s_bundle, sizeof(header));
+    header.crc32 = ota_bundle_crc32(0, (const uint8_t *)entries(), image_num * sizeof(ota_bundle_entry_t));
+    memcpy(s_bundle, &header, sizeof(header));
+}
+
+//An app, then two data images
+static size_t make_bundle(void)
+{
+    const int image_num = 3;
+    memset(s_bundle, 0, sizeof(s_bundle));
+    const ota_bundle_header_t header = {
+        .magic = OTA_BUNDLE_MAGIC,
+        .version = OTA_BUNDLE_VERSION,
+        .image_num = image_num,
+    };
+    memcpy(s_bundle, &header, sizeof(header));
+    size_t len = sizeof(header) + image_num * sizeof(ota_bundle_entry_t);
+    for (int i = 0; i < image_num; i++) {
+        ota_bundle_entry_t *entry = &entries()[i];
+        strcpy(entry->name, s_names[i]);
+        entry->type = (i == 0) ? OTA_BUNDLE_TYPE_APP : OTA_BUNDLE_TYPE_DATA;
+        entry->size = s_sizes[i];
+        for (size_t j = 0; j < s_sizes[i]; j++) {
+            s_bundle[len++] = pattern(i, j);
+        }
+    }
+    update_crc(image_num);
+    return len;
+}
+
+static esp_err_t parse(size_t len, size_t chunk, received_t *r, esp_err_t *finish_err)
+{
+    ota_bundle_parser_t parser;
+    memset(r, 0, sizeof(*r));
+    r->fail_image = -1;
+    ota_bundle_parser_init(&parser, &s_callbacks, r);
+    esp_err_t err = ESP_OK;
+    for (size_t offset = 0; offset < len && err == ESP_OK; offset += chunk) {
+        err = ota_bundle_parser_feed(&parser, s_bundle + offset, (len - offset < chunk) ? len - offset : chunk);
+    }
+    *finish_err = ota_bundle_parser_finish(&parser);
+    return err;
+}
+
+static void test_crc32(void)
+{
+    CHECK(ota_bundle_crc32(0, (const uint8_t *)"123456789", 9) == 0xcbf43926, "check value of CRC-32");
+    uint32_t crc = ota_bundle_crc32(0, (const uint8_t *)"1234", 4);
+    CHECK(ota_bundle_crc32(crc, (const uint8_t *)"56789", 5) == 0xcbf43926, "CRC-32 in two parts");
+}
+
+static void test_chunks(void)
+{
+    size_t len = make_bundle();
+    CHECK(ota_bundle_is_bundle(s_bundle, len), "magic");
+    const uint8_t app[] = { 0xe9, 0x05, 0x02, 0x20 };
+    CHECK(!ota_bundle_is_bundle(app, sizeof(app)), "app image taken for a bundle");
+
+    static const size_t chunks[] = { 1, 3, 12, 13, 56, 500, 1024, sizeof(s_bundle) };
+    for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        received_t r;
+        esp_err_t finish_err;
+        esp_err_t err = parse(len, chunks[c], &r, &finish_err);
+        CHECK(err == ESP_OK && finish_err == ESP_OK, "chunks of %zu: 0x%x, finish 0x%x", chunks[c], err, finish_err);
+        CHECK(r.begins == 3 && r.ends == 3 && r.order_errors == 0, "chunks of %zu: %d begins, %d ends, %d order errors",
+              chunks[c], r.begins, r.ends, r.order_errors);
+        for (int i = 0; i < 3; i++) {
+            bool same = r.sizes[i] == s_sizes[i];
+            for (size_t j = 0; j < r.sizes[i] && same; j++) {
+                same = r.images[i][j] == pattern(i, j);
+            }
+            CHECK(same, "chunks of %zu: image %d differs, %zu bytes", chunks[c], i, r.sizes[i]);
+        }
+    }
+}
+
+static void test_truncated_and_trailing(void)
+{
+    size_t len = make_bundle();
+    received_t r;
+    esp_err_t finish_err;
+    CHECK(parse(len - 1, 100, &r, &finish_err) == ESP_OK && finish_err == ESP_ERR_INVALID_SIZE,
+          "truncated bundle: finish 0x%x", finish_err);
+    CHECK(r.ends == 2, "%d images complete in a truncated bundle", r.ends);
+    CHECK(parse(10, 100, &r, &finish_err) == ESP_OK && finish_err == ESP_ERR_INVALID_SIZE && r.begins == 0,
+          "truncated header: finish 0x%x", finish_err);
+    CHECK(parse(len + 1, 100, &r, &finish_err) == ESP_ERR_INVALID_SIZE && finish_err == ESP_ERR_INVALID_SIZE,
+          "trailing data: finish 0x%x", finish_err);
+}
+
+static void test_invalid_table(void)
+{
+    received_t r;
+    esp_err_t finish_err;
+    size_t len = make_bundle();
+    s_bundle[0] = 0xe9;
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_VERSION && r.begins == 0, "bad magic");
+
+    len = make_bundle();
+    s_bundle[4] = OTA_BUNDLE_VERSION + 1;
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_VERSION, "unknown version");
+
+    len = make_bundle();
+    s_bundle[5] = OTA_BUNDLE_MAX_IMAGES + 1;
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_ARG, "too many images");
+
+    len = make_bundle();
+    entries()[1].size++;
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_CRC && r.begins == 0, "corrupted table");
+
+    len = make_bundle();
+    entries()[2].type = OTA_BUNDLE_TYPE_APP;
+    update_crc(3);
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_ARG, "two app images");
+
+    len = make_bundle();
+    strcpy(entries()[2].name, s_names[1]);
+    update_crc(3);
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_ARG, "component twice");
+
+    len = make_bundle();
+    entries()[1].name[0] = '\0';
+    update_crc(3);
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_ARG, "data image without a name");
+
+    len = make_bundle();
+    memset(entries()[1].name, 'm', OTA_BUNDLE_NAME_LEN);
+    update_crc(3);
+    CHECK(parse(len, 7, &r, &finish_err) == ESP_ERR_INVALID_ARG, "name not terminated");
+}
+
+static void test_callback_error(void)
+{
+    size_t len = make_bundle();
+    ota_bundle_parser_t parser;
+    received_t r = { .fail_image = 1 };
+    ota_bundle_parser_init(&parser, &s_callbacks, &r);
+    esp_err_t err = ota_bundle_parser_feed(&parser, s_bundle, len);
+    CHECK(err == ERR_CALLBACK, "callback error 0x%x", err);
+    CHECK(r.ends == 1, "%d images ended before the error", r.ends);
+    //The parser stays failed
+    CHECK(ota_bundle_parser_feed(&parser, s_bundle, 1) == ERR_CALLBACK, "feed after an error");
+    CHECK(ota_bundle_parser_finish(&parser) == ERR_CALLBACK, "finish after an error");
+}
+
+int main(void)
+{
+    test_crc32();
+    test_chunks();
+    test_truncated_and_trailing();
+    test_invalid_table();
+    test_callback_error();
+    printf("%s\n", s_failures ? "FAILED" : "OK");
+    return s_failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#!/usr/bin/env python
+#
+# Makes bundles for the ota_bundle component: an app image and data images,
+# such as models, web assets or NVS defaults, sent in one download.
+#
+# Output: 12 byte header (magic "OTAB", format version, image count, CRC-32 of
+# the entries), a 56 byte entry per image (component name, type, size,
+# SHA-256), then the images in the order of the entries. The app comes first.
+#
+# Usage:
+#   mkbundle.py create --app build/native_ota.bin --data model=model.bin --data www=www.bin native_ota.bundle
+#   mkbundle.py list native_ota.bundle
+#
+# Each data image goes to the partitions <name>_0 and <name>_1 of the device,
+# see "partition_planner.py plan --bundle-data".
+#
+from __future__ import print_function, division
+import argparse
+import binascii
+import hashlib
+import struct
+import sys
+
+MAGIC = b"OTAB"
+VERSION = 1
+MAX_IMAGES = 8
+MAX_NAME = 14               # So that <name>_1 fits the 16 characters of a partition label
+HEADER = struct.Struct("<4sBB2xI")
+ENTRY = struct.Struct("<16sB3xI32s")
+TYPE_APP = 0
+TYPE_DATA = 1
+TYPE_NAMES = {TYPE_APP: "app", TYPE_DATA: "data"}
+APP_MAGIC = 0xe9
+
+
+def create(args):
+    images = []
+    with open(args.app, "rb") as f:
+        images.append(("app", TYPE_APP, f.read()))
+    if bytearray(images[0][2][:1]) != bytearray([APP_MAGIC]):
+        print("Error: %s is not an app image" % args.app, file=sys.stderr)
+        return 1
+    for spec in args.data or []:
+        name, _, path = spec.partition("=")
+        if not name or not path or len(name) > MAX_NAME:
+            print("Error: --data %s: expected NAME=FILE, NAME of up to %d characters" % (spec, MAX_NAME), file=sys.stderr)
+            return 1
+        if name in [image[0] for image in images[1:]]:
+            print("Error: component %s given twice" % name, file=sys.stderr)
+            return 1
+        with open(path, "rb") as f:
+            images.append((name, TYPE_DATA, f.read()))
+    if len(images) > MAX_IMAGES:
+        print("Error: %d images, at most %d" % (len(images), MAX_IMAGES), file=sys.stderr)
+        return 1
+    for name, _, data in images:
+        if not data:
+            print("Error: %s is empty" % name, file=sys.stderr)
+            return 1
+
+    entries = b"".join(ENTRY.pack(name.encode(), image_type, len(data), hashlib.sha256(data).digest())
+                       for name, image_type, data in images)
+    header = HEADER.pack(MAGIC, VERSION, len(images), binascii.crc32(entries) & 0xffffffff)
+    with open(args.output, "wb") as f:
+        f.write(header + entries)
+        for _, _, data in images:
+            f.write(data)
+    print("%s: %d images, %d bytes" % (args.output, len(images),
+                                      len(header) + len(entries) + sum(len(image[2]) for image in images)))
+    return 0
+
+
+def list_bundle(args):
+    with open(args.input, "rb") as f:
+        data = f.read()
+    magic, version, image_num, crc = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        print("Error: %s is not a bundle" % args.input, file=sys.stderr)
+        return 1
+    entries = data[HEADER.size:HEADER.size + image_num * ENTRY.size]
+    if binascii.crc32(entries) & 0xffffffff != crc:
+        print("Error: image table corrupted", file=sys.stderr)
+        return 1
+    offset = HEADER.size + len(entries)
+    errors = 0
+    for i in range(image_num):
+        name, image_type, size, sha256 = ENTRY.unpack_from(entries, i * ENTRY.size)
+        image = data[offset:offset + size]
+        status = "ok" if len(image) == size and hashlib.sha256(image).digest() == sha256 else "CORRUPTED"
+        errors += status != "ok"
+        print("%d %-4s %-14s offset 0x%06x size %8d sha256 %s %s" % (i, TYPE_NAMES.get(image_type, "?"),
+              name.rstrip(b"\0").decode(), offset, size, binascii.hexlify(sha256).decode(), status))
+        offset += size
+    if offset != len(data):
+        print("Error: bundle of %d bytes, %d expected" % (len(data), offset), file=sys.stderr)
+        errors += 1
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Make bundles of an app and data images for the ota_bundle component")
+    subparsers = parser.add_subparsers(dest="command")
+
+    create_parser = subparsers.add_parser("create", help="make a bundle")
+    create_parser.add_argument("--app", required=True, help="app image, the first of the bundle")
+    create_parser.add_argument("--data", action="append", metavar="NAME=FILE",
+                               help="data image for the partitions NAME_0 and NAME_1, may be repeated")
+    create_parser.add_argument("output")
+
+    list_parser = subparsers.add_parser("list", help="list and check the images of a bundle")
+    list_parser.add_argument("input")
+
+    args = parser.parse_args()
+    if args.command == "create":
+        return create(args)
+    elif args.command == "list":
+        return list_bundle(args)
+    parser.print_help()
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,334 @@
+/* Multi-image OTA bundles
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+#include "ota_bundle.h"
+
+#define NVS_NAMESPACE       "ota_bundle"
+#define SECTOR_SIZE         4096
+#define APP_DESC_OFFSET     (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t))
+#define APP_SHA_OFFSET      (APP_DESC_OFFSET + offsetof(esp_app_desc_t, app_elf_sha256))
+//Start of the app image kept, up to the end of app_elf_sha256 in its description
+#define APP_HEAD_LEN        (APP_SHA_OFFSET + OTA_BUNDLE_HASH_LEN)
+
+//Partitions of the components an app uses, stored in NVS under the label of
+//its app partition. The hash identifies the app the record was written for,
+//as the partition may have been rewritten since by another update.
+typedef struct {
+    uint8_t app_elf_sha256[OTA_BUNDLE_HASH_LEN];
+    uint8_t component_num;
+    struct {
+        char name[OTA_BUNDLE_MAX_NAME + 1];
+        uint8_t slot;
+    } components[OTA_BUNDLE_MAX_IMAGES];
+} selection_t;
+
+struct ota_bundle {
+    const esp_partition_t *app_partition;
+    selection_t running;                //Of the running app, empty if none
+    selection_t next;                   //Of the app being downloaded
+    ota_bundle_parser_t parser;
+    bool is_bundle;
+    bool started;                       //First byte seen, is_bundle set
+    uint8_t app_head[APP_HEAD_LEN];
+    size_t app_len;                     //Bytes of the app image so far
+    //Image being received
+    mbedtls_sha256_context sha;
+    bool hashing;
+    const esp_partition_t *target;      //NULL for the app
+    size_t erased;
+    //Chunk being processed
+    uint8_t *buf;
+    size_t out_len;
+};
+
+static const char *TAG = "ota_bundle";
+
+static esp_err_t load_selection(const esp_partition_t *app_partition, selection_t *selection)
+{
+    memset(selection, 0, sizeof(*selection));
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    size_t size = sizeof(*selection);
+    err = nvs_get_blob(handle, app_partition->label, selection, &size);
+    nvs_close(handle);
+    if (err == ESP_OK && (size != sizeof(*selection) || selection->component_num > OTA_BUNDLE_MAX_IMAGES)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK) {
+        memset(selection, 0, sizeof(*selection));
+    }
+    return err;
+}
+
+static esp_err_t save_selection(const esp_partition_t *app_partition, const selection_t *selection)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, app_partition->label, selection, sizeof(*selection));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+//Selection of the running app, empty if written for another app
+static void load_running_selection(selection_t *selection)
+{
+    const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+    if (load_selection(esp_ota_get_running_partition(), selection) == ESP_OK
+            && memcmp(selection->app_elf_sha256, app_desc->app_elf_sha256, OTA_BUNDLE_HASH_LEN) != 0) {
+        memset(selection, 0, sizeof(*selection));
+    }
+}
+
+static int find_component(const selection_t *selection, const char *name)
+{
+    for (int i = 0; i < selection->component_num; i++) {
+        if (strcmp(selection->components[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int get_slot(const selection_t *selection, const char *name)
+{
+    int i = find_component(selection, name);
+    return (i >= 0) ? selection->components[i].slot : 0;
+}
+
+static const esp_partition_t *find_slot(const char *name, int slot)
+{
+    char label[sizeof(((esp_partition_t *)0)->label)];
+    snprintf(label, sizeof(label), "%s_%d", name, slot);
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+}
+
+static esp_err_t set_slot(selection_t *selection, const char *name, int slot)
+{
+    int i = find_component(selection, name);
+    if (i < 0) {
+        if (selection->component_num == OTA_BUNDLE_MAX_IMAGES) {
+            return ESP_ERR_NO_MEM;
+        }
+        i = selection->component_num++;
+        strlcpy(selection->components[i].name, name, sizeof(selection->components[i].name));
+    }
+    selection->components[i].slot = slot;
+    return ESP_OK;
+}
+
+static esp_err_t image_begin(void *ctx, int index, const ota_bundle_entry_t *entry)
+{
+    struct ota_bundle *b = ctx;
+    //The engine checks the version on the first bytes, before anything is written
+    if ((index == 0) != (entry->type == OTA_BUNDLE_TYPE_APP)) {
+        ESP_LOGE(TAG, "The app must be the first image of the bundle");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    b->target = NULL;
+    if (entry->type == OTA_BUNDLE_TYPE_DATA) {
+        if (strlen(entry->name) > OTA_BUNDLE_MAX_NAME) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        int slot = !get_slot(&b->running, entry->name);
+        b->target = find_slot(entry->name, slot);
+        if (b->target == NULL || find_slot(entry->name, !slot) == NULL) {
+            ESP_LOGE(TAG, "No partitions %s_0 and %s_1", entry->name, entry->name);
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (entry->size > b->target->size) {
+            ESP_LOGE(TAG, "%s image of %u bytes, partition %s of %u", entry->name, entry->size, b->target->label,
+                     b->target->size);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        esp_err_t err = set_slot(&b->next, entry->name, slot);
+        if (err != ESP_OK) {
+            return err;
+        }
+        b->erased = 0;
+        ESP_LOGI(TAG, "Writing %s (%u bytes) to %s", entry->name, entry->size, b->target->label);
+    }
+    mbedtls_sha256_init(&b->sha);
+    mbedtls_sha256_starts_ret(&b->sha, 0);
+    b->hashing = true;
+    return ESP_OK;
+}
+
+//Keeps the start of the app image, for the hash of the app in its description
+static void take_app_bytes(struct ota_bundle *b, const uint8_t *data, size_t len)
+{
+    if (b->app_len < APP_HEAD_LEN) {
+        size_t n = APP_HEAD_LEN - b->app_len;
+        memcpy(b->app_head + b->app_len, data, (len < n) ? len : n);
+    }
+    b->app_len += len;
+}
+
+static esp_err_t image_data(void *ctx, int index, const uint8_t *data, size_t len)
+{
+    struct ota_bundle *b = ctx;
+    mbedtls_sha256_update_ret(&b->sha, data, len);
+    if (b->target == NULL) {
+        take_app_bytes(b, data, len);
+        //data is at or after the output so far, the bundle header and data images are dropped
+        memmove(b->buf + b->out_len, data, len);
+        b->out_len += len;
+        return ESP_OK;
+    }
+    size_t offset = b->parser.image_offset;
+    if (offset + len > b->erased) {
+        size_t erase_end = (offset + len + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+        esp_err_t err = esp_partition_erase_range(b->target, b->erased, erase_end - b->erased);
+        if (err != ESP_OK) {
+            return err;
+        }
+        b->erased = erase_end;
+    }
+    return esp_partition_write(b->target, offset, data, len);
+}
+
+static esp_err_t image_end(void *ctx, int index)
+{
+    struct ota_bundle *b = ctx;
+    const ota_bundle_entry_t *entry = &b->parser.table.entries[index];
+    uint8_t digest[OTA_BUNDLE_HASH_LEN];
+    mbedtls_sha256_finish_ret(&b->sha, digest);
+    mbedtls_sha256_free(&b->sha);
+    b->hashing = false;
+    if (memcmp(digest, entry->sha256, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Image %d (%s) does not match its hash", index,
+                 entry->type == OTA_BUNDLE_TYPE_APP ? "app" : entry->name);
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+
+static const ota_bundle_callbacks_t s_callbacks = {
+    .image_begin = image_begin,
+    .image_data = image_data,
+    .image_end = image_end,
+};
+
+esp_err_t ota_bundle_begin(const esp_partition_t *app_partition, ota_bundle_handle_t *out_handle)
+{
+    struct ota_bundle *b = calloc(1, sizeof(struct ota_bundle));
+    if (b == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    b->app_partition = app_partition;
+    load_running_selection(&b->running);
+    //Components left out of the bundle keep their partitions
+    b->next = b->running;
+    ota_bundle_parser_init(&b->parser, &s_callbacks, b);
+    *out_handle = b;
+    return ESP_OK;
+}
+
+esp_err_t ota_bundle_update(ota_bundle_handle_t b, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    b->buf = buf;
+    b->out_len = 0;
+    if (!b->started && len > 0) {
+        b->started = true;
+        b->is_bundle = ota_bundle_is_bundle(buf, len);
+    }
+    esp_err_t err = ESP_OK;
+    if (b->is_bundle) {
+        err = ota_bundle_parser_feed(&b->parser, buf, len);
+    } else {
+        take_app_bytes(b, buf, len);
+        b->out_len = len;
+    }
+    *out = buf;
+    *out_len = b->out_len;
+    return err;
+}
+
+esp_err_t ota_bundle_end(ota_bundle_handle_t b)
+{
+    esp_err_t err = b->is_bundle ? ota_bundle_parser_finish(&b->parser) : ESP_OK;
+    if (err == ESP_OK && b->app_len < APP_HEAD_LEN) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        uint32_t magic_word;
+        memcpy(&magic_word, b->app_head + APP_DESC_OFFSET, sizeof(magic_word));
+        if (magic_word != ESP_APP_DESC_MAGIC_WORD) {
+            err = ESP_ERR_INVALID_VERSION;
+        }
+    }
+    if (err == ESP_OK) {
+        //Written for the new app only: the running app keeps its record until the new one runs
+        memcpy(b->next.app_elf_sha256, b->app_head + APP_SHA_OFFSET, OTA_BUNDLE_HASH_LEN);
+        err = save_selection(b->app_partition, &b->next);
+    }
+    if (err == ESP_OK) {
+        for (int i = 0; i < b->next.component_num; i++) {
+            ESP_LOGI(TAG, "%s: %s_%d after the update", b->next.components[i].name, b->next.components[i].name,
+                     b->next.components[i].slot);
+        }
+    }
+    ota_bundle_abort(b);
+    return err;
+}
+
+void ota_bundle_abort(ota_bundle_handle_t b)
+{
+    //Between image_begin() and image_end()
+    if (b->hashing) {
+        mbedtls_sha256_free(&b->sha);
+    }
+    free(b);
+}
+
+esp_err_t ota_bundle_find_partition(const char *name, const esp_partition_t **out_partition)
+{
+    if (strlen(name) > OTA_BUNDLE_MAX_NAME) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    selection_t selection;
+    load_running_selection(&selection);
+    const esp_partition_t *partition = find_slot(name, get_slot(&selection, name));
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *out_partition = partition;
+    return ESP_OK;
+}
+
+void ota_bundle_print_selection(void)
+{
+    selection_t selection;
+    load_running_selection(&selection);
+    if (selection.component_num == 0) {
+        ESP_LOGI(TAG, "No components installed by a bundle, using the partitions <name>_0");
+    }
+    for (int i = 0; i < selection.component_num; i++) {
+        ESP_LOGI(TAG, "%s: %s_%d", selection.components[i].name, selection.components[i].name,
+                 selection.components[i].slot);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "ota_bundle_format.h"
+
+#define OTA_BUNDLE_SUBTYPE      0x41        //Of the data partitions <name>_0 and <name>_1
+#define OTA_BUNDLE_MAX_NAME     14          //Characters of a component name, so that <name>_1 fits a partition label
+
+typedef struct ota_bundle *ota_bundle_handle_t;
+
+/**
+ * @brief   Start receiving a download for the app partition.
+ *
+ * A download is either a bundle, see ota_bundle_format.h, or a plain app
+ * image which is passed through unchanged.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        Insufficient memory
+ */
+esp_err_t ota_bundle_begin(const esp_partition_t *app_partition, ota_bundle_handle_t *out_handle);
+
+/**
+ * @brief   Process the next bytes of the download, in place.
+ *
+ * Takes the data exactly as received, in chunks of any size. The bytes of the
+ * app image are moved to the front of buf: *out is buf and *out_len may be 0.
+ * Data images are written to the inactive partition of their component as
+ * they arrive, erasing it sector by sector.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NOT_SUPPORTED The app is not the first image of the bundle
+ *  - ESP_ERR_NOT_FOUND     No partitions <name>_0 and <name>_1 for a data image
+ *  - ESP_ERR_INVALID_SIZE  Data image larger than its partitions
+ *  - ESP_ERR_INVALID_CRC   An image does not match its hash
+ *  - other                 Error of the bundle parser or of the flash
+ */
+esp_err_t ota_bundle_update(ota_bundle_handle_t handle, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len);
+
+/**
+ * @brief   Check that the download is complete and record the data partitions
+ *          of the new app, then release the handle.
+ *
+ * The record only takes effect when the new app runs: the boot partition set
+ * after esp_ota_end() switches the app and its data at once, and a rollback
+ * to the running app brings its data back.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_SIZE  Download truncated
+ *  - ESP_ERR_INVALID_VERSION   No app description at the start of the app image
+ *  - other                 Error of the bundle parser or from NVS
+ */
+esp_err_t ota_bundle_end(ota_bundle_handle_t handle);
+
+/**
+ * @brief   Release the handle. The data written so far stays in the inactive
+ *          partitions, which are not used.
+ */
+void ota_bundle_abort(ota_bundle_handle_t handle);
+
+/**
+ * @brief   Partition of a component the running app uses.
+ *
+ * Partition <name>_0 until an update installed by a bundle has run, for
+ * instance after flashing over the serial port. NVS must be initialised.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NOT_FOUND     No partition <name>_0 and <name>_1
+ *  - ESP_ERR_INVALID_ARG   Name longer than OTA_BUNDLE_MAX_NAME
+ */
+esp_err_t ota_bundle_find_partition(const char *name, const esp_partition_t **out_partition);
+
+/**
+ * @brief   Log the partitions of the components the running app uses.
+ */
+void ota_bundle_print_selection(void);
\ No newline at end of file
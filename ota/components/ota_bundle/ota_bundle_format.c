@@ -0,0 +1,178 @@
+/* Streaming parser of OTA bundles
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "ota_bundle_format.h"
+
+uint32_t ota_bundle_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    //Bitwise, the table is only a few hundred bytes
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+bool ota_bundle_is_bundle(const uint8_t *data, size_t len)
+{
+    //An app image starts with ESP_IMAGE_HEADER_MAGIC, 0xe9
+    return len > 0 && data[0] == (OTA_BUNDLE_MAGIC & 0xff);
+}
+
+void ota_bundle_parser_init(ota_bundle_parser_t *parser, const ota_bundle_callbacks_t *callbacks, void *ctx)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->callbacks = *callbacks;
+    parser->ctx = ctx;
+    parser->image = -1;
+}
+
+static size_t table_size(const ota_bundle_parser_t *parser)
+{
+    if (parser->table_len < sizeof(ota_bundle_header_t)) {
+        return sizeof(ota_bundle_header_t);
+    }
+    return sizeof(ota_bundle_header_t) + parser->table.header.image_num * sizeof(ota_bundle_entry_t);
+}
+
+static esp_err_t check_header(const ota_bundle_header_t *header)
+{
+    if (header->magic != OTA_BUNDLE_MAGIC || header->version != OTA_BUNDLE_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (header->image_num == 0 || header->image_num > OTA_BUNDLE_MAX_IMAGES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t check_entries(const ota_bundle_table_t *table)
+{
+    int image_num = table->header.image_num;
+    if (ota_bundle_crc32(0, (const uint8_t *)table->entries, image_num * sizeof(ota_bundle_entry_t))
+            != table->header.crc32) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    int app_num = 0;
+    for (int i = 0; i < image_num; i++) {
+        const ota_bundle_entry_t *entry = &table->entries[i];
+        if (entry->size == 0 || strnlen(entry->name, sizeof(entry->name)) == sizeof(entry->name)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (entry->type == OTA_BUNDLE_TYPE_APP) {
+            app_num++;
+        } else if (entry->type != OTA_BUNDLE_TYPE_DATA || entry->name[0] == '\0') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        //Components are updated as a whole, once
+        for (int j = 0; j < i; j++) {
+            if (entry->type == OTA_BUNDLE_TYPE_DATA && strcmp(entry->name, table->entries[j].name) == 0) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+    }
+    return (app_num <= 1) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+//Receives the header and the entries, then checks them
+static esp_err_t feed_table(ota_bundle_parser_t *parser, const uint8_t **data, size_t *len)
+{
+    while (*len > 0 && parser->image < 0) {
+        size_t n = table_size(parser) - parser->table_len;
+        if (n > *len) {
+            n = *len;
+        }
+        memcpy((uint8_t *)&parser->table + parser->table_len, *data, n);
+        parser->table_len += n;
+        *data += n;
+        *len -= n;
+
+        if (parser->table_len == sizeof(ota_bundle_header_t)) {
+            esp_err_t err = check_header(&parser->table.header);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        if (parser->table_len > sizeof(ota_bundle_header_t) && parser->table_len == table_size(parser)) {
+            esp_err_t err = check_entries(&parser->table);
+            if (err != ESP_OK) {
+                return err;
+            }
+            parser->image = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t feed_images(ota_bundle_parser_t *parser, const uint8_t *data, size_t len)
+{
+    const ota_bundle_callbacks_t *cb = &parser->callbacks;
+    while (len > 0) {
+        if (parser->image >= parser->table.header.image_num) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const ota_bundle_entry_t *entry = &parser->table.entries[parser->image];
+        esp_err_t err;
+        if (parser->image_offset == 0 && (err = cb->image_begin(parser->ctx, parser->image, entry)) != ESP_OK) {
+            return err;
+        }
+        size_t n = entry->size - parser->image_offset;
+        if (n > len) {
+            n = len;
+        }
+        if ((err = cb->image_data(parser->ctx, parser->image, data, n)) != ESP_OK) {
+            return err;
+        }
+        parser->image_offset += n;
+        data += n;
+        len -= n;
+        if (parser->image_offset == entry->size) {
+            if ((err = cb->image_end(parser->ctx, parser->image)) != ESP_OK) {
+                return err;
+            }
+            parser->image++;
+            parser->image_offset = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_bundle_parser_feed(ota_bundle_parser_t *parser, const uint8_t *data, size_t len)
+{
+    if (parser->error != ESP_OK) {
+        return parser->error;
+    }
+    esp_err_t err = feed_table(parser, &data, &len);
+    if (err == ESP_OK) {
+        err = feed_images(parser, data, len);
+    }
+    parser->error = err;
+    return err;
+}
+
+esp_err_t ota_bundle_parser_finish(const ota_bundle_parser_t *parser)
+{
+    if (parser->error != ESP_OK) {
+        return parser->error;
+    }
+    return (parser->image == parser->table.header.image_num) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+const ota_bundle_entry_t *ota_bundle_parser_entries(const ota_bundle_parser_t *parser, int *image_num)
+{
+    if (parser->image < 0) {
+        return NULL;
+    }
+    *image_num = parser->table.header.image_num;
+    return parser->table.entries;
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/**
+ * OTA bundle: several images sent in one download.
+ *
+ *   ota_bundle_header_t
+ *   ota_bundle_entry_t, image_num times
+ *   the images, in the order of the table, without padding
+ *
+ * All fields are little endian. crc32 is the CRC-32 (IEEE 802.3) of the
+ * entries. See mkbundle.py.
+ */
+
+#define OTA_BUNDLE_MAGIC        0x4241544f  //"OTAB"
+#define OTA_BUNDLE_VERSION      1
+#define OTA_BUNDLE_MAX_IMAGES   8
+#define OTA_BUNDLE_NAME_LEN     16
+#define OTA_BUNDLE_HASH_LEN     32
+
+#define OTA_BUNDLE_TYPE_APP     0           //Written by the OTA engine to the next update partition
+#define OTA_BUNDLE_TYPE_DATA    1           //Written to the inactive one of the partitions <name>_0 and <name>_1
+
+typedef struct {
+    uint32_t magic;                         //OTA_BUNDLE_MAGIC
+    uint8_t version;                        //OTA_BUNDLE_VERSION
+    uint8_t image_num;                      //1 to OTA_BUNDLE_MAX_IMAGES
+    uint16_t reserved;
+    uint32_t crc32;                         //Of the entries
+} __attribute__((packed)) ota_bundle_header_t;
+
+typedef struct {
+    char name[OTA_BUNDLE_NAME_LEN];         //Component of a data image, NUL terminated
+    uint8_t type;                           //OTA_BUNDLE_TYPE_*
+    uint8_t reserved[3];
+    uint32_t size;
+    uint8_t sha256[OTA_BUNDLE_HASH_LEN];    //Of the image
+} __attribute__((packed)) ota_bundle_entry_t;
+
+typedef struct {
+    ota_bundle_header_t header;
+    ota_bundle_entry_t entries[OTA_BUNDLE_MAX_IMAGES];
+} __attribute__((packed)) ota_bundle_table_t;
+
+/**
+ * Callbacks of the parser, all mandatory. An error stops the parser and is
+ * returned by ota_bundle_parser_feed().
+ */
+typedef struct {
+    esp_err_t (*image_begin)(void *ctx, int index, const ota_bundle_entry_t *entry);
+    esp_err_t (*image_data)(void *ctx, int index, const uint8_t *data, size_t len);
+    esp_err_t (*image_end)(void *ctx, int index);
+} ota_bundle_callbacks_t;
+
+typedef struct {
+    ota_bundle_callbacks_t callbacks;
+    void *ctx;
+    ota_bundle_table_t table;
+    size_t table_len;                       //Bytes of the table received
+    int image;                              //Image being received, -1 before the table is complete
+    size_t image_offset;                    //Bytes of that image received
+    esp_err_t error;
+} ota_bundle_parser_t;
+
+/**
+ * @brief   Whether a download is a bundle rather than an app image, from its
+ *          first byte. The parser checks the whole header.
+ */
+bool ota_bundle_is_bundle(const uint8_t *data, size_t len);
+
+void ota_bundle_parser_init(ota_bundle_parser_t *parser, const ota_bundle_callbacks_t *callbacks, void *ctx);
+
+/**
+ * @brief   Parse the next bytes of a bundle, in chunks of any size.
+ *
+ * image_data() gets pointers into data.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_VERSION   Not a bundle of OTA_BUNDLE_VERSION
+ *  - ESP_ERR_INVALID_CRC   Image table corrupted
+ *  - ESP_ERR_INVALID_ARG   Invalid image table: bad image count, type, size or name, several app images
+ *  - ESP_ERR_INVALID_SIZE  Data after the last image
+ *  - other                 Error of a callback, or of a previous call
+ */
+esp_err_t ota_bundle_parser_feed(ota_bundle_parser_t *parser, const uint8_t *data, size_t len);
+
+/**
+ * @brief   Check that the whole bundle was received.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_SIZE  Bundle truncated
+ *  - other                 Error of the parser
+ */
+esp_err_t ota_bundle_parser_finish(const ota_bundle_parser_t *parser);
+
+/**
+ * @brief   Entries of the bundle, NULL until the table is received.
+ */
+const ota_bundle_entry_t *ota_bundle_parser_entries(const ota_bundle_parser_t *parser, int *image_num);
+
+uint32_t ota_bundle_crc32(uint32_t crc, const uint8_t *data, size_t len);
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+//Smallest mbedtls configuration for the host test: AES with CTR mode for
+//ota_decrypt, GCM for the reference encryption of the test images
+
+#define MBEDTLS_AES_C
+#define MBEDTLS_CIPHER_C
+#define MBEDTLS_CIPHER_MODE_CTR
+#define MBEDTLS_GCM_C
+
+#include "mbedtls/check_config.h"
\ No newline at end of file
@@ -0,0 +1,231 @@
+/* Host test and benchmark of ota_decrypt
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mbedtls/gcm.h"
+#include "ota_decrypt.h"
+#include "check.h"
+
+#define MAX_IMAGE_SIZE      (1024 * 1024)
+#define MAX_ENCRYPTED_SIZE  (sizeof(ota_decrypt_header_t) + MAX_IMAGE_SIZE + OTA_DECRYPT_TAG_LEN)
+
+static const uint8_t s_key[32] = {
+    0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+    0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4
+};
+
+//Reference encryption with mbedtls GCM, in the format of ota_encrypt.py
+static size_t encrypt_image(const uint8_t *key, size_t key_len, const uint8_t *image, size_t size, uint8_t *out)
+{
+    ota_decrypt_header_t header = {
+        .magic = OTA_DECRYPT_MAGIC,
+        .version = OTA_DECRYPT_VERSION,
+        .image_size = size,
+    };
+    for (int i = 0; i < OTA_DECRYPT_IV_LEN; i++) {
+        header.iv[i] = rand();
+    }
+    memcpy(out, &header, sizeof(header));
+
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, key_len * 8);
+    mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, size, header.iv, OTA_DECRYPT_IV_LEN,
+                              (const uint8_t *)&header, sizeof(header), image, out + sizeof(header),
+                              OTA_DECRYPT_TAG_LEN, out + sizeof(header) + size);
+    mbedtls_gcm_free(&gcm);
+    return sizeof(header) + size + OTA_DECRYPT_TAG_LEN;
+}
+
+//Feeds the encrypted image in chunks, as received from the network
+static esp_err_t decrypt_image(const uint8_t *key, size_t key_len, const uint8_t *encrypted, size_t len,
+                               size_t chunk_size, uint8_t *image, size_t *image_size)
+{
+    uint8_t *buf = malloc(chunk_size);
+    ota_decrypt_handle_t handle;
+    esp_err_t err = ota_decrypt_begin(key, key_len, &handle);
+    if (err != ESP_OK) {
+        free(buf);
+        return err;
+    }
+    *image_size = 0;
+    for (size_t pos = 0; pos < len; pos += chunk_size) {
+        size_t n = len - pos < chunk_size ? len - pos : chunk_size;
+        memcpy(buf, encrypted + pos, n);
+        uint8_t *out;
+        size_t out_len;
+        err = ota_decrypt_update(handle, buf, n, &out, &out_len);
+        if (err != ESP_OK) {
+            ota_decrypt_abort(handle);
+            free(buf);
+            return err;
+        }
+        if (out < buf || out + out_len > buf + n) {
+            printf("FAIL output outside of the input buffer\n");
+            s_failures++;
+        }
+        memcpy(image + *image_size, out, out_len);
+        *image_size += out_len;
+    }
+    free(buf);
+    return ota_decrypt_end(handle);
+}
+
+static void test_round_trip(uint8_t *image, uint8_t *encrypted, uint8_t *decrypted)
+{
+    static const size_t sizes[] = { 0, 1, 15, 16, 17, 1000, 4096, 65537 };
+    static const size_t chunks[] = { 1, 7, 16, 23, 24, 25, 1024, 4096, MAX_ENCRYPTED_SIZE };
+    static const size_t key_lens[] = { 16, 24, 32 };
+    for (int k = 0; k < sizeof(key_lens) / sizeof(key_lens[0]); k++) {
+        for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t len = encrypt_image(s_key, key_lens[k], image, sizes[s], encrypted);
+            for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+                size_t out_size;
+                esp_err_t err = decrypt_image(s_key, key_lens[k], encrypted, len, chunks[c], decrypted, &out_size);
+                CHECK(err == ESP_OK, "key %zu size %zu chunk %zu: error 0x%x", key_lens[k], sizes[s], chunks[c], err);
+                CHECK(out_size == sizes[s] && memcmp(image, decrypted, out_size) == 0,
+                      "key %zu size %zu chunk %zu: wrong image", key_lens[k], sizes[s], chunks[c]);
+            }
+        }
+    }
+}
+
+static void expect_error(const char *name, const uint8_t *key, const uint8_t *encrypted, size_t len,
+                         uint8_t *decrypted, esp_err_t expected)
+{
+    static const size_t chunks[] = { 1, 1024 };
+    for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        size_t out_size;
+        esp_err_t err = decrypt_image(key, 32, encrypted, len, chunks[c], decrypted, &out_size);
+        CHECK(err == expected, "%s, chunk %zu: error 0x%x, expected 0x%x", name, chunks[c], err, expected);
+    }
+}
+
+static void test_tamper(uint8_t *image, uint8_t *encrypted, uint8_t *decrypted)
+{
+    const size_t size = 10000;
+    const size_t len = encrypt_image(s_key, 32, image, size, encrypted);
+    const size_t image_pos = sizeof(ota_decrypt_header_t);
+    const size_t tag_pos = image_pos + size;
+    const struct {
+        const char *name;
+        size_t pos;
+        esp_err_t expected;
+    } flips[] = {
+        { "magic", 0, ESP_ERR_NOT_SUPPORTED },
+        { "version", 4, ESP_ERR_NOT_SUPPORTED },
+        { "reserved", 5, ESP_ERR_INVALID_CRC },
+        { "image size", 8, ESP_ERR_INVALID_SIZE },
+        { "iv", 12, ESP_ERR_INVALID_CRC },
+        { "first image byte", image_pos, ESP_ERR_INVALID_CRC },
+        { "middle image byte", image_pos + size / 2, ESP_ERR_INVALID_CRC },
+        { "last image byte", tag_pos - 1, ESP_ERR_INVALID_CRC },
+        { "first tag byte", tag_pos, ESP_ERR_INVALID_CRC },
+        { "last tag byte", len - 1, ESP_ERR_INVALID_CRC },
+    };
+    for (int i = 0; i < sizeof(flips) / sizeof(flips[0]); i++) {
+        encrypted[flips[i].pos] ^= 0x01;
+        expect_error(flips[i].name, s_key, encrypted, len, decrypted, flips[i].expected);
+        encrypted[flips[i].pos] ^= 0x01;
+    }
+
+    expect_error("truncated tag", s_key, encrypted, len - 1, decrypted, ESP_ERR_INVALID_SIZE);
+    expect_error("truncated image", s_key, encrypted, tag_pos - 100, decrypted, ESP_ERR_INVALID_SIZE);
+    expect_error("truncated header", s_key, encrypted, 10, decrypted, ESP_ERR_INVALID_SIZE);
+    encrypted[len] = 0;
+    expect_error("trailing data", s_key, encrypted, len + 1, decrypted, ESP_ERR_INVALID_SIZE);
+
+    uint8_t wrong_key[32];
+    memcpy(wrong_key, s_key, sizeof(wrong_key));
+    wrong_key[31] ^= 0x80;
+    expect_error("wrong key", wrong_key, encrypted, len, decrypted, ESP_ERR_INVALID_CRC);
+
+    //Swapping two blocks keeps the size and every byte value
+    uint8_t block[16];
+    memcpy(block, encrypted + image_pos, 16);
+    memcpy(encrypted + image_pos, encrypted + image_pos + 16, 16);
+    memcpy(encrypted + image_pos + 16, block, 16);
+    expect_error("swapped blocks", s_key, encrypted, len, decrypted, ESP_ERR_INVALID_CRC);
+}
+
+static void test_key_from_hex(void)
+{
+    uint8_t key[32];
+    size_t key_len = sizeof(key);
+    CHECK(ota_decrypt_key_from_hex("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", key, &key_len) == ESP_OK
+          && key_len == 32 && memcmp(key, s_key, 32) == 0, "256 bit key");
+    key_len = sizeof(key);
+    CHECK(ota_decrypt_key_from_hex("603DEB1015CA71BE2B73AEF0857D7781", key, &key_len) == ESP_OK
+          && key_len == 16 && memcmp(key, s_key, 16) == 0, "128 bit key");
+    key_len = sizeof(key);
+    CHECK(ota_decrypt_key_from_hex("603deb1015ca71be2b73aef0857d778", key, &key_len) == ESP_ERR_INVALID_ARG, "odd length");
+    key_len = sizeof(key);
+    CHECK(ota_decrypt_key_from_hex("603deb1015ca71be2b73aef0857d778g", key, &key_len) == ESP_ERR_INVALID_ARG, "not hex");
+    key_len = 16;
+    CHECK(ota_decrypt_key_from_hex("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", key, &key_len)
+          == ESP_ERR_INVALID_ARG, "key buffer too small");
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(uint8_t *image, uint8_t *encrypted, uint8_t *decrypted)
+{
+    static const size_t chunks[] = { 16, 64, 256, 1024, 4096, 16384 };
+    const size_t len = encrypt_image(s_key, 32, image, MAX_IMAGE_SIZE, encrypted);
+    printf("| Chunk size | MiB/s\n");
+    printf("| --- | ---\n");
+    for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        int rounds = 0;
+        double start = now_s();
+        double elapsed;
+        do {
+            size_t out_size;
+            if (decrypt_image(s_key, 32, encrypted, len, chunks[c], decrypted, &out_size) != ESP_OK) {
+                printf("FAIL decryption\n");
+                s_failures++;
+                return;
+            }
+            rounds++;
+            elapsed = now_s() - start;
+        } while (elapsed < 0.5);
+        printf("| %zu | %.1f\n", chunks[c], rounds * MAX_IMAGE_SIZE / elapsed / (1024 * 1024));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *image = malloc(MAX_IMAGE_SIZE);
+    uint8_t *encrypted = malloc(MAX_ENCRYPTED_SIZE + 1);
+    uint8_t *decrypted = malloc(MAX_IMAGE_SIZE);
+    srand(1);
+    for (int i = 0; i < MAX_IMAGE_SIZE; i++) {
+        image[i] = rand();
+    }
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench(image, encrypted, decrypted);
+    } else {
+        test_key_from_hex();
+        test_round_trip(image, encrypted, decrypted);
+        test_tamper(image, encrypted, decrypted);
+        printf("%s\n", s_failures ? "FAILED" : "OK");
+    }
+    free(image);
+    free(encrypted);
+    free(decrypted);
+    return s_failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,293 @@
+/* OTA image decryption
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "mbedtls/aes.h"
+#include "ota_decrypt.h"
+
+#define BLOCK_LEN   16
+
+//AES-GCM split in its two halves: the keystream comes from mbedtls_aes_crypt_ctr(),
+//which the hardware AES implements on the ESP32 and which takes any length, so
+//chunks are decrypted in place whatever their size. mbedtls_gcm_update() needs
+//multiples of 16 bytes, which would mean holding back and copying the remainder
+//of every chunk. GHASH is calculated here over the ciphertext.
+struct ota_decrypt {
+    mbedtls_aes_context aes;
+    uint64_t h_table_hi[16];            //Multiples of the hash key, 4 bit table
+    uint64_t h_table_lo[16];
+    uint8_t ghash[BLOCK_LEN];
+    size_t ghash_fill;                  //Bytes of the current GHASH block
+    uint8_t counter[BLOCK_LEN];
+    uint8_t stream_block[BLOCK_LEN];
+    size_t stream_off;
+    uint8_t tag_mask[BLOCK_LEN];        //Encrypted initial counter block
+    union {
+        ota_decrypt_header_t header;
+        uint8_t header_bytes[sizeof(ota_decrypt_header_t)];
+    };
+    uint8_t tag[OTA_DECRYPT_TAG_LEN];
+    uint64_t received;                  //Bytes of the encrypted image so far
+    bool header_valid;
+};
+
+static const uint16_t s_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static uint64_t get_be64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static void put_be64(uint8_t *p, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--) {
+        p[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static void ghash_gen_table(struct ota_decrypt *d, const uint8_t *h)
+{
+    uint64_t hi = get_be64(h);
+    uint64_t lo = get_be64(h + 8);
+    d->h_table_hi[0] = 0;
+    d->h_table_lo[0] = 0;
+    d->h_table_hi[8] = hi;
+    d->h_table_lo[8] = lo;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint32_t t = (lo & 1) * 0xe1000000u;
+        lo = (hi << 63) | (lo >> 1);
+        hi = (hi >> 1) ^ ((uint64_t)t << 32);
+        d->h_table_hi[i] = hi;
+        d->h_table_lo[i] = lo;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            d->h_table_hi[i + j] = d->h_table_hi[i] ^ d->h_table_hi[j];
+            d->h_table_lo[i + j] = d->h_table_lo[i] ^ d->h_table_lo[j];
+        }
+    }
+}
+
+//x = x * H in GF(2^128), Shoup's method with 4 bit tables
+static void ghash_mult(struct ota_decrypt *d, uint8_t *x)
+{
+    uint8_t lo = x[15] & 0xf;
+    uint64_t zh = d->h_table_hi[lo];
+    uint64_t zl = d->h_table_lo[lo];
+    for (int i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        uint8_t hi = x[i] >> 4;
+        uint8_t rem;
+        if (i != 15) {
+            rem = zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ ((uint64_t)s_last4[rem] << 48);
+            zh ^= d->h_table_hi[lo];
+            zl ^= d->h_table_lo[lo];
+        }
+        rem = zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ ((uint64_t)s_last4[rem] << 48);
+        zh ^= d->h_table_hi[hi];
+        zl ^= d->h_table_lo[hi];
+    }
+    put_be64(x, zh);
+    put_be64(x + 8, zl);
+}
+
+static void ghash_update(struct ota_decrypt *d, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        if (d->ghash_fill == 0 && len >= BLOCK_LEN) {
+            for (int i = 0; i < BLOCK_LEN; i++) {
+                d->ghash[i] ^= data[i];
+            }
+            ghash_mult(d, d->ghash);
+            data += BLOCK_LEN;
+            len -= BLOCK_LEN;
+            continue;
+        }
+        d->ghash[d->ghash_fill++] ^= *data++;
+        len--;
+        if (d->ghash_fill == BLOCK_LEN) {
+            ghash_mult(d, d->ghash);
+            d->ghash_fill = 0;
+        }
+    }
+}
+
+//Zero padding to the end of the block
+static void ghash_pad(struct ota_decrypt *d)
+{
+    if (d->ghash_fill != 0) {
+        ghash_mult(d, d->ghash);
+        d->ghash_fill = 0;
+    }
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+esp_err_t ota_decrypt_key_from_hex(const char *hex, uint8_t *key, size_t *key_len)
+{
+    size_t len = strlen(hex) / 2;
+    if (strlen(hex) % 2 != 0 || (len != 16 && len != 24 && len != 32) || len > *key_len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < len; i++) {
+        int hi = hex_digit(hex[2 * i]);
+        int lo = hex_digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        key[i] = (hi << 4) | lo;
+    }
+    *key_len = len;
+    return ESP_OK;
+}
+
+esp_err_t ota_decrypt_begin(const uint8_t *key, size_t key_len, ota_decrypt_handle_t *out_handle)
+{
+    if (key_len != 16 && key_len != 24 && key_len != 32) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct ota_decrypt *d = calloc(1, sizeof(struct ota_decrypt));
+    if (d == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    mbedtls_aes_init(&d->aes);
+    if (mbedtls_aes_setkey_enc(&d->aes, key, key_len * 8) != 0) {
+        ota_decrypt_abort(d);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t h[BLOCK_LEN] = { 0 };
+    mbedtls_aes_crypt_ecb(&d->aes, MBEDTLS_AES_ENCRYPT, h, h);
+    ghash_gen_table(d, h);
+    *out_handle = d;
+    return ESP_OK;
+}
+
+static esp_err_t start_image(struct ota_decrypt *d)
+{
+    if (d->header.magic != OTA_DECRYPT_MAGIC || d->header.version != OTA_DECRYPT_VERSION) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    //96 bit IV: the initial counter block is IV || 1, the image starts at IV || 2
+    memcpy(d->counter, d->header.iv, OTA_DECRYPT_IV_LEN);
+    d->counter[15] = 1;
+    mbedtls_aes_crypt_ecb(&d->aes, MBEDTLS_AES_ENCRYPT, d->counter, d->tag_mask);
+    d->counter[15] = 2;
+    //The header is the additional authenticated data
+    ghash_update(d, d->header_bytes, sizeof(d->header_bytes));
+    ghash_pad(d);
+    d->header_valid = true;
+    return ESP_OK;
+}
+
+esp_err_t ota_decrypt_update(ota_decrypt_handle_t d, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    *out = buf;
+    *out_len = 0;
+    if (d->received < sizeof(ota_decrypt_header_t)) {
+        size_t n = sizeof(ota_decrypt_header_t) - d->received;
+        n = n < len ? n : len;
+        memcpy(d->header_bytes + d->received, buf, n);
+        d->received += n;
+        buf += n;
+        len -= n;
+        *out = buf;
+        if (d->received == sizeof(ota_decrypt_header_t)) {
+            esp_err_t err = start_image(d);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+
+    uint64_t image_end = sizeof(ota_decrypt_header_t) + (uint64_t)d->header.image_size;
+    if (d->received < image_end) {
+        size_t n = image_end - d->received < len ? image_end - d->received : len;
+        //GHASH covers the ciphertext, so it goes first
+        ghash_update(d, buf, n);
+        mbedtls_aes_crypt_ctr(&d->aes, n, &d->stream_off, d->counter, d->stream_block, buf, buf);
+        d->received += n;
+        buf += n;
+        len -= n;
+        *out_len = n;
+    }
+    if (len > 0) {
+        uint64_t tag_received = d->received - image_end;
+        if (tag_received + len > OTA_DECRYPT_TAG_LEN) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(d->tag + tag_received, buf, len);
+        d->received += len;
+    }
+    return ESP_OK;
+}
+
+uint32_t ota_decrypt_get_image_size(ota_decrypt_handle_t d)
+{
+    return d->header_valid ? d->header.image_size : 0;
+}
+
+esp_err_t ota_decrypt_end(ota_decrypt_handle_t d)
+{
+    esp_err_t err = ESP_OK;
+    if (!d->header_valid) {
+        err = d->received < sizeof(ota_decrypt_header_t) ? ESP_ERR_INVALID_SIZE : ESP_ERR_NOT_SUPPORTED;
+    } else if (d->received != sizeof(ota_decrypt_header_t) + (uint64_t)d->header.image_size + OTA_DECRYPT_TAG_LEN) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        ghash_pad(d);
+        uint8_t lengths[BLOCK_LEN];
+        put_be64(lengths, sizeof(ota_decrypt_header_t) * 8);
+        put_be64(lengths + 8, (uint64_t)d->header.image_size * 8);
+        ghash_update(d, lengths, sizeof(lengths));
+        //Constant time comparison
+        uint8_t diff = 0;
+        for (int i = 0; i < OTA_DECRYPT_TAG_LEN; i++) {
+            diff |= d->ghash[i] ^ d->tag_mask[i] ^ d->tag[i];
+        }
+        err = diff == 0 ? ESP_OK : ESP_ERR_INVALID_CRC;
+    }
+    ota_decrypt_abort(d);
+    return err;
+}
+
+void ota_decrypt_abort(ota_decrypt_handle_t d)
+{
+    mbedtls_aes_free(&d->aes);
+    memset(d, 0, sizeof(struct ota_decrypt));
+    free(d);
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define OTA_DECRYPT_MAGIC       0x41544f45  //"EOTA"
+#define OTA_DECRYPT_VERSION     1
+#define OTA_DECRYPT_IV_LEN      12
+#define OTA_DECRYPT_TAG_LEN     16
+
+/**
+ * Encrypted image: this header, the image encrypted with AES-GCM, then the
+ * 16 byte tag. The header is authenticated as additional data. See
+ * ota_encrypt.py.
+ */
+typedef struct {
+    uint32_t magic;                     //OTA_DECRYPT_MAGIC
+    uint8_t version;                    //OTA_DECRYPT_VERSION
+    uint8_t reserved[3];
+    uint32_t image_size;                //Size of the plain image
+    uint8_t iv[OTA_DECRYPT_IV_LEN];
+} __attribute__((packed)) ota_decrypt_header_t;
+
+typedef struct ota_decrypt *ota_decrypt_handle_t;
+
+/**
+ * @brief   Convert a key given as hexadecimal text, such as a Kconfig string.
+ *
+ * @param   key_len     In: size of key. Out: 16, 24 or 32.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   Not 32, 48 or 64 hexadecimal digits, or key too small
+ */
+esp_err_t ota_decrypt_key_from_hex(const char *hex, uint8_t *key, size_t *key_len);
+
+/**
+ * @brief   Start decrypting an image.
+ *
+ * @param   key_len     16, 24 or 32 bytes
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   Invalid key length
+ *  - ESP_ERR_NO_MEM        Insufficient memory
+ */
+esp_err_t ota_decrypt_begin(const uint8_t *key, size_t key_len, ota_decrypt_handle_t *out_handle);
+
+/**
+ * @brief   Decrypt the next bytes of the encrypted image, in place.
+ *
+ * Takes the data exactly as received, in chunks of any size. The plain image
+ * is written over the ciphertext at the same position, so no copy is made:
+ * *out points into buf, after the part of the header in this chunk, and
+ * *out_len excludes the header and the tag. *out_len may be 0.
+ *
+ * The data is authenticated only by ota_decrypt_end(): the output must not be
+ * trusted, only written to a partition which is not booted before then.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NOT_SUPPORTED Not an encrypted image, or a format version not supported
+ *  - ESP_ERR_INVALID_SIZE  More data than announced by the header
+ */
+esp_err_t ota_decrypt_update(ota_decrypt_handle_t handle, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len);
+
+/**
+ * @brief   Size of the plain image, from the header.
+ *
+ * @return  Size in bytes, or 0 if the header has not been received yet.
+ */
+uint32_t ota_decrypt_get_image_size(ota_decrypt_handle_t handle);
+
+/**
+ * @brief   Check the tag of the image and release the handle.
+ *
+ * @return
+ *  - ESP_OK                The image is authentic
+ *  - ESP_ERR_INVALID_SIZE  Image truncated
+ *  - ESP_ERR_INVALID_CRC   The image, its header or the tag was modified, or the key is wrong
+ *  - ESP_ERR_NOT_SUPPORTED Not an encrypted image
+ */
+esp_err_t ota_decrypt_end(ota_decrypt_handle_t handle);
+
+/**
+ * @brief   Release the handle without checking the image.
+ */
+void ota_decrypt_abort(ota_decrypt_handle_t handle);
\ No newline at end of file
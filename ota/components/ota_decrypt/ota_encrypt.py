@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+#
+# Encrypts an app image for the ota_decrypt component, so that it can be kept
+# encrypted on the distribution server.
+#
+# Output: 24 byte header (magic "EOTA", format version, image size, random
+# 96 bit IV), the image encrypted with AES-GCM, then the 16 byte tag. The
+# header is authenticated as additional data.
+#
+# Usage:
+#   ota_encrypt.py genkey > ota_key.txt
+#   ota_encrypt.py encrypt --key-file ota_key.txt build/native_ota.bin native_ota.bin.enc
+#
+# The key file holds the key in hexadecimal, as CONFIG_OTA_DECRYPT_KEY.
+#
+from __future__ import print_function, division
+import argparse
+import binascii
+import os
+import struct
+import sys
+
+from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+
+MAGIC = b"EOTA"
+VERSION = 1
+HEADER = struct.Struct("<4sB3xI12s")
+
+
+def read_key(path):
+    with open(path) as f:
+        key = binascii.unhexlify(f.read().strip())
+    if len(key) not in (16, 24, 32):
+        raise ValueError("the key must be 128, 192 or 256 bits")
+    return key
+
+
+def encrypt(args):
+    key = read_key(args.key_file)
+    with open(args.input, "rb") as f:
+        image = f.read()
+    header = HEADER.pack(MAGIC, VERSION, len(image), os.urandom(12))
+    # AESGCM appends the tag to the ciphertext
+    encrypted = AESGCM(key).encrypt(header[-12:], image, header)
+    with open(args.output, "wb") as f:
+        f.write(header + encrypted)
+    print("%s: %d bytes encrypted to %s" % (args.input, len(image), args.output))
+    return 0
+
+
+def decrypt(args):
+    key = read_key(args.key_file)
+    with open(args.input, "rb") as f:
+        data = f.read()
+    magic, version, size, iv = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        print("Error: %s is not an encrypted image" % args.input, file=sys.stderr)
+        return 1
+    image = AESGCM(key).decrypt(iv, data[HEADER.size:], data[:HEADER.size])
+    if len(image) != size:
+        print("Error: image size %d, header %d" % (len(image), size), file=sys.stderr)
+        return 1
+    with open(args.output, "wb") as f:
+        f.write(image)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Encrypt app images for the ota_decrypt component")
+    subparsers = parser.add_subparsers(dest="command")
+
+    genkey_parser = subparsers.add_parser("genkey", help="print a random key in hexadecimal")
+    genkey_parser.add_argument("--bits", type=int, choices=(128, 192, 256), default=256)
+
+    for name, help in (("encrypt", "encrypt an image"), ("decrypt", "decrypt and authenticate an image")):
+        subparser = subparsers.add_parser(name, help=help)
+        subparser.add_argument("--key-file", required=True, help="file holding the key in hexadecimal")
+        subparser.add_argument("input")
+        subparser.add_argument("output")
+
+    args = parser.parse_args()
+    if args.command == "genkey":
+        print(binascii.hexlify(os.urandom(args.bits // 8)).decode())
+        return 0
+    elif args.command == "encrypt":
+        return encrypt(args)
+    elif args.command == "decrypt":
+        return decrypt(args)
+    parser.print_help()
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,218 @@
+/* ESP-IDF stand-ins of the host benchmark of the OTA engine
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_shim.h"
+
+#define HASH_LEN        32
+#define READ_SIZE       4096
+
+esp_log_level_t esp_log_host_level = ESP_LOG_WARN;
+
+static flash_emu_t *s_flash;
+static esp_app_desc_t s_running_app = {
+    .magic_word = ESP_APP_DESC_MAGIC_WORD,
+    .project_name = "ota_bench",
+};
+static esp_partition_t s_running = {
+    .type = ESP_PARTITION_TYPE_APP,
+    .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0,
+    .address = 0x10000,
+    .label = "ota_0",
+};
+static esp_partition_t s_update = {
+    .type = ESP_PARTITION_TYPE_APP,
+    .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1,
+    .label = "ota_1",
+};
+static bool s_ota_begun;
+static size_t s_ota_written;
+
+static const char *TAG = "esp_shim";
+
+esp_err_t esp_shim_init(flash_emu_t *flash, const char *version)
+{
+    if (strlen(version) >= sizeof(s_running_app.version)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    strcpy(s_running_app.version, version);
+    s_flash = flash;
+    s_running.size = flash->size;
+    s_update.address = s_running.address + flash->size;
+    s_update.size = flash->size;
+    s_ota_begun = false;
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    esp_log_host_level = level;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char name[16];
+    if (code == ESP_OK) {
+        return "ESP_OK";
+    }
+    snprintf(name, sizeof(name), "0x%x", code);
+    return name;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    return partition == &s_update ? flash_emu_read(s_flash, src_offset, dst, size) : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    return partition == &s_update ? flash_emu_write(s_flash, dst_offset, src, size) : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size)
+{
+    return partition == &s_update ? flash_emu_erase_range(s_flash, start_addr, size) : ESP_ERR_NOT_SUPPORTED;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &s_running;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    return s_flash != NULL ? &s_update : NULL;
+}
+
+const esp_app_desc_t *esp_ota_get_app_description(void)
+{
+    return &s_running_app;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *app_desc)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state)
+{
+    *ota_state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_last_invalid_partition(void)
+{
+    return NULL;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+//As ESP-IDF: the whole partition is erased for OTA_SIZE_UNKNOWN, otherwise the sectors of image_size
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    if (partition != &s_update || s_ota_begun) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t erase_size = partition->size;
+    if (image_size != OTA_SIZE_UNKNOWN) {
+        if (image_size > partition->size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        erase_size = (image_size + FLASH_EMU_SECTOR_SIZE - 1) / FLASH_EMU_SECTOR_SIZE * FLASH_EMU_SECTOR_SIZE;
+    }
+    esp_err_t err = flash_emu_erase_range(s_flash, 0, erase_size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_ota_begun = true;
+    s_ota_written = 0;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    if (handle != 1 || !s_ota_begun) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_ota_written == 0 && size > 0 && *(const uint8_t *)data != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "OTA image has invalid magic byte (expected 0xE9, saw 0x%02x)", *(const uint8_t *)data);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    esp_err_t err = flash_emu_write(s_flash, s_ota_written, data, size);
+    if (err == ESP_OK) {
+        s_ota_written += size;
+    }
+    return err;
+}
+
+//Reads the image back and checks the SHA-256 appended to it, the part of
+//esp_image_verify() which reads the partition. The images of ota_bench.py
+//always have one.
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (handle != 1 || !s_ota_begun) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_ota_begun = false;
+    if (s_ota_written <= HASH_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t buf[READ_SIZE];
+    uint8_t digest[HASH_LEN];
+    size_t image_len = s_ota_written - HASH_LEN;
+    EVP_MD_CTX *sha = EVP_MD_CTX_new();
+    esp_err_t err = sha != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+    if (err == ESP_OK) {
+        EVP_DigestInit_ex(sha, EVP_sha256(), NULL);
+    }
+    for (size_t offset = 0; offset < image_len && err == ESP_OK; ) {
+        size_t len = (image_len - offset < sizeof(buf)) ? image_len - offset : sizeof(buf);
+        err = flash_emu_read(s_flash, offset, buf, len);
+        EVP_DigestUpdate(sha, buf, len);
+        offset += len;
+    }
+    if (err == ESP_OK) {
+        EVP_DigestFinal_ex(sha, digest, NULL);
+        err = flash_emu_read(s_flash, image_len, buf, HASH_LEN);
+    }
+    EVP_MD_CTX_free(sha);
+    if (err != ESP_OK || memcmp(digest, buf, HASH_LEN) != 0) {
+        ESP_LOGE(TAG, "Image hash failed, image read back from flash differs");
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    return partition == &s_update ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+
+//Set up of the ESP-IDF stand-ins of the host benchmark: esp_ota_ops.h and
+//esp_partition.h over a file backed flash, esp_timer.h, esp_log.h and
+//esp_err_to_name(). The HTTP client and FreeRTOS need none.
+
+#include "esp_err.h"
+#include "flash_emu.h"
+
+/**
+ * @brief   Make flash the update partition, and report version as the one of the running app.
+ *
+ * The flash must stay open while the engine runs. The running app is valid,
+ * there is no invalid partition and no rollback.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_SIZE  Version longer than esp_app_desc_t keeps
+ */
+esp_err_t esp_shim_init(flash_emu_t *flash, const char *version);
\ No newline at end of file
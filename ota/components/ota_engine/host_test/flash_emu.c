@@ -0,0 +1,87 @@
+/* File backed NOR flash for the host benchmark
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "flash_emu.h"
+
+esp_err_t flash_emu_open(flash_emu_t *flash, const char *path, size_t size)
+{
+    if (size % FLASH_EMU_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(flash, 0, sizeof(*flash));
+    flash->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (flash->fd < 0) {
+        return ESP_FAIL;
+    }
+    if (ftruncate(flash->fd, size) != 0) {
+        close(flash->fd);
+        return ESP_FAIL;
+    }
+    flash->size = size;
+    return ESP_OK;
+}
+
+void flash_emu_close(flash_emu_t *flash)
+{
+    close(flash->fd);
+    flash->fd = -1;
+}
+
+esp_err_t flash_emu_erase_range(flash_emu_t *flash, size_t offset, size_t len)
+{
+    if (offset % FLASH_EMU_SECTOR_SIZE != 0 || len % FLASH_EMU_SECTOR_SIZE != 0 || offset + len > flash->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t erased[FLASH_EMU_SECTOR_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    for (size_t sector = offset; sector < offset + len; sector += FLASH_EMU_SECTOR_SIZE) {
+        if (pwrite(flash->fd, erased, sizeof(erased), sector) != sizeof(erased)) {
+            return ESP_FAIL;
+        }
+        flash->erases++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t flash_emu_write(flash_emu_t *flash, size_t offset, const void *data, size_t len)
+{
+    if (offset + len > flash->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *src = data;
+    uint8_t cells[FLASH_EMU_SECTOR_SIZE];
+    for (size_t done = 0; done < len; ) {
+        size_t n = (len - done < sizeof(cells)) ? len - done : sizeof(cells);
+        if (pread(flash->fd, cells, n, offset + done) != n) {
+            return ESP_FAIL;
+        }
+        //NOR flash only clears bits
+        for (size_t i = 0; i < n; i++) {
+            cells[i] &= src[done + i];
+        }
+        if (pwrite(flash->fd, cells, n, offset + done) != n) {
+            return ESP_FAIL;
+        }
+        done += n;
+    }
+    flash->writes++;
+    flash->written += len;
+    return ESP_OK;
+}
+
+esp_err_t flash_emu_read(flash_emu_t *flash, size_t offset, void *data, size_t len)
+{
+    if (offset + len > flash->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return (pread(flash->fd, data, len, offset) == len) ? ESP_OK : ESP_FAIL;
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+//File backed NOR flash for the host benchmark: erase sets a sector to 0xff,
+//a write only clears bits, as esp_partition_write() on the target
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define FLASH_EMU_SECTOR_SIZE   4096
+
+typedef struct {
+    int fd;
+    size_t size;
+    uint32_t erases;                    //Sectors erased
+    uint32_t writes;
+    size_t written;                     //Bytes written
+} flash_emu_t;
+
+/**
+ * @brief   Open or create the file backing a partition of size bytes.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   Size not a multiple of FLASH_EMU_SECTOR_SIZE
+ *  - ESP_FAIL              File error
+ */
+esp_err_t flash_emu_open(flash_emu_t *flash, const char *path, size_t size);
+
+void flash_emu_close(flash_emu_t *flash);
+
+/**
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   Range not aligned to sectors or out of the partition
+ *  - ESP_FAIL              File error
+ */
+esp_err_t flash_emu_erase_range(flash_emu_t *flash, size_t offset, size_t len);
+
+/**
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_SIZE  Out of the partition
+ *  - ESP_FAIL              File error
+ */
+esp_err_t flash_emu_write(flash_emu_t *flash, size_t offset, const void *data, size_t len);
+
+esp_err_t flash_emu_read(flash_emu_t *flash, size_t offset, void *data, size_t len);
\ No newline at end of file
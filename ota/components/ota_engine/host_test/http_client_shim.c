@@ -0,0 +1,308 @@
+/* esp_http_client over OpenSSL, for the host benchmark of the OTA engine
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+//The calls of the OTA engine over HTTPS/1.1 GET, one connection per
+//esp_http_client_open(). Only what the engine relies on is kept: the status,
+//Content-Length, extra request headers such as Range, and reads which fill
+//the buffer unless the response ends.
+
+#define _GNU_SOURCE                     //strcasestr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include "esp_log.h"
+#include "esp_http_client.h"
+
+#define HEADER_BUFFER_SIZE  4096
+#define MAX_HEADERS         4
+
+typedef struct {
+    char key[32];
+    char value[64];
+} header_t;
+
+struct esp_http_client {
+    char host[256];
+    char port[8];
+    char path[256];
+    SSL_CTX *ctx;                       //With the CA of cert_pem, kept across connections
+    SSL *ssl;
+    int fd;
+    header_t headers[MAX_HEADERS];
+    uint8_t response[HEADER_BUFFER_SIZE];
+    size_t response_len;
+    size_t pending_offset;              //Body bytes received with the headers
+    size_t pending_len;
+    int status;
+    int content_length;                 //-1 when not given, the body then ends with the connection
+    size_t body_read;
+    bool closed_by_server;
+};
+
+static const char *TAG = "HTTP_CLIENT";
+
+static bool parse_url(esp_http_client_handle_t client, const char *url)
+{
+    const char *prefix = "https://";
+    if (strncmp(url, prefix, strlen(prefix)) != 0) {
+        return false;
+    }
+    const char *host = url + strlen(prefix);
+    const char *path = strchr(host, '/');
+    const char *port = strchr(host, ':');
+    if (path == NULL || port == NULL || port > path || port - host >= sizeof(client->host)
+            || path - port - 1 >= sizeof(client->port) || strlen(path) >= sizeof(client->path)) {
+        return false;
+    }
+    memcpy(client->host, host, port - host);
+    client->host[port - host] = '\0';
+    memcpy(client->port, port + 1, path - port - 1);
+    client->port[path - port - 1] = '\0';
+    strcpy(client->path, path);
+    return true;
+}
+
+static bool load_ca(SSL_CTX *ctx, const char *cert_pem)
+{
+    BIO *bio = BIO_new_mem_buf(cert_pem, -1);
+    int loaded = 0;
+    X509 *cert;
+    while (bio != NULL && (cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+        loaded += X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx), cert);
+        X509_free(cert);
+    }
+    BIO_free(bio);
+    ERR_clear_error();
+    return loaded > 0;
+}
+
+static int tcp_connect(esp_http_client_handle_t client)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addrs;
+    if (getaddrinfo(client->host, client->port, &hints, &addrs) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->fd = -1;
+    if (!parse_url(client, config->url)) {
+        ESP_LOGE(TAG, "Unsupported URL %s", config->url);
+        free(client);
+        return NULL;
+    }
+    client->ctx = SSL_CTX_new(TLS_client_method());
+    if (client->ctx == NULL || config->cert_pem == NULL || !load_ca(client->ctx, config->cert_pem)) {
+        ESP_LOGE(TAG, "No CA certificate in cert_pem");
+        SSL_CTX_free(client->ctx);
+        free(client);
+        return NULL;
+    }
+    //The certificate is checked against the CA, not the host name, as esp_http_client with cert_pem
+    SSL_CTX_set_verify(client->ctx, SSL_VERIFY_PEER, NULL);
+    return client;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    esp_http_client_close(client);
+    client->fd = tcp_connect(client);
+    if (client->fd < 0) {
+        ESP_LOGE(TAG, "Cannot connect to %s:%s", client->host, client->port);
+        return ESP_FAIL;
+    }
+    client->ssl = SSL_new(client->ctx);
+    SSL_set_fd(client->ssl, client->fd);
+    if (SSL_connect(client->ssl) != 1) {
+        ESP_LOGE(TAG, "TLS handshake failed");
+        ERR_print_errors_fp(stderr);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+
+    char request[1024];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n", client->path, client->host);
+    for (int i = 0; i < MAX_HEADERS; i++) {
+        if (client->headers[i].key[0] != '\0' && len < sizeof(request)) {
+            len += snprintf(request + len, sizeof(request) - len, "%s: %s\r\n",
+                            client->headers[i].key, client->headers[i].value);
+        }
+    }
+    if (len < sizeof(request)) {
+        len += snprintf(request + len, sizeof(request) - len, "Connection: close\r\n\r\n");
+    }
+    if (len >= sizeof(request) || SSL_write(client->ssl, request, len) != len) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    char *end = NULL;
+    while (end == NULL) {
+        if (client->ssl == NULL || client->response_len == sizeof(client->response) - 1) {
+            ESP_LOGE(TAG, "Response headers too long");
+            return ESP_FAIL;
+        }
+        int n = SSL_read(client->ssl, client->response + client->response_len,
+                         sizeof(client->response) - 1 - client->response_len);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "Connection closed in the response headers");
+            return ESP_FAIL;
+        }
+        client->response_len += n;
+        client->response[client->response_len] = '\0';
+        end = strstr((char *)client->response, "\r\n\r\n");
+    }
+    if (sscanf((char *)client->response, "HTTP/%*s %d", &client->status) != 1) {
+        ESP_LOGE(TAG, "No HTTP status");
+        return ESP_FAIL;
+    }
+    const char *length = strcasestr((char *)client->response, "\r\nContent-Length:");
+    if (length != NULL && length < end) {
+        client->content_length = strtol(length + strlen("\r\nContent-Length:"), NULL, 10);
+    }
+    client->pending_offset = end + 4 - (char *)client->response;
+    client->pending_len = client->response_len - client->pending_offset;
+    return client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->content_length;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    if (client->ssl == NULL) {
+        return ESP_FAIL;
+    }
+    if (client->content_length >= 0 && client->body_read + len > client->content_length) {
+        len = client->content_length - client->body_read;
+    }
+    int filled = 0;
+    if (client->pending_len > 0) {
+        filled = (client->pending_len < len) ? client->pending_len : len;
+        memcpy(buffer, client->response + client->pending_offset, filled);
+        client->pending_offset += filled;
+        client->pending_len -= filled;
+    }
+    while (filled < len && !client->closed_by_server) {
+        int n = SSL_read(client->ssl, buffer + filled, len - filled);
+        if (n <= 0) {
+            int err = SSL_get_error(client->ssl, n);
+            //The server may close without close_notify after Content-Length bytes
+            if (err != SSL_ERROR_ZERO_RETURN && err != SSL_ERROR_SYSCALL) {
+                return ESP_FAIL;
+            }
+            client->closed_by_server = true;
+            break;
+        }
+        filled += n;
+    }
+    client->body_read += filled;
+    return filled;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    if (client->content_length >= 0) {
+        return client->body_read >= client->content_length;
+    }
+    return client->closed_by_server;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    if (strlen(key) >= sizeof(client->headers[0].key) || strlen(value) >= sizeof(client->headers[0].value)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    header_t *free_header = NULL;
+    for (int i = 0; i < MAX_HEADERS; i++) {
+        if (strcasecmp(client->headers[i].key, key) == 0) {
+            free_header = &client->headers[i];
+            break;
+        }
+        if (free_header == NULL && client->headers[i].key[0] == '\0') {
+            free_header = &client->headers[i];
+        }
+    }
+    if (free_header == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(free_header->key, key);
+    strcpy(free_header->value, value);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+    for (int i = 0; i < MAX_HEADERS; i++) {
+        if (strcasecmp(client->headers[i].key, key) == 0) {
+            client->headers[i].key[0] = '\0';
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->ssl != NULL) {
+        SSL_free(client->ssl);
+        client->ssl = NULL;
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+    client->response_len = 0;
+    client->pending_len = 0;
+    client->status = 0;
+    client->content_length = -1;
+    client->body_read = 0;
+    client->closed_by_server = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    SSL_CTX_free(client->ctx);
+    free(client);
+    return ESP_OK;
+}
\ No newline at end of file
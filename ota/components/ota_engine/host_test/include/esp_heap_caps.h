@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT         (1 << 2)
+#define MALLOC_CAP_SPIRAM       (1 << 10)
+#define MALLOC_CAP_INTERNAL     (1 << 11)
+
+//One heap on the host: PSRAM allocations succeed, so the PSRAM path of the engine runs
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+//No low watermark on the host
+static inline size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+//Monotonic clock of the host, in microseconds
+int64_t esp_timer_get_time(void);
\ No newline at end of file
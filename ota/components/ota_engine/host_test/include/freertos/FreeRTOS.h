@@ -0,0 +1,19 @@
+#pragma once
+
+//The FreeRTOS calls of the OTA engine over POSIX threads, see freertos_shim.c.
+//A wait is either portMAX_DELAY or none, the only ones the engine uses.
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define errQUEUE_FULL           0
+
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define portNUM_PROCESSORS      2
\ No newline at end of file
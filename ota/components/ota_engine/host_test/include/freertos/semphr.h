@@ -0,0 +1,11 @@
+#pragma once
+
+#include "freertos/queue.h"
+
+//A binary semaphore is a queue of one item of no size, as in FreeRTOS
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateBinary()            xQueueCreate(1, 0)
+#define vSemaphoreDelete(semaphore)         vQueueDelete(semaphore)
+#define xSemaphoreGive(semaphore)           xQueueSend(semaphore, NULL, 0)
+#define xSemaphoreTake(semaphore, ticks)    xQueueReceive(semaphore, NULL, ticks)
\ No newline at end of file
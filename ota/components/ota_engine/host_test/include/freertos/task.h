@@ -0,0 +1,17 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#define tskNO_AFFINITY          0x7FFFFFFF
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+//A detached thread, the name, stack size, priority and core are ignored
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+
+//Only for the calling task, task must be NULL
+void vTaskDelete(TaskHandle_t task);
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
\ No newline at end of file
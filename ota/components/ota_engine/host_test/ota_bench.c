@@ -0,0 +1,225 @@
+/* Host end-to-end benchmark of the OTA data path
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+//Runs ota_engine.c, as built for the target with the configuration given by
+//the Makefile, over the stand-ins of esp_shim.c, http_client_shim.c and
+//freertos_shim.c: ota_engine_run() downloads an image over HTTPS and writes
+//it to a file backed flash, esp_ota_end() reads it back. Prints one line of
+//JSON with the timings, the CPU time and the peak memory. Run by ota_bench.py.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "ota_engine.h"
+#include "esp_shim.h"
+
+#define MAX_CERT_SIZE   16384
+
+typedef struct {
+    const esp_partition_t *partition;
+    size_t erased;                      //Erased from the start of the partition
+} erase_stage_t;
+
+static double seconds(int64_t us)
+{
+    return us / 1e6;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *data = malloc(MAX_CERT_SIZE);
+    size_t len = 0;
+    if (f != NULL && data != NULL) {
+        len = fread(data, 1, MAX_CERT_SIZE - 1, f);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    if (len == 0) {
+        free(data);
+        return NULL;
+    }
+    data[len] = '\0';
+    return data;
+}
+
+//With erase_on_demand, esp_ota_begin() erases the first sector only
+static esp_err_t erase_begin(void *ctx)
+{
+    erase_stage_t *stage = ctx;
+    stage->partition = esp_ota_get_next_update_partition(NULL);
+    stage->erased = FLASH_EMU_SECTOR_SIZE;
+    return ESP_OK;
+}
+
+//As ota_preerase_ensure() without its background task: erases the sectors of each write just before it
+static esp_err_t erase_before_write(void *ctx, size_t offset, size_t len)
+{
+    erase_stage_t *stage = ctx;
+    if (offset + len <= stage->erased) {
+        return ESP_OK;
+    }
+    size_t end = (offset + len + FLASH_EMU_SECTOR_SIZE - 1) / FLASH_EMU_SECTOR_SIZE * FLASH_EMU_SECTOR_SIZE;
+    esp_err_t err = esp_partition_erase_range(stage->partition, stage->erased, end - stage->erased);
+    stage->erased = end;
+    return err;
+}
+
+//ru_maxrss keeps the peak of the process forked for exec on Linux, VmHWM is of this program alone
+static long peak_rss_kb(const struct rusage *usage)
+{
+    long kb = usage->ru_maxrss;
+    char line[128];
+    FILE *f = fopen("/proc/self/status", "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return kb;
+}
+
+static void print_result(ota_engine_handle_t engine, int64_t time_total, const flash_emu_t *flash)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    ota_engine_stats_t s;
+    ota_engine_get_stats(engine, &s);
+    printf("{\"state\": \"%s\", \"image_len\": %zu, \"buffer_internal\": %zu, \"buffer_external\": %zu, "
+           "\"time_total\": %.6f, \"time_http\": %.6f, \"time_process\": %.6f, "
+           "\"time_validate\": %.6f, \"time_write\": %.6f, \"time_first_write\": %.6f, "
+           "\"mb_per_s\": %.3f, \"cpu_user\": %.6f, \"cpu_sys\": %.6f, \"peak_rss_kb\": %ld, "
+           "\"flash_erases\": %u, \"flash_writes\": %u}\n",
+           ota_engine_state_name(ota_engine_get_state(engine)), s.image_len, s.buffer_internal, s.buffer_external,
+           seconds(time_total), seconds(s.time_http), seconds(s.time_process),
+           seconds(s.time_validate), seconds(s.time_write), seconds(s.time_first_write),
+           time_total > 0 ? s.image_len / seconds(time_total) / 1e6 : 0, user, sys, peak_rss_kb(&usage),
+           flash->erases, flash->writes);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s --url https://HOST:PORT/PATH --ca CA_CERT --flash FILE [--partition-size BYTES] "
+            "[--running-version VERSION] [--erase-on-demand] [--verbose]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    size_t partition_size = 0x330000;
+    const char *url = NULL;
+    const char *ca_file = NULL;
+    const char *flash_path = NULL;
+    const char *running_version = "";
+    bool erase_on_demand = false;
+    static const struct option options[] = {
+        { "url", required_argument, NULL, 'u' },
+        { "ca", required_argument, NULL, 'c' },
+        { "flash", required_argument, NULL, 'f' },
+        { "partition-size", required_argument, NULL, 'p' },
+        { "running-version", required_argument, NULL, 'v' },
+        { "erase-on-demand", no_argument, NULL, 'e' },
+        { "verbose", no_argument, NULL, 'V' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'u':
+            url = optarg;
+            break;
+        case 'c':
+            ca_file = optarg;
+            break;
+        case 'f':
+            flash_path = optarg;
+            break;
+        case 'p':
+            partition_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            running_version = optarg;
+            break;
+        case 'e':
+            erase_on_demand = true;
+            break;
+        case 'V':
+            esp_log_level_set("*", ESP_LOG_INFO);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (url == NULL || ca_file == NULL || flash_path == NULL) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char *cert_pem = read_file(ca_file);
+    if (cert_pem == NULL) {
+        fprintf(stderr, "Cannot read %s\n", ca_file);
+        return 1;
+    }
+    flash_emu_t flash;
+    if (flash_emu_open(&flash, flash_path, partition_size) != ESP_OK) {
+        fprintf(stderr, "Cannot set up %s\n", flash_path);
+        return 1;
+    }
+    if (esp_shim_init(&flash, running_version) != ESP_OK) {
+        fprintf(stderr, "Running version %s too long\n", running_version);
+        return 2;
+    }
+    esp_http_client_config_t http_config = {
+        .url = url,
+        .cert_pem = cert_pem,
+    };
+    ota_engine_config_t engine_config = {
+        .http_config = &http_config,
+        .erase_on_demand = erase_on_demand,
+    };
+    ota_engine_handle_t engine;
+    if (ota_engine_init(&engine_config, &engine) != ESP_OK) {
+        fprintf(stderr, "Cannot create the engine\n");
+        return 1;
+    }
+    erase_stage_t erase;
+    ota_engine_stage_t erase_stage = {
+        .name = "erase",
+        .ctx = &erase,
+        .begin = erase_begin,
+        .before_write = erase_before_write,
+    };
+    if (erase_on_demand) {
+        ota_engine_add_stage(engine, &erase_stage);
+    }
+
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = ota_engine_run(engine);
+    int64_t time_total = esp_timer_get_time() - time_start;
+    if (err != ESP_OK) {
+        fprintf(stderr, "ota_engine_run() failed (%s)\n", esp_err_to_name(err));
+    }
+    print_result(engine, time_total, &flash);
+    ota_engine_deinit(engine);
+    flash_emu_close(&flash);
+    free(cert_pem);
+    return err == ESP_OK ? 0 : 1;
+}
\ No newline at end of file
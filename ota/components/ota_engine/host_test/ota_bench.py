@@ -0,0 +1,430 @@
+#!/usr/bin/env python
+#
+# End-to-end benchmark of the OTA data path on the host. ota_bench, built by
+# "make bench" from ota_engine.c in three configurations, runs
+# ota_engine_run() on an app image from a local HTTPS server, through a proxy
+# shaping the link, into a file backed flash. Reports MB/s, CPU time and peak
+# memory of ota_bench, and fails when the throughput on a shaped link
+# regresses past the baseline of the scenario.
+#
+# The server uses the certificate of the examples,
+# ota/native_ota_example/server_certs/ca_cert.pem, with the key made with it
+# in step 2 of ota/README.md, by default ca_key.pem next to it. --self-signed
+# makes a throwaway pair instead.
+#
+# The proxy paces each direction to the bandwidth, delays it by the latency,
+# and stalls it for a retransmission timeout on each lost segment, with the
+# segments behind it waiting as they would for TCP. It models the link, not
+# the congestion control of TCP.
+#
+# Usage:
+#   ota_bench.py --key ca_key.pem                   # the scenarios of the baseline, checked against it
+#   ota_bench.py --self-signed --scenario lossy
+#   ota_bench.py --self-signed --image-size 2M --build pipeline --bandwidth 20M --latency-ms 10 --loss 0.5
+#   ota_bench.py --self-signed --update-baseline    # after a deliberate change to the data path
+#
+from __future__ import print_function, division
+import argparse
+import hashlib
+import json
+import os
+import random
+import shutil
+import socket
+import ssl
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+    import queue
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+    import Queue as queue
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_CERT = os.path.normpath(os.path.join(HERE, "..", "..", "..", "native_ota_example", "server_certs", "ca_cert.pem"))
+DEFAULT_BASELINE = os.path.join(HERE, "ota_bench_baseline.json")
+# Builds of the Makefile: the Kconfig defaults, CONFIG_OTA_ENGINE_PIPELINE,
+# and CONFIG_OTA_ENGINE_PSRAM_BUFFER with its 16 KiB chunks
+BUILDS = {
+    "default": os.path.join(HERE, "ota_bench"),
+    "pipeline": os.path.join(HERE, "ota_bench_pipeline"),
+    "psram": os.path.join(HERE, "ota_bench_psram"),
+}
+
+SEGMENT_SIZE = 1460                 # TCP MSS on Ethernet and Wi-Fi
+MIN_RTO = 0.2                       # Minimum retransmission timeout of Linux and lwIP
+RUNNING_VERSION = "bench-0"
+IMAGE_VERSION = "bench-1"
+
+# Image layout of esp_image_format.h
+IMAGE_MAGIC = 0xe9
+APP_DESC_MAGIC = 0xabcd5432
+DROM_ADDR = 0x3f400000
+CHECKSUM_SEED = 0xef
+
+# Scenarios of the baseline: each build over loopback, then typical Wi-Fi links
+SCENARIOS = {
+    "loopback": dict(image_size="3M", build="default", bandwidth="0", latency_ms=0, loss=0),
+    "loopback_pipeline": dict(image_size="3M", build="pipeline", bandwidth="0", latency_ms=0, loss=0),
+    "loopback_psram": dict(image_size="3M", build="psram", bandwidth="0", latency_ms=0, loss=0),
+    "wifi": dict(image_size="1M", build="default", bandwidth="20M", latency_ms=5, loss=0),
+    "wifi_psram": dict(image_size="1M", build="psram", bandwidth="20M", latency_ms=5, loss=0),
+    "lossy": dict(image_size="1M", build="default", bandwidth="5M", latency_ms=30, loss=1),
+}
+
+# Metrics checked against the baseline, whether higher is better. Only on a
+# shaped link: the throughput is then set by the link and the engine, the same
+# on any host fast enough for the proxy. Over loopback, and for the CPU time
+# and the memory anywhere, the numbers depend on the machine and its load and
+# are only reported.
+GATED_METRICS = (("mb_per_s", True),)
+
+
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def parse_size(text):
+    text = str(text).strip().upper()
+    for suffix, scale in (("M", 1000 * 1000), ("K", 1000)):
+        if text.endswith(suffix):
+            return int(float(text[:-len(suffix)]) * scale)
+    return int(text, 0)
+
+
+def parse_bytes(text):
+    text = str(text).strip().upper()
+    for suffix, scale in (("M", 1024 * 1024), ("K", 1024)):
+        if text.endswith(suffix):
+            return int(text[:-len(suffix)], 0) * scale
+    return int(text, 0)
+
+
+def make_image(size, version):
+    """ App image of about size bytes the validator accepts: one DROM segment
+    starting with the app description, the checksum and the appended SHA-256 """
+    data_len = max(256, (size - 24 - 8 - 16 - 32) // 4 * 4)
+    if data_len > 0x400000 - 0x20:
+        raise ValueError("image too large for the DROM segment")
+    app_desc = struct.pack("<II8x32s32s16s16s32s32s20x", APP_DESC_MAGIC, 0, version.encode(), b"ota_bench",
+                           b"00:00:00", b"Jan  1 2020", b"host", b"\0" * 32)
+    data = app_desc + os.urandom(data_len - len(app_desc))
+    header = struct.pack("<BBBBI", IMAGE_MAGIC, 1, 2, 0x20, DROM_ADDR + 0x20)
+    # wp_pin, spi_pin_drv, chip_id, min_chip_rev, reserved, hash_appended
+    header += struct.pack("<B3sHB8sB", 0xee, b"\0" * 3, 0, 0, b"\0" * 8, 1)
+    image = bytearray(header + struct.pack("<II", DROM_ADDR + 0x20, data_len) + data)
+    checksum = CHECKSUM_SEED
+    for byte in bytearray(data):
+        checksum ^= byte
+    image += b"\0" * (15 - len(image) % 16) + bytearray([checksum])
+    image += hashlib.sha256(image).digest()
+    return bytes(image)
+
+
+class ImageServer(object):
+    """ Serves the image over HTTPS at /image.bin """
+
+    def __init__(self, image, cert, key):
+        server = self
+        self.image = image
+
+        class Handler(BaseHTTPRequestHandler):
+            def log_message(self, *args):
+                pass
+
+            def do_GET(self):
+                if self.path != "/image.bin":
+                    self.send_error(404)
+                    return
+                self.send_response(200)
+                self.send_header("Content-Type", "application/octet-stream")
+                self.send_header("Content-Length", str(len(server.image)))
+                self.end_headers()
+                try:
+                    self.wfile.write(server.image)
+                except (socket.error, ssl.SSLError):
+                    pass
+
+        self.httpd = ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+        context = ssl.SSLContext(getattr(ssl, "PROTOCOL_TLS_SERVER", ssl.PROTOCOL_SSLv23))
+        context.load_cert_chain(cert, key)
+        self.httpd.socket = context.wrap_socket(self.httpd.socket, server_side=True)
+        self.port = self.httpd.server_address[1]
+        thread = threading.Thread(target=self.httpd.serve_forever)
+        thread.daemon = True
+        thread.start()
+
+    def stop(self):
+        self.httpd.shutdown()
+        self.httpd.server_close()
+
+
+class Link(object):
+    """ One direction of the shaped link """
+
+    def __init__(self, src, dst, bandwidth, latency, loss, rng):
+        self.src = src
+        self.dst = dst
+        self.bandwidth = bandwidth
+        self.latency = latency
+        self.loss = loss
+        self.rng = rng
+        self.queue = queue.Queue()
+        self.departure = 0
+        self.lost = 0
+        self.threads = [threading.Thread(target=self.receive), threading.Thread(target=self.deliver)]
+        for thread in self.threads:
+            thread.daemon = True
+            thread.start()
+
+    def receive(self):
+        while True:
+            try:
+                data = self.src.recv(SEGMENT_SIZE)
+            except socket.error:
+                data = b""
+            now = time.time()
+            if not data:
+                self.queue.put((max(now, self.departure) + self.latency, None))
+                return
+            # Serialised after the segments before it, at the bandwidth of the link
+            self.departure = max(now, self.departure)
+            if self.bandwidth:
+                self.departure += len(data) * 8.0 / self.bandwidth
+            if self.loss and self.rng.random() < self.loss:
+                # Sent again after the timeout, the segments behind it wait
+                self.departure += max(MIN_RTO, 4 * self.latency)
+                self.lost += 1
+            self.queue.put((self.departure + self.latency, data))
+
+    def deliver(self):
+        while True:
+            deliver_at, data = self.queue.get()
+            delay = deliver_at - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            try:
+                if data is None:
+                    self.dst.shutdown(socket.SHUT_WR)
+                    return
+                self.dst.sendall(data)
+            except socket.error:
+                return
+
+    def join(self):
+        for thread in self.threads:
+            thread.join()
+
+
+class ShapingProxy(object):
+    """ TCP proxy between ota_bench and the server, for one connection at a time """
+
+    def __init__(self, server_port, bandwidth, latency, loss, seed):
+        self.server_port = server_port
+        self.bandwidth = bandwidth
+        self.latency = latency
+        self.loss = loss
+        self.seed = seed
+        self.lost = 0
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(4)
+        self.port = self.listener.getsockname()[1]
+        thread = threading.Thread(target=self.serve)
+        thread.daemon = True
+        thread.start()
+
+    def serve(self):
+        while True:
+            try:
+                client, _ = self.listener.accept()
+            except socket.error:
+                return
+            server = socket.create_connection(("127.0.0.1", self.server_port))
+            for s in (client, server):
+                s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            # The same segments are lost in each run
+            rng = random.Random(self.seed)
+            links = [Link(client, server, self.bandwidth, self.latency, self.loss, rng),
+                     Link(server, client, self.bandwidth, self.latency, self.loss, rng)]
+            for link in links:
+                link.join()
+            self.lost += sum(link.lost for link in links)
+            client.close()
+            server.close()
+
+    def stop(self):
+        self.listener.close()
+
+
+def self_signed_pair(directory):
+    cert = os.path.join(directory, "ca_cert.pem")
+    key = os.path.join(directory, "ca_key.pem")
+    with open(os.devnull, "w") as devnull:
+        subprocess.check_call(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-keyout", key, "-out", cert,
+                               "-days", "1", "-subj", "/CN=127.0.0.1"], stdout=devnull, stderr=devnull)
+    return cert, key
+
+
+def is_gated(params):
+    return parse_size(params["bandwidth"]) > 0
+
+
+def median(values):
+    values = sorted(values)
+    middle = len(values) // 2
+    return values[middle] if len(values) % 2 else (values[middle - 1] + values[middle]) / 2
+
+
+def run_scenario(params, args, cert, key, workdir):
+    image = make_image(parse_bytes(params["image_size"]), IMAGE_VERSION)
+    server = ImageServer(image, cert, key)
+    proxy = ShapingProxy(server.port, parse_size(params["bandwidth"]), params["latency_ms"] / 1000.0,
+                         params["loss"] / 100.0, args.seed)
+    results = []
+    try:
+        for _ in range(args.runs):
+            command = [BUILDS[params["build"]], "--url", "https://127.0.0.1:%d/image.bin" % proxy.port, "--ca", cert,
+                       "--flash", os.path.join(workdir, "flash.bin"), "--partition-size", str(args.partition_size),
+                       "--running-version", RUNNING_VERSION]
+            if args.erase_on_demand:
+                command.append("--erase-on-demand")
+            output = subprocess.check_output(command)
+            result = json.loads(output.decode())
+            if result["state"] != "activated" or result["image_len"] != len(image):
+                raise RuntimeError("ota_bench ended in state %s after %d bytes" % (result["state"], result["image_len"]))
+            if params["build"] == "psram" and not result["buffer_external"]:
+                raise RuntimeError("ota_bench_psram fell back to the internal buffers")
+            results.append(result)
+    finally:
+        proxy.stop()
+        server.stop()
+    mb = len(image) / 1e6
+    return {
+        "mb_per_s": round(median([r["mb_per_s"] for r in results]), 3),
+        "cpu_s_per_mb": round(median([(r["cpu_user"] + r["cpu_sys"]) / mb for r in results]), 4),
+        "peak_rss_kb": max(r["peak_rss_kb"] for r in results),
+        "time_total": round(median([r["time_total"] for r in results]), 3),
+        "time_http": round(median([r["time_http"] for r in results]), 3),
+        "time_validate": round(median([r["time_validate"] for r in results]), 3),
+        "time_write": round(median([r["time_write"] for r in results]), 3),
+        "lost_segments": proxy.lost // args.runs,
+    }
+
+
+def compare(name, result, baseline, tolerance):
+    """ Returns the regressions of a scenario against its baseline """
+    regressions = []
+    for metric, higher_is_better in GATED_METRICS:
+        if metric not in baseline:
+            continue
+        limit = baseline[metric] * (1 - tolerance / 100.0 if higher_is_better else 1 + tolerance / 100.0)
+        if (result[metric] < limit) if higher_is_better else (result[metric] > limit):
+            regressions.append("%s: %s %s, baseline %s, limit %.4g" % (name, metric, result[metric], baseline[metric], limit))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End-to-end benchmark of the OTA data path on the host")
+    parser.add_argument("--scenario", action="append", choices=sorted(SCENARIOS),
+                        help="scenario of the baseline to run, may be repeated; all by default")
+    parser.add_argument("--name", help="name of a custom scenario, given by the options below, to compare with the baseline")
+    parser.add_argument("--image-size", help="size of the app image, such as 1M")
+    parser.add_argument("--build", choices=sorted(BUILDS), help="configuration of the engine")
+    parser.add_argument("--bandwidth", help="of the link in bit/s, such as 20M; 0 for no limit")
+    parser.add_argument("--latency-ms", type=float, help="one way latency of the link")
+    parser.add_argument("--loss", type=float, help="segments lost, in percent")
+    parser.add_argument("--partition-size", type=lambda text: int(text, 0), default=0x330000,
+                        help="size of the update partition, an OTA slot of native_ota_example by default")
+    parser.add_argument("--erase-on-demand", action="store_true", help="erase sector by sector while writing, "
+                        "instead of the whole partition first")
+    parser.add_argument("--runs", type=int, default=3, help="runs per scenario, the median is kept")
+    parser.add_argument("--seed", type=int, default=1, help="of the segments lost")
+    parser.add_argument("--cert", default=DEFAULT_CERT, help="server certificate, also the CA of ota_bench")
+    parser.add_argument("--key", help="key of the server certificate, ca_key.pem next to it by default")
+    parser.add_argument("--self-signed", action="store_true", help="use a throwaway certificate and key")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE, help="JSON file of the reference results")
+    parser.add_argument("--tolerance", type=float, default=20, help="regression allowed, in percent")
+    parser.add_argument("--update-baseline", action="store_true", help="store the results as the new baseline")
+    parser.add_argument("--json", help="also write the results to this file")
+    args = parser.parse_args()
+
+    missing = [path for path in BUILDS.values() if not os.path.exists(path)]
+    if missing:
+        print("Error: %s not built, run \"make bench\"" % " ".join(missing), file=sys.stderr)
+        return 1
+    custom = [args.image_size, args.build, args.bandwidth, args.latency_ms, args.loss]
+    if any(value is not None for value in custom):
+        defaults = SCENARIOS["loopback"]
+        scenarios = {args.name or "custom": dict(
+            image_size=args.image_size or defaults["image_size"],
+            build=args.build or defaults["build"],
+            bandwidth=args.bandwidth or defaults["bandwidth"],
+            latency_ms=args.latency_ms if args.latency_ms is not None else defaults["latency_ms"],
+            loss=args.loss if args.loss is not None else defaults["loss"])}
+    else:
+        scenarios = dict((name, SCENARIOS[name]) for name in (args.scenario or sorted(SCENARIOS)))
+
+    workdir = tempfile.mkdtemp(prefix="ota_bench")
+    try:
+        if args.self_signed:
+            cert, key = self_signed_pair(workdir)
+        else:
+            cert, key = args.cert, args.key or os.path.join(os.path.dirname(args.cert), "ca_key.pem")
+            if not os.path.exists(key):
+                print("Error: no key %s of %s, give --key or --self-signed" % (key, args.cert), file=sys.stderr)
+                return 1
+        results = {}
+        for name in sorted(scenarios):
+            results[name] = run_scenario(scenarios[name], args, cert, key, workdir)
+    finally:
+        shutil.rmtree(workdir)
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    print("| Scenario | Image | Build | Link | MB/s | CPU s/MB | Peak RSS KiB | HTTP s | Validate s | Write s | Lost |")
+    print("| --- | --- | --- | --- | --- | --- | --- | --- | --- | --- | --- |")
+    regressions = []
+    for name in sorted(results):
+        params, result = scenarios[name], results[name]
+        link = "loopback" if not parse_size(params["bandwidth"]) else "%sbit/s %gms %g%%" % (
+            params["bandwidth"], params["latency_ms"], params["loss"])
+        print("| %s | %s | %s | %s | %.3f | %.4f | %d | %.3f | %.3f | %.3f | %d |" % (
+            name, params["image_size"], params["build"], link, result["mb_per_s"], result["cpu_s_per_mb"],
+            result["peak_rss_kb"], result["time_http"], result["time_validate"], result["time_write"],
+            result["lost_segments"]))
+        if name in baseline and is_gated(params):
+            regressions += compare(name, result, baseline[name], args.tolerance)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=1, sort_keys=True)
+    if args.update_baseline:
+        for name in results:
+            if is_gated(scenarios[name]):
+                baseline[name] = dict((metric, results[name][metric]) for metric, _ in GATED_METRICS)
+            else:
+                baseline.pop(name, None)
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print("Baseline %s updated" % args.baseline)
+        return 0
+    for regression in regressions:
+        print("Regression %s" % regression, file=sys.stderr)
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,274 @@
+/* Host test of the OTA engine state machine and stage chain
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "ota_engine_core.h"
+#include "check.h"
+
+static void dispatch_ok(ota_engine_sm_t *sm, ota_engine_event_t event, ota_engine_state_t expected)
+{
+    esp_err_t err = ota_engine_sm_dispatch(sm, event, ESP_OK);
+    CHECK(err == ESP_OK && sm->state == expected, "event %d: error 0x%x, state %s, expected %s",
+          event, err, ota_engine_state_name(sm->state), ota_engine_state_name(expected));
+}
+
+static void test_update(void)
+{
+    ota_engine_sm_t sm = { 0 };
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_START, OTA_ENGINE_STATE_CHECK);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_RETRY, OTA_ENGINE_STATE_CHECK);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_NEW_VERSION, OTA_ENGINE_STATE_DOWNLOAD);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_INTERRUPTED, OTA_ENGINE_STATE_PAUSED);
+    CHECK(!ota_engine_sm_is_final(&sm), "paused is not final");
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_RESUMED, OTA_ENGINE_STATE_DOWNLOAD);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_DOWNLOADED, OTA_ENGINE_STATE_VERIFY);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_VERIFIED, OTA_ENGINE_STATE_ACTIVATE);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_ACTIVATED, OTA_ENGINE_STATE_ACTIVATED);
+    CHECK(ota_engine_sm_is_final(&sm), "activated is final");
+    CHECK(ota_engine_sm_dispatch(&sm, OTA_ENGINE_EVENT_ERROR, ESP_FAIL) == ESP_ERR_INVALID_STATE
+          && sm.state == OTA_ENGINE_STATE_ACTIVATED, "no error after activation");
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_RESET, OTA_ENGINE_STATE_IDLE);
+}
+
+static void test_no_update(void)
+{
+    ota_engine_sm_t sm = { 0 };
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_START, OTA_ENGINE_STATE_CHECK);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_NO_UPDATE, OTA_ENGINE_STATE_UP_TO_DATE);
+    CHECK(ota_engine_sm_is_final(&sm), "up to date is final");
+    CHECK(ota_engine_sm_dispatch(&sm, OTA_ENGINE_EVENT_START, ESP_OK) == ESP_ERR_INVALID_STATE, "start needs a reset");
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_RESET, OTA_ENGINE_STATE_IDLE);
+}
+
+static void test_errors(void)
+{
+    //Events leading to each state which accepts an error
+    static const ota_engine_event_t paths[][4] = {
+        { OTA_ENGINE_EVENT_MAX },
+        { OTA_ENGINE_EVENT_PENDING_VERIFY, OTA_ENGINE_EVENT_MAX },
+        { OTA_ENGINE_EVENT_START, OTA_ENGINE_EVENT_MAX },
+        { OTA_ENGINE_EVENT_START, OTA_ENGINE_EVENT_NEW_VERSION, OTA_ENGINE_EVENT_MAX },
+        { OTA_ENGINE_EVENT_START, OTA_ENGINE_EVENT_NEW_VERSION, OTA_ENGINE_EVENT_INTERRUPTED, OTA_ENGINE_EVENT_MAX },
+        { OTA_ENGINE_EVENT_START, OTA_ENGINE_EVENT_NEW_VERSION, OTA_ENGINE_EVENT_DOWNLOADED, OTA_ENGINE_EVENT_MAX },
+    };
+    for (int i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        ota_engine_sm_t sm = { 0 };
+        for (int j = 0; paths[i][j] != OTA_ENGINE_EVENT_MAX; j++) {
+            ota_engine_sm_dispatch(&sm, paths[i][j], ESP_OK);
+        }
+        ota_engine_state_t state = sm.state;
+        CHECK(ota_engine_sm_dispatch(&sm, OTA_ENGINE_EVENT_ERROR, ESP_ERR_INVALID_CRC) == ESP_OK
+              && sm.state == OTA_ENGINE_STATE_FAILED && sm.failed_state == state && sm.error == ESP_ERR_INVALID_CRC,
+              "error in %s", ota_engine_state_name(state));
+        CHECK(ota_engine_sm_dispatch(&sm, OTA_ENGINE_EVENT_ERROR, ESP_FAIL) == ESP_ERR_INVALID_STATE
+              && sm.error == ESP_ERR_INVALID_CRC, "second error in %s keeps the first", ota_engine_state_name(state));
+        dispatch_ok(&sm, OTA_ENGINE_EVENT_RESET, OTA_ENGINE_STATE_IDLE);
+        CHECK(sm.error == ESP_OK, "reset clears the error");
+    }
+}
+
+static void test_invalid_events(void)
+{
+    //Every event not listed here must be rejected, leaving the state unchanged
+    static const struct {
+        ota_engine_state_t state;
+        ota_engine_event_t event;
+    } allowed[] = {
+        { OTA_ENGINE_STATE_IDLE, OTA_ENGINE_EVENT_START },
+        { OTA_ENGINE_STATE_IDLE, OTA_ENGINE_EVENT_PENDING_VERIFY },
+        { OTA_ENGINE_STATE_CONFIRM, OTA_ENGINE_EVENT_CONFIRMED },
+        { OTA_ENGINE_STATE_CHECK, OTA_ENGINE_EVENT_NEW_VERSION },
+        { OTA_ENGINE_STATE_CHECK, OTA_ENGINE_EVENT_NO_UPDATE },
+        { OTA_ENGINE_STATE_CHECK, OTA_ENGINE_EVENT_RETRY },
+        { OTA_ENGINE_STATE_DOWNLOAD, OTA_ENGINE_EVENT_DOWNLOADED },
+        { OTA_ENGINE_STATE_DOWNLOAD, OTA_ENGINE_EVENT_INTERRUPTED },
+        { OTA_ENGINE_STATE_PAUSED, OTA_ENGINE_EVENT_RESUMED },
+        { OTA_ENGINE_STATE_VERIFY, OTA_ENGINE_EVENT_VERIFIED },
+        { OTA_ENGINE_STATE_ACTIVATE, OTA_ENGINE_EVENT_ACTIVATED },
+        { OTA_ENGINE_STATE_ACTIVATED, OTA_ENGINE_EVENT_RESET },
+        { OTA_ENGINE_STATE_UP_TO_DATE, OTA_ENGINE_EVENT_RESET },
+        { OTA_ENGINE_STATE_FAILED, OTA_ENGINE_EVENT_RESET },
+    };
+    for (ota_engine_state_t state = 0; state < OTA_ENGINE_STATE_MAX; state++) {
+        for (ota_engine_event_t event = 0; event < OTA_ENGINE_EVENT_MAX; event++) {
+            if (event == OTA_ENGINE_EVENT_ERROR) {
+                continue;
+            }
+            bool is_allowed = false;
+            for (int i = 0; i < sizeof(allowed) / sizeof(allowed[0]); i++) {
+                is_allowed |= allowed[i].state == state && allowed[i].event == event;
+            }
+            ota_engine_sm_t sm = { .state = state };
+            esp_err_t err = ota_engine_sm_dispatch(&sm, event, ESP_OK);
+            CHECK(is_allowed ? err == ESP_OK : err == ESP_ERR_INVALID_STATE && sm.state == state,
+                  "event %d in %s: error 0x%x", event, ota_engine_state_name(state), err);
+        }
+    }
+}
+
+static void test_confirm(void)
+{
+    ota_engine_sm_t sm = { 0 };
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_PENDING_VERIFY, OTA_ENGINE_STATE_CONFIRM);
+    CHECK(ota_engine_sm_dispatch(&sm, OTA_ENGINE_EVENT_START, ESP_OK) == ESP_ERR_INVALID_STATE, "no update before confirmation");
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_CONFIRMED, OTA_ENGINE_STATE_IDLE);
+    dispatch_ok(&sm, OTA_ENGINE_EVENT_START, OTA_ENGINE_STATE_CHECK);
+}
+
+static void test_version(void)
+{
+    char v1[32] = "1.0", v2[32] = "2.0";
+    CHECK(ota_engine_check_version(v2, v1, NULL, sizeof(v1)) == OTA_ENGINE_VERSION_NEW, "new");
+    CHECK(ota_engine_check_version(v1, v1, NULL, sizeof(v1)) == OTA_ENGINE_VERSION_SAME, "same");
+    CHECK(ota_engine_check_version(v2, v1, v2, sizeof(v1)) == OTA_ENGINE_VERSION_REJECTED, "rejected");
+    CHECK(ota_engine_check_version(v1, v1, v2, sizeof(v1)) == OTA_ENGINE_VERSION_SAME, "same, other rejected");
+    //Version fields are not always terminated
+    char a[4] = { '1', '.', '0', '0' }, b[4] = { '1', '.', '0', '0' };
+    CHECK(ota_engine_check_version(a, b, NULL, sizeof(a)) == OTA_ENGINE_VERSION_SAME, "full length field");
+}
+
+//Mock stages recording the calls in a log
+static char s_log[256];
+
+typedef struct {
+    char id;
+    size_t skip;            //Bytes dropped at the start of each chunk by process()
+    esp_err_t begin_err;
+    esp_err_t end_err;
+} mock_t;
+
+static void log_call(char id, char call)
+{
+    size_t len = strlen(s_log);
+    s_log[len] = id;
+    s_log[len + 1] = call;
+    s_log[len + 2] = '\0';
+}
+
+static esp_err_t mock_begin(void *ctx)
+{
+    mock_t *mock = ctx;
+    log_call(mock->id, 'b');
+    return mock->begin_err;
+}
+
+static esp_err_t mock_process(void *ctx, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    mock_t *mock = ctx;
+    log_call(mock->id, 'p');
+    size_t skip = mock->skip < len ? mock->skip : len;
+    *out = buf + skip;
+    *out_len = len - skip;
+    for (size_t i = 0; i < *out_len; i++) {
+        (*out)[i] += 1;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t mock_end(void *ctx)
+{
+    mock_t *mock = ctx;
+    log_call(mock->id, 'e');
+    return mock->end_err;
+}
+
+static void mock_abort(void *ctx)
+{
+    mock_t *mock = ctx;
+    log_call(mock->id, 'a');
+}
+
+static esp_err_t bad_process(void *ctx, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    *out = buf + 1;
+    *out_len = len;
+    return ESP_OK;
+}
+
+static void add_mock(ota_engine_chain_t *chain, mock_t *mock)
+{
+    ota_engine_stage_t stage = {
+        .name = "mock",
+        .ctx = mock,
+        .begin = mock_begin,
+        .process = mock_process,
+        .end = mock_end,
+        .abort = mock_abort,
+    };
+    CHECK(ota_engine_chain_add(chain, &stage) == ESP_OK, "add stage");
+}
+
+static void test_chain(void)
+{
+    ota_engine_chain_t chain = { 0 };
+    mock_t a = { .id = 'A', .skip = 2 }, b = { .id = 'B' }, c = { .id = 'C', .skip = 1 };
+    add_mock(&chain, &a);
+    add_mock(&chain, &b);
+    add_mock(&chain, &c);
+
+    s_log[0] = '\0';
+    CHECK(ota_engine_chain_begin(&chain) == ESP_OK && strcmp(s_log, "AbBbCb") == 0, "begin order: %s", s_log);
+
+    uint8_t buf[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    uint8_t *out;
+    size_t out_len;
+    s_log[0] = '\0';
+    CHECK(ota_engine_chain_process(&chain, buf, sizeof(buf), &out, &out_len) == ESP_OK
+          && strcmp(s_log, "ApBpCp") == 0, "process order: %s", s_log);
+    CHECK(out == buf + 3 && out_len == 5 && out[0] == 6 && out[4] == 10, "in place output");
+
+    //A chunk fully consumed is not passed on
+    s_log[0] = '\0';
+    CHECK(ota_engine_chain_process(&chain, buf, 2, &out, &out_len) == ESP_OK && out_len == 0
+          && strcmp(s_log, "Ap") == 0, "consumed chunk: %s", s_log);
+
+    s_log[0] = '\0';
+    b.end_err = ESP_ERR_INVALID_CRC;
+    c.end_err = ESP_FAIL;
+    CHECK(ota_engine_chain_end(&chain) == ESP_ERR_INVALID_CRC && strcmp(s_log, "AeBeCe") == 0,
+          "end calls all stages, first error: %s", s_log);
+    s_log[0] = '\0';
+    ota_engine_chain_abort(&chain);
+    CHECK(s_log[0] == '\0', "no abort after end: %s", s_log);
+
+    //A failed begin aborts the stages begun, in reverse order
+    b.begin_err = ESP_ERR_NO_MEM;
+    s_log[0] = '\0';
+    CHECK(ota_engine_chain_begin(&chain) == ESP_ERR_NO_MEM && strcmp(s_log, "AbBbAa") == 0, "failed begin: %s", s_log);
+    b.begin_err = ESP_OK;
+    ota_engine_chain_begin(&chain);
+    s_log[0] = '\0';
+    ota_engine_chain_abort(&chain);
+    CHECK(strcmp(s_log, "CaBaAa") == 0, "abort order: %s", s_log);
+
+    //Output outside of the input is rejected
+    ota_engine_stage_t bad = { .name = "bad", .process = bad_process };
+    ota_engine_chain_add(&chain, &bad);
+    CHECK(ota_engine_chain_process(&chain, buf, sizeof(buf), &out, &out_len) == ESP_ERR_INVALID_SIZE, "bad stage output");
+
+    ota_engine_stage_t empty = { .name = "empty" };
+    while (chain.stage_num < OTA_ENGINE_MAX_STAGES) {
+        ota_engine_chain_add(&chain, &empty);
+    }
+    CHECK(ota_engine_chain_add(&chain, &empty) == ESP_ERR_NO_MEM, "too many stages");
+}
+
+int main(void)
+{
+    test_update();
+    test_no_update();
+    test_errors();
+    test_invalid_events();
+    test_confirm();
+    test_version();
+    test_chain();
+    printf("%s\n", s_failures ? "FAILED" : "OK");
+    return s_failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,867 @@
+/* OTA engine
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "ota_engine.h"
+#ifdef CONFIG_OTA_ENGINE_VALIDATE
+#include "mbedtls/sha256.h"
+#include "image_validator.h"
+#endif
+
+#define APP_DESC_OFFSET     (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t))
+#define APP_DESC_END        (APP_DESC_OFFSET + sizeof(esp_app_desc_t))
+#define BUFFER_SIZE         CONFIG_OTA_ENGINE_BUFFER_SIZE
+
+#ifdef CONFIG_OTA_ENGINE_PIPELINE
+#define INTERNAL_BUFFER_NUM 2
+#define WRITER_TASK_STACK   4096
+#ifdef CONFIG_OTA_ENGINE_PSRAM_BUFFER
+#define PSRAM_CHUNK_SIZE    16384       //Largest TLS record
+#define PSRAM_BUFFER_NUM    (CONFIG_OTA_ENGINE_PSRAM_BUFFER_KB * 1024 / PSRAM_CHUNK_SIZE)
+#define PSRAM_WRITE_SIZE    CONFIG_OTA_ENGINE_PSRAM_WRITE_SIZE
+#define BUFFER_NUM_MAX      PSRAM_BUFFER_NUM
+#else
+#define BUFFER_NUM_MAX      INTERNAL_BUFFER_NUM
+#endif
+
+typedef struct {
+    uint8_t *buf;       //NULL ends the writer task
+    uint8_t *data;      //Data to write, in buf
+    size_t len;
+} chunk_t;
+#else
+#define INTERNAL_BUFFER_NUM 1
+#define BUFFER_NUM_MAX      1
+#endif
+
+struct ota_engine {
+    ota_engine_config_t config;
+    ota_engine_sm_t sm;
+    ota_engine_chain_t chain;
+    esp_http_client_handle_t client;
+    int http_status;
+    size_t content_length;      //Of the response to the check, 0 if unknown
+    size_t received;            //Bytes of the response read, where a resumed download starts
+    const esp_partition_t *partition;
+    esp_ota_handle_t ota_handle;
+    bool ota_begun;
+    uint8_t *buffers[BUFFER_NUM_MAX];
+    int buffer_num;
+    size_t buffer_size;
+    size_t buffer_internal;     //Bytes of internal RAM held by the buffers
+    size_t buffer_external;     //Bytes of PSRAM held by the buffers
+#ifdef CONFIG_OTA_ENGINE_PSRAM_BUFFER
+    uint8_t *bounce;            //Internal copy of the data in PSRAM for esp_ota_write(), NULL without PSRAM
+#endif
+    size_t pending_len;         //Data read by the check at the start of buffers[0], not written yet
+    size_t queued;              //Bytes handed to write_chunk(), directly or through the writer task
+    size_t written;             //Bytes written by write_chunk()
+    int64_t time_start;
+    ota_engine_stats_t stats;
+#ifdef CONFIG_OTA_ENGINE_VALIDATE
+    image_validator_t validator;
+    mbedtls_sha256_context sha;
+    bool sha_started;
+#endif
+#ifdef CONFIG_OTA_ENGINE_PIPELINE
+    QueueHandle_t free_queue;   //Buffers the reader may fill
+    QueueHandle_t full_queue;   //Chunks for the writer task
+    SemaphoreHandle_t writer_done;
+    volatile esp_err_t write_err;
+    bool writer_running;
+#endif
+    int writer_core;
+};
+
+static const char *TAG = "ota_engine";
+
+static esp_err_t write_chunk(ota_engine_handle_t h, const uint8_t *data, size_t len)
+{
+    esp_err_t err = ota_engine_chain_before_write(&h->chain, h->written, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    int64_t time_start = esp_timer_get_time();
+    err = esp_ota_write(h->ota_handle, data, len);
+    int64_t time_end = esp_timer_get_time();
+    h->stats.time_write += time_end - time_start;
+    if (h->written == 0) {
+        h->stats.time_first_write = time_end - h->time_start;
+    }
+    h->written += len;
+    return err;
+}
+
+//The low watermark of the heap, unlike its free size after a read, includes the
+//peaks of TLS and Wi-Fi while esp_http_client_read() runs
+static void sample_heap(ota_engine_handle_t h)
+{
+    h->stats.heap_internal_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+}
+
+#ifdef CONFIG_OTA_ENGINE_PIPELINE
+//spi_flash_write() copies data outside internal RAM 32 bytes at a time,
+//disabling the cache for each, so chunks in PSRAM go through the bounce buffer
+static esp_err_t write_buffer(ota_engine_handle_t h, const uint8_t *data, size_t len)
+{
+#ifdef CONFIG_OTA_ENGINE_PSRAM_BUFFER
+    if (h->bounce != NULL) {
+        esp_err_t err = ESP_OK;
+        for (size_t offset = 0; offset < len && err == ESP_OK; offset += PSRAM_WRITE_SIZE) {
+            size_t piece = (len - offset < PSRAM_WRITE_SIZE) ? len - offset : PSRAM_WRITE_SIZE;
+            memcpy(h->bounce, data + offset, piece);
+            err = write_chunk(h, h->bounce, piece);
+        }
+        return err;
+    }
+#endif
+    return write_chunk(h, data, len);
+}
+
+//Writes the chunks to flash while the caller of ota_engine_perform() receives the next one
+static void writer_task(void *arg)
+{
+    ota_engine_handle_t h = arg;
+    chunk_t chunk;
+    while (xQueueReceive(h->full_queue, &chunk, portMAX_DELAY) == pdTRUE && chunk.buf != NULL) {
+        //After an error, only return the buffers until the reader notices
+        if (h->write_err == ESP_OK) {
+            h->write_err = write_buffer(h, chunk.data, chunk.len);
+        }
+        xQueueSend(h->free_queue, &chunk.buf, portMAX_DELAY);
+    }
+    xSemaphoreGive(h->writer_done);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t start_writer(ota_engine_handle_t h)
+{
+    h->free_queue = xQueueCreate(h->buffer_num, sizeof(uint8_t *));
+    h->full_queue = xQueueCreate(h->buffer_num, sizeof(chunk_t));
+    h->writer_done = xSemaphoreCreateBinary();
+    if (h->free_queue == NULL || h->full_queue == NULL || h->writer_done == NULL) {
+        goto fail;
+    }
+    //buffers[0] holds the data of the check
+    for (int i = 1; i < h->buffer_num; i++) {
+        xQueueSend(h->free_queue, &h->buffers[i], 0);
+    }
+    h->write_err = ESP_OK;
+    if (xTaskCreatePinnedToCore(writer_task, OTA_ENGINE_WRITER_TASK_NAME, WRITER_TASK_STACK, h, uxTaskPriorityGet(NULL),
+                                NULL, h->writer_core) != pdPASS) {
+        goto fail;
+    }
+    h->writer_running = true;
+    return ESP_OK;
+
+fail:
+    if (h->free_queue != NULL) {
+        vQueueDelete(h->free_queue);
+    }
+    if (h->full_queue != NULL) {
+        vQueueDelete(h->full_queue);
+    }
+    if (h->writer_done != NULL) {
+        vSemaphoreDelete(h->writer_done);
+    }
+    h->free_queue = NULL;
+    h->full_queue = NULL;
+    h->writer_done = NULL;
+    return ESP_ERR_NO_MEM;
+}
+
+//Waits until the chunks queued are written
+static void stop_writer(ota_engine_handle_t h)
+{
+    if (!h->writer_running) {
+        return;
+    }
+    chunk_t end = { 0 };
+    xQueueSend(h->full_queue, &end, portMAX_DELAY);
+    xSemaphoreTake(h->writer_done, portMAX_DELAY);
+    vQueueDelete(h->free_queue);
+    vQueueDelete(h->full_queue);
+    vSemaphoreDelete(h->writer_done);
+    h->free_queue = NULL;
+    h->full_queue = NULL;
+    h->writer_done = NULL;
+    h->writer_running = false;
+}
+
+static uint8_t *get_buffer(ota_engine_handle_t h)
+{
+    uint8_t *buf;
+    xQueueReceive(h->free_queue, &buf, portMAX_DELAY);
+    return buf;
+}
+
+static void put_buffer(ota_engine_handle_t h, uint8_t *buf)
+{
+    xQueueSend(h->free_queue, &buf, portMAX_DELAY);
+}
+
+static esp_err_t submit(ota_engine_handle_t h, uint8_t *buf, uint8_t *data, size_t len)
+{
+    chunk_t chunk = {
+        .buf = buf,
+        .data = data,
+        .len = len,
+    };
+    xQueueSend(h->full_queue, &chunk, portMAX_DELAY);
+    return h->write_err;
+}
+
+static esp_err_t finish_writes(ota_engine_handle_t h)
+{
+    stop_writer(h);
+    return h->write_err;
+}
+#else
+static esp_err_t start_writer(ota_engine_handle_t h)
+{
+    return ESP_OK;
+}
+
+static void stop_writer(ota_engine_handle_t h)
+{
+}
+
+static uint8_t *get_buffer(ota_engine_handle_t h)
+{
+    return h->buffers[0];
+}
+
+static void put_buffer(ota_engine_handle_t h, uint8_t *buf)
+{
+}
+
+static esp_err_t submit(ota_engine_handle_t h, uint8_t *buf, uint8_t *data, size_t len)
+{
+    return write_chunk(h, data, len);
+}
+
+static esp_err_t finish_writes(ota_engine_handle_t h)
+{
+    return ESP_OK;
+}
+#endif
+
+#ifdef CONFIG_OTA_ENGINE_VALIDATE
+static void sha_update(void *ctx, const uint8_t *data, size_t len)
+{
+    mbedtls_sha256_update_ret(ctx, data, len);
+}
+
+static void sha_finish(void *ctx, uint8_t *digest)
+{
+    mbedtls_sha256_finish_ret(ctx, digest);
+}
+
+static void validate_begin(ota_engine_handle_t h)
+{
+    mbedtls_sha256_init(&h->sha);
+    mbedtls_sha256_starts_ret(&h->sha, 0);
+    h->sha_started = true;
+    const image_validator_hash_t hash = {
+        .ctx = &h->sha,
+        .update = sha_update,
+        .finish = sha_finish,
+    };
+    image_validator_init(&h->validator, &hash, image_validator_esp32_regions, image_validator_esp32_region_num,
+                         h->partition->size);
+}
+
+//Checks the image as it is received, so a bad one fails before it is all downloaded and written
+static esp_err_t validate(ota_engine_handle_t h, const uint8_t *data, size_t len)
+{
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = image_validator_feed(&h->validator, data, len);
+    h->stats.time_validate += esp_timer_get_time() - time_start;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid image at offset %u (0x%x)", (unsigned)image_validator_image_len(&h->validator), err);
+    }
+    return err;
+}
+
+static void validate_end(ota_engine_handle_t h)
+{
+    if (h->sha_started) {
+        //Releases the SHA engine
+        mbedtls_sha256_free(&h->sha);
+        h->sha_started = false;
+    }
+}
+
+static esp_err_t validate_finish(ota_engine_handle_t h)
+{
+    validate_end(h);
+    esp_err_t err = image_validator_finish(&h->validator);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Image incomplete after %u bytes (0x%x)", (unsigned)image_validator_image_len(&h->validator), err);
+    }
+    return err;
+}
+#else
+static void validate_begin(ota_engine_handle_t h)
+{
+}
+
+static esp_err_t validate(ota_engine_handle_t h, const uint8_t *data, size_t len)
+{
+    return ESP_OK;
+}
+
+static void validate_end(ota_engine_handle_t h)
+{
+}
+
+static esp_err_t validate_finish(ota_engine_handle_t h)
+{
+    return ESP_OK;
+}
+#endif
+
+//Releases everything held for an update in progress
+static void cleanup(ota_engine_handle_t h)
+{
+    stop_writer(h);
+    validate_end(h);
+    ota_engine_chain_abort(&h->chain);
+    if (h->ota_begun) {
+        //This release of app_update has no esp_ota_abort(), esp_ota_end() frees the handle
+        esp_ota_end(h->ota_handle);
+        h->ota_begun = false;
+    }
+    if (h->client != NULL) {
+        esp_http_client_close(h->client);
+        esp_http_client_cleanup(h->client);
+        h->client = NULL;
+    }
+    h->pending_len = 0;
+}
+
+static esp_err_t fail(ota_engine_handle_t h, esp_err_t err)
+{
+    ESP_LOGE(TAG, "%s failed (%s)", ota_engine_state_name(h->sm.state), esp_err_to_name(err));
+    cleanup(h);
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_ERROR, err);
+    return err;
+}
+
+static int read_timed(ota_engine_handle_t h, uint8_t *buf, size_t len)
+{
+    int64_t time_start = esp_timer_get_time();
+    int data_read = esp_http_client_read(h->client, (char *)buf, len);
+    h->stats.time_http += esp_timer_get_time() - time_start;
+    if (data_read > 0) {
+        h->received += data_read;
+    }
+    return data_read;
+}
+
+static esp_err_t process_timed(ota_engine_handle_t h, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    int64_t time_start = esp_timer_get_time();
+    esp_err_t err = ota_engine_chain_process(&h->chain, buf, len, out, out_len);
+    h->stats.time_process += esp_timer_get_time() - time_start;
+    return err;
+}
+
+static void free_buffers(ota_engine_handle_t h)
+{
+    for (int i = 0; i < BUFFER_NUM_MAX; i++) {
+        free(h->buffers[i]);
+        h->buffers[i] = NULL;
+    }
+#ifdef CONFIG_OTA_ENGINE_PSRAM_BUFFER
+    free(h->bounce);
+    h->bounce = NULL;
+#endif
+}
+
+#ifdef CONFIG_OTA_ENGINE_PSRAM_BUFFER
+static bool alloc_psram_buffers(ota_engine_handle_t h)
+{
+    h->bounce = heap_caps_malloc(PSRAM_WRITE_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (h->bounce == NULL) {
+        return false;
+    }
+    for (int i = 0; i < PSRAM_BUFFER_NUM; i++) {
+        h->buffers[i] = heap_caps_malloc(PSRAM_CHUNK_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (h->buffers[i] == NULL) {
+            free_buffers(h);
+            return false;
+        }
+    }
+    h->buffer_num = PSRAM_BUFFER_NUM;
+    h->buffer_size = PSRAM_CHUNK_SIZE;
+    h->buffer_internal = PSRAM_WRITE_SIZE;
+    h->buffer_external = PSRAM_BUFFER_NUM * PSRAM_CHUNK_SIZE;
+    return true;
+}
+#endif
+
+static esp_err_t alloc_buffers(ota_engine_handle_t h)
+{
+#ifdef CONFIG_OTA_ENGINE_PSRAM_BUFFER
+    if (alloc_psram_buffers(h)) {
+        return ESP_OK;
+    }
+    //PSRAM absent at boot, not added to the heap, or too small
+    ESP_LOGW(TAG, "No %d KiB of PSRAM for the download, buffering in internal RAM", CONFIG_OTA_ENGINE_PSRAM_BUFFER_KB);
+#endif
+    for (int i = 0; i < INTERNAL_BUFFER_NUM; i++) {
+        h->buffers[i] = malloc(BUFFER_SIZE);
+        if (h->buffers[i] == NULL) {
+            free_buffers(h);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    h->buffer_num = INTERNAL_BUFFER_NUM;
+    h->buffer_size = BUFFER_SIZE;
+    h->buffer_internal = INTERNAL_BUFFER_NUM * BUFFER_SIZE;
+    h->buffer_external = 0;
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_init(const ota_engine_config_t *config, ota_engine_handle_t *out_handle)
+{
+    if (config == NULL || config->http_config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ota_engine_handle_t h = calloc(1, sizeof(struct ota_engine));
+    if (h == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (alloc_buffers(h) != ESP_OK) {
+        free(h);
+        return ESP_ERR_NO_MEM;
+    }
+    h->config = *config;
+    h->writer_core = tskNO_AFFINITY;
+
+    esp_ota_img_states_t ota_state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &ota_state) == ESP_OK
+            && ota_state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_PENDING_VERIFY, ESP_OK);
+    }
+    *out_handle = h;
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_add_stage(ota_engine_handle_t h, const ota_engine_stage_t *stage)
+{
+    if (h->sm.state != OTA_ENGINE_STATE_IDLE && h->sm.state != OTA_ENGINE_STATE_CONFIRM) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ota_engine_chain_add(&h->chain, stage);
+}
+
+esp_err_t ota_engine_set_writer_core(ota_engine_handle_t h, int core_id)
+{
+    if (core_id != tskNO_AFFINITY && (core_id < 0 || core_id >= portNUM_PROCESSORS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    h->writer_core = core_id;
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_confirm(ota_engine_handle_t h, bool healthy)
+{
+    if (h->sm.state != OTA_ENGINE_STATE_CONFIRM) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!healthy) {
+        ESP_LOGE(TAG, "Diagnostics failed, rolling back to the previous version");
+        //Restarts on success
+        return fail(h, esp_ota_mark_app_invalid_rollback_and_reboot());
+    }
+    esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_CONFIRMED, ESP_OK);
+    return ESP_OK;
+}
+
+static esp_err_t check_app_desc(ota_engine_handle_t h, const esp_app_desc_t *new_app_info)
+{
+    const esp_app_desc_t *running_app_info = esp_ota_get_app_description();
+    ESP_LOGI(TAG, "New firmware version: %s", new_app_info->version);
+    ESP_LOGI(TAG, "Running firmware version: %s", running_app_info->version);
+
+    esp_app_desc_t invalid_app_info;
+    const esp_partition_t *last_invalid_app = esp_ota_get_last_invalid_partition();
+    bool has_invalid = last_invalid_app != NULL
+                       && esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK;
+    switch (ota_engine_check_version(new_app_info->version, running_app_info->version,
+                                     has_invalid ? invalid_app_info.version : NULL, sizeof(new_app_info->version))) {
+    case OTA_ENGINE_VERSION_SAME:
+        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
+        return ESP_ERR_OTA_ENGINE_UP_TO_DATE;
+    case OTA_ENGINE_VERSION_REJECTED:
+        ESP_LOGW(TAG, "New version is the same as invalid version.");
+        ESP_LOGW(TAG, "Previously, there was an attempt to launch the firmware with %s version, but it failed.", invalid_app_info.version);
+        return ESP_ERR_OTA_ENGINE_REJECTED;
+    default:
+        return ESP_OK;
+    }
+}
+
+esp_err_t ota_engine_check(ota_engine_handle_t h, esp_app_desc_t *new_app_info)
+{
+    if (h->sm.state == OTA_ENGINE_STATE_IDLE) {
+        ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_START, ESP_OK);
+        memset(&h->stats, 0, sizeof(h->stats));
+        h->queued = 0;
+        h->written = 0;
+        h->received = 0;
+        h->time_start = esp_timer_get_time();
+        sample_heap(h);
+        h->stats.heap_internal_min_free_before = h->stats.heap_internal_min_free;
+    } else if (h->sm.state != OTA_ENGINE_STATE_CHECK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    h->http_status = 0;
+    if (h->client == NULL) {
+        h->client = esp_http_client_init(h->config.http_config);
+        if (h->client == NULL) {
+            return fail(h, ESP_FAIL);
+        }
+    }
+    esp_err_t err = esp_http_client_open(h->client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(h->client);
+        h->http_status = esp_http_client_get_status_code(h->client);
+    }
+    if (err != ESP_OK || h->http_status == 429 || h->http_status >= 500) {
+        ESP_LOGW(TAG, "Server not available (%s, status %d)", esp_err_to_name(err), h->http_status);
+        esp_http_client_close(h->client);
+        ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_RETRY, ESP_OK);
+        return ESP_ERR_OTA_ENGINE_BUSY;
+    }
+    if (h->http_status != 200) {
+        ESP_LOGE(TAG, "HTTP status %d", h->http_status);
+        return fail(h, ESP_ERR_OTA_ENGINE_HTTP);
+    }
+    int length = esp_http_client_get_content_length(h->client);
+    h->content_length = length > 0 ? length : 0;
+    err = ota_engine_chain_begin(&h->chain);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+
+    //Stages may consume data without output (headers), so read until the
+    //app description is complete in the buffer
+    uint8_t *buf = h->buffers[0];
+    size_t filled = 0;
+    while (filled < APP_DESC_END) {
+        int data_read = read_timed(h, buf + filled, h->buffer_size - filled);
+        if (data_read <= 0) {
+            return fail(h, data_read < 0 ? ESP_FAIL : ESP_ERR_INVALID_SIZE);
+        }
+        uint8_t *out;
+        size_t out_len;
+        err = process_timed(h, buf + filled, data_read, &out, &out_len);
+        if (err != ESP_OK) {
+            return fail(h, err);
+        }
+        memmove(buf + filled, out, out_len);
+        filled += out_len;
+    }
+
+    esp_app_desc_t app_info;
+    memcpy(&app_info, buf + APP_DESC_OFFSET, sizeof(app_info));
+    if (app_info.magic_word != ESP_APP_DESC_MAGIC_WORD) {
+        ESP_LOGE(TAG, "No app description in the image");
+        return fail(h, ESP_ERR_OTA_VALIDATE_FAILED);
+    }
+    if (new_app_info != NULL) {
+        *new_app_info = app_info;
+    }
+    err = check_app_desc(h, &app_info);
+    if (err != ESP_OK) {
+        cleanup(h);
+        ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_NO_UPDATE, ESP_OK);
+        return err;
+    }
+
+    h->partition = esp_ota_get_next_update_partition(NULL);
+    if (h->partition == NULL) {
+        return fail(h, ESP_ERR_NOT_FOUND);
+    }
+    //Headers are checked before esp_ota_begin() erases anything
+    validate_begin(h);
+    err = validate(h, buf, filled);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x", h->partition->subtype, h->partition->address);
+    err = esp_ota_begin(h->partition, h->config.erase_on_demand ? 1 : OTA_SIZE_UNKNOWN, &h->ota_handle);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    h->ota_begun = true;
+    err = start_writer(h);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    h->pending_len = filled;
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_NEW_VERSION, ESP_OK);
+    return ESP_OK;
+}
+
+//Keeps everything but the connection, ota_engine_perform() reconnects
+static esp_err_t pause(ota_engine_handle_t h)
+{
+    ESP_LOGW(TAG, "Connection lost after %u bytes, pausing", (unsigned)h->received);
+    esp_http_client_close(h->client);
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_INTERRUPTED, ESP_OK);
+    return ESP_ERR_OTA_ENGINE_PAUSED;
+}
+
+//Requests the rest of the image. A server ignoring the range sends all of
+//it, the part already received is then read again and dropped.
+static esp_err_t resume(ota_engine_handle_t h)
+{
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%u-", (unsigned)h->received);
+    esp_http_client_set_header(h->client, "Range", range);
+    h->http_status = 0;
+    esp_err_t err = esp_http_client_open(h->client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(h->client);
+        h->http_status = esp_http_client_get_status_code(h->client);
+    }
+    esp_http_client_delete_header(h->client, "Range");
+    if (err != ESP_OK || h->http_status == 429 || h->http_status >= 500) {
+        esp_http_client_close(h->client);
+        return ESP_ERR_OTA_ENGINE_PAUSED;
+    }
+    if (h->http_status == 200) {
+        uint8_t *buf = get_buffer(h);
+        size_t skipped = 0;
+        while (skipped < h->received) {
+            size_t len = h->received - skipped < h->buffer_size ? h->received - skipped : h->buffer_size;
+            int data_read = esp_http_client_read(h->client, (char *)buf, len);
+            if (data_read <= 0) {
+                put_buffer(h, buf);
+                esp_http_client_close(h->client);
+                return ESP_ERR_OTA_ENGINE_PAUSED;
+            }
+            skipped += data_read;
+        }
+        put_buffer(h, buf);
+    } else if (h->http_status != 206) {
+        ESP_LOGE(TAG, "HTTP status %d", h->http_status);
+        return fail(h, ESP_ERR_OTA_ENGINE_HTTP);
+    }
+    ESP_LOGI(TAG, "Resuming at %u bytes (status %d)", (unsigned)h->received, h->http_status);
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_RESUMED, ESP_OK);
+    return ESP_ERR_OTA_ENGINE_IN_PROGRESS;
+}
+
+esp_err_t ota_engine_perform(ota_engine_handle_t h)
+{
+    if (h->sm.state == OTA_ENGINE_STATE_PAUSED) {
+        return resume(h);
+    }
+    if (h->sm.state != OTA_ENGINE_STATE_DOWNLOAD) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err;
+    if (h->pending_len > 0) {
+        size_t len = h->pending_len;
+        h->pending_len = 0;
+        err = submit(h, h->buffers[0], h->buffers[0], len);
+        if (err != ESP_OK) {
+            return fail(h, err);
+        }
+        h->queued += len;
+        ota_engine_chain_progress(&h->chain, h->queued, h->content_length, 0);
+        return ESP_ERR_OTA_ENGINE_IN_PROGRESS;
+    }
+
+    int64_t time_start = esp_timer_get_time();
+    uint8_t *buf = get_buffer(h);
+    int data_read = read_timed(h, buf, h->buffer_size);
+    sample_heap(h);
+    if (data_read < 0) {
+        ESP_LOGE(TAG, "Error: SSL data read error");
+        put_buffer(h, buf);
+        return pause(h);
+    }
+    if (data_read == 0) {
+        put_buffer(h, buf);
+        if (!esp_http_client_is_complete_data_received(h->client)) {
+            ESP_LOGE(TAG, "Connection closed before the end of the image");
+            return pause(h);
+        }
+        err = finish_writes(h);
+        if (err != ESP_OK) {
+            return fail(h, err);
+        }
+        esp_http_client_close(h->client);
+        esp_http_client_cleanup(h->client);
+        h->client = NULL;
+        h->stats.time_total = esp_timer_get_time() - h->time_start;
+        h->stats.image_len = h->written;
+        ESP_LOGI(TAG, "Total Write binary data length : %u", (unsigned)h->written);
+        ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_DOWNLOADED, ESP_OK);
+        return ESP_OK;
+    }
+
+    uint8_t *out;
+    size_t out_len;
+    err = process_timed(h, buf, data_read, &out, &out_len);
+    if (err == ESP_OK && out_len > 0) {
+        err = validate(h, out, out_len);
+    }
+    if (err == ESP_OK && out_len > 0) {
+        err = submit(h, buf, out, out_len);
+        h->queued += out_len;
+    } else {
+        put_buffer(h, buf);
+    }
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    ota_engine_chain_progress(&h->chain, h->queued, h->content_length, esp_timer_get_time() - time_start);
+    return ESP_ERR_OTA_ENGINE_IN_PROGRESS;
+}
+
+esp_err_t ota_engine_verify(ota_engine_handle_t h)
+{
+    if (h->sm.state != OTA_ENGINE_STATE_VERIFY) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    //The partition holds unchecked data until here, it must not become bootable before
+    esp_err_t err = validate_finish(h);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    err = ota_engine_chain_end(&h->chain);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    h->ota_begun = false;
+    err = esp_ota_end(h->ota_handle);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_VERIFIED, ESP_OK);
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_activate(ota_engine_handle_t h)
+{
+    if (h->sm.state != OTA_ENGINE_STATE_ACTIVATE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = esp_ota_set_boot_partition(h->partition);
+    if (err != ESP_OK) {
+        return fail(h, err);
+    }
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_ACTIVATED, ESP_OK);
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_run(ota_engine_handle_t h)
+{
+    esp_err_t err;
+    if (h->sm.state == OTA_ENGINE_STATE_IDLE || h->sm.state == OTA_ENGINE_STATE_CHECK) {
+        err = ota_engine_check(h, NULL);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    while ((err = ota_engine_perform(h)) == ESP_ERR_OTA_ENGINE_IN_PROGRESS) {
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = ota_engine_verify(h);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return ota_engine_activate(h);
+}
+
+ota_engine_state_t ota_engine_get_state(ota_engine_handle_t h)
+{
+    return h->sm.state;
+}
+
+esp_err_t ota_engine_get_error(ota_engine_handle_t h)
+{
+    return h->sm.state == OTA_ENGINE_STATE_FAILED ? h->sm.error : ESP_OK;
+}
+
+int ota_engine_get_http_status(ota_engine_handle_t h)
+{
+    return h->http_status;
+}
+
+void ota_engine_get_stats(ota_engine_handle_t h, ota_engine_stats_t *stats)
+{
+    *stats = h->stats;
+    stats->buffer_internal = h->buffer_internal;
+    stats->buffer_external = h->buffer_external;
+    if (h->sm.state == OTA_ENGINE_STATE_DOWNLOAD || h->sm.state == OTA_ENGINE_STATE_PAUSED) {
+        stats->image_len = h->queued;
+    }
+}
+
+esp_err_t ota_engine_get_image_sha256(ota_engine_handle_t h, uint8_t *sha256)
+{
+#ifdef CONFIG_OTA_ENGINE_VALIDATE
+    if (h->sm.state != OTA_ENGINE_STATE_ACTIVATE && h->sm.state != OTA_ENGINE_STATE_ACTIVATED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const uint8_t *digest = image_validator_digest(&h->validator);
+    if (digest == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(sha256, digest, IMAGE_VALIDATOR_HASH_LEN);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void ota_engine_reset(ota_engine_handle_t h)
+{
+    if (h->sm.state == OTA_ENGINE_STATE_IDLE || h->sm.state == OTA_ENGINE_STATE_CONFIRM) {
+        return;
+    }
+    cleanup(h);
+    if (!ota_engine_sm_is_final(&h->sm)) {
+        ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_ERROR, ESP_ERR_INVALID_STATE);
+    }
+    ota_engine_sm_dispatch(&h->sm, OTA_ENGINE_EVENT_RESET, ESP_OK);
+}
+
+void ota_engine_deinit(ota_engine_handle_t h)
+{
+    cleanup(h);
+    free_buffers(h);
+    free(h);
+}
\ No newline at end of file
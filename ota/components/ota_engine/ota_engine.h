@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "esp_app_format.h"
+#include "ota_engine_core.h"
+
+#define OTA_ENGINE_WRITER_TASK_NAME "ota_writer"     //Writes to flash with CONFIG_OTA_ENGINE_PIPELINE
+
+typedef struct ota_engine *ota_engine_handle_t;
+
+typedef struct {
+    const esp_http_client_config_t *http_config;   //Image URL, certificate and event handler
+    bool erase_on_demand;       //Let esp_ota_begin() erase one sector only, a stage erases before each write
+} ota_engine_config_t;
+
+typedef struct {
+    int64_t time_total;         //From the start of the check to the end of the download
+    int64_t time_http;          //In esp_http_client_read()
+    int64_t time_process;       //In process() of the stages
+    int64_t time_write;         //In esp_ota_write(), in the writer task with CONFIG_OTA_ENGINE_PIPELINE
+    int64_t time_validate;      //Checking the image while it is received, with CONFIG_OTA_ENGINE_VALIDATE
+    int64_t time_first_write;   //From the start of the check to the first write
+    size_t image_len;           //Bytes written to the update partition, so far while downloading
+    size_t buffer_internal;     //Internal RAM held by the receive buffers
+    size_t buffer_external;     //PSRAM held by the receive buffers, with CONFIG_OTA_ENGINE_PSRAM_BUFFER
+    size_t heap_internal_min_free;  //Lowest free internal heap since boot, at the last chunk received
+    size_t heap_internal_min_free_before;   //The same at the start of the check, equal if the update did not go lower
+} ota_engine_stats_t;
+
+/**
+ * @brief   Create an engine.
+ *
+ * If the running app has not been confirmed yet (rollback enabled, first boot
+ * after an update), the engine starts in OTA_ENGINE_STATE_CONFIRM and only
+ * accepts ota_engine_confirm().
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   No HTTP configuration
+ *  - ESP_ERR_NO_MEM        Insufficient memory
+ */
+esp_err_t ota_engine_init(const ota_engine_config_t *config, ota_engine_handle_t *out_handle);
+
+/**
+ * @brief   Add a stage to the data path, before the first check.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        OTA_ENGINE_MAX_STAGES reached
+ *  - ESP_ERR_INVALID_STATE Not idle
+ */
+esp_err_t ota_engine_add_stage(ota_engine_handle_t handle, const ota_engine_stage_t *stage);
+
+/**
+ * @brief   Pin the flash writer task of CONFIG_OTA_ENGINE_PIPELINE to a core,
+ *          from the next check on.
+ *
+ * @param   core_id     Core of the writer task, tskNO_AFFINITY (the default) for any
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   No such core
+ */
+esp_err_t ota_engine_set_writer_core(ota_engine_handle_t handle, int core_id);
+
+/**
+ * @brief   Confirm or reject the running app after the diagnostics of its first boot.
+ *
+ * A rejected app is marked invalid and the device restarts into the previous one.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE Not in OTA_ENGINE_STATE_CONFIRM
+ */
+esp_err_t ota_engine_confirm(ota_engine_handle_t handle, bool healthy);
+
+/**
+ * @brief   Connect to the server and read the app description of the image.
+ *
+ * The data read is kept and written by the first ota_engine_perform().
+ *
+ * @param   new_app_info    Receives the description of the new app, may be NULL
+ *
+ * @return
+ *  - ESP_OK                        A new version, ready for ota_engine_perform()
+ *  - ESP_ERR_OTA_ENGINE_UP_TO_DATE The server offers the running version
+ *  - ESP_ERR_OTA_ENGINE_REJECTED   The server offers the version which was rolled back last
+ *  - ESP_ERR_OTA_ENGINE_BUSY       No connection or server busy, call again after a delay (see ota_engine_get_http_status())
+ *  - ESP_ERR_OTA_ENGINE_HTTP       Unexpected HTTP status
+ *  - ESP_ERR_INVALID_STATE         Not idle
+ *  - other                         Error of the HTTP client, the stages or esp_ota_begin()
+ */
+esp_err_t ota_engine_check(ota_engine_handle_t handle, esp_app_desc_t *new_app_info);
+
+/**
+ * @brief   Read, process and write the next chunk of the image.
+ *
+ * When the connection is lost the engine pauses instead of failing. The next
+ * call reconnects and requests the rest of the image with a Range header; it
+ * keeps returning ESP_ERR_OTA_ENGINE_PAUSED until the server answers, so wait
+ * for the network to come back in between, or give up with ota_engine_reset().
+ *
+ * @return
+ *  - ESP_ERR_OTA_ENGINE_IN_PROGRESS    Call again
+ *  - ESP_ERR_OTA_ENGINE_PAUSED         Connection lost, call again once connected
+ *  - ESP_OK                            Whole image written
+ *  - ESP_ERR_INVALID_STATE             Not downloading
+ *  - other                             Failed, see ota_engine_get_error()
+ */
+esp_err_t ota_engine_perform(ota_engine_handle_t handle);
+
+/**
+ * @brief   Let the stages check the image, then esp_ota_end() validate it.
+ *
+ * With CONFIG_OTA_ENGINE_VALIDATE the image was checked while it was received
+ * and is rejected here only if it ended early.
+ */
+esp_err_t ota_engine_verify(ota_engine_handle_t handle);
+
+/**
+ * @brief   Make the update partition the boot partition. Restarting is left to the caller.
+ */
+esp_err_t ota_engine_activate(ota_engine_handle_t handle);
+
+/**
+ * @brief   Check, download, verify and activate in one call.
+ *
+ * After ESP_ERR_OTA_ENGINE_BUSY or ESP_ERR_OTA_ENGINE_PAUSED, calling it again
+ * continues where it stopped.
+ *
+ * @return  As ota_engine_check(), or the first error of the following steps
+ */
+esp_err_t ota_engine_run(ota_engine_handle_t handle);
+
+ota_engine_state_t ota_engine_get_state(ota_engine_handle_t handle);
+
+/**
+ * @brief   Error which made the engine fail, ESP_OK if it did not.
+ */
+esp_err_t ota_engine_get_error(ota_engine_handle_t handle);
+
+/**
+ * @brief   HTTP status of the last check, 0 if the server could not be reached.
+ */
+int ota_engine_get_http_status(ota_engine_handle_t handle);
+
+void ota_engine_get_stats(ota_engine_handle_t handle, ota_engine_stats_t *stats);
+
+/**
+ * @brief   SHA-256 appended to the image, as checked while it was received.
+ *
+ * @param   sha256  Receives 32 bytes
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NOT_FOUND     The image has no appended hash
+ *  - ESP_ERR_INVALID_STATE The image is not verified yet
+ *  - ESP_ERR_NOT_SUPPORTED CONFIG_OTA_ENGINE_VALIDATE is disabled
+ */
+esp_err_t ota_engine_get_image_sha256(ota_engine_handle_t handle, uint8_t *sha256);
+
+/**
+ * @brief   Give up any update in progress and back to idle, to check again later.
+ */
+void ota_engine_reset(ota_engine_handle_t handle);
+
+/**
+ * @brief   Give up any update in progress and free the engine.
+ */
+void ota_engine_deinit(ota_engine_handle_t handle);
\ No newline at end of file
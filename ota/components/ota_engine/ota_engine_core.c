@@ -0,0 +1,208 @@
+/* OTA engine: state machine and stage chain
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "ota_engine_core.h"
+
+//Entries hold the next state + 1, so that events left out (0) are not allowed.
+//OTA_ENGINE_EVENT_ERROR is handled separately.
+#define TO(state)   ((state) + 1)
+
+static const uint8_t s_transitions[OTA_ENGINE_STATE_MAX][OTA_ENGINE_EVENT_MAX] = {
+    [OTA_ENGINE_STATE_IDLE] = {
+        [OTA_ENGINE_EVENT_START] = TO(OTA_ENGINE_STATE_CHECK),
+        [OTA_ENGINE_EVENT_PENDING_VERIFY] = TO(OTA_ENGINE_STATE_CONFIRM),
+    },
+    [OTA_ENGINE_STATE_CONFIRM] = {
+        [OTA_ENGINE_EVENT_CONFIRMED] = TO(OTA_ENGINE_STATE_IDLE),
+    },
+    [OTA_ENGINE_STATE_CHECK] = {
+        [OTA_ENGINE_EVENT_NEW_VERSION] = TO(OTA_ENGINE_STATE_DOWNLOAD),
+        [OTA_ENGINE_EVENT_NO_UPDATE] = TO(OTA_ENGINE_STATE_UP_TO_DATE),
+        [OTA_ENGINE_EVENT_RETRY] = TO(OTA_ENGINE_STATE_CHECK),
+    },
+    [OTA_ENGINE_STATE_DOWNLOAD] = {
+        [OTA_ENGINE_EVENT_DOWNLOADED] = TO(OTA_ENGINE_STATE_VERIFY),
+        [OTA_ENGINE_EVENT_INTERRUPTED] = TO(OTA_ENGINE_STATE_PAUSED),
+    },
+    [OTA_ENGINE_STATE_PAUSED] = {
+        [OTA_ENGINE_EVENT_RESUMED] = TO(OTA_ENGINE_STATE_DOWNLOAD),
+    },
+    [OTA_ENGINE_STATE_VERIFY] = {
+        [OTA_ENGINE_EVENT_VERIFIED] = TO(OTA_ENGINE_STATE_ACTIVATE),
+    },
+    [OTA_ENGINE_STATE_ACTIVATE] = {
+        [OTA_ENGINE_EVENT_ACTIVATED] = TO(OTA_ENGINE_STATE_ACTIVATED),
+    },
+    [OTA_ENGINE_STATE_ACTIVATED] = {
+        [OTA_ENGINE_EVENT_RESET] = TO(OTA_ENGINE_STATE_IDLE),
+    },
+    [OTA_ENGINE_STATE_UP_TO_DATE] = {
+        [OTA_ENGINE_EVENT_RESET] = TO(OTA_ENGINE_STATE_IDLE),
+    },
+    [OTA_ENGINE_STATE_FAILED] = {
+        [OTA_ENGINE_EVENT_RESET] = TO(OTA_ENGINE_STATE_IDLE),
+    },
+};
+
+static const char *s_state_names[OTA_ENGINE_STATE_MAX] = {
+    [OTA_ENGINE_STATE_IDLE] = "idle",
+    [OTA_ENGINE_STATE_CONFIRM] = "confirm",
+    [OTA_ENGINE_STATE_CHECK] = "check",
+    [OTA_ENGINE_STATE_DOWNLOAD] = "download",
+    [OTA_ENGINE_STATE_PAUSED] = "paused",
+    [OTA_ENGINE_STATE_VERIFY] = "verify",
+    [OTA_ENGINE_STATE_ACTIVATE] = "activate",
+    [OTA_ENGINE_STATE_ACTIVATED] = "activated",
+    [OTA_ENGINE_STATE_UP_TO_DATE] = "up to date",
+    [OTA_ENGINE_STATE_FAILED] = "failed",
+};
+
+bool ota_engine_sm_is_final(const ota_engine_sm_t *sm)
+{
+    return sm->state == OTA_ENGINE_STATE_ACTIVATED || sm->state == OTA_ENGINE_STATE_UP_TO_DATE
+           || sm->state == OTA_ENGINE_STATE_FAILED;
+}
+
+esp_err_t ota_engine_sm_dispatch(ota_engine_sm_t *sm, ota_engine_event_t event, esp_err_t err)
+{
+    if (sm->state >= OTA_ENGINE_STATE_MAX || event >= OTA_ENGINE_EVENT_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (event == OTA_ENGINE_EVENT_ERROR) {
+        if (ota_engine_sm_is_final(sm)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        sm->failed_state = sm->state;
+        sm->error = err;
+        sm->state = OTA_ENGINE_STATE_FAILED;
+        return ESP_OK;
+    }
+    if (s_transitions[sm->state][event] == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ota_engine_state_t next = s_transitions[sm->state][event] - 1;
+    if (next == OTA_ENGINE_STATE_IDLE) {
+        sm->error = ESP_OK;
+    }
+    sm->state = next;
+    return ESP_OK;
+}
+
+const char *ota_engine_state_name(ota_engine_state_t state)
+{
+    return state < OTA_ENGINE_STATE_MAX ? s_state_names[state] : "?";
+}
+
+ota_engine_version_t ota_engine_check_version(const char *new_version, const char *running_version,
+                                              const char *invalid_version, size_t len)
+{
+    if (invalid_version != NULL && strncmp(new_version, invalid_version, len) == 0) {
+        return OTA_ENGINE_VERSION_REJECTED;
+    }
+    if (strncmp(new_version, running_version, len) == 0) {
+        return OTA_ENGINE_VERSION_SAME;
+    }
+    return OTA_ENGINE_VERSION_NEW;
+}
+
+esp_err_t ota_engine_chain_add(ota_engine_chain_t *chain, const ota_engine_stage_t *stage)
+{
+    if (chain->stage_num == OTA_ENGINE_MAX_STAGES) {
+        return ESP_ERR_NO_MEM;
+    }
+    chain->stages[chain->stage_num++] = *stage;
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_chain_begin(ota_engine_chain_t *chain)
+{
+    chain->begun = 0;
+    for (size_t i = 0; i < chain->stage_num; i++) {
+        const ota_engine_stage_t *stage = &chain->stages[i];
+        esp_err_t err = stage->begin ? stage->begin(stage->ctx) : ESP_OK;
+        if (err != ESP_OK) {
+            ota_engine_chain_abort(chain);
+            return err;
+        }
+        chain->begun = i + 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_chain_process(ota_engine_chain_t *chain, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    for (size_t i = 0; i < chain->stage_num && len > 0; i++) {
+        const ota_engine_stage_t *stage = &chain->stages[i];
+        if (stage->process == NULL) {
+            continue;
+        }
+        uint8_t *stage_out = buf;
+        size_t stage_out_len = len;
+        esp_err_t err = stage->process(stage->ctx, buf, len, &stage_out, &stage_out_len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (stage_out < buf || stage_out + stage_out_len > buf + len) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        buf = stage_out;
+        len = stage_out_len;
+    }
+    *out = buf;
+    *out_len = len;
+    return ESP_OK;
+}
+
+esp_err_t ota_engine_chain_before_write(ota_engine_chain_t *chain, size_t offset, size_t len)
+{
+    for (size_t i = 0; i < chain->stage_num; i++) {
+        const ota_engine_stage_t *stage = &chain->stages[i];
+        esp_err_t err = stage->before_write ? stage->before_write(stage->ctx, offset, len) : ESP_OK;
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+void ota_engine_chain_progress(ota_engine_chain_t *chain, size_t written, size_t total, int64_t chunk_us)
+{
+    for (size_t i = 0; i < chain->stage_num; i++) {
+        const ota_engine_stage_t *stage = &chain->stages[i];
+        if (stage->progress) {
+            stage->progress(stage->ctx, written, total, chunk_us);
+        }
+    }
+}
+
+esp_err_t ota_engine_chain_end(ota_engine_chain_t *chain)
+{
+    esp_err_t ret = ESP_OK;
+    for (size_t i = 0; i < chain->begun; i++) {
+        const ota_engine_stage_t *stage = &chain->stages[i];
+        esp_err_t err = stage->end ? stage->end(stage->ctx) : ESP_OK;
+        if (ret == ESP_OK) {
+            ret = err;
+        }
+    }
+    chain->begun = 0;
+    return ret;
+}
+
+void ota_engine_chain_abort(ota_engine_chain_t *chain)
+{
+    for (size_t i = chain->begun; i > 0; i--) {
+        const ota_engine_stage_t *stage = &chain->stages[i - 1];
+        if (stage->abort) {
+            stage->abort(stage->ctx);
+        }
+    }
+    chain->begun = 0;
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+#pragma once
+
+//Parts of the OTA engine without ESP-IDF dependencies, built on the host by host_test
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define ESP_ERR_OTA_ENGINE_BASE         0x9100
+#define ESP_ERR_OTA_ENGINE_IN_PROGRESS  (ESP_ERR_OTA_ENGINE_BASE + 1)   //Download not finished, call ota_engine_perform() again
+#define ESP_ERR_OTA_ENGINE_BUSY         (ESP_ERR_OTA_ENGINE_BASE + 2)   //No connection, or the server answered 429 or 5xx
+#define ESP_ERR_OTA_ENGINE_HTTP         (ESP_ERR_OTA_ENGINE_BASE + 3)   //Other HTTP status than 200
+#define ESP_ERR_OTA_ENGINE_UP_TO_DATE   (ESP_ERR_OTA_ENGINE_BASE + 4)   //The server offers the running version
+#define ESP_ERR_OTA_ENGINE_REJECTED     (ESP_ERR_OTA_ENGINE_BASE + 5)   //The server offers a version which was rolled back
+#define ESP_ERR_OTA_ENGINE_PAUSED       (ESP_ERR_OTA_ENGINE_BASE + 6)   //Connection lost while downloading, call ota_engine_perform() again to resume
+
+typedef enum {
+    OTA_ENGINE_STATE_IDLE,
+    OTA_ENGINE_STATE_CONFIRM,           //Running a new app not confirmed yet, waiting for the diagnostics
+    OTA_ENGINE_STATE_CHECK,             //Connecting, reading the app description of the new image
+    OTA_ENGINE_STATE_DOWNLOAD,          //Writing the image to the update partition
+    OTA_ENGINE_STATE_PAUSED,            //Connection lost, the download resumes where it stopped
+    OTA_ENGINE_STATE_VERIFY,            //Stages and esp_ota_end() checking the image
+    OTA_ENGINE_STATE_ACTIVATE,          //Image valid, setting the boot partition
+    OTA_ENGINE_STATE_ACTIVATED,         //Boots the new image at the next restart
+    OTA_ENGINE_STATE_UP_TO_DATE,        //Nothing to do
+    OTA_ENGINE_STATE_FAILED,
+    OTA_ENGINE_STATE_MAX,
+} ota_engine_state_t;
+
+typedef enum {
+    OTA_ENGINE_EVENT_START,
+    OTA_ENGINE_EVENT_NEW_VERSION,
+    OTA_ENGINE_EVENT_NO_UPDATE,         //Same or rejected version
+    OTA_ENGINE_EVENT_DOWNLOADED,
+    OTA_ENGINE_EVENT_VERIFIED,
+    OTA_ENGINE_EVENT_ACTIVATED,
+    OTA_ENGINE_EVENT_RETRY,             //Check again after a busy server, from CHECK only
+    OTA_ENGINE_EVENT_PENDING_VERIFY,    //The running app waits for confirmation, from IDLE only
+    OTA_ENGINE_EVENT_CONFIRMED,
+    OTA_ENGINE_EVENT_INTERRUPTED,       //Connection lost, from DOWNLOAD only
+    OTA_ENGINE_EVENT_RESUMED,
+    OTA_ENGINE_EVENT_ERROR,
+    OTA_ENGINE_EVENT_RESET,             //Back to IDLE from a final state
+    OTA_ENGINE_EVENT_MAX,
+} ota_engine_event_t;
+
+typedef struct {
+    ota_engine_state_t state;
+    ota_engine_state_t failed_state;    //State in which the error occurred
+    esp_err_t error;
+} ota_engine_sm_t;
+
+typedef enum {
+    OTA_ENGINE_VERSION_NEW,
+    OTA_ENGINE_VERSION_SAME,            //Same as the running app
+    OTA_ENGINE_VERSION_REJECTED,        //Same as the app which was last rolled back
+} ota_engine_version_t;
+
+/**
+ * Stage of the data path, between the HTTP client and esp_ota_write(). All
+ * callbacks are optional and get ctx. Stages run in the order they were added.
+ */
+typedef struct {
+    const char *name;
+    void *ctx;
+    //Before the first byte of a download
+    esp_err_t (*begin)(void *ctx);
+    //Transform a chunk in place: the output is in buf[0, len) at *out, *out_len may be 0.
+    //*out and *out_len are preset to pass the chunk unchanged.
+    esp_err_t (*process)(void *ctx, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len);
+    //Before len bytes are written at offset of the update partition
+    esp_err_t (*before_write)(void *ctx, size_t offset, size_t len);
+    //After each chunk: bytes written so far, image size if known (else 0) and time spent on the chunk
+    void (*progress)(void *ctx, size_t written, size_t total, int64_t chunk_us);
+    //Download complete, before esp_ota_end(): last chance to reject the image
+    esp_err_t (*end)(void *ctx);
+    //Download given up after begin()
+    void (*abort)(void *ctx);
+} ota_engine_stage_t;
+
+#define OTA_ENGINE_MAX_STAGES   6
+
+typedef struct {
+    ota_engine_stage_t stages[OTA_ENGINE_MAX_STAGES];
+    size_t stage_num;
+    size_t begun;                       //Stages whose begin() succeeded
+} ota_engine_chain_t;
+
+/**
+ * @brief   Apply an event to the state machine.
+ *
+ * OTA_ENGINE_EVENT_ERROR is accepted in every state but the final ones and
+ * records err.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE The event is not allowed in the current state, the state is unchanged
+ */
+esp_err_t ota_engine_sm_dispatch(ota_engine_sm_t *sm, ota_engine_event_t event, esp_err_t err);
+
+/**
+ * @brief   Whether the state machine is done: up to date, activated or failed.
+ */
+bool ota_engine_sm_is_final(const ota_engine_sm_t *sm);
+
+const char *ota_engine_state_name(ota_engine_state_t state);
+
+/**
+ * @brief   Decide whether to install a version.
+ *
+ * @param   invalid_version     Version of the app last rolled back, NULL if none
+ * @param   len                 Size of the version fields
+ */
+ota_engine_version_t ota_engine_check_version(const char *new_version, const char *running_version,
+                                              const char *invalid_version, size_t len);
+
+/**
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        OTA_ENGINE_MAX_STAGES reached
+ */
+esp_err_t ota_engine_chain_add(ota_engine_chain_t *chain, const ota_engine_stage_t *stage);
+
+/**
+ * @brief   Call begin() of all stages. If one fails, the stages begun before are aborted.
+ */
+esp_err_t ota_engine_chain_begin(ota_engine_chain_t *chain);
+
+/**
+ * @brief   Run a chunk through process() of all stages, in place.
+ */
+esp_err_t ota_engine_chain_process(ota_engine_chain_t *chain, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len);
+
+esp_err_t ota_engine_chain_before_write(ota_engine_chain_t *chain, size_t offset, size_t len);
+
+void ota_engine_chain_progress(ota_engine_chain_t *chain, size_t written, size_t total, int64_t chunk_us);
+
+/**
+ * @brief   Call end() of all stages, all of them even after an error.
+ *
+ * @return  First error
+ */
+esp_err_t ota_engine_chain_end(ota_engine_chain_t *chain);
+
+/**
+ * @brief   Call abort() of the stages begun. Does nothing after ota_engine_chain_end().
+ */
+void ota_engine_chain_abort(ota_engine_chain_t *chain);
\ No newline at end of file
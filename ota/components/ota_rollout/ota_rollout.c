@@ -0,0 +1,225 @@
+/* OTA rollout client
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "ota_rollout.h"
+
+#define POLICY_MAX_LEN      1024
+#define DEVICE_ID_LEN       13
+#define RETRY_AFTER_NONE    -1
+
+typedef struct {
+    ota_rollout_target_t target;
+    bool cohort_listed;
+    uint32_t percent;
+    uint32_t window_s;
+    char seed[64];
+} policy_t;
+
+static const char *TAG = "ota_rollout";
+static int s_retry_after_s = RETRY_AFTER_NONE;
+static int s_failures;
+
+esp_err_t ota_rollout_http_event_handler(esp_http_client_event_t *evt)
+{
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, "Retry-After") == 0) {
+        //Only the delay-seconds form, an HTTP date falls back to the backoff
+        char *end;
+        long seconds = strtol(evt->header_value, &end, 10);
+        if (end != evt->header_value && *end == '\0' && seconds >= 0) {
+            s_retry_after_s = seconds;
+        }
+    }
+    return ESP_OK;
+}
+
+void ota_rollout_backoff(int status_code)
+{
+    uint32_t delay_ms;
+    if ((status_code == 429 || status_code == 503) && s_retry_after_s != RETRY_AFTER_NONE) {
+        delay_ms = s_retry_after_s * 1000;
+        if (delay_ms > CONFIG_OTA_ROLLOUT_BACKOFF_MAX_MS) {
+            delay_ms = CONFIG_OTA_ROLLOUT_BACKOFF_MAX_MS;
+        }
+    } else {
+        //Full jitter: uniform in [0, min(max, min * 2^failures)]
+        uint32_t ceiling = CONFIG_OTA_ROLLOUT_BACKOFF_MIN_MS;
+        for (int i = 0; i < s_failures && ceiling < CONFIG_OTA_ROLLOUT_BACKOFF_MAX_MS; i++) {
+            ceiling *= 2;
+        }
+        if (ceiling > CONFIG_OTA_ROLLOUT_BACKOFF_MAX_MS) {
+            ceiling = CONFIG_OTA_ROLLOUT_BACKOFF_MAX_MS;
+        }
+        delay_ms = esp_random() % (ceiling + 1);
+    }
+    s_failures++;
+    s_retry_after_s = RETRY_AFTER_NONE;
+    ESP_LOGW(TAG, "status %d, retrying in %u ms", status_code, delay_ms);
+    vTaskDelay(pdMS_TO_TICKS(delay_ms));
+}
+
+void ota_rollout_backoff_reset(void)
+{
+    s_failures = 0;
+    s_retry_after_s = RETRY_AFTER_NONE;
+}
+
+//FNV-1a, also used by rollout_sim.py, so a server can tell which devices a gate admits
+static uint32_t fnv1a(const char *a, const char *b)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *p = a; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    hash = (hash ^ (uint8_t)':') * 16777619u;
+    for (const char *p = b; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return hash;
+}
+
+static void get_device_id(char *id)
+{
+    uint8_t mac[6];
+    esp_efuse_mac_get_default(mac);
+    snprintf(id, DEVICE_ID_LEN, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static esp_err_t parse_policy(const char *json, policy_t *policy)
+{
+    cJSON *root = cJSON_Parse(json);
+    if (root == NULL) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    esp_err_t err = ESP_ERR_INVALID_RESPONSE;
+    cJSON *version = cJSON_GetObjectItem(root, "version");
+    cJSON *url = cJSON_GetObjectItem(root, "url");
+    if (cJSON_IsString(version) && cJSON_IsString(url)) {
+        strlcpy(policy->target.version, version->valuestring, sizeof(policy->target.version));
+        strlcpy(policy->target.url, url->valuestring, sizeof(policy->target.url));
+
+        cJSON *cohorts = cJSON_GetObjectItem(root, "cohorts");
+        policy->cohort_listed = !cJSON_IsArray(cohorts);
+        for (int i = 0; cJSON_IsArray(cohorts) && i < cJSON_GetArraySize(cohorts); i++) {
+            cJSON *cohort = cJSON_GetArrayItem(cohorts, i);
+            if (cJSON_IsString(cohort) && strcmp(cohort->valuestring, CONFIG_OTA_ROLLOUT_COHORT) == 0) {
+                policy->cohort_listed = true;
+            }
+        }
+        cJSON *percent = cJSON_GetObjectItem(root, "percent");
+        policy->percent = cJSON_IsNumber(percent) ? percent->valueint : 100;
+        cJSON *window_s = cJSON_GetObjectItem(root, "window_s");
+        policy->window_s = cJSON_IsNumber(window_s) && window_s->valueint > 0 ? window_s->valueint : 0;
+        cJSON *seed = cJSON_GetObjectItem(root, "seed");
+        strlcpy(policy->seed, cJSON_IsString(seed) ? seed->valuestring : policy->target.version, sizeof(policy->seed));
+        err = ESP_OK;
+    }
+    cJSON_Delete(root);
+    return err;
+}
+
+/**
+ * @return  HTTP status of the policy request, 0 if there was no response
+ */
+static int fetch_policy(const char *cert_pem, const char *device_id, const char *running_version, policy_t *policy)
+{
+    esp_http_client_config_t config = {
+        .url = CONFIG_OTA_ROLLOUT_URL,
+        .cert_pem = cert_pem,
+        .event_handler = ota_rollout_http_event_handler,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    char *json = malloc(POLICY_MAX_LEN + 1);
+    int status = 0;
+    if (client == NULL || json == NULL) {
+        goto exit;
+    }
+    //Lets the server pick the policy per device, the gates below still apply
+    esp_http_client_set_header(client, "X-Device-Id", device_id);
+    esp_http_client_set_header(client, "X-Cohort", CONFIG_OTA_ROLLOUT_COHORT);
+    esp_http_client_set_header(client, "X-Version", running_version);
+    if (esp_http_client_open(client, 0) != ESP_OK) {
+        goto exit;
+    }
+    esp_http_client_fetch_headers(client);
+    status = esp_http_client_get_status_code(client);
+    if (status == 200) {
+        int len = 0;
+        int read;
+        while (len < POLICY_MAX_LEN && (read = esp_http_client_read(client, json + len, POLICY_MAX_LEN - len)) > 0) {
+            len += read;
+        }
+        json[len] = '\0';
+        if (parse_policy(json, policy) != ESP_OK) {
+            ESP_LOGE(TAG, "invalid policy");
+            status = 0;
+        }
+    }
+    esp_http_client_close(client);
+
+exit:
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    free(json);
+    return status;
+}
+
+static void poll_delay(void)
+{
+    uint32_t delay_ms = CONFIG_OTA_ROLLOUT_POLL_S * 1000;
+    delay_ms += esp_random() % (delay_ms / 10 + 1);
+    vTaskDelay(pdMS_TO_TICKS(delay_ms));
+}
+
+esp_err_t ota_rollout_wait(const char *cert_pem, const char *running_version, ota_rollout_target_t *target)
+{
+    char device_id[DEVICE_ID_LEN];
+    policy_t *policy = calloc(1, sizeof(policy_t));
+    if (policy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    get_device_id(device_id);
+
+    while (1) {
+        int status = fetch_policy(cert_pem, device_id, running_version, policy);
+        if (status == 0 || status == 429 || status >= 500) {
+            ota_rollout_backoff(status);
+            continue;
+        }
+        ota_rollout_backoff_reset();
+        if (status != 200) {
+            ESP_LOGW(TAG, "no policy (status %d)", status);
+        } else if (strncmp(policy->target.version, running_version, sizeof(policy->target.version)) == 0) {
+            ESP_LOGI(TAG, "version %s is current", running_version);
+        } else if (!policy->cohort_listed) {
+            ESP_LOGI(TAG, "%s not in the rollout of %s", CONFIG_OTA_ROLLOUT_COHORT, policy->target.version);
+        } else if (fnv1a(policy->seed, device_id) % 100 >= policy->percent) {
+            ESP_LOGI(TAG, "%s rolled out to %u%%, not this device yet", policy->target.version, policy->percent);
+        } else {
+            break;
+        }
+        poll_delay();
+    }
+
+    uint32_t delay_ms = policy->window_s ? esp_random() % (policy->window_s * 1000) : 0;
+    ESP_LOGI(TAG, "admitted to %s, starting in %u ms", policy->target.version, delay_ms);
+    vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    *target = policy->target;
+    free(policy);
+    return ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+typedef struct {
+    char version[32];
+    char url[256];          //Image to download
+} ota_rollout_target_t;
+
+/**
+ * @brief   Block until the rollout policy admits this device to an update.
+ *
+ * Polls CONFIG_OTA_ROLLOUT_URL. The device is admitted when the policy offers
+ * a version other than running_version, lists the cohort of the device (or no
+ * cohorts at all) and the device falls under the percentage gate. The gate
+ * hashes the seed of the policy with the MAC address, so raising the
+ * percentage only ever adds devices. Once admitted, the call sleeps a random
+ * time within the start window of the policy before returning.
+ *
+ * @return
+ *  - ESP_OK                Admitted, target filled in
+ */
+esp_err_t ota_rollout_wait(const char *cert_pem, const char *running_version, ota_rollout_target_t *target);
+
+/**
+ * @brief   HTTP client event handler recording the Retry-After header.
+ *
+ * Set it as event_handler of the client downloading the image so that
+ * ota_rollout_backoff() honours the delay asked by the server.
+ */
+esp_err_t ota_rollout_http_event_handler(esp_http_client_event_t *evt);
+
+/**
+ * @brief   Sleep before retrying a request which failed.
+ *
+ * Uses the Retry-After of the last response with status 429 or 503 when
+ * present, otherwise an exponential backoff with full jitter.
+ *
+ * @param   status_code     HTTP status of the failed request, or 0 if there was no response
+ */
+void ota_rollout_backoff(int status_code);
+
+/**
+ * @brief   Reset the backoff after a successful request.
+ */
+void ota_rollout_backoff_reset(void);
\ No newline at end of file
@@ -0,0 +1,178 @@
+#!/usr/bin/env python
+#
+# Simulates a fleet following the ota_rollout component, to size the stages of
+# a rollout against the capacity of the image server.
+#
+# Every device polls the policy, passes the same cohort and percentage gates as
+# ota_rollout_wait() (FNV-1a of "<seed>:<device id>"), waits a random delay in
+# the start window and downloads the image. The server accepts a limited number
+# of downloads at a time and answers 429 with Retry-After beyond that; rejected
+# devices back off with full jitter, as ota_rollout_backoff() does.
+#
+# The simulation runs in virtual time, so fleets of thousands of devices and
+# rollouts of hours finish in seconds. --naive compares with every device
+# starting at once and retrying at a fixed interval.
+#
+# Usage:
+#   rollout_sim.py --devices 5000 --stages 0:1,600:10,1800:50,3600:100 --window-s 600
+#   rollout_sim.py --devices 5000 --naive
+#
+from __future__ import print_function, division
+import argparse
+import heapq
+import random
+import sys
+
+
+def fnv1a(seed, device_id):
+    value = 2166136261
+    for c in bytearray((seed + ":" + device_id).encode()):
+        value = ((value ^ c) * 16777619) & 0xffffffff
+    return value
+
+
+def parse_stages(text):
+    """ "0:1,600:10" -> [(0, 1), (600, 10)], percent rolled out from each time on """
+    stages = []
+    for stage in text.split(","):
+        at, _, percent = stage.partition(":")
+        stages.append((float(at), int(percent)))
+    return sorted(stages)
+
+
+class Server(object):
+    def __init__(self, args):
+        self.args = args
+        self.active = 0
+        self.peak = 0
+        self.accepted = 0
+        self.rejected = 0
+        self.policy_requests = 0
+
+    def percent(self, now):
+        if self.args.naive:
+            return 100
+        current = 0
+        for at, percent in self.args.stages:
+            if now >= at:
+                current = percent
+        return current
+
+    def try_download(self):
+        if self.active >= self.args.capacity:
+            self.rejected += 1
+            return False
+        self.active += 1
+        self.accepted += 1
+        self.peak = max(self.peak, self.active)
+        return True
+
+    def transfer_s(self):
+        # Bandwidth of the server shared by the active downloads, but no faster
+        # than a single device can write to flash
+        rate = min(self.args.device_kbps, self.args.server_kbps / max(1, self.active))
+        return self.args.image_kb / rate
+
+
+class Device(object):
+    def __init__(self, index, cohort):
+        self.id = "24%010x" % index
+        self.cohort = cohort
+        self.failures = 0
+        self.retries = 0
+        self.done_at = None
+
+
+def backoff_s(args, device, retry_after):
+    if args.naive:
+        return args.backoff_min_ms / 1000
+    if retry_after is not None:
+        return min(retry_after, args.backoff_max_ms / 1000)
+    ceiling = min(args.backoff_max_ms, args.backoff_min_ms * 2 ** device.failures)
+    return random.uniform(0, ceiling) / 1000
+
+
+def simulate(args):
+    server = Server(args)
+    devices = [Device(i, args.cohorts[i % len(args.cohorts)]) for i in range(args.devices)]
+    events = []
+    seq = [0]
+
+    def schedule(at, action, device):
+        seq[0] += 1
+        heapq.heappush(events, (at, seq[0], action, device))
+
+    # Devices boot over the first poll interval
+    for device in devices:
+        schedule(random.uniform(0, args.poll_s), "poll", device)
+
+    now = 0.0
+    while events:
+        now, _, action, device = heapq.heappop(events)
+        if action == "poll":
+            server.policy_requests += 1
+            admitted = (device.cohort in args.rollout_cohorts and
+                        fnv1a(args.seed, device.id) % 100 < server.percent(now))
+            if admitted:
+                delay = 0 if args.naive or not args.window_s else random.uniform(0, args.window_s)
+                schedule(now + delay, "download", device)
+            elif device.cohort in args.rollout_cohorts:
+                schedule(now + args.poll_s * random.uniform(1, 1.1), "poll", device)
+        elif action == "download":
+            if server.try_download():
+                device.failures = 0
+                schedule(now + server.transfer_s(), "done", device)
+            else:
+                device.retries += 1
+                schedule(now + backoff_s(args, device, args.retry_after), "download", device)
+                device.failures += 1
+        elif action == "done":
+            server.active -= 1
+            device.done_at = now
+
+    return server, devices, now
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate a staged OTA rollout of a fleet against the image server capacity")
+    parser.add_argument("--devices", type=int, default=1000)
+    parser.add_argument("--cohorts", default="default", help="cohorts the devices are spread over, comma separated")
+    parser.add_argument("--rollout-cohorts", help="cohorts listed in the policy, all if omitted")
+    parser.add_argument("--stages", default="0:1,600:10,1800:50,3600:100",
+                        help="rollout stages as seconds:percent, comma separated")
+    parser.add_argument("--window-s", type=float, default=300, help="start window of the policy")
+    parser.add_argument("--seed", default="v2", help="seed of the percentage gate, the version by default on devices")
+    parser.add_argument("--poll-s", type=float, default=300, help="CONFIG_OTA_ROLLOUT_POLL_S")
+    parser.add_argument("--backoff-min-ms", type=int, default=1000, help="CONFIG_OTA_ROLLOUT_BACKOFF_MIN_MS")
+    parser.add_argument("--backoff-max-ms", type=int, default=300000, help="CONFIG_OTA_ROLLOUT_BACKOFF_MAX_MS")
+    parser.add_argument("--retry-after", type=float, help="Retry-After sent with 429, none if omitted")
+    parser.add_argument("--capacity", type=int, default=50, help="downloads the image server accepts at a time")
+    parser.add_argument("--server-kbps", type=float, default=10240, help="uplink of the image server, KiB/s")
+    parser.add_argument("--device-kbps", type=float, default=100, help="download rate of a single device, KiB/s")
+    parser.add_argument("--image-kb", type=float, default=1024, help="image size, KiB")
+    parser.add_argument("--naive", action="store_true", help="all devices at once, fixed retry interval of --backoff-min-ms")
+    parser.add_argument("--random-seed", type=int, default=1)
+    args = parser.parse_args()
+
+    random.seed(args.random_seed)
+    args.cohorts = args.cohorts.split(",")
+    args.rollout_cohorts = set(args.rollout_cohorts.split(",") if args.rollout_cohorts else args.cohorts)
+    args.stages = parse_stages(args.stages)
+
+    server, devices, end = simulate(args)
+    updated = [d for d in devices if d.done_at is not None]
+    print("%s rollout of %d devices" % ("naive" if args.naive else "staged", len(devices)))
+    print("  updated:              %d" % len(updated))
+    if updated:
+        times = sorted(d.done_at for d in updated)
+        print("  last update at:       %.0f s (median %.0f s)" % (times[-1], times[len(times) // 2]))
+    print("  peak downloads:       %d of %d" % (server.peak, args.capacity))
+    print("  download requests:    %d (%d rejected with 429)" % (server.accepted + server.rejected, server.rejected))
+    print("  policy requests:      %d" % server.policy_requests)
+    if updated:
+        print("  max retries, device:  %d" % max(d.retries for d in devices))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,6 @@
+COMPONENT_SRCDIRS := .
+COMPONENT_ADD_INCLUDEDIRS := .
+
+ifndef CONFIG_PERF_LOG
+COMPONENT_OBJEXCLUDE := perf_log.o
+endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+/* Host test of the sector ring of the performance log
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "perf_log_store.h"
+#include "check.h"
+
+#define SECTORS     4
+#define TYPE_TEST   0x80
+
+static const esp_partition_t s_partition = {
+    .address = 0,
+    .size = SECTORS * PERF_LOG_SECTOR_SIZE,
+    .label = "perf_log",
+};
+
+static uint8_t s_flash[SECTORS * PERF_LOG_SECTOR_SIZE];
+static int s_erases[SECTORS];
+static int s_writes;
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, s_flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    //NOR flash only clears bits
+    for (size_t i = 0; i < size; i++) {
+        s_flash[dst_offset + i] &= ((const uint8_t *)src)[i];
+    }
+    s_writes++;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size)
+{
+    if (start_addr % PERF_LOG_SECTOR_SIZE != 0 || size % PERF_LOG_SECTOR_SIZE != 0 || start_addr + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(s_flash + start_addr, 0xff, size);
+    for (size_t sector = start_addr / PERF_LOG_SECTOR_SIZE; sector < (start_addr + size) / PERF_LOG_SECTOR_SIZE; sector++) {
+        s_erases[sector]++;
+    }
+    return ESP_OK;
+}
+
+static void reset_flash(void)
+{
+    memset(s_flash, 0xff, sizeof(s_flash));
+    memset(s_erases, 0, sizeof(s_erases));
+    s_writes = 0;
+}
+
+//Records of the test carry their number, and a length varying with it
+typedef struct {
+    uint32_t numbers[64];
+    int count;
+    bool bad;
+} seen_t;
+
+static size_t encode_test_record(uint8_t *buf, size_t buf_len, uint32_t number)
+{
+    uint8_t data[PERF_LOG_RECORD_MAX_DATA];
+    size_t len = 4 + number % 50;
+    memset(data, number, len);
+    memcpy(data, &number, sizeof(number));
+    return perf_log_record_encode(buf, buf_len, TYPE_TEST, data, len);
+}
+
+static bool collect(uint8_t type, const void *data, size_t len, void *arg)
+{
+    seen_t *seen = arg;
+    uint32_t number;
+    memcpy(&number, data, sizeof(number));
+    if (type != TYPE_TEST || len != 4 + number % 50) {
+        seen->bad = true;
+    }
+    if (seen->count < 64) {
+        seen->numbers[seen->count] = number;
+    }
+    seen->count++;
+    return true;
+}
+
+static seen_t iterate(const perf_log_store_t *store)
+{
+    seen_t seen = { 0 };
+    CHECK(perf_log_store_iterate(store, collect, &seen) == ESP_OK, "iterate");
+    CHECK(!seen.bad, "bad record");
+    return seen;
+}
+
+static void test_encode(void)
+{
+    uint8_t buf[PERF_LOG_RECORD_MAX_LEN];
+    uint8_t data[PERF_LOG_RECORD_MAX_DATA + 1] = { 0 };
+    CHECK(perf_log_record_encode(buf, sizeof(buf), TYPE_TEST, data, 5) == PERF_LOG_RECORD_HEADER_LEN + 8, "padding");
+    CHECK(buf[9] == 0 && buf[11] == 0, "zero padding");
+    CHECK(perf_log_record_encode(buf, sizeof(buf), TYPE_TEST, data, PERF_LOG_RECORD_MAX_DATA) == sizeof(buf), "max length");
+    CHECK(perf_log_record_encode(buf, sizeof(buf), TYPE_TEST, data, PERF_LOG_RECORD_MAX_DATA + 1) == 0, "too long");
+    CHECK(perf_log_record_encode(buf, 8, TYPE_TEST, data, 5) == 0, "buffer too small");
+    CHECK(perf_log_record_encode(buf, sizeof(buf), PERF_LOG_TYPE_ERASED, data, 5) == 0, "erased type");
+}
+
+static void test_append_and_reopen(void)
+{
+    perf_log_store_t store;
+    uint8_t batch[1024];
+    reset_flash();
+    CHECK(perf_log_store_open(&store, &s_partition) == ESP_OK && store.head_seq == 0, "open empty");
+    CHECK(iterate(&store).count == 0, "empty log");
+
+    //A batch is written at once
+    size_t len = 0;
+    for (uint32_t number = 0; number < 10; number++) {
+        len += encode_test_record(batch + len, sizeof(batch) - len, number);
+    }
+    CHECK(perf_log_store_write(&store, batch, len) == ESP_OK, "write");
+    CHECK(s_writes == 2 && s_erases[0] == 1, "%d writes, %d erases: sector header and one write expected", s_writes, s_erases[0]);
+    CHECK(store.head == 0 && store.head_offset == PERF_LOG_SECTOR_HEADER_LEN + len, "head at %u:%u",
+          (unsigned)store.head, (unsigned)store.head_offset);
+
+    //Reopening finds the end of the records, the next ones follow them
+    size_t head_offset = store.head_offset;
+    CHECK(perf_log_store_open(&store, &s_partition) == ESP_OK, "reopen");
+    CHECK(store.head == 0 && store.head_seq == 1 && store.head_offset == head_offset, "reopened head at %u:%u",
+          (unsigned)store.head, (unsigned)store.head_offset);
+    len = encode_test_record(batch, sizeof(batch), 10);
+    CHECK(perf_log_store_write(&store, batch, len) == ESP_OK, "write after reopen");
+    seen_t seen = iterate(&store);
+    CHECK(seen.count == 11, "%d records", seen.count);
+    for (int i = 0; i < 11 && i < seen.count; i++) {
+        CHECK(seen.numbers[i] == i, "record %d is %u", i, seen.numbers[i]);
+    }
+
+    //A record not made by perf_log_record_encode() is refused
+    batch[1] = PERF_LOG_RECORD_MAX_DATA + 1;
+    CHECK(perf_log_store_write(&store, batch, len) == ESP_ERR_INVALID_ARG, "bad record");
+    CHECK(perf_log_store_write(&store, batch, 3) == ESP_ERR_INVALID_ARG, "truncated record");
+}
+
+static void test_wrap(void)
+{
+    perf_log_store_t store;
+    uint8_t record[PERF_LOG_RECORD_MAX_LEN];
+    reset_flash();
+    CHECK(perf_log_store_open(&store, &s_partition) == ESP_OK, "open");
+    //About 13 sectors of records, the ring of 4 wraps several times
+    const uint32_t total = 1500;
+    for (uint32_t number = 0; number < total; number++) {
+        size_t len = encode_test_record(record, sizeof(record), number);
+        CHECK(perf_log_store_write(&store, record, len) == ESP_OK, "write %u", number);
+    }
+    //Sectors are erased in turn
+    for (int sector = 1; sector < SECTORS; sector++) {
+        CHECK(s_erases[sector] >= s_erases[0] - 1 && s_erases[sector] <= s_erases[0], "sector %d erased %d times, sector 0 %d times",
+              sector, s_erases[sector], s_erases[0]);
+    }
+    CHECK(s_erases[0] >= 3, "sector 0 erased %d times", s_erases[0]);
+
+    //The newest records are kept in order, up to the last one
+    seen_t seen = iterate(&store);
+    CHECK(seen.count > 3 * (PERF_LOG_SECTOR_SIZE / 64) && seen.count < 4 * (PERF_LOG_SECTOR_SIZE / 32), "%d records kept", seen.count);
+    uint32_t first = total - seen.count;
+    for (int i = 0; i < seen.count && i < 64; i++) {
+        CHECK(seen.numbers[i] == first + i, "record %d is %u, %u expected", i, seen.numbers[i], first + i);
+    }
+
+    //Same state after a reboot
+    perf_log_store_t reopened;
+    CHECK(perf_log_store_open(&reopened, &s_partition) == ESP_OK, "reopen");
+    CHECK(reopened.head == store.head && reopened.head_offset == store.head_offset && reopened.head_seq == store.head_seq,
+          "reopened head at %u:%u seq %u, %u:%u seq %u expected", (unsigned)reopened.head, (unsigned)reopened.head_offset,
+          reopened.head_seq, (unsigned)store.head, (unsigned)store.head_offset, store.head_seq);
+    CHECK(iterate(&reopened).count == seen.count, "records after reopen");
+
+    CHECK(perf_log_store_erase(&store) == ESP_OK && iterate(&store).count == 0, "erase");
+    CHECK(perf_log_store_open(&store, &s_partition) == ESP_OK && store.head_seq == 0 && iterate(&store).count == 0, "open erased");
+}
+
+static void test_torn_record(void)
+{
+    perf_log_store_t store;
+    uint8_t batch[256];
+    reset_flash();
+    CHECK(perf_log_store_open(&store, &s_partition) == ESP_OK, "open");
+    size_t len = encode_test_record(batch, sizeof(batch), 1);
+    len += encode_test_record(batch + len, sizeof(batch) - len, 2);
+    CHECK(perf_log_store_write(&store, batch, len) == ESP_OK, "write");
+
+    //A reset in the middle of a write leaves the header and part of the data
+    size_t offset = store.head_offset;
+    len = encode_test_record(batch, sizeof(batch), 3);
+    CHECK(esp_partition_write(&s_partition, offset, batch, len / 2) == ESP_OK, "torn write");
+    CHECK(perf_log_store_open(&store, &s_partition) == ESP_OK, "reopen");
+    CHECK(store.head_offset == PERF_LOG_SECTOR_SIZE, "sector with a torn record not continued");
+    seen_t seen = iterate(&store);
+    CHECK(seen.count == 2, "%d records before the torn one", seen.count);
+
+    //The next records start the next sector and come after the others
+    len = encode_test_record(batch, sizeof(batch), 4);
+    CHECK(perf_log_store_write(&store, batch, len) == ESP_OK, "write after torn record");
+    CHECK(store.head == 1, "head in sector %u", (unsigned)store.head);
+    seen = iterate(&store);
+    CHECK(seen.count == 3 && seen.numbers[2] == 4, "%d records, last %u", seen.count, seen.numbers[2]);
+}
+
+int main(void)
+{
+    test_encode();
+    test_append_and_reopen();
+    test_wrap();
+    test_torn_record();
+    printf("%s\n", s_failures ? "FAILED" : "OK");
+    return s_failures ? 1 : 0;
+}
\ No newline at end of file
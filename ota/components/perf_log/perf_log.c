@@ -0,0 +1,252 @@
+/* Performance log
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "perf_log.h"
+
+#define WRITER_TASK_NAME    "perf_log"
+#define WRITER_TASK_STACK   3072
+#define WRITER_TASK_PRIO    1
+
+/*
+ * Records are appended to one of two buffers under a spinlock. The writer
+ * task swaps the buffers and writes the full one while the other fills up, so
+ * perf_log_append() never waits for the flash. The store is shared by the
+ * writer and the queries under a mutex.
+ */
+static const char *TAG = "perf_log";
+static perf_log_store_t s_store;
+static SemaphoreHandle_t s_store_lock;
+static portMUX_TYPE s_buf_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t s_bufs[2][CONFIG_PERF_LOG_BUFFER_SIZE];
+static int s_buf_index;
+static size_t s_buf_len;
+static uint32_t s_appended;             //Records accepted so far
+static volatile uint32_t s_written;     //Records written so far, or lost to a flash error
+static uint32_t s_dropped;
+static TaskHandle_t s_writer;
+static SemaphoreHandle_t s_pass_done;   //Given after each pass of the writer
+static uint32_t s_boot;
+
+static void writer_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_PERF_LOG_FLUSH_INTERVAL_MS));
+        portENTER_CRITICAL(&s_buf_lock);
+        const uint8_t *buf = s_bufs[s_buf_index];
+        size_t len = s_buf_len;
+        uint32_t appended = s_appended;
+        s_buf_index ^= 1;
+        s_buf_len = 0;
+        portEXIT_CRITICAL(&s_buf_lock);
+        if (len > 0) {
+            xSemaphoreTake(s_store_lock, portMAX_DELAY);
+            esp_err_t err = perf_log_store_write(&s_store, buf, len);
+            xSemaphoreGive(s_store_lock);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "%u bytes of records lost (%s)", len, esp_err_to_name(err));
+            }
+        }
+        s_written = appended;
+        xSemaphoreGive(s_pass_done);
+    }
+}
+
+typedef struct {
+    uint8_t type;
+    perf_log_record_cb_t cb;
+    void *arg;
+} query_t;
+
+static bool query_filter(uint8_t type, const void *data, size_t len, void *arg)
+{
+    query_t *query = arg;
+    return type != query->type || query->cb(type, data, len, query->arg);
+}
+
+typedef struct {
+    perf_log_export_cb_t write;
+    void *arg;
+    esp_err_t err;
+} export_t;
+
+static bool export_record(uint8_t type, const void *data, size_t len, void *arg)
+{
+    export_t *export = arg;
+    uint8_t record[PERF_LOG_RECORD_MAX_LEN];
+    size_t record_len = perf_log_record_encode(record, sizeof(record), type, data, len);
+    export->err = export->write(record, record_len, export->arg);
+    return export->err == ESP_OK;
+}
+
+static bool find_last_boot(uint8_t type, const void *data, size_t len, void *arg)
+{
+    if (type == PERF_LOG_TYPE_BOOT && len >= sizeof(uint32_t)) {
+        memcpy(arg, data, sizeof(uint32_t));
+    }
+    return true;
+}
+
+static void append_boot_record(void)
+{
+    const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+    perf_log_boot_t boot = {
+        .boot = s_boot,
+        .boot_us = esp_timer_get_time(),
+        .reset_reason = esp_reset_reason(),
+    };
+    strlcpy(boot.version, app_desc->version, sizeof(boot.version));
+    memcpy(boot.elf_sha256, app_desc->app_elf_sha256, sizeof(boot.elf_sha256));
+    perf_log_append(PERF_LOG_TYPE_BOOT, &boot, sizeof(boot));
+}
+
+esp_err_t perf_log_init(void)
+{
+    if (s_writer != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, PERF_LOG_PARTITION_SUBTYPE,
+                                                                PERF_LOG_PARTITION_LABEL);
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = perf_log_store_open(&s_store, partition);
+    uint32_t last_boot = 0;
+    if (err == ESP_OK) {
+        err = perf_log_store_iterate(&s_store, find_last_boot, &last_boot);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_boot = last_boot + 1;
+
+    s_store_lock = xSemaphoreCreateMutex();
+    s_pass_done = xSemaphoreCreateBinary();
+    if (s_store_lock == NULL || s_pass_done == NULL
+            || xTaskCreate(writer_task, WRITER_TASK_NAME, WRITER_TASK_STACK, NULL, WRITER_TASK_PRIO, &s_writer) != pdPASS) {
+        if (s_store_lock != NULL) {
+            vSemaphoreDelete(s_store_lock);
+        }
+        if (s_pass_done != NULL) {
+            vSemaphoreDelete(s_pass_done);
+        }
+        s_writer = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    append_boot_record();
+    ESP_LOGI(TAG, "boot %u, %u sectors at 0x%x", s_boot, s_store.sector_num, partition->address);
+    return ESP_OK;
+}
+
+esp_err_t perf_log_append(uint8_t type, const void *data, size_t len)
+{
+    uint8_t record[PERF_LOG_RECORD_MAX_LEN];
+    if (s_writer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t record_len = perf_log_record_encode(record, sizeof(record), type, data, len);
+    if (record_len == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    bool full = false;
+    bool wake = false;
+    portENTER_CRITICAL(&s_buf_lock);
+    if (s_buf_len + record_len > CONFIG_PERF_LOG_BUFFER_SIZE) {
+        s_dropped++;
+        full = true;
+    } else {
+        memcpy(s_bufs[s_buf_index] + s_buf_len, record, record_len);
+        s_buf_len += record_len;
+        s_appended++;
+        wake = s_buf_len > CONFIG_PERF_LOG_BUFFER_SIZE / 2;
+    }
+    portEXIT_CRITICAL(&s_buf_lock);
+    if (full || wake) {
+        xTaskNotifyGive(s_writer);
+    }
+    return full ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+esp_err_t perf_log_flush(uint32_t timeout_ms)
+{
+    if (s_writer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_buf_lock);
+    uint32_t target = s_appended;
+    portEXIT_CRITICAL(&s_buf_lock);
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    //A pass in progress may have swapped the buffers before the last records
+    while ((int32_t)(s_written - target) < 0) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return ESP_ERR_TIMEOUT;
+        }
+        xTaskNotifyGive(s_writer);
+        xSemaphoreTake(s_pass_done, timeout - elapsed);
+    }
+    return ESP_OK;
+}
+
+esp_err_t perf_log_query(uint8_t type, perf_log_record_cb_t cb, void *arg)
+{
+    if (s_writer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    query_t query = {
+        .type = type,
+        .cb = cb,
+        .arg = arg,
+    };
+    xSemaphoreTake(s_store_lock, portMAX_DELAY);
+    esp_err_t err = type == PERF_LOG_TYPE_ANY ? perf_log_store_iterate(&s_store, cb, arg)
+                    : perf_log_store_iterate(&s_store, query_filter, &query);
+    xSemaphoreGive(s_store_lock);
+    return err;
+}
+
+esp_err_t perf_log_export(perf_log_export_cb_t write, void *arg)
+{
+    export_t export = {
+        .write = write,
+        .arg = arg,
+    };
+    esp_err_t err = perf_log_query(PERF_LOG_TYPE_ANY, export_record, &export);
+    return err != ESP_OK ? err : export.err;
+}
+
+esp_err_t perf_log_erase(void)
+{
+    if (s_writer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_store_lock, portMAX_DELAY);
+    esp_err_t err = perf_log_store_erase(&s_store);
+    xSemaphoreGive(s_store_lock);
+    return err;
+}
+
+uint32_t perf_log_get_boot(void)
+{
+    return s_writer != NULL ? s_boot : 0;
+}
+
+uint32_t perf_log_get_dropped(void)
+{
+    return s_dropped;
+}
\ No newline at end of file
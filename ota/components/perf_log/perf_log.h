@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "perf_log_store.h"
+
+/**
+ * Performance history kept across reboots in the perf_log data partition.
+ *
+ * perf_log_append() only copies the record to a RAM buffer and returns, a
+ * low priority writer task appends the buffered records to the partition in
+ * one write when half the buffer is used or every
+ * CONFIG_PERF_LOG_FLUSH_INTERVAL_MS. Call perf_log_flush() before a restart.
+ *
+ * The records below are little endian, without implicit padding, and read by
+ * tools/perf_log_decode.py: keep both in sync.
+ */
+
+#define PERF_LOG_PARTITION_LABEL    "perf_log"
+#define PERF_LOG_PARTITION_SUBTYPE  0x40        //First custom data subtype
+
+#define PERF_LOG_TYPE_ANY           0           //Query filter, not a record type
+#define PERF_LOG_TYPE_BOOT          1
+#define PERF_LOG_TYPE_OTA           2
+#define PERF_LOG_TYPE_CPU           3
+#define PERF_LOG_TYPE_USER          0x80        //First type free for the application
+
+#define PERF_LOG_NAME_LEN           16
+#define PERF_LOG_OTA_PHASES         4
+#define PERF_LOG_CPU_TASKS          10
+
+//Written by perf_log_init(), the records after it belong to this boot
+typedef struct {
+    uint32_t boot;                      //Boot number, counted by the log
+    uint32_t boot_us;                   //Time from the start of the app to perf_log_init()
+    uint8_t reset_reason;               //esp_reset_reason_t
+    uint8_t reserved[3];
+    char version[32];                   //Of the running app
+    uint8_t elf_sha256[8];              //First bytes of the ELF hash, tells builds of a version apart
+} perf_log_boot_t;
+
+typedef struct {
+    char name[12];
+    uint32_t window_us;
+    uint32_t cpu_us;                    //CPU time of all tasks but the idle tasks
+} perf_log_phase_t;
+
+typedef struct {
+    int32_t result;                     //esp_err_t of the update
+    uint32_t image_len;
+    uint32_t time_total_us;
+    uint32_t time_http_us;
+    uint32_t time_write_us;
+    uint32_t time_process_us;
+    uint32_t time_validate_us;
+    uint32_t time_first_write_us;
+    uint32_t heap_min_free;             //Low-water mark of the heap since boot
+    uint32_t phase_num;
+    perf_log_phase_t phases[PERF_LOG_OTA_PHASES];
+} perf_log_ota_t;
+
+typedef struct {
+    char name[PERF_LOG_NAME_LEN];
+    uint32_t load_x100;                 //Share of a single core, in hundredths of percent
+} perf_log_task_load_t;
+
+//Averages over several stats windows
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t windows;
+    uint32_t heap_free;
+    uint32_t heap_min_free;             //Low-water mark of the heap since boot
+    uint8_t core_load[2];               //Percent
+    uint8_t task_num;
+    uint8_t reserved;
+    perf_log_task_load_t tasks[PERF_LOG_CPU_TASKS];     //Busiest first
+} perf_log_cpu_t;
+
+/**
+ * @brief   Called with the records of perf_log_export(), encoded as in the partition.
+ */
+typedef esp_err_t (*perf_log_export_cb_t)(const void *data, size_t len, void *arg);
+
+/**
+ * @brief   Open the log in the perf_log partition, start the writer task and
+ *          append the boot record.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NOT_FOUND     No perf_log partition
+ *  - ESP_ERR_INVALID_STATE Already started
+ *  - ESP_ERR_NO_MEM        Insufficient memory
+ *  - other                 Error reading the partition
+ */
+esp_err_t perf_log_init(void);
+
+/**
+ * @brief   Queue a record for the writer task. Never waits for the flash.
+ *
+ * May be called from any task, but not from an ISR.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_SIZE  len above PERF_LOG_RECORD_MAX_DATA, or bad type
+ *  - ESP_ERR_NO_MEM        Buffer full, the record is dropped
+ *  - ESP_ERR_INVALID_STATE Not started
+ */
+esp_err_t perf_log_append(uint8_t type, const void *data, size_t len);
+
+/**
+ * @brief   Wait until the records appended so far are in flash.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_TIMEOUT       Not written within timeout_ms
+ *  - ESP_ERR_INVALID_STATE Not started
+ */
+esp_err_t perf_log_flush(uint32_t timeout_ms);
+
+/**
+ * @brief   Read the records in flash, oldest first, optionally of one type only.
+ *
+ * Reads the flash in the calling task, while the writer waits.
+ *
+ * @return
+ *  - ESP_OK                Success, or stopped by the callback
+ *  - ESP_ERR_INVALID_STATE Not started
+ *  - other                 Error reading the partition
+ */
+esp_err_t perf_log_query(uint8_t type, perf_log_record_cb_t cb, void *arg);
+
+/**
+ * @brief   Stream all records in flash, oldest first, for perf_log_decode.py.
+ *
+ * Stops at the first error returned by write.
+ */
+esp_err_t perf_log_export(perf_log_export_cb_t write, void *arg);
+
+/**
+ * @brief   Erase the history, the records still buffered are written after it.
+ */
+esp_err_t perf_log_erase(void);
+
+/**
+ * @brief   Boot number of the running app, 0 if not started.
+ */
+uint32_t perf_log_get_boot(void);
+
+/**
+ * @brief   Records dropped because the buffer was full.
+ */
+uint32_t perf_log_get_dropped(void);
\ No newline at end of file
@@ -0,0 +1,262 @@
+/* Sector ring of the performance log
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "perf_log_store.h"
+
+//CRC-16/CCITT-FALSE, continued from crc (0xffff to start)
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static size_t padded(size_t len)
+{
+    return (len + 3) & ~3;
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+//Sequence number of a sector, 0 if it is not a sector of the log
+static esp_err_t read_sector_seq(const perf_log_store_t *store, size_t sector, uint32_t *seq)
+{
+    uint8_t header[PERF_LOG_SECTOR_HEADER_LEN];
+    esp_err_t err = esp_partition_read(store->partition, sector * PERF_LOG_SECTOR_SIZE, header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t value = read_u32(header + 4);
+    *seq = read_u32(header) == PERF_LOG_SECTOR_MAGIC && value != 0xffffffff ? value : 0;
+    return ESP_OK;
+}
+
+/*
+ * Reads the record at offset of a sector into buf, which holds
+ * PERF_LOG_RECORD_MAX_LEN bytes. *len is 0 at the end of the records, the
+ * length of the record otherwise; *valid is false if it is corrupted.
+ */
+static esp_err_t read_record(const perf_log_store_t *store, size_t sector, size_t offset,
+                             uint8_t *buf, size_t *len, bool *valid)
+{
+    *len = 0;
+    *valid = false;
+    if (offset + PERF_LOG_RECORD_HEADER_LEN > PERF_LOG_SECTOR_SIZE) {
+        return ESP_OK;
+    }
+    size_t address = sector * PERF_LOG_SECTOR_SIZE + offset;
+    esp_err_t err = esp_partition_read(store->partition, address, buf, PERF_LOG_RECORD_HEADER_LEN);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (buf[0] == PERF_LOG_TYPE_ERASED && buf[1] == 0xff && buf[2] == 0xff && buf[3] == 0xff) {
+        return ESP_OK;
+    }
+    size_t record_len = PERF_LOG_RECORD_HEADER_LEN + padded(buf[1]);
+    *len = record_len;
+    if (buf[0] == PERF_LOG_TYPE_ERASED || buf[1] > PERF_LOG_RECORD_MAX_DATA || offset + record_len > PERF_LOG_SECTOR_SIZE) {
+        return ESP_OK;
+    }
+    err = esp_partition_read(store->partition, address + PERF_LOG_RECORD_HEADER_LEN,
+                             buf + PERF_LOG_RECORD_HEADER_LEN, record_len - PERF_LOG_RECORD_HEADER_LEN);
+    if (err != ESP_OK) {
+        return err;
+    }
+    //The CRC covers the type and length, so a header cut short is detected
+    uint16_t crc = crc16(crc16(0xffff, buf, 2), buf + PERF_LOG_RECORD_HEADER_LEN, buf[1]);
+    *valid = (buf[2] | (buf[3] << 8)) == crc;
+    return ESP_OK;
+}
+
+esp_err_t perf_log_store_open(perf_log_store_t *store, const esp_partition_t *partition)
+{
+    memset(store, 0, sizeof(*store));
+    store->partition = partition;
+    store->sector_num = partition->size / PERF_LOG_SECTOR_SIZE;
+    store->head_offset = PERF_LOG_SECTOR_SIZE;
+    if (store->sector_num < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t sector = 0; sector < store->sector_num; sector++) {
+        uint32_t seq;
+        esp_err_t err = read_sector_seq(store, sector, &seq);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (seq > store->head_seq) {
+            store->head_seq = seq;
+            store->head = sector;
+        }
+    }
+    if (store->head_seq == 0) {
+        //Empty log, the first write starts at sector 0
+        store->head = store->sector_num - 1;
+        return ESP_OK;
+    }
+
+    uint8_t buf[PERF_LOG_RECORD_MAX_LEN];
+    size_t offset = PERF_LOG_SECTOR_HEADER_LEN;
+    for (;;) {
+        size_t len;
+        bool valid;
+        esp_err_t err = read_record(store, store->head, offset, buf, &len, &valid);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (len == 0) {
+            store->head_offset = offset;
+            break;
+        }
+        if (!valid) {
+            //Leave the sector as it is, the next records go to the next one
+            break;
+        }
+        offset += len;
+    }
+    return ESP_OK;
+}
+
+size_t perf_log_record_encode(uint8_t *buf, size_t buf_len, uint8_t type, const void *data, size_t len)
+{
+    size_t record_len = PERF_LOG_RECORD_HEADER_LEN + padded(len);
+    if (type == PERF_LOG_TYPE_ERASED || len > PERF_LOG_RECORD_MAX_DATA || record_len > buf_len) {
+        return 0;
+    }
+    buf[0] = type;
+    buf[1] = len;
+    memcpy(buf + PERF_LOG_RECORD_HEADER_LEN, data, len);
+    memset(buf + PERF_LOG_RECORD_HEADER_LEN + len, 0, record_len - PERF_LOG_RECORD_HEADER_LEN - len);
+    uint16_t crc = crc16(crc16(0xffff, buf, 2), buf + PERF_LOG_RECORD_HEADER_LEN, len);
+    buf[2] = crc;
+    buf[3] = crc >> 8;
+    return record_len;
+}
+
+//Erase the sector after the head and make it the head
+static esp_err_t next_sector(perf_log_store_t *store)
+{
+    size_t sector = (store->head + 1) % store->sector_num;
+    uint8_t header[PERF_LOG_SECTOR_HEADER_LEN];
+    //Even on error the head moves on, so a bad sector is skipped next time
+    store->head = sector;
+    store->head_offset = PERF_LOG_SECTOR_SIZE;
+    store->head_seq++;
+    esp_err_t err = esp_partition_erase_range(store->partition, sector * PERF_LOG_SECTOR_SIZE, PERF_LOG_SECTOR_SIZE);
+    if (err != ESP_OK) {
+        return err;
+    }
+    write_u32(header, PERF_LOG_SECTOR_MAGIC);
+    write_u32(header + 4, store->head_seq);
+    err = esp_partition_write(store->partition, sector * PERF_LOG_SECTOR_SIZE, header, sizeof(header));
+    if (err == ESP_OK) {
+        store->head_offset = PERF_LOG_SECTOR_HEADER_LEN;
+    }
+    return err;
+}
+
+esp_err_t perf_log_store_write(perf_log_store_t *store, const uint8_t *records, size_t len)
+{
+    while (len > 0) {
+        //Records fitting the rest of the head sector
+        size_t n = 0;
+        while (n < len) {
+            if (len - n < PERF_LOG_RECORD_HEADER_LEN || records[n] == PERF_LOG_TYPE_ERASED
+                    || records[n + 1] > PERF_LOG_RECORD_MAX_DATA) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            size_t record_len = PERF_LOG_RECORD_HEADER_LEN + padded(records[n + 1]);
+            if (record_len > len - n) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            if (store->head_offset + n + record_len > PERF_LOG_SECTOR_SIZE) {
+                break;
+            }
+            n += record_len;
+        }
+        if (n == 0) {
+            esp_err_t err = next_sector(store);
+            if (err != ESP_OK) {
+                return err;
+            }
+            continue;
+        }
+        esp_err_t err = esp_partition_write(store->partition, store->head * PERF_LOG_SECTOR_SIZE + store->head_offset,
+                                            records, n);
+        if (err != ESP_OK) {
+            store->head_offset = PERF_LOG_SECTOR_SIZE;
+            return err;
+        }
+        store->head_offset += n;
+        records += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t perf_log_store_iterate(const perf_log_store_t *store, perf_log_record_cb_t cb, void *arg)
+{
+    if (store->head_seq == 0) {
+        return ESP_OK;
+    }
+    uint8_t buf[PERF_LOG_RECORD_MAX_LEN];
+    //The sector after the head is the oldest one, unless the ring has not wrapped yet
+    for (size_t i = 1; i <= store->sector_num; i++) {
+        size_t sector = (store->head + i) % store->sector_num;
+        uint32_t seq;
+        esp_err_t err = read_sector_seq(store, sector, &seq);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (seq == 0 || seq > store->head_seq) {
+            continue;
+        }
+        size_t offset = PERF_LOG_SECTOR_HEADER_LEN;
+        for (;;) {
+            size_t len;
+            bool valid;
+            err = read_record(store, sector, offset, buf, &len, &valid);
+            if (err != ESP_OK) {
+                return err;
+            }
+            if (len == 0 || !valid) {
+                break;
+            }
+            if (!cb(buf[0], buf + PERF_LOG_RECORD_HEADER_LEN, buf[1], arg)) {
+                return ESP_OK;
+            }
+            offset += len;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t perf_log_store_erase(perf_log_store_t *store)
+{
+    esp_err_t err = esp_partition_erase_range(store->partition, 0, store->sector_num * PERF_LOG_SECTOR_SIZE);
+    store->head = store->sector_num - 1;
+    store->head_offset = PERF_LOG_SECTOR_SIZE;
+    store->head_seq = 0;
+    return err;
+}
\ No newline at end of file
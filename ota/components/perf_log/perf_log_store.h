@@ -0,0 +1,86 @@
+#pragma once
+
+//Append-only record log in a ring of flash sectors, without FreeRTOS
+//dependencies, built on the host by host_test against a mock flash.
+//
+//Each sector starts with a header holding a sequence number, then records
+//follow back to back. Records are appended to the newest sector; when it is
+//full the sector after it, the oldest one, is erased and reused. Sectors are
+//thus erased in turn, every one as often as the others.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define PERF_LOG_SECTOR_SIZE        4096
+#define PERF_LOG_SECTOR_MAGIC       0x474f4c50  //"PLOG"
+#define PERF_LOG_SECTOR_HEADER_LEN  8           //Magic and sequence number
+#define PERF_LOG_RECORD_HEADER_LEN  4           //Type, length and CRC-16 of the payload
+#define PERF_LOG_RECORD_MAX_DATA    248
+#define PERF_LOG_RECORD_MAX_LEN     (PERF_LOG_RECORD_HEADER_LEN + PERF_LOG_RECORD_MAX_DATA)
+#define PERF_LOG_TYPE_ERASED        0xFF        //Not a record type, end of the records of a sector
+
+typedef struct {
+    const esp_partition_t *partition;
+    size_t sector_num;
+    size_t head;                    //Sector records are appended to
+    size_t head_offset;             //Offset of the next record in it, PERF_LOG_SECTOR_SIZE if it is full
+    uint32_t head_seq;              //Sequence number of the head sector, 0 if the log is empty
+} perf_log_store_t;
+
+/**
+ * @brief   Called for each record, oldest first.
+ *
+ * @return  false to stop the iteration
+ */
+typedef bool (*perf_log_record_cb_t)(uint8_t type, const void *data, size_t len, void *arg);
+
+/**
+ * @brief   Find the newest sector and the end of its records.
+ *
+ * A record cut by a reset, or otherwise corrupted, ends its sector: the next
+ * record goes to a fresh sector.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_SIZE  The partition has less than two sectors
+ *  - other                 Error from esp_partition_read()
+ */
+esp_err_t perf_log_store_open(perf_log_store_t *store, const esp_partition_t *partition);
+
+/**
+ * @brief   Encode a record: header, then the data padded to 4 bytes.
+ *
+ * @return  Length of the record, 0 if it does not fit buf_len, the data is
+ *          longer than PERF_LOG_RECORD_MAX_DATA or the type is PERF_LOG_TYPE_ERASED
+ */
+size_t perf_log_record_encode(uint8_t *buf, size_t buf_len, uint8_t type, const void *data, size_t len);
+
+/**
+ * @brief   Append encoded records, with as few flash writes as possible.
+ *
+ * The records which fit the head sector are written at once, then the next
+ * sector is erased for the others.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   records is not a sequence of encoded records
+ *  - other                 Error from the flash, the log continues on the next sector
+ */
+esp_err_t perf_log_store_write(perf_log_store_t *store, const uint8_t *records, size_t len);
+
+/**
+ * @brief   Read the records from the oldest to the newest.
+ *
+ * @return
+ *  - ESP_OK    Success, or stopped by the callback
+ *  - other     Error from esp_partition_read()
+ */
+esp_err_t perf_log_store_iterate(const perf_log_store_t *store, perf_log_record_cb_t cb, void *arg);
+
+/**
+ * @brief   Erase the whole log.
+ */
+esp_err_t perf_log_store_erase(perf_log_store_t *store);
\ No newline at end of file
@@ -0,0 +1,144 @@
+/* Flash benchmark
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "flash_profiler.h"
+
+#define SECTOR_SIZE     4096
+#define MAX_WRITE_SIZE  16384
+
+static const char *TAG = "flash_benchmark";
+
+static const size_t s_write_sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+//Offsets of the first write: aligned to a page, to a word, and neither
+static const size_t s_alignments[] = { 0, 4, 1 };
+static const size_t s_erase_sizes[] = { 4096, 32768, 65536 };
+
+static void print_header(void)
+{
+    printf("| Case | Size | Offset | KiB/s | p50 us | p99 us | max us | Cache disabled us/KiB |\n");
+    printf("| --- | --- | --- | --- | --- | --- | --- | --- |\n");
+}
+
+static void print_row(const char *name, size_t size, size_t offset, size_t bytes, int64_t elapsed_us,
+                      flash_profiler_op_t op)
+{
+    flash_profiler_stats_t stats;
+    flash_profiler_get_stats(&stats);
+    const flash_profiler_stat_t *stat = &stats.ops[op];
+    const flash_profiler_stat_t *cache = &stats.ops[FLASH_PROFILER_OP_CACHE_DISABLED];
+    printf("| %s | %u | %u | %llu | %u | %u | %u | %llu |\n", name, size, offset,
+           (uint64_t)bytes * 1000000 / 1024 / elapsed_us,
+           flash_profiler_percentile(stat, 500), flash_profiler_percentile(stat, 990), stat->max_us,
+           cache->total_us * 1024 / bytes);
+}
+
+static esp_err_t bench_write(const esp_partition_t *partition, const uint8_t *data, size_t size, size_t offset)
+{
+    const size_t bytes = CONFIG_FLASH_BENCHMARK_BYTES;
+    size_t erase_len = (offset + bytes + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    esp_err_t err = esp_partition_erase_range(partition, 0, erase_len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    flash_profiler_reset();
+    int64_t time_start = esp_timer_get_time();
+    for (size_t written = 0; written < bytes; written += size) {
+        size_t len = bytes - written < size ? bytes - written : size;
+        err = esp_partition_write(partition, offset + written, data, len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    int64_t elapsed_us = esp_timer_get_time() - time_start;
+    print_row(partition->encrypted ? "write_encrypted" : "write", size, offset, bytes, elapsed_us,
+              partition->encrypted ? FLASH_PROFILER_OP_WRITE_ENCRYPTED : FLASH_PROFILER_OP_WRITE);
+    return ESP_OK;
+}
+
+static esp_err_t bench_read(const esp_partition_t *partition, uint8_t *data, size_t size, size_t offset)
+{
+    const size_t bytes = CONFIG_FLASH_BENCHMARK_BYTES;
+    flash_profiler_reset();
+    int64_t time_start = esp_timer_get_time();
+    for (size_t read = 0; read < bytes; read += size) {
+        size_t len = bytes - read < size ? bytes - read : size;
+        esp_err_t err = esp_partition_read(partition, offset + read, data, len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    print_row("read", size, offset, bytes, esp_timer_get_time() - time_start, FLASH_PROFILER_OP_READ);
+    return ESP_OK;
+}
+
+static esp_err_t bench_erase(const esp_partition_t *partition, size_t size)
+{
+    const size_t bytes = (CONFIG_FLASH_BENCHMARK_BYTES + size - 1) / size * size;
+    flash_profiler_reset();
+    int64_t time_start = esp_timer_get_time();
+    for (size_t erased = 0; erased < bytes; erased += size) {
+        esp_err_t err = esp_partition_erase_range(partition, erased, size);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    print_row("erase", size, 0, bytes, esp_timer_get_time() - time_start, FLASH_PROFILER_OP_ERASE);
+    return ESP_OK;
+}
+
+void app_main()
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                                                CONFIG_FLASH_BENCHMARK_PARTITION);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No data partition %s", CONFIG_FLASH_BENCHMARK_PARTITION);
+        return;
+    }
+    if (CONFIG_FLASH_BENCHMARK_BYTES + SECTOR_SIZE > partition->size) {
+        ESP_LOGE(TAG, "Partition %s is smaller than CONFIG_FLASH_BENCHMARK_BYTES", partition->label);
+        return;
+    }
+    uint8_t *data = malloc(MAX_WRITE_SIZE);
+    if (data == NULL) {
+        ESP_LOGE(TAG, "No memory");
+        return;
+    }
+    for (int i = 0; i < MAX_WRITE_SIZE; i++) {
+        data[i] = esp_random();
+    }
+    ESP_LOGI(TAG, "Partition %s at 0x%x, %d bytes per case%s", partition->label, partition->address,
+             CONFIG_FLASH_BENCHMARK_BYTES, partition->encrypted ? ", encrypted" : "");
+
+    print_header();
+    esp_err_t err = ESP_OK;
+    for (int i = 0; err == ESP_OK && i < sizeof(s_write_sizes) / sizeof(s_write_sizes[0]); i++) {
+        for (int j = 0; err == ESP_OK && j < sizeof(s_alignments) / sizeof(s_alignments[0]); j++) {
+            err = bench_write(partition, data, s_write_sizes[i], s_alignments[j]);
+        }
+    }
+    for (int i = 0; err == ESP_OK && i < sizeof(s_write_sizes) / sizeof(s_write_sizes[0]); i++) {
+        err = bench_read(partition, data, s_write_sizes[i], 0);
+    }
+    for (int i = 0; err == ESP_OK && i < sizeof(s_erase_sizes) / sizeof(s_erase_sizes[0]); i++) {
+        err = bench_erase(partition, s_erase_sizes[i]);
+    }
+    free(data);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Benchmark failed (%s)", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Benchmark done");
+}
@@ -0,0 +1,182 @@
+/* Prometheus metrics endpoint
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "stats_monitor.h"
+#include "metrics_server.h"
+#ifdef CONFIG_PERF_LOG
+#include "perf_log.h"
+#endif
+
+#define CHUNK_SIZE  256
+
+typedef struct {
+    httpd_req_t *req;
+    char buf[CHUNK_SIZE];
+    int len;
+    esp_err_t err;
+} chunk_writer_t;
+
+static const char *TAG = "metrics_server";
+static httpd_handle_t s_server;
+static volatile uint32_t s_ota_written;
+static volatile uint32_t s_ota_total;
+
+static void writer_flush(chunk_writer_t *writer)
+{
+    if (writer->len > 0 && writer->err == ESP_OK) {
+        writer->err = httpd_resp_send_chunk(writer->req, writer->buf, writer->len);
+    }
+    writer->len = 0;
+}
+
+//Append one line, sending the buffer as a chunk whenever the line does not fit
+static void writer_printf(chunk_writer_t *writer, const char *fmt, ...)
+{
+    va_list args;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_start(args, fmt);
+        int len = vsnprintf(writer->buf + writer->len, CHUNK_SIZE - writer->len, fmt, args);
+        va_end(args);
+        if (len < CHUNK_SIZE - writer->len) {
+            writer->len += len;
+            return;
+        }
+        writer_flush(writer);
+    }
+    ESP_LOGW(TAG, "line longer than %d bytes dropped", CHUNK_SIZE);
+}
+
+static void write_header(chunk_writer_t *writer, const char *name, const char *type, const char *help)
+{
+    writer_printf(writer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    chunk_writer_t *writer = calloc(1, sizeof(chunk_writer_t));
+    stats_monitor_snapshot_t *snapshot = malloc(sizeof(stats_monitor_snapshot_t));
+    if (writer == NULL || snapshot == NULL) {
+        free(writer);
+        free(snapshot);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "out of memory");
+        return ESP_FAIL;
+    }
+    writer->req = req;
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    if (stats_monitor_get_snapshot(snapshot) == ESP_OK) {
+        write_header(writer, "esp_stats_window_seconds", "gauge", "Length of the last stats window");
+        writer_printf(writer, "esp_stats_window_seconds %lld.%06lld\n", snapshot->window_us / 1000000, snapshot->window_us % 1000000);
+        write_header(writer, "esp_stats_windows_total", "counter", "Stats windows completed");
+        writer_printf(writer, "esp_stats_windows_total %u\n", snapshot->seq);
+
+        write_header(writer, "esp_core_load_percent", "gauge", "Busy time of a core over the last stats window");
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            if (snapshot->core_loads[core] >= 0) {
+                writer_printf(writer, "esp_core_load_percent{core=\"%d\"} %d\n", core, snapshot->core_loads[core]);
+            }
+        }
+
+        write_header(writer, "esp_task_cpu_percent", "gauge", "Run time of a task over the last stats window, in percent of one core");
+        for (int i = 0; i < snapshot->task_num; i++) {
+            const stats_monitor_task_t *task = &snapshot->tasks[i];
+            writer_printf(writer, "esp_task_cpu_percent{task=\"%s\"} %u.%02u\n", task->name, task->load_x100 / 100, task->load_x100 % 100);
+        }
+        write_header(writer, "esp_task_run_time_accumulated", "counter", "Run time of a task since the last reset, in run time stats clock periods");
+        for (int i = 0; i < snapshot->task_num; i++) {
+            const stats_monitor_task_t *task = &snapshot->tasks[i];
+            writer_printf(writer, "esp_task_run_time_accumulated{task=\"%s\"} %llu\n", task->name, task->run_time_accumulated);
+        }
+    }
+
+    write_header(writer, "esp_heap_free_bytes", "gauge", "Free heap");
+    writer_printf(writer, "esp_heap_free_bytes{caps=\"default\"} %u\n", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    writer_printf(writer, "esp_heap_free_bytes{caps=\"internal\"} %u\n", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    write_header(writer, "esp_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    writer_printf(writer, "esp_heap_min_free_bytes %u\n", esp_get_minimum_free_heap_size());
+
+    write_header(writer, "esp_ota_written_bytes", "gauge", "Bytes of the OTA image written so far");
+    writer_printf(writer, "esp_ota_written_bytes %u\n", s_ota_written);
+    write_header(writer, "esp_ota_image_bytes", "gauge", "Size of the OTA image, 0 if unknown");
+    writer_printf(writer, "esp_ota_image_bytes %u\n", s_ota_total);
+
+    writer_flush(writer);
+    esp_err_t err = writer->err;
+    if (err == ESP_OK) {
+        //Zero length chunk terminates the response
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    free(writer);
+    free(snapshot);
+    return err;
+}
+
+#ifdef CONFIG_PERF_LOG
+static esp_err_t perf_log_send(const void *data, size_t len, void *arg)
+{
+    return httpd_resp_send_chunk(arg, data, len);
+}
+
+//The records of the perf_log partition, for tools/perf_log_decode.py
+static esp_err_t perf_log_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/octet-stream");
+    esp_err_t err = perf_log_export(perf_log_send, req);
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return err;
+}
+#endif
+
+esp_err_t metrics_server_start(uint16_t port)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.ctrl_port = port + 1;
+    //Lowest application priority, scraping must not disturb the measured tasks
+    config.task_priority = 1;
+
+    esp_err_t err = httpd_start(&s_server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "httpd_start failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler,
+    };
+    httpd_register_uri_handler(s_server, &metrics_uri);
+#ifdef CONFIG_PERF_LOG
+    httpd_uri_t perf_log_uri = {
+        .uri = "/perf_log",
+        .method = HTTP_GET,
+        .handler = perf_log_get_handler,
+    };
+    httpd_register_uri_handler(s_server, &perf_log_uri);
+#endif
+    ESP_LOGI(TAG, "serving metrics on port %d", port);
+    return ESP_OK;
+}
+
+void metrics_server_set_ota_progress(uint32_t written, uint32_t total)
+{
+    s_ota_written = written;
+    s_ota_total = total;
+}
\ No newline at end of file
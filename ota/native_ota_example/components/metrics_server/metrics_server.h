@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief   Start an HTTP server exposing /metrics in the Prometheus text format.
+ *
+ * The page is rendered from the last stats_monitor snapshot and sent in
+ * chunks, so neither the sampler nor the server ever waits for the other.
+ *
+ * @return
+ *  - ESP_OK    Success
+ *  - other     Error from httpd_start()
+ */
+esp_err_t metrics_server_start(uint16_t port);
+
+/**
+ * @brief   Update the OTA progress gauges.
+ *
+ * @param   written     Bytes of the image written so far
+ * @param   total       Size of the image, or 0 if unknown
+ */
+void metrics_server_set_ota_progress(uint32_t written, uint32_t total);
\ No newline at end of file
@@ -0,0 +1,311 @@
+/* Placement of the OTA tasks on the cores
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "latency_probe.h"
+#include "ota_affinity.h"
+
+#define NVS_NAMESPACE       "ota_affinity"
+#define NVS_KEY_PLACEMENT   "placement"
+#define PROBE_PERIOD_MS     10
+
+typedef struct {
+    ota_engine_handle_t engine;
+    SemaphoreHandle_t done;
+    esp_err_t err;
+} run_t;
+
+static const char *TAG = "ota_affinity";
+
+const char *ota_affinity_mode_name(ota_affinity_mode_t mode)
+{
+    switch (mode) {
+    case OTA_AFFINITY_PINNED:
+        return "pinned";
+    case OTA_AFFINITY_UNPINNED:
+        return "unpinned";
+    case OTA_AFFINITY_ADVISED:
+        return "advised";
+    default:
+        return "unknown";
+    }
+}
+
+static const char *core_name(int core)
+{
+    static const char *names[] = { "0", "1" };
+    return (core >= 0 && core < portNUM_PROCESSORS) ? names[core] : "any";
+}
+
+static bool is_valid_core(int core)
+{
+    return core == tskNO_AFFINITY || (core >= 0 && core < portNUM_PROCESSORS);
+}
+
+static esp_err_t load_advice(ota_affinity_t *placement)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ota_affinity_t advice;
+    size_t size = sizeof(advice);
+    err = nvs_get_blob(handle, NVS_KEY_PLACEMENT, &advice, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    //Saved by a build with more cores, or another layout
+    if (size != sizeof(advice) || !is_valid_core(advice.reader_core) || !is_valid_core(advice.writer_core)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *placement = advice;
+    return ESP_OK;
+}
+
+void ota_affinity_get_placement(ota_affinity_mode_t mode, ota_affinity_t *placement)
+{
+    placement->reader_core = tskNO_AFFINITY;
+    placement->writer_core = tskNO_AFFINITY;
+    if (mode == OTA_AFFINITY_PINNED) {
+        placement->reader_core = 0;
+        placement->writer_core = 0;
+    } else if (mode == OTA_AFFINITY_ADVISED && load_advice(placement) != ESP_OK) {
+        ESP_LOGI(TAG, "No advice yet, the OTA tasks run on any core");
+    }
+}
+
+void ota_affinity_measure(const stats_monitor_snapshot_t *snapshot, const char *reader_task, const char *writer_task,
+                          ota_affinity_sample_t *sample)
+{
+    memset(sample, 0, sizeof(*sample));
+    memcpy(sample->core_loads, snapshot->core_loads, sizeof(sample->core_loads));
+    for (int i = 0; i < snapshot->task_num; i++) {
+        const stats_monitor_task_t *task = &snapshot->tasks[i];
+        if (stats_monitor_task_name_is(task->name, reader_task)) {
+            sample->reader_load_x100 = task->load_x100;
+        } else if (stats_monitor_task_name_is(task->name, writer_task)) {
+            sample->writer_load_x100 = task->load_x100;
+        }
+    }
+}
+
+//Adds the load of a task to the cores it runs on, an unpinned task counting half on each
+static void add_load(int *loads_x100, int core, int load_x100)
+{
+    if (core == tskNO_AFFINITY) {
+        for (int c = 0; c < portNUM_PROCESSORS; c++) {
+            loads_x100[c] += load_x100 / portNUM_PROCESSORS;
+        }
+    } else {
+        loads_x100[core] += load_x100;
+    }
+}
+
+static int place(const int *loads_x100, int current, int margin)
+{
+    int least = 0, most = 0;
+    for (int c = 1; c < portNUM_PROCESSORS; c++) {
+        if (loads_x100[c] < loads_x100[least]) {
+            least = c;
+        }
+        if (loads_x100[c] > loads_x100[most]) {
+            most = c;
+        }
+    }
+    //Moving for a few percent is not worth losing a placement that works
+    return (loads_x100[most] - loads_x100[least] > margin * 100) ? least : current;
+}
+
+void ota_affinity_advise(const ota_affinity_sample_t *sample, const ota_affinity_t *current, int margin,
+                         ota_affinity_t *advice)
+{
+    //Load of the other tasks on each core
+    int loads_x100[portNUM_PROCESSORS];
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        //A core without an idle task in the window was fully busy
+        loads_x100[c] = (sample->core_loads[c] >= 0) ? sample->core_loads[c] * 100 : 10000;
+    }
+    add_load(loads_x100, current->reader_core, -(int)sample->reader_load_x100);
+    add_load(loads_x100, current->writer_core, -(int)sample->writer_load_x100);
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        if (loads_x100[c] < 0) {
+            loads_x100[c] = 0;
+        }
+    }
+
+    advice->reader_core = place(loads_x100, current->reader_core, margin);
+    add_load(loads_x100, advice->reader_core, sample->reader_load_x100);
+    advice->writer_core = place(loads_x100, current->writer_core, margin);
+}
+
+esp_err_t ota_affinity_learn(const ota_affinity_sample_t *sample, const ota_affinity_t *current, int margin)
+{
+    ota_affinity_t advice;
+    ota_affinity_advise(sample, current, margin, &advice);
+    ESP_LOGI(TAG, "core loads %d%%/%d%%, reader %u.%02u%% on core %s, writer %u.%02u%% on core %s: next reader on core %s, writer on core %s",
+             sample->core_loads[0], sample->core_loads[portNUM_PROCESSORS - 1],
+             sample->reader_load_x100 / 100, sample->reader_load_x100 % 100, core_name(current->reader_core),
+             sample->writer_load_x100 / 100, sample->writer_load_x100 % 100, core_name(current->writer_core),
+             core_name(advice.reader_core), core_name(advice.writer_core));
+
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, NVS_KEY_PLACEMENT, &advice, sizeof(advice));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+//Runs an update but the activation, on the core of the placement
+static void reader_task(void *arg)
+{
+    run_t *run = arg;
+    esp_err_t err = ota_engine_check(run->engine, NULL);
+    if (err == ESP_OK) {
+        while ((err = ota_engine_perform(run->engine)) == ESP_ERR_OTA_ENGINE_IN_PROGRESS) {
+        }
+    }
+    if (err == ESP_OK) {
+        err = ota_engine_verify(run->engine);
+    }
+    run->err = err;
+    xSemaphoreGive(run->done);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t run_placement(ota_engine_handle_t engine, const ota_affinity_benchmark_config_t *config,
+                               const ota_affinity_t *placement, stats_monitor_snapshot_t *snapshot,
+                               ota_engine_stats_t *stats)
+{
+    run_t run = {
+        .engine = engine,
+        .done = xSemaphoreCreateBinary(),
+    };
+    if (run.done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ota_engine_set_writer_core(engine, placement->writer_core);
+    stats_monitor_window_handle_t window;
+    esp_err_t err = stats_monitor_begin_window(&window);
+    if (err != ESP_OK) {
+        vSemaphoreDelete(run.done);
+        return err;
+    }
+    latency_probe_reset();
+    if (xTaskCreatePinnedToCore(reader_task, config->task_name, config->stack_size, &run, config->priority,
+                                NULL, placement->reader_core) != pdPASS) {
+        stats_monitor_discard_window(window);
+        vSemaphoreDelete(run.done);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(run.done, portMAX_DELAY);
+    vSemaphoreDelete(run.done);
+    err = stats_monitor_end_window(window, snapshot);
+    ota_engine_get_stats(engine, stats);
+    ota_engine_reset(engine);
+    return run.err != ESP_OK ? run.err : err;
+}
+
+static void print_row(ota_affinity_mode_t mode, const ota_affinity_t *placement, const ota_engine_stats_t *stats,
+                      const ota_affinity_sample_t *sample, UBaseType_t probe_priority)
+{
+    printf("| %s | %s | %s | %llu | %u.%02u | %u.%02u |", ota_affinity_mode_name(mode),
+           core_name(placement->reader_core), core_name(placement->writer_core),
+           stats->time_total > 0 ? (uint64_t)stats->image_len * 1000000 / 1024 / stats->time_total : 0,
+           sample->reader_load_x100 / 100, sample->reader_load_x100 % 100,
+           sample->writer_load_x100 / 100, sample->writer_load_x100 % 100);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        printf(" %d |", sample->core_loads[core]);
+    }
+    latency_probe_result_t results[LATENCY_PROBE_MAX];
+    int result_num = latency_probe_get_results(results, LATENCY_PROBE_MAX);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        for (int i = 0; i < result_num; i++) {
+            if (results[i].core_id == core && results[i].priority == probe_priority) {
+                printf(" %u / %u |", results[i].p99_us, results[i].max_us);
+                break;
+            }
+        }
+    }
+    printf("\n");
+}
+
+esp_err_t ota_affinity_benchmark(ota_engine_handle_t engine, const ota_affinity_benchmark_config_t *config)
+{
+    if (!stats_monitor_task_name_valid(config->task_name)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        const latency_probe_config_t probe_config = {
+            .core_id = core,
+            .priority = config->probe_priority,
+            .period_ms = PROBE_PERIOD_MS,
+        };
+        esp_err_t err = latency_probe_start(&probe_config);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    stats_monitor_snapshot_t *snapshot = malloc(sizeof(stats_monitor_snapshot_t));
+    if (snapshot == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    printf("| Placement | Reader core | Writer core | KiB/s | Reader %% | Writer %% |");
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        printf(" Core %d %% |", core);
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        printf(" App p99/max us core %d |", core);
+    }
+    printf("\n| --- | --- | --- | --- | --- | --- |");
+    for (int i = 0; i < 2 * portNUM_PROCESSORS; i++) {
+        printf(" --- |");
+    }
+    printf("\n");
+
+    esp_err_t err = ESP_OK;
+    ota_affinity_t advice = { tskNO_AFFINITY, tskNO_AFFINITY };
+    for (ota_affinity_mode_t mode = 0; mode < OTA_AFFINITY_MODE_MAX && err == ESP_OK; mode++) {
+        ota_affinity_t placement;
+        if (mode == OTA_AFFINITY_ADVISED) {
+            placement = advice;
+        } else {
+            ota_affinity_get_placement(mode, &placement);
+        }
+        ota_engine_stats_t stats;
+        err = run_placement(engine, config, &placement, snapshot, &stats);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "%s run failed (%s)", ota_affinity_mode_name(mode), esp_err_to_name(err));
+            break;
+        }
+        ota_affinity_sample_t sample;
+        ota_affinity_measure(snapshot, config->task_name, OTA_ENGINE_WRITER_TASK_NAME, &sample);
+        print_row(mode, &placement, &stats, &sample, config->probe_priority);
+        if (mode == OTA_AFFINITY_UNPINNED) {
+            ota_affinity_advise(&sample, &placement, config->margin, &advice);
+        }
+    }
+    free(snapshot);
+    return err;
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "stats_monitor.h"
+#include "ota_engine.h"
+
+typedef enum {
+    OTA_AFFINITY_PINNED,        //Both tasks on core 0, with the Wi-Fi and lwIP tasks
+    OTA_AFFINITY_UNPINNED,      //Both tasks on any core
+    OTA_AFFINITY_ADVISED,       //As advised after the last update, unpinned before the first one
+    OTA_AFFINITY_MODE_MAX,
+} ota_affinity_mode_t;
+
+typedef struct {
+    int reader_core;            //OTA task, reading the network and running TLS, or tskNO_AFFINITY
+    int writer_core;            //Flash writer task of CONFIG_OTA_ENGINE_PIPELINE, or tskNO_AFFINITY
+} ota_affinity_t;
+
+//Loads measured over an update, see ota_affinity_measure()
+typedef struct {
+    int core_loads[portNUM_PROCESSORS];     //Percent, -1 if unknown
+    uint32_t reader_load_x100;              //Share of a single core, in hundredths of percent
+    uint32_t writer_load_x100;
+} ota_affinity_sample_t;
+
+/**
+ * @brief   Placement of the OTA tasks in a mode. The advice is read from NVS,
+ *          which must be initialised.
+ */
+void ota_affinity_get_placement(ota_affinity_mode_t mode, ota_affinity_t *placement);
+
+/**
+ * @brief   Take the loads of the cores and the OTA tasks from a stats window
+ *          spanning an update.
+ *
+ * Tasks are matched with stats_monitor_task_name_is().
+ *
+ * @param   writer_task     NULL without CONFIG_OTA_ENGINE_PIPELINE
+ */
+void ota_affinity_measure(const stats_monitor_snapshot_t *snapshot, const char *reader_task, const char *writer_task,
+                          ota_affinity_sample_t *sample);
+
+/**
+ * @brief   Advise a placement from the loads measured with the current one.
+ *
+ * The load of the other tasks on each core is the load of the core minus the
+ * OTA tasks pinned to it, or minus half of the unpinned ones. The reader goes
+ * to the core the other tasks use least, then the writer to the core left the
+ * least used. A task only moves when the loads of the cores differ by more
+ * than margin percent, otherwise it keeps its current placement.
+ */
+void ota_affinity_advise(const ota_affinity_sample_t *sample, const ota_affinity_t *current, int margin,
+                         ota_affinity_t *advice);
+
+/**
+ * @brief   Advise a placement from an update and save it in NVS for the next
+ *          update in OTA_AFFINITY_ADVISED mode.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - other                 Error from NVS
+ */
+esp_err_t ota_affinity_learn(const ota_affinity_sample_t *sample, const ota_affinity_t *current, int margin);
+
+typedef struct {
+    const char *task_name;      //Of the reader task, as the OTA task of the application
+    uint32_t stack_size;
+    UBaseType_t priority;
+    UBaseType_t probe_priority; //Of the latency probes standing for the application tasks, one per core
+    int margin;                 //Of ota_affinity_advise()
+} ota_affinity_benchmark_config_t;
+
+/**
+ * @brief   Download and verify the image once per placement mode and print
+ *          the throughput and the latency of the application on each core.
+ *
+ * The advised placement is computed from the unpinned run. The update is not
+ * activated, the engine is reset after each run. Starts a latency probe per
+ * core, the stats of the probes are reset at each run.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   task_name rejected by stats_monitor_task_name_valid()
+ *  - other                 First error of a run
+ */
+esp_err_t ota_affinity_benchmark(ota_engine_handle_t engine, const ota_affinity_benchmark_config_t *config);
+
+const char *ota_affinity_mode_name(ota_affinity_mode_t mode);
\ No newline at end of file
@@ -0,0 +1,184 @@
+/* CPU cost of the OTA phases
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "stats_monitor.h"
+#include "ota_cpu_cost.h"
+
+//Tasks of ESP-IDF doing the work of an update
+#define TCPIP_TASK_NAME     "tiT"
+#define WIFI_TASK_NAME      "wifi"
+#define IPC_TASK_PREFIX     "ipc"
+#define IDLE_TASK_PREFIX    "IDLE"
+
+/*
+ * Each phase is a stats_monitor window. The CPU time of the system tasks maps
+ * directly to a category. The OTA task does several kinds of work in turn: the
+ * time it spends on flash and in the stages is timed by the caller, what
+ * remains is receiving, which is mostly mbedTLS decrypting the records.
+ */
+static const char *TAG = "ota_cpu_cost";
+static const char *s_category_names[OTA_CPU_COST_MAX] = {
+    "tls", "tcpip", "wifi", "flash", "stages", "other",
+};
+static ota_cpu_cost_config_t s_config;
+static ota_cpu_cost_phase_t s_phases[OTA_CPU_COST_MAX_PHASES];
+static int s_phase_num;
+static stats_monitor_window_handle_t s_window;
+static const char *s_phase_name;
+static int64_t s_phase_start;
+
+static ota_cpu_cost_category_t category_of(const char *task_name)
+{
+    if (stats_monitor_task_name_is(task_name, TCPIP_TASK_NAME)) {
+        return OTA_CPU_COST_TCPIP;
+    }
+    if (stats_monitor_task_name_is(task_name, WIFI_TASK_NAME)) {
+        return OTA_CPU_COST_WIFI;
+    }
+    //While the flash cache is disabled the other core spins in its IPC task
+    if (stats_monitor_task_name_is(task_name, s_config.writer_task) || strncmp(task_name, IPC_TASK_PREFIX, strlen(IPC_TASK_PREFIX)) == 0) {
+        return OTA_CPU_COST_FLASH;
+    }
+    return OTA_CPU_COST_OTHER;
+}
+
+static int64_t clamp(int64_t value, int64_t max)
+{
+    if (value < 0) {
+        return 0;
+    }
+    return value < max ? value : max;
+}
+
+static void attribute(ota_cpu_cost_phase_t *phase, const stats_monitor_snapshot_t *snapshot,
+                      const ota_cpu_cost_known_t *known)
+{
+    for (int i = 0; i < snapshot->task_num; i++) {
+        const stats_monitor_task_t *task = &snapshot->tasks[i];
+        uint64_t us = task->run_time * 1000000 / snapshot->run_time_clock_hz;
+        if (strncmp(task->name, IDLE_TASK_PREFIX, strlen(IDLE_TASK_PREFIX)) == 0) {
+            continue;
+        }
+        if (!stats_monitor_task_name_is(task->name, s_config.ota_task)) {
+            phase->cpu_us[category_of(task->name)] += us;
+            continue;
+        }
+        //The known times are wall times, they may include preemption
+        int64_t flash_us = known ? clamp(known->flash_us, us) : 0;
+        int64_t stages_us = known ? clamp(known->stages_us, us - flash_us) : 0;
+        phase->cpu_us[OTA_CPU_COST_FLASH] += flash_us;
+        phase->cpu_us[OTA_CPU_COST_STAGES] += stages_us;
+        phase->cpu_us[OTA_CPU_COST_TLS] += us - flash_us - stages_us;
+    }
+}
+
+esp_err_t ota_cpu_cost_init(const ota_cpu_cost_config_t *config)
+{
+    if (s_window != NULL) {
+        stats_monitor_discard_window(s_window);
+        s_window = NULL;
+    }
+    s_phase_num = 0;
+    s_phase_name = NULL;
+    if (!stats_monitor_task_name_valid(config->ota_task) ||
+        (config->writer_task != NULL && !stats_monitor_task_name_valid(config->writer_task))) {
+        memset(&s_config, 0, sizeof(s_config));
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    return ESP_OK;
+}
+
+esp_err_t ota_cpu_cost_begin_phase(const char *name)
+{
+    if (s_window != NULL || s_config.ota_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_phase_num == OTA_CPU_COST_MAX_PHASES) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = stats_monitor_begin_window(&s_window);
+    if (err != ESP_OK) {
+        s_window = NULL;
+        return err;
+    }
+    s_phase_name = name;
+    s_phase_start = esp_timer_get_time();
+    return ESP_OK;
+}
+
+esp_err_t ota_cpu_cost_end_phase(size_t bytes, const ota_cpu_cost_known_t *known)
+{
+    if (s_window == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stats_monitor_window_handle_t window = s_window;
+    s_window = NULL;
+    stats_monitor_snapshot_t *snapshot = malloc(sizeof(stats_monitor_snapshot_t));
+    if (snapshot == NULL) {
+        stats_monitor_discard_window(window);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = stats_monitor_end_window(window, snapshot);
+    if (err == ESP_OK) {
+        ota_cpu_cost_phase_t *phase = &s_phases[s_phase_num++];
+        memset(phase, 0, sizeof(*phase));
+        phase->name = s_phase_name;
+        phase->bytes = bytes;
+        phase->window_us = esp_timer_get_time() - s_phase_start;
+        attribute(phase, snapshot, known);
+    }
+    free(snapshot);
+    s_phase_name = NULL;
+    return err;
+}
+
+const char *ota_cpu_cost_get_phase(void)
+{
+    return s_phase_name;
+}
+
+int ota_cpu_cost_get_phases(ota_cpu_cost_phase_t *phases, int max_phases)
+{
+    int n = s_phase_num < max_phases ? s_phase_num : max_phases;
+    memcpy(phases, s_phases, n * sizeof(ota_cpu_cost_phase_t));
+    return n;
+}
+
+const char *ota_cpu_cost_category_name(ota_cpu_cost_category_t category)
+{
+    return category < OTA_CPU_COST_MAX ? s_category_names[category] : "?";
+}
+
+void ota_cpu_cost_print(void)
+{
+    ESP_LOGW(TAG, "cpu us per KiB  %-10s %8s %10s %8s %8s %8s %8s %8s %8s %8s", "phase", "KiB", "window_ms",
+             "tls", "tcpip", "wifi", "flash", "stages", "other", "total");
+    for (int i = 0; i < s_phase_num; i++) {
+        const ota_cpu_cost_phase_t *phase = &s_phases[i];
+        //A phase without data, such as activating, is shown in us
+        size_t divisor = phase->bytes ? phase->bytes : 1024;
+        uint64_t per_kib[OTA_CPU_COST_MAX];
+        uint64_t total = 0;
+        for (int c = 0; c < OTA_CPU_COST_MAX; c++) {
+            per_kib[c] = phase->cpu_us[c] * 1024 / divisor;
+            total += phase->cpu_us[c];
+        }
+        ESP_LOGW(TAG, "cpu us per KiB  %-10s %8u %10lld %8llu %8llu %8llu %8llu %8llu %8llu %8llu", phase->name,
+                 phase->bytes / 1024, phase->window_us / 1000,
+                 per_kib[OTA_CPU_COST_TLS], per_kib[OTA_CPU_COST_TCPIP], per_kib[OTA_CPU_COST_WIFI],
+                 per_kib[OTA_CPU_COST_FLASH], per_kib[OTA_CPU_COST_STAGES], per_kib[OTA_CPU_COST_OTHER],
+                 total * 1024 / divisor);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define OTA_CPU_COST_MAX_PHASES     6
+
+typedef enum {
+    OTA_CPU_COST_TLS,       //OTA task time not explained by the known work below: HTTP client and mbedTLS
+    OTA_CPU_COST_TCPIP,     //lwIP task
+    OTA_CPU_COST_WIFI,      //Wi-Fi driver task
+    OTA_CPU_COST_FLASH,     //esp_ota_write() and the other core held in its IPC task while the cache is disabled
+    OTA_CPU_COST_STAGES,    //Stages of the data path and the image validator
+    OTA_CPU_COST_OTHER,     //Every other task but the idle tasks
+    OTA_CPU_COST_MAX,
+} ota_cpu_cost_category_t;
+
+typedef struct {
+    const char *ota_task;       //Task running the OTA engine
+    const char *writer_task;    //Task writing to flash, NULL if the OTA task writes
+} ota_cpu_cost_config_t;
+
+//CPU bound work of the OTA task in a phase, timed by the caller
+typedef struct {
+    int64_t flash_us;           //In esp_ota_write() (0 if the writer task writes) or reading the image back
+    int64_t stages_us;          //In the stages and the image validator
+} ota_cpu_cost_known_t;
+
+typedef struct {
+    const char *name;
+    size_t bytes;               //Bytes of the image received, written or read back in the phase
+    int64_t window_us;
+    uint64_t cpu_us[OTA_CPU_COST_MAX];
+} ota_cpu_cost_phase_t;
+
+/**
+ * @brief   Forget the phases measured so far and set the tasks to attribute.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   A task name rejected by stats_monitor_task_name_valid(); no phase
+ *                          can be measured then
+ */
+esp_err_t ota_cpu_cost_init(const ota_cpu_cost_config_t *config);
+
+/**
+ * @brief   Start measuring a phase of the update, such as "download".
+ *
+ * The phase is a stats_monitor window: the run time of every task is taken at
+ * the start and at the end, and attributed to the categories above.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE A phase is already in progress, or ota_cpu_cost_init() failed
+ *  - ESP_ERR_NO_MEM        OTA_CPU_COST_MAX_PHASES reached, or no memory for the window
+ */
+esp_err_t ota_cpu_cost_begin_phase(const char *name);
+
+/**
+ * @brief   End the phase in progress.
+ *
+ * @param   bytes   Bytes processed in the phase, divides the costs
+ * @param   known   Time the OTA task spent writing and in the stages during the phase, may be NULL
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE No phase in progress, or the phase was too short to be measured
+ *  - other                 Error from stats_monitor_end_window()
+ */
+esp_err_t ota_cpu_cost_end_phase(size_t bytes, const ota_cpu_cost_known_t *known);
+
+/**
+ * @brief   Name of the phase in progress, NULL if none.
+ */
+const char *ota_cpu_cost_get_phase(void);
+
+/**
+ * @brief   Copy the phases measured so far.
+ *
+ * @return  Number of phases copied
+ */
+int ota_cpu_cost_get_phases(ota_cpu_cost_phase_t *phases, int max_phases);
+
+const char *ota_cpu_cost_category_name(ota_cpu_cost_category_t category);
+
+/**
+ * @brief   Log the CPU microseconds per KiB of each category in each phase.
+ */
+void ota_cpu_cost_print(void);
\ No newline at end of file
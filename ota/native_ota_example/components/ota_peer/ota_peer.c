@@ -0,0 +1,328 @@
+/* LAN peer OTA
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_http_client.h"
+#include "esp_http_server.h"
+#include "mdns.h"
+#include "cJSON.h"
+#include "mbedtls/sha256.h"
+#include "ota_peer.h"
+
+#define CHUNK_SIZE          4096
+#define MANIFEST_MAX_LEN    512
+#define QUERY_TIMEOUT_MS    2000
+#define QUERY_MAX_RESULTS   8
+#define PEER_TIMEOUT_MS     5000
+
+static const char *TAG = "ota_peer";
+static httpd_handle_t s_server;
+static const esp_partition_t *s_partition;
+static ota_peer_manifest_t s_served;
+
+static void sha256_to_hex(const uint8_t *sha256, char *hex)
+{
+    for (int i = 0; i < 32; i++) {
+        sprintf(&hex[i * 2], "%02x", sha256[i]);
+    }
+}
+
+static esp_err_t hex_to_sha256(const char *hex, uint8_t *sha256)
+{
+    if (strlen(hex) != 64) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < 32; i++) {
+        unsigned int byte;
+        if (sscanf(&hex[i * 2], "%2x", &byte) != 1) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        sha256[i] = byte;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_manifest(const char *json, ota_peer_manifest_t *manifest)
+{
+    esp_err_t err = ESP_ERR_INVALID_RESPONSE;
+    cJSON *root = cJSON_Parse(json);
+    if (root == NULL) {
+        return err;
+    }
+    cJSON *version = cJSON_GetObjectItem(root, "version");
+    cJSON *size = cJSON_GetObjectItem(root, "size");
+    cJSON *sha256 = cJSON_GetObjectItem(root, "sha256");
+    if (cJSON_IsString(version) && cJSON_IsNumber(size) && cJSON_IsString(sha256)
+            && hex_to_sha256(sha256->valuestring, manifest->sha256) == ESP_OK) {
+        strlcpy(manifest->version, version->valuestring, sizeof(manifest->version));
+        manifest->size = size->valueint;
+        err = ESP_OK;
+    }
+    cJSON_Delete(root);
+    return err;
+}
+
+esp_err_t ota_peer_fetch_manifest(const char *url, const char *cert_pem, ota_peer_manifest_t *manifest)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .cert_pem = cert_pem,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return ESP_FAIL;
+    }
+    char *json = malloc(MANIFEST_MAX_LEN + 1);
+    esp_err_t err = (json != NULL) ? esp_http_client_open(client, 0) : ESP_ERR_NO_MEM;
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(client);
+        int len = 0;
+        int read;
+        while (len < MANIFEST_MAX_LEN && (read = esp_http_client_read(client, json + len, MANIFEST_MAX_LEN - len)) > 0) {
+            len += read;
+        }
+        json[len] = '\0';
+        err = parse_manifest(json, manifest);
+        esp_http_client_close(client);
+    }
+    esp_http_client_cleanup(client);
+    free(json);
+    return err;
+}
+
+static esp_err_t manifest_get_handler(httpd_req_t *req)
+{
+    char hex[65];
+    char json[MANIFEST_MAX_LEN];
+    sha256_to_hex(s_served.sha256, hex);
+    snprintf(json, sizeof(json), "{\"version\": \"%s\", \"size\": %u, \"sha256\": \"%s\"}",
+             s_served.version, s_served.size, hex);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, strlen(json));
+}
+
+//Stream the image straight from flash, one chunk at a time
+static esp_err_t image_get_handler(httpd_req_t *req)
+{
+    char *buf = malloc(CHUNK_SIZE);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "out of memory");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/octet-stream");
+    esp_err_t err = ESP_OK;
+    for (uint32_t offset = 0; offset < s_served.size && err == ESP_OK; offset += CHUNK_SIZE) {
+        size_t len = (s_served.size - offset < CHUNK_SIZE) ? s_served.size - offset : CHUNK_SIZE;
+        err = esp_partition_read(s_partition, offset, buf, len);
+        if (err == ESP_OK) {
+            err = httpd_resp_send_chunk(req, buf, len);
+        }
+    }
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+        ESP_LOGI(TAG, "served %s (%u bytes)", s_served.version, s_served.size);
+    }
+    free(buf);
+    return err;
+}
+
+static esp_err_t hash_image(const esp_partition_t *partition, uint32_t size, uint8_t *sha256)
+{
+    char *buf = malloc(CHUNK_SIZE);
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    esp_err_t err = ESP_OK;
+    for (uint32_t offset = 0; offset < size && err == ESP_OK; offset += CHUNK_SIZE) {
+        size_t len = (size - offset < CHUNK_SIZE) ? size - offset : CHUNK_SIZE;
+        err = esp_partition_read(partition, offset, buf, len);
+        mbedtls_sha256_update_ret(&ctx, (const unsigned char *)buf, len);
+    }
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+    mbedtls_sha256_free(&ctx);
+    free(buf);
+    return err;
+}
+
+esp_err_t ota_peer_serve(const esp_partition_t *partition, uint16_t port)
+{
+    if (s_server != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_pos_t pos = {
+        .offset = partition->address,
+        .size = partition->size,
+    };
+    esp_image_metadata_t data;
+    esp_app_desc_t app_desc;
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &data) != ESP_OK
+            || esp_ota_get_partition_description(partition, &app_desc) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = hash_image(partition, data.image_len, s_served.sha256);
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_partition = partition;
+    s_served.size = data.image_len;
+    strlcpy(s_served.version, app_desc.version, sizeof(s_served.version));
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.ctrl_port = port + 1;
+    err = httpd_start(&s_server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "httpd_start failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    httpd_uri_t image_uri = {
+        .uri = "/image",
+        .method = HTTP_GET,
+        .handler = image_get_handler,
+    };
+    httpd_uri_t manifest_uri = {
+        .uri = "/manifest",
+        .method = HTTP_GET,
+        .handler = manifest_get_handler,
+    };
+    httpd_register_uri_handler(s_server, &image_uri);
+    httpd_register_uri_handler(s_server, &manifest_uri);
+
+    uint8_t mac[6];
+    char hostname[32];
+    char hex[65];
+    esp_efuse_mac_get_default(mac);
+    snprintf(hostname, sizeof(hostname), "esp-ota-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    sha256_to_hex(s_served.sha256, hex);
+    mdns_txt_item_t txt[] = {
+        { "version", s_served.version },
+        { "sha256", hex },
+    };
+    err = mdns_init();
+    if (err == ESP_OK) {
+        err = mdns_hostname_set(hostname);
+    }
+    if (err == ESP_OK) {
+        err = mdns_service_add(hostname, OTA_PEER_SERVICE, OTA_PEER_PROTO, port, txt, sizeof(txt) / sizeof(txt[0]));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mdns announcement failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "serving %s from %s on port %d as %s", s_served.version, partition->label, port, hostname);
+    return ESP_OK;
+}
+
+esp_err_t ota_peer_find(const ota_peer_manifest_t *manifest, char *url, size_t url_len)
+{
+    char hex[65];
+    mdns_result_t *results = NULL;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    sha256_to_hex(manifest->sha256, hex);
+    //Nothing to do if ota_peer_serve() initialised mdns already
+    if (mdns_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (mdns_query_ptr(OTA_PEER_SERVICE, OTA_PEER_PROTO, QUERY_TIMEOUT_MS, QUERY_MAX_RESULTS, &results) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (mdns_result_t *r = results; r != NULL && err != ESP_OK; r = r->next) {
+        //The URL is built for IPv4 only
+        mdns_ip_addr_t *addr = r->addr;
+        while (addr != NULL && addr->addr.type != IPADDR_TYPE_V4) {
+            addr = addr->next;
+        }
+        if (addr == NULL) {
+            continue;
+        }
+        for (size_t i = 0; i < r->txt_count; i++) {
+            if (strcmp(r->txt[i].key, "sha256") == 0 && r->txt[i].value != NULL && strcmp(r->txt[i].value, hex) == 0) {
+                snprintf(url, url_len, "http://" IPSTR ":%d/image", IP2STR(&addr->addr.u_addr.ip4), r->port);
+                ESP_LOGI(TAG, "%s serves %s", r->hostname ? r->hostname : "peer", manifest->version);
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    mdns_query_results_free(results);
+    return err;
+}
+
+esp_err_t ota_peer_download(const char *url, const ota_peer_manifest_t *manifest, const esp_partition_t *partition)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = PEER_TIMEOUT_MS,
+    };
+    esp_ota_handle_t update_handle = 0;
+    uint8_t sha256[32];
+    uint32_t received = 0;
+    char *buf = malloc(CHUNK_SIZE);
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    esp_err_t err = (buf != NULL && client != NULL) ? esp_http_client_open(client, 0) : ESP_ERR_NO_MEM;
+    if (err != ESP_OK) {
+        goto exit;
+    }
+    esp_http_client_fetch_headers(client);
+
+    //Only the size of the image is erased
+    err = esp_ota_begin(partition, manifest->size, &update_handle);
+    if (err != ESP_OK) {
+        goto exit;
+    }
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    int read;
+    while ((read = esp_http_client_read(client, buf, CHUNK_SIZE)) > 0) {
+        if (received + read > manifest->size) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        mbedtls_sha256_update_ret(&ctx, (const unsigned char *)buf, read);
+        err = esp_ota_write(update_handle, buf, read);
+        if (err != ESP_OK) {
+            break;
+        }
+        received += read;
+    }
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+    mbedtls_sha256_free(&ctx);
+    if (err == ESP_OK && (read < 0 || received != manifest->size)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK && memcmp(sha256, manifest->sha256, sizeof(sha256)) != 0) {
+        ESP_LOGE(TAG, "SHA-256 of the image from %s does not match the manifest", url);
+        err = ESP_ERR_INVALID_CRC;
+    }
+    //Also releases the handle when the image was rejected
+    esp_err_t end_err = esp_ota_end(update_handle);
+    if (err == ESP_OK) {
+        err = end_err;
+    }
+    ESP_LOGI(TAG, "%u bytes from %s (%s)", received, url, esp_err_to_name(err));
+
+exit:
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    free(buf);
+    return err;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define OTA_PEER_SERVICE    "_esp-ota"
+#define OTA_PEER_PROTO      "_tcp"
+
+typedef struct {
+    char version[32];
+    uint32_t size;
+    uint8_t sha256[32];     //SHA-256 of the whole image file
+} ota_peer_manifest_t;
+
+/**
+ * @brief   Download and parse a manifest such as
+ *          {"version": "1.1", "size": 925184, "sha256": "<64 hex digits>"}
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_RESPONSE  Manifest could not be parsed
+ *  - other                 Error from esp_http_client
+ */
+esp_err_t ota_peer_fetch_manifest(const char *url, const char *cert_pem, ota_peer_manifest_t *manifest);
+
+/**
+ * @brief   Serve the image of an app partition to peers on the LAN.
+ *
+ * Hashes the image, starts an HTTP server with GET /image, streamed straight
+ * from flash, and GET /manifest, and announces both with mDNS as an
+ * OTA_PEER_SERVICE service whose TXT records carry the version and SHA-256.
+ * Only serve partitions holding a confirmed image.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE Already serving
+ *  - ESP_ERR_NOT_FOUND     No valid image in the partition
+ *  - other                 Error from httpd or mdns
+ */
+esp_err_t ota_peer_serve(const esp_partition_t *partition, uint16_t port);
+
+/**
+ * @brief   Look for a peer serving the image of a manifest. Peers without an
+ *          IPv4 address are skipped.
+ *
+ * @param   url     Receives the URL of the image on the peer
+ *
+ * @return
+ *  - ESP_OK                Found
+ *  - ESP_ERR_NOT_FOUND     No peer serves this image
+ */
+esp_err_t ota_peer_find(const ota_peer_manifest_t *manifest, char *url, size_t url_len);
+
+/**
+ * @brief   Download an image from a peer to a partition.
+ *
+ * The image is hashed while it is written and only accepted when its size and
+ * SHA-256 match the manifest, which is what makes an unauthenticated peer
+ * safe to use. The boot partition is not changed.
+ *
+ * @return
+ *  - ESP_OK                Image written and verified
+ *  - ESP_ERR_INVALID_SIZE  Size does not match the manifest
+ *  - ESP_ERR_INVALID_CRC   SHA-256 does not match the manifest
+ *  - other                 Error from esp_http_client or app_update
+ */
+esp_err_t ota_peer_download(const char *url, const ota_peer_manifest_t *manifest, const esp_partition_t *partition);
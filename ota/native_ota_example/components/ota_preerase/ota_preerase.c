@@ -0,0 +1,230 @@
+/* OTA slot pre-erase
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "nvs.h"
+#include "stats_monitor.h"
+#include "ota_preerase.h"
+
+#define BLOCK_SIZE          0x10000
+#define BLOCKS_MAX          256         //16 MiB, the largest flash
+#define IDLE_POLL_MS        100
+#define TASK_PRIO           (tskIDLE_PRIORITY + 1)
+#define NVS_NAMESPACE       "ota_preerase"
+#define NVS_KEY_ADDRESS     "address"
+#define NVS_KEY_BITMAP      "bitmap"
+
+/*
+ * One bit per 64 KiB block of the update partition, set once the block has
+ * been erased. The bitmap is saved to NVS together with the address of the
+ * partition, which changes after every successful update.
+ */
+static const char *TAG = "ota_preerase";
+static const esp_partition_t *s_partition;
+static uint8_t s_bitmap[BLOCKS_MAX / 8];
+static int s_block_num;
+static ota_preerase_config_t s_config;
+static volatile bool s_stop;
+static SemaphoreHandle_t s_done;
+
+static bool is_erased(int block)
+{
+    return s_bitmap[block / 8] & (1 << (block % 8));
+}
+
+static void set_erased(int block)
+{
+    s_bitmap[block / 8] |= 1 << (block % 8);
+}
+
+static void load_bitmap(void)
+{
+    nvs_handle handle;
+    uint32_t address = 0;
+    size_t size = sizeof(s_bitmap);
+
+    memset(s_bitmap, 0, sizeof(s_bitmap));
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_u32(handle, NVS_KEY_ADDRESS, &address) != ESP_OK || address != s_partition->address
+            || nvs_get_blob(handle, NVS_KEY_BITMAP, s_bitmap, &size) != ESP_OK) {
+        //Bitmap of the other slot, or none
+        memset(s_bitmap, 0, sizeof(s_bitmap));
+    }
+    nvs_close(handle);
+}
+
+static esp_err_t save_bitmap(bool valid)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (valid) {
+        err = nvs_set_u32(handle, NVS_KEY_ADDRESS, s_partition->address);
+        if (err == ESP_OK) {
+            err = nvs_set_blob(handle, NVS_KEY_BITMAP, s_bitmap, sizeof(s_bitmap));
+        }
+    } else {
+        err = nvs_erase_all(handle);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static esp_err_t erase_block(int block)
+{
+    size_t offset = block * BLOCK_SIZE;
+    size_t len = (s_partition->size - offset < BLOCK_SIZE) ? s_partition->size - offset : BLOCK_SIZE;
+    esp_err_t err = esp_partition_erase_range(s_partition, offset, len);
+    if (err == ESP_OK) {
+        set_erased(block);
+    }
+    return err;
+}
+
+static bool system_is_idle(void)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        //-1 means no stats window completed yet, erase anyway
+        if (stats_monitor_get_core_load(core) >= s_config.idle_load) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void preerase_task(void *arg)
+{
+    int erased = 0;
+    int64_t busy_us = 0;
+    for (int block = 0; block < s_block_num && !s_stop; block++) {
+        if (is_erased(block)) {
+            continue;
+        }
+        while (!s_stop && !system_is_idle()) {
+            vTaskDelay(pdMS_TO_TICKS(IDLE_POLL_MS));
+        }
+        if (s_stop) {
+            break;
+        }
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = erase_block(block);
+        busy_us += esp_timer_get_time() - start;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "erase of block %d failed (%s)", block, esp_err_to_name(err));
+            break;
+        }
+        erased++;
+        save_bitmap(true);
+        vTaskDelay(pdMS_TO_TICKS(s_config.interval_ms));
+    }
+    ESP_LOGI(TAG, "%s: %d blocks erased in %lld ms%s", s_partition->label, erased, busy_us / 1000,
+             s_stop ? ", stopped" : "");
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t ota_preerase_start(const ota_preerase_config_t *config)
+{
+    if (s_done != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGW(TAG, "running app not confirmed yet, the update partition is kept for rollback");
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_partition = esp_ota_get_next_update_partition(NULL);
+    if (s_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_config = *config;
+    s_block_num = (s_partition->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (s_block_num > BLOCKS_MAX) {
+        s_block_num = BLOCKS_MAX;
+    }
+    load_bitmap();
+
+    s_done = xSemaphoreCreateBinary();
+    if (s_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_stop = false;
+    if (xTaskCreate(preerase_task, "ota_preerase", 2048, NULL, TASK_PRIO, NULL) != pdPASS) {
+        vSemaphoreDelete(s_done);
+        s_done = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+//Wait for the background task to finish the block being erased
+static void stop_task(void)
+{
+    if (s_done != NULL) {
+        s_stop = true;
+        xSemaphoreTake(s_done, portMAX_DELAY);
+        vSemaphoreDelete(s_done);
+        s_done = NULL;
+    }
+}
+
+esp_err_t ota_preerase_begin_update(const esp_partition_t *partition)
+{
+    stop_task();
+    if (partition != s_partition) {
+        //Not the partition being pre-erased, erase every block on demand
+        s_partition = partition;
+        s_block_num = (partition->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        memset(s_bitmap, 0, sizeof(s_bitmap));
+    }
+    int clean = 0;
+    for (int block = 0; block < s_block_num; block++) {
+        clean += is_erased(block) ? 1 : 0;
+    }
+    ESP_LOGI(TAG, "%s: %d of %d blocks already erased", partition->label, clean, s_block_num);
+    return save_bitmap(false);
+}
+
+esp_err_t ota_preerase_ensure(size_t offset, size_t len)
+{
+    if (s_partition == NULL || len == 0) {
+        return ESP_OK;
+    }
+    int last = (offset + len - 1) / BLOCK_SIZE;
+    for (int block = offset / BLOCK_SIZE; block <= last && block < s_block_num; block++) {
+        if (!is_erased(block)) {
+            esp_err_t err = erase_block(block);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+void ota_preerase_invalidate(void)
+{
+    stop_task();
+    memset(s_bitmap, 0, sizeof(s_bitmap));
+    save_bitmap(false);
+}
\ No newline at end of file
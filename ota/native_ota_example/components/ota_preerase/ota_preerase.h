@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+typedef struct {
+    int idle_load;          //Erase only while the load of every core is below this, in percent
+    uint32_t interval_ms;   //Pause between two blocks
+} ota_preerase_config_t;
+
+/**
+ * @brief   Start erasing the next update partition in the background.
+ *
+ * A low priority task erases the partition in 64 KiB blocks while the system
+ * is idle, as measured by stats_monitor. Erased blocks are recorded in NVS, so
+ * the work survives reboots. NVS must be initialised.
+ *
+ * @note    Nothing is erased while the running app is pending verification,
+ *          as the update partition then holds the app to roll back to.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE Running app not confirmed yet, or already started
+ *  - ESP_ERR_NOT_FOUND     No update partition
+ *  - ESP_ERR_NO_MEM        Task could not be created
+ */
+esp_err_t ota_preerase_start(const ota_preerase_config_t *config);
+
+/**
+ * @brief   Stop the background erase and take over the partition for an update.
+ *
+ * Waits for the block being erased, then forgets the erased blocks in NVS
+ * before anything is written, so an interrupted update can never leave blocks
+ * recorded as erased. Call before esp_ota_begin(), which then only needs to
+ * erase the first sector (pass an image size of 1).
+ *
+ * If the partition is not the one pre-erased, every block is erased on demand.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - other                 Error from NVS
+ */
+esp_err_t ota_preerase_begin_update(const esp_partition_t *partition);
+
+/**
+ * @brief   Erase the blocks of [offset, offset + len) not erased yet.
+ *
+ * Call before every esp_ota_write() of an update started with
+ * ota_preerase_begin_update(). Writes must be sequential.
+ */
+esp_err_t ota_preerase_ensure(size_t offset, size_t len);
+
+/**
+ * @brief   Stop the background erase and forget the erased blocks, for code
+ *          writing to the update partition without ota_preerase_ensure().
+ */
+void ota_preerase_invalidate(void);
\ No newline at end of file
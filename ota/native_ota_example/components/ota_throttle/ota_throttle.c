@@ -0,0 +1,132 @@
+/* OTA throttle
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "stats_monitor.h"
+#include "ota_throttle.h"
+
+#define CPU_BURST_US        20000   //Largest amount of CPU time the task may spend in one go
+#define FLASH_BURST_BYTES   (16 * 1024)
+#define SCALE_ONE           1000    //Fixed point 1.0 of the CPU charge scale
+#define SCALE_MIN           100
+#define SCALE_MAX           8000
+
+/*
+ * Two token buckets, one counting CPU microseconds and one counting flash
+ * bytes. Both refill with wall time at the configured rate and are charged
+ * after every chunk. The wall time of a chunk overestimates its CPU cost
+ * because the task also blocks on the socket, so the CPU charge is scaled by a
+ * factor which is corrected every stats window using the load of the task
+ * measured by stats_monitor.
+ */
+typedef struct {
+    int64_t tokens;
+    int64_t capacity;
+    uint32_t rate;          //Tokens per second
+} bucket_t;
+
+static const char *TAG = "ota_throttle";
+static ota_throttle_config_t s_config;
+static bucket_t s_cpu_bucket;
+static bucket_t s_flash_bucket;
+static int64_t s_last_refill;
+static uint32_t s_cpu_scale = SCALE_ONE;
+static uint32_t s_last_window_seq;
+
+static void bucket_init(bucket_t *bucket, uint32_t rate, int64_t capacity)
+{
+    bucket->rate = rate;
+    bucket->capacity = capacity;
+    bucket->tokens = capacity;
+}
+
+static void bucket_refill(bucket_t *bucket, int64_t elapsed_us)
+{
+    bucket->tokens += elapsed_us * bucket->rate / 1000000;
+    if (bucket->tokens > bucket->capacity) {
+        bucket->tokens = bucket->capacity;
+    }
+}
+
+//Time until the bucket is out of debt, in microseconds
+static int64_t bucket_debt_us(const bucket_t *bucket)
+{
+    if (bucket->tokens >= 0) {
+        return 0;
+    }
+    return (-bucket->tokens * 1000000) / bucket->rate + 1;
+}
+
+static void refill(void)
+{
+    int64_t now = esp_timer_get_time();
+    bucket_refill(&s_cpu_bucket, now - s_last_refill);
+    bucket_refill(&s_flash_bucket, now - s_last_refill);
+    s_last_refill = now;
+}
+
+static void update_cpu_scale(void)
+{
+    uint32_t seq = stats_monitor_get_window_seq();
+    if (seq == s_last_window_seq) {
+        return;
+    }
+    s_last_window_seq = seq;
+
+    int load = stats_monitor_get_task_load(s_config.task_name);
+    if (load <= 0) {
+        return;
+    }
+    uint32_t scale = s_cpu_scale * (uint32_t)load / s_config.cpu_percent;
+    if (scale < SCALE_MIN) {
+        scale = SCALE_MIN;
+    } else if (scale > SCALE_MAX) {
+        scale = SCALE_MAX;
+    }
+    ESP_LOGD(TAG, "%s load %d%% (budget %d%%), cpu charge scale %d -> %d",
+             s_config.task_name, load, s_config.cpu_percent, s_cpu_scale, scale);
+    s_cpu_scale = scale;
+}
+
+void ota_throttle_init(const ota_throttle_config_t *config)
+{
+    s_config = *config;
+    bucket_init(&s_cpu_bucket, config->cpu_percent * 10000, CPU_BURST_US);
+    bucket_init(&s_flash_bucket, config->flash_kbps * 1024, FLASH_BURST_BYTES);
+    s_last_refill = esp_timer_get_time();
+    s_cpu_scale = SCALE_ONE;
+    s_last_window_seq = stats_monitor_get_window_seq();
+    ESP_LOGI(TAG, "budget: %d%% cpu, %d KiB/s flash", config->cpu_percent, config->flash_kbps);
+}
+
+void ota_throttle_account(int64_t busy_us, size_t bytes_written)
+{
+    update_cpu_scale();
+    refill();
+    s_cpu_bucket.tokens -= busy_us * s_cpu_scale / SCALE_ONE;
+    s_flash_bucket.tokens -= bytes_written;
+}
+
+void ota_throttle_wait(void)
+{
+    while (1) {
+        refill();
+        int64_t cpu_debt = bucket_debt_us(&s_cpu_bucket);
+        int64_t flash_debt = bucket_debt_us(&s_flash_bucket);
+        int64_t debt = (cpu_debt > flash_debt) ? cpu_debt : flash_debt;
+        if (debt == 0) {
+            return;
+        }
+        TickType_t ticks = pdMS_TO_TICKS((debt + 999) / 1000);
+        vTaskDelay(ticks > 0 ? ticks : 1);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t cpu_percent;   //CPU budget of the throttled task, in percent of one core
+    uint32_t flash_kbps;    //Flash write budget, in KiB per second
+    const char *task_name;  //Task whose measured load is fed back from stats_monitor
+} ota_throttle_config_t;
+
+/**
+ * @brief   Set up the CPU and flash token buckets. Both start full.
+ */
+void ota_throttle_init(const ota_throttle_config_t *config);
+
+/**
+ * @brief   Charge the buckets for one chunk of work.
+ *
+ * @param   busy_us         Time spent processing the chunk (read + write)
+ * @param   bytes_written   Bytes written to flash for the chunk
+ */
+void ota_throttle_account(int64_t busy_us, size_t bytes_written);
+
+/**
+ * @brief   Block the calling task until both buckets are out of debt again.
+ */
+void ota_throttle_wait(void);
@@ -0,0 +1,150 @@
+/* Performance history of the OTA example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "perf_log.h"
+#include "ota_cpu_cost.h"
+#include "perf_history.h"
+
+#define FLUSH_TIMEOUT_MS    2000
+
+typedef struct {
+    char name[PERF_LOG_NAME_LEN];
+    uint64_t load_x100_sum;
+} task_sum_t;
+
+static const char *TAG = "perf_history";
+//Only touched by the periodic sampler
+static task_sum_t s_task_sums[STATS_MONITOR_SNAPSHOT_TASKS];
+static int s_task_num;
+static uint64_t s_core_load_sums[2];
+static uint32_t s_windows;
+
+void perf_history_window(const stats_monitor_snapshot_t *snapshot, void *arg)
+{
+    for (int i = 0; i < snapshot->task_num; i++) {
+        const stats_monitor_task_t *task = &snapshot->tasks[i];
+        int j = 0;
+        while (j < s_task_num && strncmp(s_task_sums[j].name, task->name, PERF_LOG_NAME_LEN) != 0) {
+            j++;
+        }
+        if (j == s_task_num) {
+            if (s_task_num == STATS_MONITOR_SNAPSHOT_TASKS) {
+                continue;
+            }
+            strlcpy(s_task_sums[j].name, task->name, PERF_LOG_NAME_LEN);
+            s_task_sums[j].load_x100_sum = 0;
+            s_task_num++;
+        }
+        s_task_sums[j].load_x100_sum += task->load_x100;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS && core < 2; core++) {
+        s_core_load_sums[core] += snapshot->core_loads[core] > 0 ? snapshot->core_loads[core] : 0;
+    }
+    if (++s_windows < CONFIG_OTA_PERF_HISTORY_WINDOWS) {
+        return;
+    }
+
+    perf_log_cpu_t record = {
+        .uptime_s = esp_timer_get_time() / 1000000,
+        .windows = s_windows,
+        .heap_free = esp_get_free_heap_size(),
+        .heap_min_free = esp_get_minimum_free_heap_size(),
+        .core_load = { s_core_load_sums[0] / s_windows, s_core_load_sums[1] / s_windows },
+    };
+    //Busiest tasks first, the idle tasks are in the core loads
+    while (record.task_num < PERF_LOG_CPU_TASKS) {
+        int busiest = -1;
+        for (int j = 0; j < s_task_num; j++) {
+            if (strncmp(s_task_sums[j].name, "IDLE", 4) != 0 && s_task_sums[j].load_x100_sum > 0
+                    && (busiest < 0 || s_task_sums[j].load_x100_sum > s_task_sums[busiest].load_x100_sum)) {
+                busiest = j;
+            }
+        }
+        if (busiest < 0) {
+            break;
+        }
+        perf_log_task_load_t *task = &record.tasks[record.task_num++];
+        memcpy(task->name, s_task_sums[busiest].name, PERF_LOG_NAME_LEN);
+        task->load_x100 = s_task_sums[busiest].load_x100_sum / s_windows;
+        s_task_sums[busiest].load_x100_sum = 0;
+    }
+    perf_log_append(PERF_LOG_TYPE_CPU, &record, sizeof(record));
+    s_task_num = 0;
+    memset(s_core_load_sums, 0, sizeof(s_core_load_sums));
+    s_windows = 0;
+}
+
+void perf_history_log_ota(esp_err_t result, const ota_engine_stats_t *stats)
+{
+    perf_log_ota_t record = {
+        .result = result,
+        .image_len = stats->image_len,
+        .time_total_us = stats->time_total,
+        .time_http_us = stats->time_http,
+        .time_write_us = stats->time_write,
+        .time_process_us = stats->time_process,
+        .time_validate_us = stats->time_validate,
+        .time_first_write_us = stats->time_first_write,
+        .heap_min_free = esp_get_minimum_free_heap_size(),
+    };
+    ota_cpu_cost_phase_t phases[PERF_LOG_OTA_PHASES];
+    record.phase_num = ota_cpu_cost_get_phases(phases, PERF_LOG_OTA_PHASES);
+    for (int i = 0; i < record.phase_num; i++) {
+        perf_log_phase_t *phase = &record.phases[i];
+        strlcpy(phase->name, phases[i].name, sizeof(phase->name));
+        phase->window_us = phases[i].window_us;
+        for (int c = 0; c < OTA_CPU_COST_MAX; c++) {
+            phase->cpu_us += phases[i].cpu_us[c];
+        }
+    }
+    perf_log_append(PERF_LOG_TYPE_OTA, &record, sizeof(record));
+    if (perf_log_flush(FLUSH_TIMEOUT_MS) != ESP_OK) {
+        ESP_LOGW(TAG, "update summary not written");
+    }
+}
+
+typedef struct {
+    perf_log_boot_t boot;
+    int updates;
+} print_state_t;
+
+static bool print_record(uint8_t type, const void *data, size_t len, void *arg)
+{
+    print_state_t *state = arg;
+    if (type == PERF_LOG_TYPE_BOOT && len >= sizeof(perf_log_boot_t)) {
+        memcpy(&state->boot, data, sizeof(perf_log_boot_t));
+    } else if (type == PERF_LOG_TYPE_OTA && len >= sizeof(perf_log_ota_t)) {
+        perf_log_ota_t ota;
+        memcpy(&ota, data, sizeof(ota));
+        ESP_LOGI(TAG, "boot %u %.32s: update %s, %u bytes, total=%u ms write=%u ms first_write=%u ms heap_min=%u",
+                 state->boot.boot, state->boot.version, ota.result == ESP_OK ? "ok" : esp_err_to_name(ota.result),
+                 ota.image_len, ota.time_total_us / 1000, ota.time_write_us / 1000, ota.time_first_write_us / 1000,
+                 ota.heap_min_free);
+        state->updates++;
+    }
+    return true;
+}
+
+esp_err_t perf_history_start(void)
+{
+    esp_err_t err = perf_log_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    //Updates made by each version, to compare them on the same device
+    print_state_t state = { 0 };
+    err = perf_log_query(PERF_LOG_TYPE_ANY, print_record, &state);
+    ESP_LOGI(TAG, "%d updates in the history", state.updates);
+    return err;
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "esp_err.h"
+#include "stats_monitor.h"
+#include "ota_engine.h"
+
+/**
+ * Records of the example for the perf_log partition: CPU load averages and
+ * heap low-water marks while running, and a summary of each update.
+ */
+
+/**
+ * @brief   Start the performance log and print the updates it recorded.
+ */
+esp_err_t perf_history_start(void);
+
+/**
+ * @brief   Callback of the periodic stats sampler, see stats_monitor_start_periodic().
+ *
+ * Averages the loads over CONFIG_OTA_PERF_HISTORY_WINDOWS windows, then
+ * appends them with the heap low-water mark to the log.
+ */
+void perf_history_window(const stats_monitor_snapshot_t *snapshot, void *arg);
+
+/**
+ * @brief   Append the summary of an update, with its CPU cost phases, and
+ *          wait until it is in flash, e.g. before a restart.
+ */
+void perf_history_log_ota(esp_err_t result, const ota_engine_stats_t *stats);
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esp_err.h"
+
+/**
+ * @brief   Allocate the per-core trace buffers. Called by sched_trace_start()
+ *          if needed.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        Buffers could not be allocated
+ *  - ESP_ERR_NOT_SUPPORTED CONFIG_STATS_MONITOR_SCHED_TRACE is not set
+ */
+esp_err_t sched_trace_init(void);
+
+/**
+ * @brief   Clear the buffers and start recording events.
+ */
+esp_err_t sched_trace_start(void);
+
+/**
+ * @brief   Stop recording events. The buffers are kept until the next start.
+ */
+void sched_trace_stop(void);
+
+/**
+ * @brief   Stop recording and print the trace on the console, framed by
+ *          "SCHED_TRACE BEGIN" and "SCHED_TRACE END" lines.
+ *
+ * Feed the console output to sched_trace_to_json.py to get a Chrome trace.
+ */
+void sched_trace_dump(void);
@@ -0,0 +1,18 @@
+/* FreeRTOS trace macros for sched_trace
+
+   Force-included into every C file when CONFIG_STATS_MONITOR_SCHED_TRACE is
+   set, so it must not include any other header.
+*/
+#pragma once
+
+void sched_trace_task_switched_in(void *task);
+void sched_trace_task_switched_out(void *task);
+void sched_trace_isr_enter(int irq);
+void sched_trace_isr_exit(void);
+
+//pxCurrentTCB is only in scope where FreeRTOS expands these macros, in tasks.c
+#define traceTASK_SWITCHED_IN()         sched_trace_task_switched_in(pxCurrentTCB[xPortGetCoreID()])
+#define traceTASK_SWITCHED_OUT()        sched_trace_task_switched_out(pxCurrentTCB[xPortGetCoreID()])
+#define traceISR_ENTER(n)               sched_trace_isr_enter(n)
+#define traceISR_EXIT()                 sched_trace_isr_exit()
+#define traceISR_EXIT_TO_SCHEDULER()    sched_trace_isr_exit()
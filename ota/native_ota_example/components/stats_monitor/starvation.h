@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * Starvation and priority inversion detector, run by the periodic sampler of
+ * stats_monitor at the end of each window with CONFIG_STATS_MONITOR_STARVATION.
+ *
+ * A task is starved in a window if it was Ready at both ends of the window
+ * and its run time counter did not advance: it could have run the whole time
+ * but higher priority tasks kept its core. The task watchdog does not see
+ * this as long as the idle tasks it watches get some time.
+ *
+ * A task runs above its base priority while it holds a mutex a higher
+ * priority task waits for (priority inheritance). When that lasts several
+ * windows, the waiter is blocked behind a lower priority task.
+ */
+
+typedef enum {
+    STARVATION_EVENT_STARVED,           //Ready without running for CONFIG_STATS_MONITOR_STARVATION_WINDOWS windows
+    STARVATION_EVENT_INVERSION,         //Priority inherited for CONFIG_STATS_MONITOR_INVERSION_WINDOWS windows
+    STARVATION_EVENT_MAX,
+} starvation_event_type_t;
+
+typedef struct {
+    starvation_event_type_t type;
+    uint32_t seq;                               //Window of the finding, see stats_monitor_get_window_seq()
+    uint32_t windows;                           //Consecutive windows in that state
+    char task[configMAX_TASK_NAME_LEN];         //Starved task, or mutex holder
+    UBaseType_t base_priority;
+    UBaseType_t current_priority;
+    //Starved: busiest task of a priority at least as high in the window.
+    //Inversion: a blocked task at the inherited priority, likely the waiter.
+    //Empty if none.
+    char other[configMAX_TASK_NAME_LEN];
+    UBaseType_t other_priority;
+    uint32_t suppressed;                        //Events dropped by the rate limit since the last one reported
+} starvation_event_t;
+
+/**
+ * @brief   Called for each event, in the task of the sampler, after it is logged.
+ */
+typedef void (*starvation_event_cb_t)(const starvation_event_t *event, void *arg);
+
+/**
+ * @brief   Set the callback receiving the events, NULL to only log them.
+ */
+void starvation_set_callback(starvation_event_cb_t callback, void *arg);
+
+/**
+ * @brief   Events of a type found since boot, reported or dropped by the rate limit.
+ */
+uint32_t starvation_get_count(starvation_event_type_t type);
+
+const char *starvation_event_name(starvation_event_type_t type);
+
+/**
+ * @brief   Check the tasks of a window. Called by stats_monitor.
+ *
+ * @param   start           States of the tasks at the start of the window
+ * @param   start_running   Task running on each core at the start of the window
+ * @param   end             States of the tasks at the end of the window
+ * @param   end_running     Task running on each core at the end of the window
+ */
+void starvation_check(const TaskStatus_t *start, UBaseType_t start_num, const TaskHandle_t *start_running,
+                      const TaskStatus_t *end, UBaseType_t end_num, const TaskHandle_t *end_running, uint32_t seq);
\ No newline at end of file
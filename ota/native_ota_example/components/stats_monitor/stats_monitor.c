@@ -7,148 +7,359 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp32/clk.h"
 #include "stats_monitor.h"
+#include "latency_probe.h"
+#include "starvation.h"
 
-#define STATS_TICKS         pdMS_TO_TICKS(1000)
+#define STATS_TICKS         pdMS_TO_TICKS(CONFIG_STATS_MONITOR_WINDOW_MS)
 #define STATS_TASK_PRIO     3
-#define ARRAY_SIZE_OFFSET   5   //Increase this if print_real_time_stats returns ESP_ERR_INVALID_SIZE
+#define ARRAY_SIZE_OFFSET   5   //Increase this if a window returns ESP_ERR_INVALID_SIZE
 #define ACCUMULATED_INFO_NUM 16
+#define RUN_TIME_TASKS      64  //Tasks whose run time counters are extended to 64 bit
+#define RUN_TIME_REFRESHES  4   //Refreshes of the 64 bit run times per wrap of the 32 bit counters
 
+#ifdef CONFIG_STATS_MONITOR_PRINT
+#define STATS_PRINTF(...)   printf(__VA_ARGS__)
+#else
+//Keep the arguments referenced so values only computed for printing do not warn
+#define STATS_PRINTF(...)   do { if (0) printf(__VA_ARGS__); } while (0)
+#endif
+
+//Rate of the FreeRTOS run time stats clock, see portGET_RUN_TIME_COUNTER_VALUE
+#ifdef CONFIG_FREERTOS_RUN_TIME_STATS_USING_CPU_CLK
+#define RUN_TIME_CLOCK_HZ   ((uint64_t)esp_clk_cpu_freq())
+#else
+#define RUN_TIME_CLOCK_HZ   1000000ULL
+#endif
+
+//Names are copied, the TCB of a task is freed when it deletes itself
 typedef struct {
-    char *task_name;
+    char task_name[configMAX_TASK_NAME_LEN];    //Empty for an unused entry
     uint64_t time;
+    uint32_t load;      //Share of a single core used in the last window, in percent
     bool is_running;
 } accumulated_info_t;
 
 static const char *TAG = "stats_monitor";
 static accumulated_info_t s_accumulated_infos[ACCUMULATED_INFO_NUM];
+static portMUX_TYPE s_accumulated_lock = portMUX_INITIALIZER_UNLOCKED;
+static int s_core_loads[portNUM_PROCESSORS] = { [0 ... portNUM_PROCESSORS - 1] = -1 };
+static volatile uint32_t s_window_seq;
+//Published snapshot and the one being filled by the current window
+static stats_monitor_snapshot_t s_snapshots[2];
+static stats_monitor_snapshot_t *s_published_snapshot;
+static portMUX_TYPE s_snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
 
 void stats_monitor_reset_accumulated_infos(void) {
-    for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
-        s_accumulated_infos[i].task_name = NULL;
-        s_accumulated_infos[i].time = 0;
-        s_accumulated_infos[i].is_running = false;
-    }
+    portENTER_CRITICAL(&s_accumulated_lock);
+    memset(s_accumulated_infos, 0, sizeof(s_accumulated_infos));
+    portEXIT_CRITICAL(&s_accumulated_lock);
+    latency_probe_reset();
     ESP_LOGI(TAG, "reseted accumulated infos");
 }
 
-static void set_accumulated_info(accumulated_info_t *info) {
+//Returns the accumulated time of the task, or the time of info if the buffer is full
+static uint64_t set_accumulated_info(const accumulated_info_t *info) {
     uint8_t dst_idx = 255;
+    uint64_t time = info->time;
+    portENTER_CRITICAL(&s_accumulated_lock);
     for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
-        if (s_accumulated_infos[i].task_name == info->task_name) {
+        if (strcmp(s_accumulated_infos[i].task_name, info->task_name) == 0) {
             s_accumulated_infos[i].time += info->time;
+            s_accumulated_infos[i].load = info->load;
             s_accumulated_infos[i].is_running = true;
-            return;
+            time = s_accumulated_infos[i].time;
+            portEXIT_CRITICAL(&s_accumulated_lock);
+            return time;
         }
-        else if (s_accumulated_infos[i].task_name == NULL && dst_idx == 255) {
+        else if (s_accumulated_infos[i].task_name[0] == '\0' && dst_idx == 255) {
             dst_idx = i;
         }
     }
+    if (dst_idx != 255) {
+        s_accumulated_infos[dst_idx] = *info;
+        s_accumulated_infos[dst_idx].is_running = true;
+    }
+    portEXIT_CRITICAL(&s_accumulated_lock);
     if (dst_idx == 255) {
         ESP_LOGE(TAG, "error: accumulated info's buffer is full");
-        return;
-    }
-    s_accumulated_infos[dst_idx].task_name = info->task_name;
-    s_accumulated_infos[dst_idx].time = info->time;
-    s_accumulated_infos[dst_idx].is_running = true;
-}
-
-static accumulated_info_t *get_accumulated_info(const char *task_name) {
-    for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
-        if (s_accumulated_infos[i].task_name == task_name) {
-            return &s_accumulated_infos[i];
-        }
     }
-    return NULL;
+    return time;
 }
 
 static void end_calc_accumulated_info(void) {
+    portENTER_CRITICAL(&s_accumulated_lock);
     for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
         if (!s_accumulated_infos[i].is_running) {
-            s_accumulated_infos[i].task_name = NULL;
-            s_accumulated_infos[i].time = 0;
+            memset(&s_accumulated_infos[i], 0, sizeof(s_accumulated_infos[i]));
         }
         else {
             s_accumulated_infos[i].is_running = false;
         }
     }
+    portEXIT_CRITICAL(&s_accumulated_lock);
+}
+
+struct stats_monitor_window {
+    TaskStatus_t *tasks;
+    uint64_t *run_times;        //64 bit run time counters of the tasks
+    TaskHandle_t running[portNUM_PROCESSORS];   //Task running on each core
+    UBaseType_t task_num;
+    int64_t start_time;
+};
+
+/*
+ * The run time counters of FreeRTOS are 32 bit and wrap every 17 s with the
+ * CPU clock at 240 MHz. Each counter is extended to 64 bit by adding its wrap
+ * safe differences to a total, kept per task number (unique, unlike the
+ * handle of a deleted task). The totals are refreshed by every snapshot of the
+ * tasks and by a timer RUN_TIME_REFRESHES times per wrap, so windows of any
+ * length get exact run times. Snapshots are taken and applied to the totals
+ * under s_state_mutex, in order: an older snapshot applied after a newer one
+ * would look like a wrap and add 2^32 ticks.
+ */
+typedef struct {
+    UBaseType_t task_number;
+    uint32_t last;
+    uint64_t total;
+    bool seen;
+} run_time_t;
+
+static run_time_t s_run_times[RUN_TIME_TASKS];
+static int s_run_time_num;
+static portMUX_TYPE s_run_time_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t s_state_mutex;    //uxTaskGetSystemState() cannot run in a critical section
+static bool s_run_time_timer_claimed;
+static esp_timer_handle_t s_run_time_timer;
+
+static portMUX_TYPE s_periodic_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_periodic_running;
+static bool s_periodic_stopping;
+static bool s_periodic_busy;            //periodic_timer_cb() is running
+static esp_timer_handle_t s_periodic_timer;
+static stats_monitor_window_handle_t s_periodic_window;
+static stats_monitor_periodic_config_t s_periodic_config;
+
+//Fills run_times with the 64 bit extensions of the counters of array, which
+//holds every task. Called with s_state_mutex held.
+static void extend_run_times(const TaskStatus_t *array, UBaseType_t size, uint64_t *run_times)
+{
+    bool full = false;
+    for (int j = 0; j < s_run_time_num; j++) {
+        s_run_times[j].seen = false;
+    }
+    for (int i = 0; i < size; i++) {
+        run_time_t *entry = NULL;
+        for (int j = 0; j < s_run_time_num; j++) {
+            if (s_run_times[j].task_number == array[i].xTaskNumber) {
+                entry = &s_run_times[j];
+                break;
+            }
+        }
+        if (entry == NULL && s_run_time_num < RUN_TIME_TASKS) {
+            //Counted from the 32 bit value, so earlier readings of it stay consistent
+            entry = &s_run_times[s_run_time_num++];
+            entry->task_number = array[i].xTaskNumber;
+            entry->last = array[i].ulRunTimeCounter;
+            entry->total = array[i].ulRunTimeCounter;
+        }
+        if (entry == NULL) {
+            //Only wrap safe within one period of the counter
+            run_times[i] = array[i].ulRunTimeCounter;
+            full = true;
+            continue;
+        }
+        entry->total += (uint32_t)(array[i].ulRunTimeCounter - entry->last);
+        entry->last = array[i].ulRunTimeCounter;
+        entry->seen = true;
+        run_times[i] = entry->total;
+    }
+    //Forget the deleted tasks
+    int kept = 0;
+    for (int j = 0; j < s_run_time_num; j++) {
+        if (s_run_times[j].seen) {
+            s_run_times[kept++] = s_run_times[j];
+        }
+    }
+    s_run_time_num = kept;
+    if (full) {
+        ESP_LOGW(TAG, "more than %d tasks, run times of the others wrap", RUN_TIME_TASKS);
+    }
+}
+
+static void start_run_time_timer(void);
+
+//Created by the first snapshot, the stats may be used without stats_monitor_init()
+static SemaphoreHandle_t get_state_mutex(void)
+{
+    if (s_state_mutex == NULL) {
+        SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+        portENTER_CRITICAL(&s_run_time_lock);
+        if (s_state_mutex == NULL) {
+            s_state_mutex = mutex;
+            mutex = NULL;
+        }
+        portEXIT_CRITICAL(&s_run_time_lock);
+        if (mutex != NULL) {
+            vSemaphoreDelete(mutex);
+        }
+    }
+    return s_state_mutex;
 }
 
 /**
- * @brief   Function to print the CPU usage of tasks over a given duration.
+ * @brief   Take the run time counters of all tasks, extended to 64 bit, and the
+ *          task running on each core (NULL running if not needed).
  *
- * This function will measure and print the CPU usage of tasks over a specified
- * number of ticks (i.e. real time stats). This is implemented by simply calling
- * uxTaskGetSystemState() twice separated by a delay, then calculating the
- * differences of task run times before and after the delay.
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        Insufficient memory to allocated internal arrays
+ *  - ESP_ERR_INVALID_SIZE  Insufficient array size for uxTaskGetSystemState. Trying increasing ARRAY_SIZE_OFFSET
+ */
+static esp_err_t get_system_state(TaskStatus_t **out_array, uint64_t **out_run_times, UBaseType_t *out_size,
+                                  int64_t *out_time, TaskHandle_t *running)
+{
+    start_run_time_timer();
+    SemaphoreHandle_t mutex = get_state_mutex();
+    UBaseType_t array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
+    TaskStatus_t *array = malloc(sizeof(TaskStatus_t) * array_size);
+    uint64_t *run_times = malloc(sizeof(uint64_t) * array_size);
+    if (mutex == NULL || array == NULL || run_times == NULL) {
+        free(array);
+        free(run_times);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    array_size = uxTaskGetSystemState(array, array_size, NULL);
+    *out_time = esp_timer_get_time();
+    for (int core = 0; running != NULL && core < portNUM_PROCESSORS; core++) {
+        running[core] = xTaskGetCurrentTaskHandleForCPU(core);
+    }
+    if (array_size > 0) {
+        extend_run_times(array, array_size, run_times);
+    }
+    xSemaphoreGive(mutex);
+    if (array_size == 0) {
+        free(array);
+        free(run_times);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_array = array;
+    *out_run_times = run_times;
+    *out_size = array_size;
+    return ESP_OK;
+}
+
+//Runs in the esp_timer task: keeps the 64 bit run times ahead of the wraps
+static void run_time_timer_cb(void *arg)
+{
+    TaskStatus_t *array;
+    uint64_t *run_times;
+    UBaseType_t size;
+    int64_t time;
+    if (get_system_state(&array, &run_times, &size, &time, NULL) == ESP_OK) {
+        free(array);
+        free(run_times);
+    }
+}
+
+//Started by the first snapshot of the tasks, runs for good
+static void start_run_time_timer(void)
+{
+    portENTER_CRITICAL(&s_run_time_lock);
+    bool claimed = !s_run_time_timer_claimed;
+    s_run_time_timer_claimed = true;
+    portEXIT_CRITICAL(&s_run_time_lock);
+    if (!claimed) {
+        return;
+    }
+    esp_timer_create_args_t timer_args = {
+        .callback = run_time_timer_cb,
+        .name = "stats_wrap",
+    };
+    uint64_t period_us = (1ULL << 32) * 1000000 / RUN_TIME_CLOCK_HZ / RUN_TIME_REFRESHES;
+    if (esp_timer_create(&timer_args, &s_run_time_timer) != ESP_OK
+            || esp_timer_start_periodic(s_run_time_timer, period_us) != ESP_OK) {
+        ESP_LOGE(TAG, "no run time refresh timer, windows must stay shorter than %llu ms",
+                 period_us * RUN_TIME_REFRESHES / 1000);
+    }
+}
+
+/**
+ * @brief   Calculate the CPU usage of tasks between the start of a window and now.
  *
- * @note    If any tasks are added or removed during the delay, the stats of
- *          those tasks will not be printed.
- * @note    This function should be called from a high priority task to minimize
- *          inaccuracies with delays.
+ * This is implemented by calling uxTaskGetSystemState() at both ends of the
+ * window, then calculating the differences of task run times.
+ *
+ * @note    If any tasks are added or removed during the window, the stats of
+ *          those tasks will not be reported.
  * @note    When running in dual core mode, each core will correspond to 50% of
  *          the run time.
+ * @note    The 32 bit run time counters are extended to 64 bit, see
+ *          extend_run_times(), so windows may span any number of wraps (every
+ *          17 s with the CPU clock at 240 MHz). The total elapsed time is taken
+ *          from the 64 bit esp_timer and all percentages are computed in 64 bit
+ *          fixed point, so short windows at high clock rates do not overflow.
  *
- * @param   xTicksToWait    Period of stats measurement
+ * @param   window      Window started by stats_monitor_begin_window(), not freed
+ * @param   snapshot    Filled with the results
+ * @param   sampler     True for the windows of the periodic sampler: the
+ *                      accumulated infos and core loads are updated and the
+ *                      snapshot is published
+ * @param   print       Print the task table on the console
  *
  * @return
  *  - ESP_OK                Success
  *  - ESP_ERR_NO_MEM        Insufficient memory to allocated internal arrays
  *  - ESP_ERR_INVALID_SIZE  Insufficient array size for uxTaskGetSystemState. Trying increasing ARRAY_SIZE_OFFSET
- *  - ESP_ERR_INVALID_STATE Delay duration too short
+ *  - ESP_ERR_INVALID_STATE Window too short
  */
-static esp_err_t print_real_time_stats(TickType_t xTicksToWait)
+static esp_err_t calc_window(stats_monitor_window_handle_t window, stats_monitor_snapshot_t *snapshot, bool sampler, bool print)
 {
-    TaskStatus_t *start_array = NULL, *end_array = NULL;
-    UBaseType_t start_array_size, end_array_size;
-    uint32_t start_run_time, end_run_time;
-    esp_err_t ret;
-
-    //Allocate array to store current task states
-    start_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    start_array = malloc(sizeof(TaskStatus_t) * start_array_size);
-    if (start_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get current task states
-    start_array_size = uxTaskGetSystemState(start_array, start_array_size, &start_run_time);
-    if (start_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
-    }
-
-    vTaskDelay(xTicksToWait);
+    TaskStatus_t *start_array = window->tasks, *end_array = NULL;
+    uint64_t *end_run_times = NULL;
+    TaskHandle_t end_running[portNUM_PROCESSORS];
+    UBaseType_t start_array_size = window->task_num, end_array_size;
+    int64_t end_time;
+    int core_loads[portNUM_PROCESSORS] = { [0 ... portNUM_PROCESSORS - 1] = -1 };
 
-    //Allocate array to store tasks states post delay
-    end_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    end_array = malloc(sizeof(TaskStatus_t) * end_array_size);
-    if (end_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get post delay task states
-    end_array_size = uxTaskGetSystemState(end_array, end_array_size, &end_run_time);
-    if (end_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
+    esp_err_t ret = get_system_state(&end_array, &end_run_times, &end_array_size, &end_time, end_running);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
     //Calculate total_elapsed_time in units of run time stats clock period.
-    uint32_t total_elapsed_time = (end_run_time - start_run_time);
+    uint64_t total_elapsed_time = (uint64_t)(end_time - window->start_time) * RUN_TIME_CLOCK_HZ / 1000000;
     if (total_elapsed_time == 0) {
-        ret = ESP_ERR_INVALID_STATE;
-        goto exit;
+        free(end_array);
+        free(end_run_times);
+        return ESP_ERR_INVALID_STATE;
     }
 
-    printf("| Task | Run Time | Run Time(Accumulated) | Percentage\n");
-    printf("| --- | --- | --- | ---\n");
+    snapshot->window_us = end_time - window->start_time;
+    snapshot->run_time_clock_hz = RUN_TIME_CLOCK_HZ;
+    snapshot->task_num = 0;
+
+    if (print) {
+        STATS_PRINTF("| Task | Run Time | Run Time(Accumulated) | Percentage\n");
+        STATS_PRINTF("| --- | --- | --- | ---\n");
+    }
+    if (sampler) {
+        //Before the matching below clears the handles
+        starvation_check(start_array, start_array_size, window->running, end_array, end_array_size, end_running,
+                         s_window_seq + 1);
+    }
     //Match each task in start_array to those in the end_array
     for (int i = 0; i < start_array_size; i++) {
+        TaskHandle_t handle = start_array[i].xHandle;
         int k = -1;
         for (int j = 0; j < end_array_size; j++) {
             if (start_array[i].xHandle == end_array[j].xHandle) {
@@ -161,56 +372,310 @@ static esp_err_t print_real_time_stats(TickType_t xTicksToWait)
         }
         //Check if matching task found
         if (k >= 0) {
-            uint32_t task_elapsed_time = end_array[k].ulRunTimeCounter - start_array[i].ulRunTimeCounter;
-            uint32_t percentage_time = (task_elapsed_time * 100UL) / (total_elapsed_time * portNUM_PROCESSORS);
+            uint64_t task_elapsed_time = end_run_times[k] - window->run_times[i];
+            //Percentage in hundredths of a percent
+            uint32_t percentage_time = (task_elapsed_time * 10000) / (total_elapsed_time * portNUM_PROCESSORS);
+            uint32_t load = (task_elapsed_time * 100) / total_elapsed_time;
+            uint64_t accumulated_time = task_elapsed_time;
 
-            accumulated_info_t buf = {
-                .task_name = (char *)start_array[i].pcTaskName,
-                .time = task_elapsed_time,
-            };
-            set_accumulated_info(&buf);
-            accumulated_info_t *res = get_accumulated_info(start_array[i].pcTaskName);
+            if (sampler) {
+                accumulated_info_t buf = {
+                    .time = task_elapsed_time,
+                    .load = load,
+                };
+                strlcpy(buf.task_name, start_array[i].pcTaskName, sizeof(buf.task_name));
+                accumulated_time = set_accumulated_info(&buf);
+            }
 
-            printf("| %s | %d | %lld | %d%%\n", start_array[i].pcTaskName, task_elapsed_time, res->time, percentage_time);
+            if (print) {
+                STATS_PRINTF("| %s | %llu | %llu | %u.%02u%%\n", start_array[i].pcTaskName, task_elapsed_time, accumulated_time,
+                       percentage_time / 100, percentage_time % 100);
+            }
+
+            if (snapshot->task_num < STATS_MONITOR_SNAPSHOT_TASKS) {
+                stats_monitor_task_t *task = &snapshot->tasks[snapshot->task_num++];
+                strlcpy(task->name, start_array[i].pcTaskName, sizeof(task->name));
+                task->run_time = task_elapsed_time;
+                task->run_time_accumulated = accumulated_time;
+                task->load_x100 = (task_elapsed_time * 10000) / total_elapsed_time;
+            }
+
+            //Idle time of each core gives the load of that core
+            for (int core = 0; core < portNUM_PROCESSORS; core++) {
+                if (handle == xTaskGetIdleTaskHandleForCPU(core)) {
+                    core_loads[core] = (load < 100) ? 100 - (int)load : 0;
+                }
+            }
         }
     }
 
     //Print unmatched tasks
-    for (int i = 0; i < start_array_size; i++) {
-        if (start_array[i].xHandle != NULL) {
-            printf("| %s | Deleted\n", start_array[i].pcTaskName);
+    if (print) {
+        for (int i = 0; i < start_array_size; i++) {
+            if (start_array[i].xHandle != NULL) {
+                STATS_PRINTF("| %s | Deleted\n", start_array[i].pcTaskName);
+            }
         }
-    }
-    for (int i = 0; i < end_array_size; i++) {
-        if (end_array[i].xHandle != NULL) {
-            printf("| %s | Created\n", end_array[i].pcTaskName);
+        for (int i = 0; i < end_array_size; i++) {
+            if (end_array[i].xHandle != NULL) {
+                STATS_PRINTF("| %s | Created\n", end_array[i].pcTaskName);
+            }
         }
     }
+    free(end_array);
+    free(end_run_times);
 
-    end_calc_accumulated_info();
-    ret = ESP_OK;
+    memcpy(snapshot->core_loads, core_loads, sizeof(snapshot->core_loads));
+    if (sampler) {
+        end_calc_accumulated_info();
+        memcpy(s_core_loads, core_loads, sizeof(s_core_loads));
+        s_window_seq++;
+        snapshot->seq = s_window_seq;
+        portENTER_CRITICAL(&s_snapshot_lock);
+        s_published_snapshot = snapshot;
+        portEXIT_CRITICAL(&s_snapshot_lock);
+    } else {
+        snapshot->seq = 0;
+    }
+    return ESP_OK;
+}
 
-exit:    //Common return path
-    free(start_array);
-    free(end_array);
+//Snapshot buffer not currently published, filled by the next sampler window
+static stats_monitor_snapshot_t *get_sampler_snapshot(void)
+{
+    return (s_published_snapshot == &s_snapshots[0]) ? &s_snapshots[1] : &s_snapshots[0];
+}
+
+esp_err_t stats_monitor_begin_window(stats_monitor_window_handle_t *out_window)
+{
+    stats_monitor_window_handle_t window = calloc(1, sizeof(struct stats_monitor_window));
+    if (window == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = get_system_state(&window->tasks, &window->run_times, &window->task_num, &window->start_time,
+                                     window->running);
+    if (ret != ESP_OK) {
+        free(window);
+        return ret;
+    }
+    *out_window = window;
+    return ESP_OK;
+}
+
+esp_err_t stats_monitor_end_window(stats_monitor_window_handle_t window, stats_monitor_snapshot_t *snapshot)
+{
+    esp_err_t ret = calc_window(window, snapshot, false, false);
+    stats_monitor_discard_window(window);
     return ret;
 }
 
+void stats_monitor_discard_window(stats_monitor_window_handle_t window)
+{
+    if (window != NULL) {
+        free(window->tasks);
+        free(window->run_times);
+        free(window);
+    }
+}
+
+//Claim the periodic sampler, only one of the stats task and the timer may run
+static bool claim_sampler(void)
+{
+    bool claimed = false;
+    portENTER_CRITICAL(&s_periodic_lock);
+    if (!s_periodic_running) {
+        s_periodic_running = true;
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&s_periodic_lock);
+    return claimed;
+}
+
 static void stats_task(void *arg)
 {
     //Print real time stats periodically
     while (1) {
-        printf("\n\nGetting real time stats over %d ticks\n", STATS_TICKS);
-        if (print_real_time_stats(STATS_TICKS) == ESP_OK) {
-            printf("Real time stats obtained\n");
+        stats_monitor_window_handle_t window;
+        esp_err_t ret;
+        STATS_PRINTF("\n\nGetting real time stats over %d ticks\n", STATS_TICKS);
+        ret = stats_monitor_begin_window(&window);
+        if (ret == ESP_OK) {
+            vTaskDelay(STATS_TICKS);
+            ret = calc_window(window, get_sampler_snapshot(), true, true);
+            stats_monitor_discard_window(window);
+        }
+        if (ret == ESP_OK) {
+#ifdef CONFIG_STATS_MONITOR_PRINT
+            latency_probe_print();
+#endif
+            STATS_PRINTF("Real time stats obtained\n");
         } else {
-            printf("Error getting real time stats\n");
+            ESP_LOGE(TAG, "Error getting real time stats");
         }
         vTaskDelay(pdMS_TO_TICKS(1));
     }
 }
 
+//Runs in the esp_timer task: closes the current window and opens the next one
+static void periodic_timer_cb(void *arg)
+{
+    portENTER_CRITICAL(&s_periodic_lock);
+    bool stopping = s_periodic_stopping;
+    s_periodic_busy = !stopping;
+    portEXIT_CRITICAL(&s_periodic_lock);
+    if (stopping) {
+        return;
+    }
+    if (s_periodic_window != NULL) {
+        stats_monitor_snapshot_t *snapshot = get_sampler_snapshot();
+        esp_err_t ret = calc_window(s_periodic_window, snapshot, true, false);
+        stats_monitor_discard_window(s_periodic_window);
+        s_periodic_window = NULL;
+        if (ret == ESP_OK) {
+            if (s_periodic_config.callback != NULL) {
+                s_periodic_config.callback(snapshot, s_periodic_config.arg);
+            }
+        } else {
+            ESP_LOGE(TAG, "Error getting real time stats (%s)", esp_err_to_name(ret));
+        }
+    }
+    if (stats_monitor_begin_window(&s_periodic_window) != ESP_OK) {
+        s_periodic_window = NULL;
+    }
+    portENTER_CRITICAL(&s_periodic_lock);
+    s_periodic_busy = false;
+    portEXIT_CRITICAL(&s_periodic_lock);
+}
+
+static bool periodic_timer_busy(void)
+{
+    portENTER_CRITICAL(&s_periodic_lock);
+    bool busy = s_periodic_busy;
+    portEXIT_CRITICAL(&s_periodic_lock);
+    return busy;
+}
+
+esp_err_t stats_monitor_start_periodic(const stats_monitor_periodic_config_t *config)
+{
+    if (config->period_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!claim_sampler()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_periodic_config = *config;
+    esp_timer_create_args_t timer_args = {
+        .callback = periodic_timer_cb,
+        .name = "stats",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &s_periodic_timer);
+    if (ret == ESP_OK) {
+        //The first expiry only opens a window
+        periodic_timer_cb(NULL);
+        ret = esp_timer_start_periodic(s_periodic_timer, (uint64_t)config->period_ms * 1000);
+    }
+    if (ret != ESP_OK) {
+        esp_timer_delete(s_periodic_timer);
+        s_periodic_timer = NULL;
+        stats_monitor_discard_window(s_periodic_window);
+        s_periodic_window = NULL;
+        s_periodic_running = false;
+    }
+    return ret;
+}
+
+esp_err_t stats_monitor_stop_periodic(void)
+{
+    portENTER_CRITICAL(&s_periodic_lock);
+    bool started = s_periodic_timer != NULL && !s_periodic_stopping;
+    s_periodic_stopping = started;
+    portEXIT_CRITICAL(&s_periodic_lock);
+    if (!started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    //esp_timer_stop() does not wait for a callback already running
+    esp_timer_stop(s_periodic_timer);
+    while (periodic_timer_busy()) {
+        vTaskDelay(1);
+    }
+    esp_timer_delete(s_periodic_timer);
+    s_periodic_timer = NULL;
+    stats_monitor_discard_window(s_periodic_window);
+    s_periodic_window = NULL;
+    portENTER_CRITICAL(&s_periodic_lock);
+    s_periodic_stopping = false;
+    s_periodic_running = false;
+    portEXIT_CRITICAL(&s_periodic_lock);
+    return ESP_OK;
+}
+
+int stats_monitor_get_core_load(int core_id)
+{
+    if (core_id < 0 || core_id >= portNUM_PROCESSORS) {
+        return -1;
+    }
+    return s_core_loads[core_id];
+}
+
+static bool task_name_fits(const char *name)
+{
+    return name != NULL && name[0] != '\0' && strnlen(name, configMAX_TASK_NAME_LEN) < configMAX_TASK_NAME_LEN;
+}
+
+bool stats_monitor_task_name_valid(const char *name)
+{
+    if (!task_name_fits(name)) {
+        ESP_LOGE(TAG, "task name %s must have 1 to %d characters", name != NULL ? name : "(null)",
+                 configMAX_TASK_NAME_LEN - 1);
+        return false;
+    }
+    return true;
+}
+
+bool stats_monitor_task_name_is(const char *task_name, const char *name)
+{
+    return task_name_fits(name) && strcmp(task_name, name) == 0;
+}
+
+int stats_monitor_get_task_load(const char *task_name)
+{
+    if (!stats_monitor_task_name_valid(task_name)) {
+        return -1;
+    }
+    int load = -1;
+    portENTER_CRITICAL(&s_accumulated_lock);
+    for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
+        if (stats_monitor_task_name_is(s_accumulated_infos[i].task_name, task_name)) {
+            load = s_accumulated_infos[i].load;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_accumulated_lock);
+    return load;
+}
+
+esp_err_t stats_monitor_get_snapshot(stats_monitor_snapshot_t *snapshot)
+{
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    portENTER_CRITICAL(&s_snapshot_lock);
+    if (s_published_snapshot != NULL) {
+        memcpy(snapshot, s_published_snapshot, sizeof(*snapshot));
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&s_snapshot_lock);
+    return ret;
+}
+
+uint32_t stats_monitor_get_window_seq(void)
+{
+    return s_window_seq;
+}
+
 void stats_monitor_init(void) {
+    if (!claim_sampler()) {
+        ESP_LOGE(TAG, "periodic sampling already running");
+        return;
+    }
     //Create and start stats task
     xTaskCreatePinnedToCore(stats_task, "stats", 4096, NULL, STATS_TASK_PRIO, NULL, tskNO_AFFINITY);
 }
\ No newline at end of file
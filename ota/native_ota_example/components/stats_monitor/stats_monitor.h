@@ -1,4 +1,161 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#define STATS_MONITOR_SNAPSHOT_TASKS    24
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint64_t run_time;              //Run time in the window, in run time stats clock periods
+    uint64_t run_time_accumulated;  //Run time since the last reset of the accumulated infos
+    uint32_t load_x100;             //Share of a single core used in the window, in hundredths of percent
+} stats_monitor_task_t;
+
+typedef struct {
+    uint32_t seq;                   //Window number, see stats_monitor_get_window_seq()
+    int64_t window_us;
+    uint32_t run_time_clock_hz;     //Rate of the run time stats clock, converts run times to seconds
+    int core_loads[portNUM_PROCESSORS];
+    int task_num;
+    stats_monitor_task_t tasks[STATS_MONITOR_SNAPSHOT_TASKS];
+} stats_monitor_snapshot_t;
+
+typedef struct stats_monitor_window *stats_monitor_window_handle_t;
+
+/**
+ * @brief   Called at the end of every window of the periodic sampler.
+ *
+ * Runs in the esp_timer task, so it must return quickly. The snapshot is only
+ * valid during the call.
+ */
+typedef void (*stats_monitor_window_cb_t)(const stats_monitor_snapshot_t *snapshot, void *arg);
+
+typedef struct {
+    uint32_t period_ms;
+    stats_monitor_window_cb_t callback;     //Optional
+    void *arg;
+} stats_monitor_periodic_config_t;
+
+/**
+ * @brief   Start the periodic sampler in a task printing the stats on the
+ *          console every CONFIG_STATS_MONITOR_WINDOW_MS.
+ */
 void stats_monitor_init(void);
-void stats_monitor_reset_accumulated_infos(void);
\ No newline at end of file
+
+/**
+ * @brief   Start the periodic sampler on an esp_timer, without a task of its own.
+ *
+ * Each expiry closes the current window, publishes it (see
+ * stats_monitor_get_snapshot()) and opens the next one. Nothing is printed.
+ * Only one of this and stats_monitor_init() may be used.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   period_ms is 0
+ *  - ESP_ERR_INVALID_STATE A periodic sampler is already running
+ *  - other                 Error from esp_timer
+ */
+esp_err_t stats_monitor_start_periodic(const stats_monitor_periodic_config_t *config);
+
+/**
+ * @brief   Stop the sampler started by stats_monitor_start_periodic().
+ *
+ * Waits for a callback already running, so it must not be called from the
+ * callback itself.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE Not started
+ */
+esp_err_t stats_monitor_stop_periodic(void);
+
+/**
+ * @brief   Start measuring the CPU usage of tasks over a region of code.
+ *
+ * Takes the run time counters of all tasks and returns immediately. Windows
+ * are independent of each other and of the periodic sampler, and may be
+ * nested or overlap.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        Insufficient memory
+ *  - ESP_ERR_INVALID_SIZE  Too many tasks created during the call
+ */
+esp_err_t stats_monitor_begin_window(stats_monitor_window_handle_t *out_window);
+
+/**
+ * @brief   Finish a window and release it.
+ *
+ * The snapshot receives the run time of each task since
+ * stats_monitor_begin_window() (run_time_accumulated equals run_time) and the
+ * load of each core; seq is 0. The run times are 64 bit, so the window may
+ * span any number of wraps of the 32 bit counters of FreeRTOS.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        Insufficient memory
+ *  - ESP_ERR_INVALID_SIZE  Too many tasks created during the window
+ *  - ESP_ERR_INVALID_STATE Window too short to be measured
+ */
+esp_err_t stats_monitor_end_window(stats_monitor_window_handle_t window, stats_monitor_snapshot_t *snapshot);
+
+/**
+ * @brief   Release a window without calculating it.
+ */
+void stats_monitor_discard_window(stats_monitor_window_handle_t window);
+
+void stats_monitor_reset_accumulated_infos(void);
+
+/**
+ * @brief   Load of a core over the last stats window, derived from its idle task.
+ *
+ * @return  Busy time in percent of the core, or -1 if no window completed yet.
+ */
+int stats_monitor_get_core_load(int core_id);
+
+/**
+ * @brief   Load of a task over the last stats window.
+ *
+ * @return  Run time in percent of a single core, or -1 if the task is unknown
+ *          or its name is rejected by stats_monitor_task_name_valid().
+ */
+int stats_monitor_get_task_load(const char *task_name);
+
+/**
+ * @brief   Check that FreeRTOS keeps a task name whole, logging an error if not.
+ *
+ * The snapshots hold the names as stored in the TCBs, cut to
+ * configMAX_TASK_NAME_LEN - 1 characters. A longer name is rejected rather
+ * than matched by its prefix, which may be the name of another task.
+ *
+ * @return  true if the name has 1 to configMAX_TASK_NAME_LEN - 1 characters
+ */
+bool stats_monitor_task_name_valid(const char *name);
+
+/**
+ * @brief   Whether a task name of a snapshot is name. Exact match, false for a
+ *          NULL name or one rejected by stats_monitor_task_name_valid().
+ */
+bool stats_monitor_task_name_is(const char *task_name, const char *name);
+
+/**
+ * @brief   Number of stats windows completed so far. Lets callers tell when a
+ *          fresh reading of the loads above is available.
+ */
+uint32_t stats_monitor_get_window_seq(void);
+
+/**
+ * @brief   Copy the results of the last completed stats window.
+ *
+ * The sampler publishes a complete snapshot at the end of each window, so
+ * this only holds a spinlock for the time of the copy and never waits for a
+ * window to finish.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_STATE No window completed yet
+ */
+esp_err_t stats_monitor_get_snapshot(stats_monitor_snapshot_t *snapshot);
\ No newline at end of file
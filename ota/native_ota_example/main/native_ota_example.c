@@ -12,86 +12,94 @@
 #include "freertos/event_groups.h"
 
 #include "esp_system.h"
-#include "esp_wifi.h"
-#include "esp_event_loop.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_http_client.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "esp_image_format.h"
+#include "ota_engine.h"
+#include "connectivity.h"
 
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "driver/gpio.h"
 
 #include "stats_monitor.h"
+#include "latency_probe.h"
+#include "sched_trace.h"
+#include "ota_cpu_cost.h"
+#include "ota_affinity.h"
+#ifdef CONFIG_OTA_BACKGROUND
+#include "ota_throttle.h"
+#endif
+#ifdef CONFIG_OTA_METRICS_SERVER
+#include "metrics_server.h"
+#endif
+#ifdef CONFIG_OTA_PREERASE
+#include "ota_preerase.h"
+#endif
+#ifdef CONFIG_OTA_PEER
+#include "ota_peer.h"
+#endif
+#ifdef CONFIG_OTA_ROLLOUT
+#include "ota_rollout.h"
+#endif
+#ifdef CONFIG_OTA_DECRYPT
+#include "ota_decrypt.h"
+#endif
+#ifdef CONFIG_OTA_BUNDLE
+#include "ota_bundle.h"
+#endif
+#ifdef CONFIG_FLASH_PROFILER
+#include "flash_profiler.h"
+#endif
+#ifdef CONFIG_PERF_LOG
+#include "perf_history.h"
+#endif
 
 #define EXAMPLE_WIFI_SSID CONFIG_WIFI_SSID
 #define EXAMPLE_WIFI_PASS CONFIG_WIFI_PASSWORD
+#define NETWORK_WAIT_MS 30000
+#define OTA_RESUME_ATTEMPTS 10
+#define OTA_RESUME_DELAY_MS 1000
 #define EXAMPLE_SERVER_URL CONFIG_FIRMWARE_UPG_URL
-#define BUFFSIZE 1024
 #define HASH_LEN 32 /* SHA-256 digest length */
+//Internal RAM of the receive buffers without CONFIG_OTA_ENGINE_PSRAM_BUFFER, to compare with
+#ifdef CONFIG_OTA_ENGINE_PIPELINE
+#define INTERNAL_BUFFERS_SIZE (2 * CONFIG_OTA_ENGINE_BUFFER_SIZE)
+#else
+#define INTERNAL_BUFFERS_SIZE CONFIG_OTA_ENGINE_BUFFER_SIZE
+#endif
+
+#define OTA_TASK_NAME "ota_task"   //At most configMAX_TASK_NAME_LEN - 1 characters
+#define OTA_TASK_STACK 8192
+#if defined(CONFIG_OTA_AFFINITY_UNPINNED)
+#define OTA_AFFINITY_MODE OTA_AFFINITY_UNPINNED
+#elif defined(CONFIG_OTA_AFFINITY_ADVISED)
+#define OTA_AFFINITY_MODE OTA_AFFINITY_ADVISED
+#else
+#define OTA_AFFINITY_MODE OTA_AFFINITY_PINNED
+#endif
+#ifdef CONFIG_OTA_BACKGROUND
+#define OTA_TASK_PRIO 1
+#define REFERENCE_PROBE_PRIO 10
+#define REFERENCE_PROBE_PERIOD_MS 10
+#else
+#define OTA_TASK_PRIO 5
+#endif
 
 static const char *TAG = "native_ota_example";
-/*an ota data write buffer ready to write to the flash*/
-static char ota_write_data[BUFFSIZE + 1] = { 0 };
+//Cores of the OTA task and of the flash writer task
+static ota_affinity_t s_placement;
 extern const uint8_t server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
 
-/* FreeRTOS event group to signal when we are connected & ready to make a request */
-static EventGroupHandle_t wifi_event_group;
+static esp_http_client_config_t s_http_config = {
+    .url = EXAMPLE_SERVER_URL,
+    .cert_pem = (char *)server_cert_pem_start,
+};
 
-/* The event group allows multiple bits for each event,
-   but we only care about one event - are we connected
-   to the AP with an IP? */
-const int CONNECTED_BIT = BIT0;
-
-static esp_err_t event_handler(void *ctx, system_event_t *event)
-{
-    switch (event->event_id) {
-    case SYSTEM_EVENT_STA_START:
-        esp_wifi_connect();
-        break;
-    case SYSTEM_EVENT_STA_GOT_IP:
-        xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
-        break;
-    case SYSTEM_EVENT_STA_DISCONNECTED:
-        /* This is a workaround as ESP32 WiFi libs don't currently
-           auto-reassociate. */
-        esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
-        break;
-    default:
-        break;
-    }
-    return ESP_OK;
-}
-
-static void initialise_wifi(void)
-{
-    tcpip_adapter_init();
-    wifi_event_group = xEventGroupCreate();
-    ESP_ERROR_CHECK( esp_event_loop_init(event_handler, NULL) );
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
-    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = EXAMPLE_WIFI_SSID,
-            .password = EXAMPLE_WIFI_PASS,
-        },
-    };
-    ESP_LOGI(TAG, "Setting WiFi configuration SSID %s...", wifi_config.sta.ssid);
-    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
-    ESP_ERROR_CHECK( esp_wifi_start() );
-}
-
-static void http_cleanup(esp_http_client_handle_t client)
-{
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-}
 
 static void __attribute__((noreturn)) task_fatal_error()
 {
@@ -113,6 +121,37 @@ static void print_sha256 (const uint8_t *image_hash, const char *label)
     ESP_LOGI(TAG, "%s: %s", label, hash_print);
 }
 
+//Log how much of each app partition its image uses, to see how much room is left to grow
+static void print_slot_utilization(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    //esp_partition_next() releases the iterator after the last partition
+    for (; it != NULL; it = esp_partition_next(it)) {
+        const esp_partition_t *partition = esp_partition_get(it);
+        const esp_partition_pos_t pos = {
+            .offset = partition->address,
+            .size = partition->size,
+        };
+        esp_image_metadata_t data;
+        if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &data) == ESP_OK) {
+            ESP_LOGI(TAG, "Partition %s%s: image %d of %d bytes (%d%%)", partition->label,
+                     partition == running ? " (running)" : "",
+                     data.image_len, partition->size, data.image_len * 100 / partition->size);
+        } else {
+            ESP_LOGI(TAG, "Partition %s: %d bytes, no valid image", partition->label, partition->size);
+        }
+    }
+}
+
+//Waits for the network, which connectivity keeps reconnecting, logging while it takes long
+static void wait_for_network(void)
+{
+    while (connectivity_wait(pdMS_TO_TICKS(NETWORK_WAIT_MS)) != ESP_OK) {
+        ESP_LOGW(TAG, "Still not connected to %s", EXAMPLE_WIFI_SSID);
+    }
+}
+
 static void infinite_loop(void)
 {
     int i = 0;
@@ -123,19 +162,281 @@ static void infinite_loop(void)
     }
 }
 
-static void accumulate_time(int64_t *timer, int64_t start_time, int64_t end_time) {
-    int64_t duration = end_time - start_time;
-    *timer += duration;
-    // ESP_LOGW(TAG, "duration=%lld", duration);
-    // ESP_LOGW(TAG, "accumulate time=%lld", *timer);
+//Log the CPU time spent per MiB of image, by the OTA task and by all tasks together
+static void print_cpu_cost(const stats_monitor_snapshot_t *snapshot, int image_length)
+{
+    uint64_t ota_run_time = 0;
+    uint64_t busy_run_time = 0;
+    if (image_length <= 0) {
+        return;
+    }
+    for (int i = 0; i < snapshot->task_num; i++) {
+        const stats_monitor_task_t *task = &snapshot->tasks[i];
+        if (stats_monitor_task_name_is(task->name, OTA_TASK_NAME)) {
+            ota_run_time = task->run_time;
+        }
+        if (strncmp(task->name, "IDLE", 4) != 0) {
+            busy_run_time += task->run_time;
+        }
+    }
+    uint64_t ota_us_per_mib = ota_run_time * 1000000 / snapshot->run_time_clock_hz * (1024 * 1024) / image_length;
+    uint64_t busy_us_per_mib = busy_run_time * 1000000 / snapshot->run_time_clock_hz * (1024 * 1024) / image_length;
+    ESP_LOGW(TAG, "cpu cost per MiB: %s=%llu us, all tasks=%llu us", OTA_TASK_NAME, ota_us_per_mib, busy_us_per_mib);
+}
+
+//Ends the CPU cost phase in progress, with the bytes written and the time the
+//engine spent on flash and in the stages since the last one
+static void end_cost_phase(ota_engine_handle_t engine, ota_engine_stats_t *last)
+{
+    ota_engine_stats_t stats;
+    ota_engine_get_stats(engine, &stats);
+    ota_cpu_cost_known_t known = {
+#ifndef CONFIG_OTA_ENGINE_PIPELINE
+        .flash_us = stats.time_write - last->time_write,
+#endif
+        .stages_us = stats.time_process + stats.time_validate - last->time_process - last->time_validate,
+    };
+    ota_cpu_cost_end_phase(stats.image_len - last->image_len, &known);
+    *last = stats;
+}
+
+//Ends a CPU cost phase spent on flash by the OTA task, such as reading the image back
+static void end_flash_phase(int64_t time_start, size_t bytes)
+{
+    ota_cpu_cost_known_t known = {
+        .flash_us = esp_timer_get_time() - time_start,
+    };
+    ota_cpu_cost_end_phase(bytes, &known);
+}
+
+#ifdef CONFIG_OTA_PEER
+//Update from a LAN peer serving the image of the manifest. Only returns if that did not happen
+static void update_from_peer(const esp_partition_t *running)
+{
+    ota_peer_manifest_t manifest;
+    esp_app_desc_t app_info;
+    char url[64];
+
+    esp_err_t err = ota_peer_fetch_manifest(CONFIG_OTA_PEER_MANIFEST_URL, (const char *)server_cert_pem_start, &manifest);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to fetch the manifest (%s)", esp_err_to_name(err));
+        return;
+    }
+    //Same or rolled back version: leave it to the checks of the download from the server
+    if (esp_ota_get_partition_description(running, &app_info) == ESP_OK
+            && strncmp(manifest.version, app_info.version, sizeof(manifest.version)) == 0) {
+        return;
+    }
+    const esp_partition_t *last_invalid_app = esp_ota_get_last_invalid_partition();
+    if (last_invalid_app != NULL && esp_ota_get_partition_description(last_invalid_app, &app_info) == ESP_OK
+            && strncmp(manifest.version, app_info.version, sizeof(manifest.version)) == 0) {
+        return;
+    }
+    if (ota_peer_find(&manifest, url, sizeof(url)) != ESP_OK) {
+        ESP_LOGI(TAG, "No peer serves version %s, downloading from the server", manifest.version);
+        return;
+    }
+
+    const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+#ifdef CONFIG_OTA_PREERASE
+    ota_preerase_invalidate();
+#endif
+    int64_t time_start = esp_timer_get_time();
+    err = ota_peer_download(url, &manifest, update_partition);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Update from %s failed (%s), downloading from the server", url, esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGW(TAG, "time_total=%lld (from peer)", esp_timer_get_time() - time_start);
+    err = esp_ota_set_boot_partition(update_partition);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Prepare to restart system!");
+    esp_restart();
+}
+#endif
+
+#ifdef CONFIG_OTA_DECRYPT
+static esp_err_t decrypt_begin(void *ctx)
+{
+    uint8_t key[32];
+    size_t key_len = sizeof(key);
+    esp_err_t err = ota_decrypt_key_from_hex(CONFIG_OTA_DECRYPT_KEY, key, &key_len);
+    if (err == ESP_OK) {
+        err = ota_decrypt_begin(key, key_len, (ota_decrypt_handle_t *)ctx);
+    } else {
+        ESP_LOGE(TAG, "Invalid CONFIG_OTA_DECRYPT_KEY");
+    }
+    memset(key, 0, sizeof(key));
+    return err;
+}
+
+static esp_err_t decrypt_process(void *ctx, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    return ota_decrypt_update(*(ota_decrypt_handle_t *)ctx, buf, len, out, out_len);
+}
+
+static esp_err_t decrypt_end(void *ctx)
+{
+    esp_err_t err = ota_decrypt_end(*(ota_decrypt_handle_t *)ctx);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Image authentication failed (%s), the image was modified or the key is wrong", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void decrypt_abort(void *ctx)
+{
+    ota_decrypt_abort(*(ota_decrypt_handle_t *)ctx);
+}
+#endif
+
+#ifdef CONFIG_OTA_BUNDLE
+static esp_err_t bundle_begin(void *ctx)
+{
+    return ota_bundle_begin(esp_ota_get_next_update_partition(NULL), (ota_bundle_handle_t *)ctx);
+}
+
+static esp_err_t bundle_process(void *ctx, uint8_t *buf, size_t len, uint8_t **out, size_t *out_len)
+{
+    return ota_bundle_update(*(ota_bundle_handle_t *)ctx, buf, len, out, out_len);
+}
+
+static esp_err_t bundle_end(void *ctx)
+{
+    esp_err_t err = ota_bundle_end(*(ota_bundle_handle_t *)ctx);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Bundle incomplete or data partitions not recorded (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static void bundle_abort(void *ctx)
+{
+    ota_bundle_abort(*(ota_bundle_handle_t *)ctx);
+}
+#endif
+
+#ifdef CONFIG_OTA_PREERASE
+static esp_err_t preerase_begin(void *ctx)
+{
+    return ota_preerase_begin_update(esp_ota_get_next_update_partition(NULL));
+}
+
+static esp_err_t preerase_before_write(void *ctx, size_t offset, size_t len)
+{
+    return ota_preerase_ensure(offset, len);
+}
+#endif
+
+#ifdef CONFIG_OTA_BACKGROUND
+static esp_err_t throttle_begin(void *ctx)
+{
+    ota_throttle_config_t throttle_config = {
+        .cpu_percent = CONFIG_OTA_BACKGROUND_CPU_PERCENT,
+        .flash_kbps = CONFIG_OTA_BACKGROUND_FLASH_KBPS,
+        .task_name = OTA_TASK_NAME,
+    };
+    ota_throttle_init(&throttle_config);
+    *(size_t *)ctx = 0;
+    return ESP_OK;
+}
+
+static void throttle_progress(void *ctx, size_t written, size_t total, int64_t chunk_us)
+{
+    size_t *last_written = ctx;
+    ota_throttle_account(chunk_us, written - *last_written);
+    *last_written = written;
+    ota_throttle_wait();
+}
+#endif
+
+#ifdef CONFIG_OTA_METRICS_SERVER
+static void metrics_progress(void *ctx, size_t written, size_t total, int64_t chunk_us)
+{
+    metrics_server_set_ota_progress(written, total);
+}
+#endif
+
+//Stages of the data path, in order: decrypt first, then the bundle stage
+//writing the data images, the others see the plain app image
+static void add_stages(ota_engine_handle_t engine)
+{
+#ifdef CONFIG_OTA_DECRYPT
+    static ota_decrypt_handle_t decrypt;
+    ota_engine_stage_t decrypt_stage = {
+        .name = "decrypt",
+        .ctx = &decrypt,
+        .begin = decrypt_begin,
+        .process = decrypt_process,
+        .end = decrypt_end,
+        .abort = decrypt_abort,
+    };
+    ESP_ERROR_CHECK(ota_engine_add_stage(engine, &decrypt_stage));
+#endif
+#ifdef CONFIG_OTA_BUNDLE
+    static ota_bundle_handle_t bundle;
+    ota_engine_stage_t bundle_stage = {
+        .name = "bundle",
+        .ctx = &bundle,
+        .begin = bundle_begin,
+        .process = bundle_process,
+        .end = bundle_end,
+        .abort = bundle_abort,
+    };
+    ESP_ERROR_CHECK(ota_engine_add_stage(engine, &bundle_stage));
+#endif
+#ifdef CONFIG_OTA_PREERASE
+    ota_engine_stage_t preerase_stage = {
+        .name = "preerase",
+        .begin = preerase_begin,
+        .before_write = preerase_before_write,
+    };
+    ESP_ERROR_CHECK(ota_engine_add_stage(engine, &preerase_stage));
+#endif
+#ifdef CONFIG_OTA_BACKGROUND
+    static size_t throttle_written;
+    ota_engine_stage_t throttle_stage = {
+        .name = "throttle",
+        .ctx = &throttle_written,
+        .begin = throttle_begin,
+        .progress = throttle_progress,
+    };
+    ESP_ERROR_CHECK(ota_engine_add_stage(engine, &throttle_stage));
+#endif
+#ifdef CONFIG_OTA_METRICS_SERVER
+    ota_engine_stage_t metrics_stage = {
+        .name = "metrics",
+        .progress = metrics_progress,
+    };
+    ESP_ERROR_CHECK(ota_engine_add_stage(engine, &metrics_stage));
+#endif
+}
+
+static void print_engine_stats(ota_engine_handle_t engine)
+{
+    ota_engine_stats_t stats;
+    ota_engine_get_stats(engine, &stats);
+    ESP_LOGW(TAG, "time_total=%lld", stats.time_total);
+    ESP_LOGW(TAG, "time_http=%lld", stats.time_http);
+    ESP_LOGW(TAG, "time_write=%lld", stats.time_write);
+    ESP_LOGW(TAG, "time_process=%lld", stats.time_process);
+    ESP_LOGW(TAG, "time_validate=%lld", stats.time_validate);
+    ESP_LOGW(TAG, "time_first_write=%lld", stats.time_first_write);
+    ESP_LOGW(TAG, "buffers internal=%u psram=%u (internal only: %u), internal heap min free=%u (before: %u)",
+             stats.buffer_internal, stats.buffer_external, INTERNAL_BUFFERS_SIZE, stats.heap_internal_min_free,
+             stats.heap_internal_min_free_before);
+    connectivity_stats_t connectivity_stats;
+    connectivity_get_stats(&connectivity_stats);
+    ESP_LOGW(TAG, "disconnects=%u max_reconnect=%lld", connectivity_stats.disconnects, connectivity_stats.max_reconnect_us);
 }
 
 static void ota_example_task(void *pvParameter)
 {
+    ota_engine_handle_t engine = pvParameter;
     esp_err_t err;
-    /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-    esp_ota_handle_t update_handle = 0 ;
-    const esp_partition_t *update_partition = NULL;
 
     ESP_LOGI(TAG, "Starting OTA example...");
 
@@ -150,148 +451,169 @@ static void ota_example_task(void *pvParameter)
     ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
              running->type, running->subtype, running->address);
 
-    /* Wait for the callback to set the CONNECTED_BIT in the
-       event group.
-    */
-    xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT,
-                        false, true, portMAX_DELAY);
+    wait_for_network();
     ESP_LOGI(TAG, "Connect to Wifi ! Start to Connect to Server....");
-    
-    esp_http_client_config_t config = {
-        .url = EXAMPLE_SERVER_URL,
-        .cert_pem = (char *)server_cert_pem_start,
+#ifdef CONFIG_OTA_ROLLOUT
+    ota_rollout_target_t rollout_target;
+    ota_rollout_wait((const char *)server_cert_pem_start, esp_ota_get_app_description()->version, &rollout_target);
+    //The engine creates its HTTP client from this configuration at the check
+    s_http_config.url = rollout_target.url;
+    s_http_config.event_handler = ota_rollout_http_event_handler;
+#endif
+#ifdef CONFIG_OTA_PEER
+    update_from_peer(running);
+#endif
+
+    ESP_LOGW(TAG, "current heap: %d, minimum ever: %d", xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize());
+    stats_monitor_reset_accumulated_infos();
+    stats_monitor_window_handle_t cpu_window = NULL;
+    if (stats_monitor_begin_window(&cpu_window) != ESP_OK) {
+        ESP_LOGW(TAG, "cpu cost of the update will not be measured");
+    }
+    const ota_cpu_cost_config_t cost_config = {
+        .ota_task = OTA_TASK_NAME,
+#ifdef CONFIG_OTA_ENGINE_PIPELINE
+        .writer_task = OTA_ENGINE_WRITER_TASK_NAME,
+#endif
     };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialise HTTP connection");
-        task_fatal_error();
+    ota_engine_stats_t cost_stats = { 0 };
+    if (ota_cpu_cost_init(&cost_config) != ESP_OK) {
+        ESP_LOGE(TAG, "CPU cost attribution disabled");
+    }
+    //Mostly the TLS handshake, nothing is written yet
+    ota_cpu_cost_begin_phase("check");
+#ifdef CONFIG_STATS_MONITOR_SCHED_TRACE
+    //The ring buffers keep the last events of the download
+    sched_trace_start();
+#endif
+#ifdef CONFIG_FLASH_PROFILER
+    //Only the flash operations of the update are reported
+    flash_profiler_reset();
+#endif
+
+    err = ota_engine_check(engine, NULL);
+#ifdef CONFIG_OTA_ROLLOUT
+    //The image server may shed load as well, retry with backoff, the update fails if it stays busy
+    for (int attempts = 1; err == ESP_ERR_OTA_ENGINE_BUSY && attempts < CONFIG_OTA_ROLLOUT_BUSY_ATTEMPTS; attempts++) {
+        ota_rollout_backoff(ota_engine_get_http_status(engine));
+        err = ota_engine_check(engine, NULL);
+    }
+    ota_rollout_backoff_reset();
+#endif
+    if (err == ESP_ERR_OTA_ENGINE_UP_TO_DATE || err == ESP_ERR_OTA_ENGINE_REJECTED) {
+        if (cpu_window != NULL) {
+            stats_monitor_discard_window(cpu_window);
+        }
+        infinite_loop();
+    }
+    end_cost_phase(engine, &cost_stats);
+    if (err == ESP_OK) {
+        ota_cpu_cost_begin_phase("download");
+        int resumes = 0;
+        while ((err = ota_engine_perform(engine)) == ESP_ERR_OTA_ENGINE_IN_PROGRESS
+                || (err == ESP_ERR_OTA_ENGINE_PAUSED && resumes++ < OTA_RESUME_ATTEMPTS)) {
+            if (err == ESP_ERR_OTA_ENGINE_PAUSED) {
+                //The download continues where it stopped once the network is back
+                wait_for_network();
+                vTaskDelay(pdMS_TO_TICKS(OTA_RESUME_DELAY_MS));
+            }
+        }
+    }
+    end_cost_phase(engine, &cost_stats);
+#ifdef CONFIG_STATS_MONITOR_SCHED_TRACE
+    sched_trace_dump();
+#endif
+    if (err == ESP_OK) {
+        //esp_ota_end() reads the image back to verify it
+        ota_cpu_cost_begin_phase("verify");
+        int64_t verify_start = esp_timer_get_time();
+        err = ota_engine_verify(engine);
+        end_flash_phase(verify_start, cost_stats.image_len);
     }
-    err = esp_http_client_open(client, 0);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
+        ESP_LOGE(TAG, "Update failed in state %s (%s)",
+                 ota_engine_state_name(ota_engine_get_state(engine)), esp_err_to_name(ota_engine_get_error(engine)));
+#ifdef CONFIG_PERF_LOG
+        ota_engine_stats_t stats;
+        ota_engine_get_stats(engine, &stats);
+        perf_history_log_ota(ota_engine_get_error(engine), &stats);
+#endif
+        if (cpu_window != NULL) {
+            stats_monitor_discard_window(cpu_window);
+        }
         task_fatal_error();
     }
-    esp_http_client_fetch_headers(client);
-
-    update_partition = esp_ota_get_next_update_partition(NULL);
-    ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
-             update_partition->subtype, update_partition->address);
-    assert(update_partition != NULL);
-
-    int binary_file_length = 0;
-    /*deal with all receive packet*/
-    bool image_header_was_checked = false;
-
-    ESP_LOGW(TAG, "current heap: %d, minimum ever: %d", xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize());
-    int64_t time_total = 0; 
-    int64_t time_http = 0; 
-    int64_t time_write = 0; 
-    int64_t time_total_start = esp_timer_get_time();
 
-    stats_monitor_reset_accumulated_infos();
-    while (1) {
-        int64_t time_start = esp_timer_get_time();
-        int data_read = esp_http_client_read(client, ota_write_data, BUFFSIZE);
-        int64_t time_end = esp_timer_get_time();
-        accumulate_time(&time_http, time_start, time_end);
-        if (data_read < 0) {
-            ESP_LOGE(TAG, "Error: SSL data read error");
-            http_cleanup(client);
-            task_fatal_error();
-        } else if (data_read > 0) {
-            if (image_header_was_checked == false) {
-                esp_app_desc_t new_app_info;
-                if (data_read > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                    // check current version with downloading
-                    memcpy(&new_app_info, &ota_write_data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
-                    ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
-
-                    esp_app_desc_t running_app_info;
-                    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) {
-                        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
-                    }
-
-                    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
-                    esp_app_desc_t invalid_app_info;
-                    if (esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK) {
-                        ESP_LOGI(TAG, "Last invalid firmware version: %s", invalid_app_info.version);
-                    }
-
-                    // check current version with last invalid partition
-                    if (last_invalid_app != NULL) {
-                        if (memcmp(invalid_app_info.version, new_app_info.version, sizeof(new_app_info.version)) == 0) {
-                            ESP_LOGW(TAG, "New version is the same as invalid version.");
-                            ESP_LOGW(TAG, "Previously, there was an attempt to launch the firmware with %s version, but it failed.", invalid_app_info.version);
-                            ESP_LOGW(TAG, "The firmware has been rolled back to the previous version.");
-                            http_cleanup(client);
-                            infinite_loop();
-                        }
-                    }
-
-                    if (memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) {
-                        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
-                        http_cleanup(client);
-                        infinite_loop();
-                    }
-
-                    image_header_was_checked = true;
-
-                    err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-                    if (err != ESP_OK) {
-                        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-                        http_cleanup(client);
-                        task_fatal_error();
-                    }
-                    ESP_LOGI(TAG, "esp_ota_begin succeeded");
-                } else {
-                    ESP_LOGE(TAG, "received package is not fit len");
-                    http_cleanup(client);
-                    task_fatal_error();
-                }
-            }
-            // ESP_LOGI(TAG, "esp_ota_write() start");
-            time_start = esp_timer_get_time();
-            err = esp_ota_write( update_handle, (const void *)ota_write_data, data_read);
-            time_end = esp_timer_get_time();
-            accumulate_time(&time_write, time_start, time_end);
-            // ESP_LOGW(TAG, "current heap: %d, minimum ever: %d", xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize());
-            if (err != ESP_OK) {
-                http_cleanup(client);
-                task_fatal_error();
+    print_engine_stats(engine);
+#ifdef CONFIG_FLASH_PROFILER
+    flash_profiler_print();
+#endif
+    if (cpu_window != NULL) {
+        stats_monitor_snapshot_t *cpu_snapshot = malloc(sizeof(stats_monitor_snapshot_t));
+        if (cpu_snapshot == NULL) {
+            stats_monitor_discard_window(cpu_window);
+        } else if (stats_monitor_end_window(cpu_window, cpu_snapshot) == ESP_OK) {
+            ota_engine_stats_t stats;
+            ota_engine_get_stats(engine, &stats);
+            print_cpu_cost(cpu_snapshot, stats.image_len);
+#ifdef CONFIG_OTA_AFFINITY_ADVISED
+            //The next update runs with the placement advised from this one
+            ota_affinity_sample_t sample;
+            ota_affinity_measure(cpu_snapshot, OTA_TASK_NAME, OTA_ENGINE_WRITER_TASK_NAME, &sample);
+            if (ota_affinity_learn(&sample, &s_placement, CONFIG_OTA_AFFINITY_MARGIN) != ESP_OK) {
+                ESP_LOGW(TAG, "placement advice not saved");
             }
-            binary_file_length += data_read;
-            ESP_LOGD(TAG, "Written image length %d", binary_file_length);
-        } else if (data_read == 0) {
-            ESP_LOGI(TAG, "Connection closed,all data received");
-            break;
+#endif
         }
+        free(cpu_snapshot);
     }
-    ESP_LOGI(TAG, "Total Write binary data length : %d", binary_file_length);
-
-    if (esp_ota_end(update_handle) != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_end failed!");
-        http_cleanup(client);
-        task_fatal_error();
+    latency_probe_result_t probe_result;
+    if (latency_probe_get_results(&probe_result, 1) == 1) {
+        ESP_LOGW(TAG, "reference task latency p50=%d p99=%d max=%d",
+                 probe_result.p50_us, probe_result.p99_us, probe_result.max_us);
     }
 
-    int64_t time_total_end = esp_timer_get_time();
-    accumulate_time(&time_total, time_total_start, time_total_end);
-    ESP_LOGW(TAG, "time_total=%lld", time_total);
-    ESP_LOGW(TAG, "time_http=%lld", time_http);
-    ESP_LOGW(TAG, "time_write=%lld", time_write);
-
-    err = esp_ota_set_boot_partition(update_partition);
+    //esp_ota_set_boot_partition() verifies the image once more
+    ota_cpu_cost_begin_phase("activate");
+    int64_t activate_start = esp_timer_get_time();
+    err = ota_engine_activate(engine);
+    end_flash_phase(activate_start, cost_stats.image_len);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
-        http_cleanup(client);
         task_fatal_error();
     }
+    ota_cpu_cost_print();
+#ifdef CONFIG_PERF_LOG
+    //esp_restart() would lose the timings of the update
+    ota_engine_stats_t stats;
+    ota_engine_get_stats(engine, &stats);
+    perf_history_log_ota(ESP_OK, &stats);
+#endif
     ESP_LOGI(TAG, "Prepare to restart system!");
     esp_restart();
     return ;
 }
 
+#ifdef CONFIG_OTA_AFFINITY_BENCHMARK
+static void affinity_benchmark_task(void *pvParameter)
+{
+    ota_engine_handle_t engine = pvParameter;
+    const ota_affinity_benchmark_config_t config = {
+        .task_name = OTA_TASK_NAME,
+        .stack_size = OTA_TASK_STACK,
+        .priority = OTA_TASK_PRIO,
+        .probe_priority = OTA_TASK_PRIO,
+        .margin = CONFIG_OTA_AFFINITY_MARGIN,
+    };
+    wait_for_network();
+    esp_err_t err = ota_affinity_benchmark(engine, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Benchmark failed (%s)", esp_err_to_name(err));
+    }
+    infinite_loop();
+}
+#endif
+
 static bool diagnostic(void)
 {
     gpio_config_t io_conf;
@@ -315,6 +637,7 @@ void app_main()
 {
     uint8_t sha_256[HASH_LEN] = { 0 };
     esp_partition_t partition;
+    esp_err_t err;
 
     // get sha256 digest for the partition table
     partition.address   = ESP_PARTITION_TABLE_OFFSET;
@@ -334,24 +657,38 @@ void app_main()
     esp_partition_get_sha256(esp_ota_get_running_partition(), sha_256);
     print_sha256(sha_256, "SHA-256 for current firmware: ");
 
-    const esp_partition_t *running = esp_ota_get_running_partition();
-    esp_ota_img_states_t ota_state;
-    if (esp_ota_get_state_partition(running, &ota_state) == ESP_OK) {
-        if (ota_state == ESP_OTA_IMG_PENDING_VERIFY) {
-            // run diagnostic function ...
-            bool diagnostic_is_ok = diagnostic();
-            if (diagnostic_is_ok) {
-                ESP_LOGI(TAG, "Diagnostics completed successfully! Continuing execution ...");
-                esp_ota_mark_app_valid_cancel_rollback();
-            } else {
-                ESP_LOGE(TAG, "Diagnostics failed! Start rollback to the previous version ...");
-                esp_ota_mark_app_invalid_rollback_and_reboot();
-            }
+    print_slot_utilization();
+#ifdef CONFIG_PERF_LOG
+    //Before the diagnostics, so the boot record comes first
+    err = perf_history_start();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No performance history (%s)", esp_err_to_name(err));
+    }
+#endif
+
+    ota_engine_config_t engine_config = {
+        .http_config = &s_http_config,
+#ifdef CONFIG_OTA_PREERASE
+        //Blocks are erased on demand before each write, only the first sector by esp_ota_begin()
+        .erase_on_demand = true,
+#endif
+    };
+    ota_engine_handle_t engine;
+    ESP_ERROR_CHECK(ota_engine_init(&engine_config, &engine));
+    add_stages(engine);
+    if (ota_engine_get_state(engine) == OTA_ENGINE_STATE_CONFIRM) {
+        // run diagnostic function ...
+        bool diagnostic_is_ok = diagnostic();
+        if (diagnostic_is_ok) {
+            ESP_LOGI(TAG, "Diagnostics completed successfully! Continuing execution ...");
+        } else {
+            ESP_LOGE(TAG, "Diagnostics failed! Start rollback to the previous version ...");
         }
+        ota_engine_confirm(engine, diagnostic_is_ok);
     }
 
     // Initialize NVS.
-    esp_err_t err = nvs_flash_init();
+    err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         // OTA app partition table has a smaller NVS partition size than the non-OTA
         // partition table. This size mismatch may cause NVS initialization to fail.
@@ -360,8 +697,59 @@ void app_main()
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK( err );
-
-    initialise_wifi();
-    xTaskCreatePinnedToCore(&ota_example_task, "ota_example_task", 8192, NULL, 5, NULL, 0);
-    stats_monitor_init();
+#ifdef CONFIG_OTA_BUNDLE
+    //The data partitions are recorded in NVS
+    ota_bundle_print_selection();
+#endif
+
+    //The advice is kept in NVS
+    ota_affinity_get_placement(OTA_AFFINITY_MODE, &s_placement);
+    ESP_ERROR_CHECK(ota_engine_set_writer_core(engine, s_placement.writer_core));
+
+    connectivity_config_t connectivity_config = {
+        .ssid = EXAMPLE_WIFI_SSID,
+        .password = EXAMPLE_WIFI_PASS,
+    };
+    connectivity_start(&connectivity_config);
+#ifdef CONFIG_OTA_PEER
+    //The running app is confirmed at this point
+    err = ota_peer_serve(esp_ota_get_running_partition(), CONFIG_OTA_PEER_PORT);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Not serving the running image to peers (%s)", esp_err_to_name(err));
+    }
+#endif
+#ifdef CONFIG_OTA_PREERASE
+    ota_preerase_config_t preerase_config = {
+        .idle_load = CONFIG_OTA_PREERASE_IDLE_LOAD,
+        .interval_ms = CONFIG_OTA_PREERASE_INTERVAL_MS,
+    };
+    err = ota_preerase_start(&preerase_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "update partition not erased in the background (%s)", esp_err_to_name(err));
+    }
+#endif
+#ifdef CONFIG_OTA_METRICS_SERVER
+    ESP_ERROR_CHECK(metrics_server_start(CONFIG_OTA_METRICS_SERVER_PORT));
+#endif
+#ifdef CONFIG_OTA_BACKGROUND
+    latency_probe_config_t probe_config = {
+        .core_id = (s_placement.reader_core == tskNO_AFFINITY) ? 0 : s_placement.reader_core,
+        .priority = REFERENCE_PROBE_PRIO,
+        .period_ms = REFERENCE_PROBE_PERIOD_MS,
+    };
+    ESP_ERROR_CHECK(latency_probe_start(&probe_config));
+#endif
+#ifdef CONFIG_OTA_AFFINITY_BENCHMARK
+    xTaskCreate(&affinity_benchmark_task, "ota_benchmark", 4096, engine, OTA_TASK_PRIO, NULL);
+#else
+    xTaskCreatePinnedToCore(&ota_example_task, OTA_TASK_NAME, OTA_TASK_STACK, engine, OTA_TASK_PRIO, NULL,
+                            s_placement.reader_core);
+#endif
+    stats_monitor_periodic_config_t stats_config = {
+        .period_ms = CONFIG_STATS_MONITOR_WINDOW_MS,
+#ifdef CONFIG_PERF_LOG
+        .callback = perf_history_window,
+#endif
+    };
+    ESP_ERROR_CHECK(stats_monitor_start_periodic(&stats_config));
 }
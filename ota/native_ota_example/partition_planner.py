@@ -0,0 +1,204 @@
+#!/usr/bin/env python
+#
+# Plans and checks the partition table of an OTA capable project.
+#
+# plan:  computes a layout giving the OTA slots all the flash left after the
+#        data partitions and an optional factory partition sized from its image
+#        plus growth headroom. App partitions are aligned to 64 KiB, so erasing
+#        them uses block erase commands only.
+# check: verifies that an app image fits every app partition of an existing
+#        table with the requested headroom, and that the partitions are aligned.
+#
+# Usage:
+#   partition_planner.py plan --flash-size 8MB --factory-app build/native_ota.bin -o partitions.csv
+#   partition_planner.py check --partitions partitions.csv --app build/native_ota.bin
+#   partition_planner.py plan --flash-size 8MB --bundle-data model:512K --bundle-data www:128K
+#
+from __future__ import print_function, division
+import argparse
+import os
+import sys
+
+APP_ALIGN = 0x10000         # SPI flash block, also required for app partitions
+SECTOR_SIZE = 0x1000
+APP_START = 0x10000
+
+# Performance history of the perf_log component, behind the app partitions
+PERF_LOG_PARTITION = ("perf_log", "data", "0x40")
+
+# Data partitions <name>_0 and <name>_1 of the ota_bundle component, behind the app partitions
+BUNDLE_DATA_SUBTYPE = "0x41"
+BUNDLE_MAX_NAME = 14
+
+# Data partitions of the layout, in front of the app partitions
+DATA_PARTITIONS = [
+    ("nvs", "data", "nvs", 0x9000, 0x4000),
+    ("otadata", "data", "ota", 0xd000, 0x2000),
+    ("phy_init", "data", "phy", 0xf000, 0x1000),
+]
+
+
+def parse_size(text):
+    text = text.strip().upper()
+    for suffix, scale in (("MB", 1024 * 1024), ("M", 1024 * 1024), ("KB", 1024), ("K", 1024)):
+        if text.endswith(suffix):
+            return int(text[:-len(suffix)], 0) * scale
+    return int(text, 0)
+
+
+def align_up(value, align):
+    return (value + align - 1) // align * align
+
+
+def align_down(value, align):
+    return value // align * align
+
+
+def image_size(path):
+    return os.path.getsize(path)
+
+
+def parse_csv(path):
+    """ Returns [(name, type, subtype, offset, size)], offsets filled in as gen_esp32part.py does """
+    partitions = []
+    next_offset = APP_START // 2
+    with open(path) as f:
+        for line in f:
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+            fields = [field.strip() for field in line.split(",")]
+            name, ptype, subtype = fields[0], fields[1], fields[2]
+            is_app = ptype in ("app", "0", "0x0", "0x00")
+            offset = parse_size(fields[3]) if fields[3] else align_up(next_offset, APP_ALIGN if is_app else 4)
+            size = parse_size(fields[4])
+            if is_app and subtype in ("0", "0x0", "0x00"):
+                subtype = "factory"
+            partitions.append((name, "app" if is_app else ptype, subtype, offset, size))
+            next_offset = offset + size
+    return partitions
+
+
+def write_csv(partitions, out):
+    out.write("# ESP-IDF Partition Table, generated by partition_planner.py\n")
+    out.write("# Name,   Type, SubType, Offset,  Size, Flags\n")
+    for name, ptype, subtype, offset, size in partitions:
+        if ptype == "app":
+            # Numeric form, as in the hand written tables of the examples
+            ptype, subtype = "0", "0" if subtype == "factory" else subtype
+        out.write("%-9s %-5s %-8s %-9s 0x%x,\n" % (name + ",", ptype + ",", subtype + ",", "0x%x," % offset, size))
+
+
+def plan(args):
+    flash_size = parse_size(args.flash_size)
+    partitions = list(DATA_PARTITIONS)
+    offset = APP_START
+    if args.factory_app or args.factory_size:
+        if args.factory_size:
+            factory_size = align_up(parse_size(args.factory_size), APP_ALIGN)
+        else:
+            factory_size = align_up(int(image_size(args.factory_app) * (100 + args.headroom) / 100), APP_ALIGN)
+        partitions.append(("factory", "app", "factory", offset, factory_size))
+        offset += factory_size
+
+    reserved = align_up(parse_size(args.reserve), APP_ALIGN) if args.reserve else 0
+    perf_log_size = align_up(parse_size(args.perf_log), SECTOR_SIZE) if args.perf_log else 0
+    bundle_data = []
+    for spec in args.bundle_data or []:
+        name, _, size = spec.partition(":")
+        if not name or not size or len(name) > BUNDLE_MAX_NAME:
+            print("Error: --bundle-data %s: expected NAME:SIZE, NAME of up to %d characters" % (spec, BUNDLE_MAX_NAME),
+                  file=sys.stderr)
+            return 1
+        bundle_data.append((name, align_up(parse_size(size), SECTOR_SIZE)))
+    bundle_data_size = sum(2 * align_up(size, APP_ALIGN) for _, size in bundle_data)
+    available = flash_size - offset - reserved - align_up(perf_log_size, APP_ALIGN) - bundle_data_size
+    slot_size = align_down(available // args.slots, APP_ALIGN)
+    if slot_size <= 0:
+        print("Error: no room left for %d OTA slots" % args.slots, file=sys.stderr)
+        return 1
+    for slot in range(args.slots):
+        partitions.append(("ota_%d" % slot, "app", "ota_%d" % slot, offset, slot_size))
+        offset += slot_size
+    if perf_log_size:
+        partitions.append(PERF_LOG_PARTITION + (offset, perf_log_size))
+        offset += align_up(perf_log_size, APP_ALIGN)
+    for name, size in bundle_data:
+        for slot in range(2):
+            partitions.append(("%s_%d" % (name, slot), "data", BUNDLE_DATA_SUBTYPE, offset, size))
+            offset += align_up(size, APP_ALIGN)
+
+    if args.app:
+        need = int(image_size(args.app) * (100 + args.headroom) / 100)
+        if need > slot_size:
+            print("Warning: %s with %d%% headroom needs 0x%x bytes, OTA slots are 0x%x" % (args.app, args.headroom, need, slot_size),
+                  file=sys.stderr)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    write_csv(partitions, out)
+    if args.output:
+        out.close()
+    print("OTA slots of 0x%x bytes (%d KiB), 0x%x bytes left at 0x%x" %
+          (slot_size, slot_size // 1024, flash_size - offset, offset), file=sys.stderr)
+    return 0
+
+
+def check(args):
+    partitions = parse_csv(args.partitions)
+    size = image_size(args.app)
+    need = int(size * (100 + args.headroom) / 100)
+    errors = 0
+    for name, ptype, subtype, offset, part_size in partitions:
+        if ptype != "app":
+            if offset % SECTOR_SIZE or part_size % SECTOR_SIZE:
+                print("Warning: %s is not aligned to the 4 KiB sector size" % name)
+            continue
+        if offset % APP_ALIGN or part_size % APP_ALIGN:
+            print("Warning: %s (0x%x, 0x%x) is not aligned to 64 KiB, erasing it needs sector erases" % (name, offset, part_size))
+        if subtype == "factory" and not args.check_factory:
+            continue
+        if size > part_size:
+            print("Error: %s (%d bytes) does not fit %s (%d bytes)" % (args.app, size, name, part_size))
+            errors += 1
+        elif need > part_size:
+            print("Warning: %s uses %d%% of %s, less than %d%% headroom left" %
+                  (args.app, size * 100 // part_size, name, args.headroom))
+        else:
+            print("%s uses %d%% of %s (%d of %d bytes)" % (os.path.basename(args.app), size * 100 // part_size, name, size, part_size))
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Plan and check partition tables of OTA capable projects")
+    subparsers = parser.add_subparsers(dest="command")
+
+    plan_parser = subparsers.add_parser("plan", help="compute a partition table")
+    plan_parser.add_argument("--flash-size", default="4MB", help="flash size, such as 4MB or 0x800000")
+    plan_parser.add_argument("--factory-app", help="image of the factory partition; no factory partition if omitted")
+    plan_parser.add_argument("--factory-size", help="size of the factory partition, instead of --factory-app")
+    plan_parser.add_argument("--app", help="OTA image, only checked against the planned slot size")
+    plan_parser.add_argument("--slots", type=int, default=2, help="number of OTA slots")
+    plan_parser.add_argument("--headroom", type=int, default=25, help="growth headroom of images, in percent")
+    plan_parser.add_argument("--reserve", help="space left free at the end of the flash")
+    plan_parser.add_argument("--perf-log", help="size of a perf_log data partition after the OTA slots, such as 64K")
+    plan_parser.add_argument("--bundle-data", action="append", metavar="NAME:SIZE",
+                             help="partitions NAME_0 and NAME_1 for data images of OTA bundles, may be repeated")
+    plan_parser.add_argument("--output", "-o", help="CSV file to write, stdout if omitted")
+
+    check_parser = subparsers.add_parser("check", help="check an image against a partition table")
+    check_parser.add_argument("--partitions", required=True, help="partition table CSV")
+    check_parser.add_argument("--app", required=True, help="OTA image")
+    check_parser.add_argument("--headroom", type=int, default=10, help="headroom to warn about, in percent")
+    check_parser.add_argument("--check-factory", action="store_true", help="also require the image to fit the factory partition")
+
+    args = parser.parse_args()
+    if args.command == "plan":
+        return plan(args)
+    elif args.command == "check":
+        return check(args)
+    parser.print_help()
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,243 @@
+#!/usr/bin/env python
+#
+# Simulates a rollout with LAN peer OTA on the host: a central server and a
+# number of devices following the same steps as the ota_peer component.
+#
+# Every device fetches the manifest from the central server, looks for a peer
+# announcing the SHA-256 of the manifest, downloads the image from it and
+# verifies size and SHA-256, falling back to the central server otherwise.
+# Once updated, a device serves the image to the others. Peer discovery uses an
+# in-process registry in place of mDNS; all transfers are real HTTP on
+# localhost.
+#
+# Usage:
+#   peer_ota_sim.py build/native_ota.bin --devices 20 --stagger-ms 200 --tamper 2
+#
+from __future__ import print_function, division
+import argparse
+import hashlib
+import json
+import random
+import sys
+import threading
+import time
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+    from urllib.request import urlopen
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+    from urllib2 import urlopen
+
+CHUNK_SIZE = 4096
+
+
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def make_manifest(version, image):
+    return {"version": version, "size": len(image), "sha256": hashlib.sha256(image).hexdigest()}
+
+
+class ImageServer(object):
+    """ Serves /manifest and /image, optionally limiting the upload rate """
+
+    def __init__(self, manifest, image, kbps=0):
+        self.manifest = manifest
+        self.image = image
+        self.kbps = kbps
+        self.bytes_served = 0
+        self.lock = threading.Lock()
+        server = self
+
+        class Handler(BaseHTTPRequestHandler):
+            def log_message(self, *args):
+                pass
+
+            def do_GET(self):
+                if self.path in ("/manifest", "/manifest.json"):
+                    body = json.dumps(server.manifest).encode()
+                    self.send_response(200)
+                    self.send_header("Content-Type", "application/json")
+                    self.send_header("Content-Length", str(len(body)))
+                    self.end_headers()
+                    self.wfile.write(body)
+                elif self.path in ("/image", "/image.bin"):
+                    self.send_response(200)
+                    self.send_header("Content-Type", "application/octet-stream")
+                    self.send_header("Content-Length", str(len(server.image)))
+                    self.end_headers()
+                    server.send_image(self.wfile)
+                else:
+                    self.send_error(404)
+
+        self.httpd = ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+        self.port = self.httpd.server_address[1]
+        self.thread = threading.Thread(target=self.httpd.serve_forever)
+        self.thread.daemon = True
+        self.thread.start()
+
+    def url(self, path):
+        return "http://127.0.0.1:%d%s" % (self.port, path)
+
+    def send_image(self, out):
+        for pos in range(0, len(self.image), CHUNK_SIZE):
+            chunk = self.image[pos:pos + CHUNK_SIZE]
+            if self.kbps:
+                time.sleep(len(chunk) / (self.kbps * 1024))
+            out.write(chunk)
+            with self.lock:
+                self.bytes_served += len(chunk)
+
+    def stop(self):
+        self.httpd.shutdown()
+        self.httpd.server_close()
+
+
+class Registry(object):
+    """ Stands in for mDNS: peers announce the SHA-256 of the image they serve """
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.services = []
+
+    def announce(self, sha256, url):
+        with self.lock:
+            self.services.append((sha256, url))
+
+    def query(self, sha256):
+        with self.lock:
+            urls = [url for digest, url in self.services if digest == sha256]
+        random.shuffle(urls)
+        return urls
+
+
+def download(url, manifest):
+    """ Streams an image and verifies it against the manifest, as ota_peer_download() does """
+    sha = hashlib.sha256()
+    data = bytearray()
+    response = urlopen(url, timeout=10)
+    while True:
+        chunk = response.read(CHUNK_SIZE)
+        if not chunk:
+            break
+        if len(data) + len(chunk) > manifest["size"]:
+            raise IOError("image larger than the manifest")
+        sha.update(chunk)
+        data += chunk
+    if len(data) != manifest["size"]:
+        raise IOError("image size %d, manifest %d" % (len(data), manifest["size"]))
+    if sha.hexdigest() != manifest["sha256"]:
+        raise IOError("SHA-256 does not match the manifest")
+    return bytes(data)
+
+
+class Device(object):
+    def __init__(self, index, registry, central, args, tampered):
+        self.name = "dev%02d" % index
+        self.registry = registry
+        self.central = central
+        self.args = args
+        self.tampered = tampered
+        self.version = "old"
+        self.image = None
+        self.source = None
+        self.rejected = 0
+        self.server = None
+        self.seconds = 0
+
+    def serve(self, manifest):
+        image = self.image
+        if self.tampered:
+            # A broken or malicious peer announcing the right hash
+            image = bytearray(image)
+            image[len(image) // 2] ^= 0xff
+            image = bytes(image)
+        self.server = ImageServer(manifest, image, self.args.peer_kbps)
+        self.registry.announce(manifest["sha256"], self.server.url("/image"))
+
+    def update(self):
+        start = time.time()
+        manifest = json.loads(urlopen(self.central.url("/manifest.json"), timeout=10).read().decode())
+        if manifest["version"] == self.version:
+            return
+        for url in self.registry.query(manifest["sha256"])[:self.args.peer_attempts]:
+            try:
+                self.image = download(url, manifest)
+                self.source = "peer"
+                break
+            except Exception as e:
+                self.rejected += 1
+                print("%s: rejected %s (%s)" % (self.name, url, e))
+        if self.image is None:
+            self.image = download(self.central.url("/image.bin"), manifest)
+            self.source = "central"
+        self.version = manifest["version"]
+        self.seconds = time.time() - start
+        self.serve(manifest)
+
+    def run(self, delay):
+        time.sleep(delay)
+        try:
+            self.update()
+        except Exception as e:
+            self.source = "FAILED: %s" % e
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate a LAN peer OTA rollout on the host")
+    parser.add_argument("image", help="image file to roll out")
+    parser.add_argument("--version", default="new", help="version in the manifest")
+    parser.add_argument("--devices", type=int, default=10)
+    parser.add_argument("--stagger-ms", type=int, default=100, help="delay between the start of two devices")
+    parser.add_argument("--central-kbps", type=int, default=0, help="uplink rate of the central server, 0 for unlimited")
+    parser.add_argument("--peer-kbps", type=int, default=0, help="upload rate of each peer, 0 for unlimited")
+    parser.add_argument("--peer-attempts", type=int, default=2, help="peers tried before falling back to the server")
+    parser.add_argument("--tamper", type=int, default=0, help="number of devices serving a corrupted image")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    with open(args.image, "rb") as f:
+        image = f.read()
+    manifest = make_manifest(args.version, image)
+    central = ImageServer(manifest, image, args.central_kbps)
+    registry = Registry()
+    tampered = set(random.sample(range(args.devices), min(args.tamper, args.devices)))
+    devices = [Device(i, registry, central, args, i in tampered) for i in range(args.devices)]
+
+    start = time.time()
+    threads = []
+    for i, device in enumerate(devices):
+        thread = threading.Thread(target=device.run, args=(i * args.stagger_ms / 1000.0,))
+        thread.start()
+        threads.append(thread)
+    for thread in threads:
+        thread.join()
+    elapsed = time.time() - start
+
+    print("\n| Device | Source | Rejected peers | Seconds | Serves corrupted image")
+    print("| --- | --- | --- | --- | ---")
+    failed = 0
+    for device in devices:
+        ok = device.image is not None and hashlib.sha256(device.image).hexdigest() == manifest["sha256"]
+        failed += 0 if ok else 1
+        print("| %s | %s | %d | %.2f | %s" % (device.name, device.source, device.rejected, device.seconds,
+                                             "yes" if device.tampered else ""))
+    peer_bytes = sum(d.server.bytes_served for d in devices if d.server)
+    print("\n%d devices updated in %.1f s, %d failed" % (len(devices) - failed, elapsed, failed))
+    print("central server sent %d bytes (%.1f images), peers sent %d bytes" %
+          (central.bytes_served, central.bytes_served / len(image), peer_bytes))
+
+    central.stop()
+    for device in devices:
+        if device.server:
+            device.server.stop()
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
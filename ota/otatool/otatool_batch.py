@@ -0,0 +1,267 @@
+#!/usr/bin/env python
+#
+# Batch flashing of OTA partitions: writes images to the app partitions of many
+# devices in parallel, skipping blocks whose contents already match.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http:#www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+from __future__ import print_function, division
+import os
+import sys
+import time
+import struct
+import hashlib
+import argparse
+import threading
+from multiprocessing.pool import ThreadPool
+
+IDF_PATH = os.path.expandvars("$IDF_PATH")
+
+PARTITION_TABLE_OFFSET = 0x8000
+PARTITION_TABLE_MAX_LEN = 0xC00
+PARTITION_MAGIC = 0x50AA
+PARTITION_ENTRY = struct.Struct("<HBBLL16sL")
+APP_TYPE = 0x00
+OTA_SUBTYPE_MIN = 0x10
+SECTOR_SIZE = 0x1000
+
+_print_lock = threading.Lock()
+
+
+def log(target, message):
+    with _print_lock:
+        print("[%s] %s" % (target, message))
+        sys.stdout.flush()
+
+
+def parse_partition_table(data):
+    # Returns {name: (type, subtype, offset, size)} from a binary partition table
+    partitions = {}
+    for pos in range(0, len(data) - PARTITION_ENTRY.size + 1, PARTITION_ENTRY.size):
+        magic, ptype, subtype, offset, size, name, _ = PARTITION_ENTRY.unpack_from(data, pos)
+        if magic != PARTITION_MAGIC:
+            break
+        name = name.rstrip(b"\0").decode("ascii")
+        partitions[name] = (ptype, subtype, offset, size)
+    return partitions
+
+
+def find_partition(partitions, spec):
+    # spec is a partition name or an OTA slot number
+    if spec.isdigit():
+        for name, (ptype, subtype, offset, size) in partitions.items():
+            if ptype == APP_TYPE and subtype == OTA_SUBTYPE_MIN + int(spec):
+                return name, offset, size
+    elif spec in partitions:
+        _, _, offset, size = partitions[spec]
+        return spec, offset, size
+    raise ValueError("partition %s not found" % spec)
+
+
+class Image(object):
+    # Image split into blocks, hashed once and shared by all devices
+
+    def __init__(self, spec, path, block_size):
+        self.spec = spec
+        self.path = path
+        with open(path, "rb") as f:
+            self.data = f.read()
+        self.blocks = []
+        for pos in range(0, len(self.data), block_size):
+            block = self.data[pos:pos + block_size]
+            self.blocks.append((pos, block, hashlib.md5(block).hexdigest()))
+
+
+class EsptoolFlash(object):
+    # Flash of a device attached to a serial port, driven through the esptool stub
+
+    def __init__(self, port, baud):
+        sys.path.append(os.path.join(IDF_PATH, "components", "esptool_py", "esptool"))
+        import esptool
+        self.name = port
+        self._esptool = esptool
+        esp = esptool.ESPLoader.detect_chip(port, esptool.ESPLoader.ESP_ROM_BAUD)
+        esp = esp.run_stub()
+        if baud != esptool.ESPLoader.ESP_ROM_BAUD:
+            esp.change_baud(baud)
+        flash_size = esptool.DETECTED_FLASH_SIZES.get((esp.flash_id() >> 16) & 0xff, "4MB")
+        esp.flash_set_parameters(esptool.flash_size_bytes(flash_size))
+        self._esp = esp
+
+    def read(self, offset, size):
+        return self._esp.read_flash(offset, size)
+
+    def md5(self, offset, size):
+        # Hashed by the stub, only the digest crosses the serial link
+        return self._esp.flash_md5sum(offset, size)
+
+    def write(self, offset, data):
+        esp = self._esp
+        esp.flash_begin(len(data), offset)
+        for seq, pos in enumerate(range(0, len(data), esp.FLASH_WRITE_SIZE)):
+            block = data[pos:pos + esp.FLASH_WRITE_SIZE]
+            block += b"\xff" * (esp.FLASH_WRITE_SIZE - len(block))
+            esp.flash_block(block, seq)
+        # The stub acknowledges a register read only once the last write completed
+        esp.read_reg(self._esptool.ESPLoader.CHIP_DETECT_MAGIC_REG_ADDR)
+
+    def close(self):
+        self._esp.hard_reset()
+        self._esp._port.close()
+
+
+class SimulatedFlash(object):
+    # Flash image file standing in for a device, with an optional link speed limit
+
+    def __init__(self, path, kbps):
+        self.name = path
+        self._path = path
+        self._delay_per_byte = 1.0 / (kbps * 1024) if kbps else 0
+        self._lock = threading.Lock()
+
+    def _transfer(self, size):
+        if self._delay_per_byte:
+            time.sleep(size * self._delay_per_byte)
+
+    def read(self, offset, size):
+        with self._lock, open(self._path, "rb") as f:
+            f.seek(offset)
+            data = f.read(size)
+        self._transfer(size)
+        return data
+
+    def md5(self, offset, size):
+        with self._lock, open(self._path, "rb") as f:
+            f.seek(offset)
+            return hashlib.md5(f.read(size)).hexdigest()
+
+    def write(self, offset, data):
+        self._transfer(len(data))
+        with self._lock, open(self._path, "r+b") as f:
+            f.seek(offset)
+            f.write(data)
+
+    def close(self):
+        pass
+
+
+def flash_device(flash, images, partition_table_offset, verify):
+    # Per device pipeline: read the partition table, then for each block of each
+    # image compare the on-device hash and write only the blocks which differ
+    stats = {"blocks": 0, "skipped": 0, "written": 0, "bytes": 0}
+    start = time.time()
+    try:
+        partitions = parse_partition_table(flash.read(partition_table_offset, PARTITION_TABLE_MAX_LEN))
+        for image in images:
+            name, offset, size = find_partition(partitions, image.spec)
+            if len(image.data) > size:
+                raise ValueError("%s (%d bytes) does not fit %s (%d bytes)" % (image.path, len(image.data), name, size))
+            written = 0
+            for pos, block, digest in image.blocks:
+                stats["blocks"] += 1
+                if flash.md5(offset + pos, len(block)) == digest:
+                    stats["skipped"] += 1
+                    continue
+                flash.write(offset + pos, block)
+                if verify and flash.md5(offset + pos, len(block)) != digest:
+                    raise IOError("verification of %s at 0x%x failed" % (name, offset + pos))
+                stats["written"] += 1
+                written += len(block)
+            stats["bytes"] += written
+            log(flash.name, "%s: %d of %d bytes written" % (name, written, len(image.data)))
+    except Exception as e:
+        log(flash.name, "Error: %s" % e)
+        return flash.name, False, stats
+    finally:
+        flash.close()
+    stats["seconds"] = time.time() - start
+    return flash.name, True, stats
+
+
+def open_target(args, target):
+    if target.startswith("sim:"):
+        return SimulatedFlash(target[len("sim:"):], args.sim_kbps)
+    return EsptoolFlash(target, args.baud)
+
+
+def run_target(args, images, target):
+    try:
+        flash = open_target(args, target)
+    except Exception as e:
+        log(target, "Error: %s" % e)
+        return target, False, {}
+    return flash_device(flash, images, args.partition_table_offset, not args.no_verify)
+
+
+def create_simulated_flash(path, size, partition_table, partition_table_offset):
+    with open(partition_table, "rb") as f:
+        table = f.read()
+    data = bytearray(b"\xff" * size)
+    data[partition_table_offset:partition_table_offset + len(table)] = table
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser("ESP-IDF OTA batch flashing")
+    parser.add_argument("targets", nargs="+",
+                        help="serial ports of the devices, or sim:<file> for a simulated flash image")
+    parser.add_argument("--image", "-i", action="append", required=True, metavar="PARTITION=FILE",
+                        help="image to write, to a partition given by name or OTA slot number; may be repeated")
+    parser.add_argument("--jobs", "-j", type=int, default=4, help="number of devices flashed at the same time")
+    parser.add_argument("--baud", "-b", type=int, default=921600, help="baud rate used after connecting")
+    parser.add_argument("--block-size", type=lambda x: int(x, 0), default=0x10000,
+                        help="granularity of hash comparison and writes, multiple of the 4 KiB sector size")
+    parser.add_argument("--partition-table-offset", type=lambda x: int(x, 0), default=PARTITION_TABLE_OFFSET)
+    parser.add_argument("--no-verify", action="store_true", help="do not hash written blocks again")
+    parser.add_argument("--sim-create", metavar="PARTITION_TABLE_BIN",
+                        help="create missing sim: files, erased, holding this partition table")
+    parser.add_argument("--sim-size", type=lambda x: int(x, 0), default=0x400000, help="size of created sim: files")
+    parser.add_argument("--sim-kbps", type=int, default=0,
+                        help="limit the transfer rate of sim: targets to emulate a serial link (KiB/s)")
+    args = parser.parse_args()
+
+    if args.block_size % SECTOR_SIZE != 0:
+        parser.error("--block-size must be a multiple of 0x%x" % SECTOR_SIZE)
+
+    images = []
+    for spec in args.image:
+        partition, _, path = spec.partition("=")
+        if not path:
+            parser.error("--image expects PARTITION=FILE")
+        images.append(Image(partition, path, args.block_size))
+
+    if args.sim_create:
+        for target in args.targets:
+            path = target[len("sim:"):]
+            if target.startswith("sim:") and not os.path.exists(path):
+                create_simulated_flash(path, args.sim_size, args.sim_create, args.partition_table_offset)
+
+    start = time.time()
+    pool = ThreadPool(max(1, min(args.jobs, len(args.targets))))
+    results = pool.map(lambda target: run_target(args, images, target), args.targets)
+    pool.close()
+
+    failed = 0
+    print("\n| Target | Result | Blocks | Skipped | Written | Bytes | Seconds")
+    print("| --- | --- | --- | --- | --- | --- | ---")
+    for name, ok, stats in results:
+        failed += 0 if ok else 1
+        print("| %s | %s | %d | %d | %d | %d | %.1f" % (name, "ok" if ok else "FAILED", stats.get("blocks", 0),
+                                                       stats.get("skipped", 0), stats.get("written", 0),
+                                                       stats.get("bytes", 0), stats.get("seconds", 0)))
+    print("\n%d of %d targets flashed in %.1f s" % (len(results) - failed, len(results), time.time() - start))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -11,12 +11,14 @@
 #include "freertos/event_groups.h"
 
 #include "esp_system.h"
-#include "esp_wifi.h"
-#include "esp_event_loop.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_http_client.h"
-#include "esp_https_ota.h"
+#include "ota_engine.h"
+#include "connectivity.h"
+#ifdef CONFIG_OTA_ROLLOUT
+#include "ota_rollout.h"
+#endif
 
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -31,15 +33,11 @@ static const char *TAG = "simple_ota_example";
 extern const uint8_t server_cert_pem_start[] asm("_binary_ca_cert_pem_start");
 extern const uint8_t server_cert_pem_end[] asm("_binary_ca_cert_pem_end");
 
-/* FreeRTOS event group to signal when we are connected & ready to make a request */
-static EventGroupHandle_t wifi_event_group;
-
-/* The event group allows multiple bits for each event,
-   but we only care about one event - are we connected
-   to the AP with an IP? */
-const int CONNECTED_BIT = BIT0;
 
 #define OTA_URL_SIZE 256 
+#define NETWORK_WAIT_MS 30000
+#define OTA_RESUME_ATTEMPTS 10
+#define OTA_RESUME_DELAY_MS 1000
 
 #ifdef CONFIG_EXAMPLE_FIRMWARE_UPGRADE_URL_FROM_STDIN
 static esp_err_t example_configure_stdin_stdout(void)
@@ -72,6 +70,9 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
             break;
         case HTTP_EVENT_ON_HEADER:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+#ifdef CONFIG_OTA_ROLLOUT
+            ota_rollout_http_event_handler(evt);
+#endif
             break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
@@ -86,54 +87,17 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-static esp_err_t event_handler(void *ctx, system_event_t *event)
+//Waits for the network, which connectivity keeps reconnecting, logging while it takes long
+static void wait_for_network(void)
 {
-    switch (event->event_id) {
-    case SYSTEM_EVENT_STA_START:
-        esp_wifi_connect();
-        break;
-    case SYSTEM_EVENT_STA_GOT_IP:
-        xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
-        break;
-    case SYSTEM_EVENT_STA_DISCONNECTED:
-        /* This is a workaround as ESP32 WiFi libs don't currently
-           auto-reassociate. */
-        esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
-        break;
-    default:
-        break;
+    while (connectivity_wait(pdMS_TO_TICKS(NETWORK_WAIT_MS)) != ESP_OK) {
+        ESP_LOGW(TAG, "Still not connected to %s", CONFIG_WIFI_SSID);
     }
-    return ESP_OK;
-}
-
-static void initialise_wifi(void)
-{
-    tcpip_adapter_init();
-    wifi_event_group = xEventGroupCreate();
-    ESP_ERROR_CHECK( esp_event_loop_init(event_handler, NULL) );
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
-    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = CONFIG_WIFI_SSID,
-            .password = CONFIG_WIFI_PASSWORD,
-        },
-    };
-    ESP_LOGI(TAG, "Setting WiFi configuration SSID %s", wifi_config.sta.ssid);
-    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
-    ESP_ERROR_CHECK( esp_wifi_start() );
 }
 
 void simple_ota_example_task(void * pvParameter)
 {
-    /* Wait for the callback to set the CONNECTED_BIT in the
-       event group.
-    */
-    xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT,
-                        false, true, portMAX_DELAY);
+    wait_for_network();
     ESP_LOGI(TAG, "Starting OTA example");
     ESP_LOGI(TAG, "Connected to WiFi network! Attempting to connect to server...");
     
@@ -161,10 +125,41 @@ void simple_ota_example_task(void * pvParameter)
     config.skip_cert_common_name_check = true;
 #endif
 
-    esp_err_t ret = esp_https_ota(&config);
+#ifdef CONFIG_OTA_ROLLOUT
+    ota_rollout_target_t rollout_target;
+    ota_rollout_wait((const char *)server_cert_pem_start, esp_ota_get_app_description()->version, &rollout_target);
+    config.url = rollout_target.url;
+#endif
+
+    ota_engine_config_t engine_config = {
+        .http_config = &config,
+    };
+    ota_engine_handle_t engine;
+    ESP_ERROR_CHECK(ota_engine_init(&engine_config, &engine));
+    if (ota_engine_get_state(engine) == OTA_ENGINE_STATE_CONFIRM) {
+        //First boot of this app with rollback enabled, it connected, that is enough to keep it
+        ota_engine_confirm(engine, true);
+    }
+    esp_err_t ret = ota_engine_run(engine);
+    int resumes = 0;
+    int busy_attempts = 1;
+    while (1) {
+        if (ret == ESP_ERR_OTA_ENGINE_PAUSED && resumes++ < OTA_RESUME_ATTEMPTS) {
+            //The download continues where it stopped once the network is back
+            wait_for_network();
+            vTaskDelay(pdMS_TO_TICKS(OTA_RESUME_DELAY_MS));
+#ifdef CONFIG_OTA_ROLLOUT
+        } else if (ret == ESP_ERR_OTA_ENGINE_BUSY && busy_attempts++ < CONFIG_OTA_ROLLOUT_BUSY_ATTEMPTS) {
+            ota_rollout_backoff(ota_engine_get_http_status(engine));
+#endif
+        } else {
+            break;
+        }
+        ret = ota_engine_run(engine);
+    }
     if (ret == ESP_OK) {
         esp_restart();
-    } else {
+    } else if (ret != ESP_ERR_OTA_ENGINE_UP_TO_DATE && ret != ESP_ERR_OTA_ENGINE_REJECTED) {
         ESP_LOGE(TAG, "Firmware upgrade failed");
     }
     while (1) {
@@ -186,6 +181,10 @@ void app_main()
     }
     ESP_ERROR_CHECK( err );
 
-    initialise_wifi();
+    connectivity_config_t connectivity_config = {
+        .ssid = CONFIG_WIFI_SSID,
+        .password = CONFIG_WIFI_PASSWORD,
+    };
+    connectivity_start(&connectivity_config);
     xTaskCreate(&simple_ota_example_task, "ota_example_task", 8192, NULL, 5, NULL);
 }
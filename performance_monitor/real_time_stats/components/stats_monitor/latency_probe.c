@@ -0,0 +1,208 @@
+/* Scheduler latency probe
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "latency_probe.h"
+
+/*
+ * Latencies are counted in a log-linear histogram: one bucket per microsecond
+ * below LINEAR_LIMIT_US, then four buckets per power of two. That keeps the
+ * error of a percentile below 25% over the whole range with a fixed, small
+ * table per probe.
+ */
+#define LINEAR_LIMIT_US     16
+#define LINEAR_LIMIT_BITS   4
+#define SUB_BUCKET_BITS     2
+#define BUCKET_NUM          96
+#define PROBE_STACK_SIZE    2048
+
+typedef struct {
+    bool in_use;                //Slot taken by latency_probe_start()
+    bool started;               //Task created, the probe is reported
+    latency_probe_config_t config;
+    volatile bool reset_pending;
+    uint32_t samples;
+    uint32_t max_us;
+    uint32_t buckets[BUCKET_NUM];
+} latency_probe_t;
+
+static const char *TAG = "latency_probe";
+//The flags of the slots are guarded by s_probe_lock
+static latency_probe_t s_probes[LATENCY_PROBE_MAX];
+static portMUX_TYPE s_probe_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int bucket_index(uint32_t latency_us)
+{
+    if (latency_us < LINEAR_LIMIT_US) {
+        return latency_us;
+    }
+    int msb = 31 - __builtin_clz(latency_us);
+    int sub = (latency_us >> (msb - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+    int index = LINEAR_LIMIT_US + ((msb - LINEAR_LIMIT_BITS) << SUB_BUCKET_BITS) + sub;
+    return (index < BUCKET_NUM) ? index : BUCKET_NUM - 1;
+}
+
+//Largest latency counted in a bucket
+static uint32_t bucket_upper_bound(int index)
+{
+    if (index < LINEAR_LIMIT_US) {
+        return index;
+    }
+    int msb = ((index - LINEAR_LIMIT_US) >> SUB_BUCKET_BITS) + LINEAR_LIMIT_BITS;
+    int sub = (index - LINEAR_LIMIT_US) & ((1 << SUB_BUCKET_BITS) - 1);
+    return (1UL << msb) + ((uint32_t)(sub + 1) << (msb - SUB_BUCKET_BITS)) - 1;
+}
+
+static uint32_t percentile(const latency_probe_t *probe, uint32_t samples, uint32_t percent)
+{
+    uint32_t rank = ((uint64_t)samples * percent + 99) / 100;
+    uint32_t count = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        count += probe->buckets[i];
+        if (count >= rank) {
+            uint32_t bound = bucket_upper_bound(i);
+            return (bound < probe->max_us) ? bound : probe->max_us;
+        }
+    }
+    return probe->max_us;
+}
+
+static void probe_task(void *arg)
+{
+    latency_probe_t *probe = (latency_probe_t *)arg;
+    const TickType_t period = pdMS_TO_TICKS(probe->config.period_ms);
+    TickType_t last_wake = xTaskGetTickCount();
+
+    //The first wake-up is aligned to a tick and serves as reference for the following ones
+    vTaskDelayUntil(&last_wake, period);
+    int64_t expected = esp_timer_get_time();
+    while (1) {
+        vTaskDelayUntil(&last_wake, period);
+        expected += (int64_t)period * portTICK_PERIOD_MS * 1000;
+        int64_t latency = esp_timer_get_time() - expected;
+        uint32_t latency_us = (latency > 0) ? (uint32_t)latency : 0;
+
+        if (probe->reset_pending) {
+            memset(probe->buckets, 0, sizeof(probe->buckets));
+            probe->samples = 0;
+            probe->max_us = 0;
+            probe->reset_pending = false;
+        }
+        probe->buckets[bucket_index(latency_us)]++;
+        probe->samples++;
+        if (latency_us > probe->max_us) {
+            probe->max_us = latency_us;
+        }
+    }
+}
+
+esp_err_t latency_probe_start(const latency_probe_config_t *config)
+{
+    if (config->core_id < 0 || config->core_id >= portNUM_PROCESSORS || pdMS_TO_TICKS(config->period_ms) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    latency_probe_t *probe = NULL;
+    portENTER_CRITICAL(&s_probe_lock);
+    for (int i = 0; i < LATENCY_PROBE_MAX && probe == NULL; i++) {
+        if (!s_probes[i].in_use) {
+            probe = &s_probes[i];
+            probe->in_use = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_probe_lock);
+    if (probe == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    //Not reported until started, so the readers never see it half set up
+    probe->config = *config;
+    probe->reset_pending = false;
+    probe->samples = 0;
+    probe->max_us = 0;
+    memset(probe->buckets, 0, sizeof(probe->buckets));
+
+    char name[configMAX_TASK_NAME_LEN];
+    snprintf(name, sizeof(name), "lat%dp%d", config->core_id, config->priority);
+    bool created = xTaskCreatePinnedToCore(probe_task, name, PROBE_STACK_SIZE, probe, config->priority, NULL,
+                                           config->core_id) == pdPASS;
+    portENTER_CRITICAL(&s_probe_lock);
+    probe->started = created;
+    probe->in_use = created;
+    portEXIT_CRITICAL(&s_probe_lock);
+    if (!created) {
+        ESP_LOGE(TAG, "failed to create probe task %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static bool probe_started(int index)
+{
+    portENTER_CRITICAL(&s_probe_lock);
+    bool started = s_probes[index].started;
+    portEXIT_CRITICAL(&s_probe_lock);
+    return started;
+}
+
+void latency_probe_reset(void)
+{
+    for (int i = 0; i < LATENCY_PROBE_MAX; i++) {
+        if (probe_started(i)) {
+            s_probes[i].reset_pending = true;
+        }
+    }
+}
+
+int latency_probe_get_results(latency_probe_result_t *results, int max_results)
+{
+    latency_probe_t snapshot;
+    int num = 0;
+
+    for (int i = 0; i < LATENCY_PROBE_MAX && num < max_results; i++) {
+        if (!probe_started(i)) {
+            continue;
+        }
+        //Probe tasks keep running while we read, so work on a copy
+        memcpy(&snapshot, &s_probes[i], sizeof(snapshot));
+        uint32_t samples = 0;
+        for (int j = 0; j < BUCKET_NUM; j++) {
+            samples += snapshot.buckets[j];
+        }
+        results[num].core_id = snapshot.config.core_id;
+        results[num].priority = snapshot.config.priority;
+        results[num].samples = samples;
+        results[num].p50_us = samples ? percentile(&snapshot, samples, 50) : 0;
+        results[num].p99_us = samples ? percentile(&snapshot, samples, 99) : 0;
+        results[num].max_us = snapshot.max_us;
+        num++;
+    }
+    return num;
+}
+
+void latency_probe_print(void)
+{
+    latency_probe_result_t results[LATENCY_PROBE_MAX];
+    int num = latency_probe_get_results(results, LATENCY_PROBE_MAX);
+    if (num == 0) {
+        return;
+    }
+
+    printf("| Core | Priority | Samples | p50(us) | p99(us) | Max(us)\n");
+    printf("| --- | --- | --- | --- | --- | ---\n");
+    for (int i = 0; i < num; i++) {
+        printf("| %d | %d | %d | %d | %d | %d\n", results[i].core_id, results[i].priority,
+               results[i].samples, results[i].p50_us, results[i].p99_us, results[i].max_us);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#define LATENCY_PROBE_MAX   8
+
+typedef struct {
+    int core_id;            //Core the probe task is pinned to
+    UBaseType_t priority;   //Priority of the probe task
+    uint32_t period_ms;     //Wake-up period, rounded to whole ticks
+} latency_probe_config_t;
+
+typedef struct {
+    int core_id;
+    UBaseType_t priority;
+    uint32_t samples;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} latency_probe_result_t;
+
+/**
+ * @brief   Start a periodic probe task which records how late it wakes up.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   Invalid core or period
+ *  - ESP_ERR_NO_MEM        All probe slots in use, or task creation failed
+ */
+esp_err_t latency_probe_start(const latency_probe_config_t *config);
+
+/**
+ * @brief   Clear the histograms of all probes. Takes effect on the next wake-up
+ *          of each probe.
+ */
+void latency_probe_reset(void);
+
+/**
+ * @brief   Get the latency percentiles of all probes since the last reset.
+ *
+ * @return  Number of results written
+ */
+int latency_probe_get_results(latency_probe_result_t *results, int max_results);
+
+/**
+ * @brief   Print the latency percentiles of all probes since the last reset.
+ */
+void latency_probe_print(void);
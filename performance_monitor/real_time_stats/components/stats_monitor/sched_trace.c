@@ -0,0 +1,218 @@
+/* Context switch tracer
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_ipc.h"
+#include "esp_spi_flash.h"
+#include "esp32/clk.h"
+#include "xtensa/hal.h"
+#include "sched_trace.h"
+
+#ifdef CONFIG_STATS_MONITOR_SCHED_TRACE
+
+#include "sched_trace_hooks.h"
+
+#define EVENT_NUM           CONFIG_STATS_MONITOR_SCHED_TRACE_EVENTS
+#define ARRAY_SIZE_OFFSET   5
+
+#ifdef CONFIG_STATS_MONITOR_SCHED_TRACE_SPIRAM
+#define BUFFER_CAPS         (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define BUFFER_CAPS         (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+/*
+ * An event is a CCOUNT timestamp and a word holding the task handle (TCBs are
+ * word aligned) or the interrupt number, with the event type in the low two
+ * bits. Each core only writes its own buffer, with interrupts masked, so no
+ * lock is needed between cores.
+ */
+typedef enum {
+    EVENT_SWITCHED_IN = 0,
+    EVENT_SWITCHED_OUT = 1,
+    EVENT_ISR_ENTER = 2,
+    EVENT_ISR_EXIT = 3,
+} event_type_t;
+
+typedef struct {
+    uint32_t ccount;
+    uint32_t data;
+} trace_event_t;
+
+typedef struct {
+    trace_event_t *events;
+    uint32_t head;          //Total number of events written, the ring index is head % EVENT_NUM
+    uint32_t cache_off;     //Events dropped because the buffer in external RAM was not accessible
+    uint32_t ref_ccount;    //CCOUNT of this core and esp_timer time sampled together at start
+    int64_t ref_time;
+} trace_buffer_t;
+
+static const char *TAG = "sched_trace";
+static DRAM_ATTR trace_buffer_t s_buffers[portNUM_PROCESSORS];
+static DRAM_ATTR volatile bool s_enabled;
+
+static inline void IRAM_ATTR record(uint32_t data)
+{
+    if (!s_enabled) {
+        return;
+    }
+    uint32_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    trace_buffer_t *buffer = &s_buffers[xPortGetCoreID()];
+#ifdef CONFIG_STATS_MONITOR_SCHED_TRACE_SPIRAM
+    //External RAM is accessed through the flash cache, touching it while the cache is disabled faults
+    if (!spi_flash_cache_enabled()) {
+        buffer->cache_off++;
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+        return;
+    }
+#endif
+    trace_event_t *event = &buffer->events[buffer->head % EVENT_NUM];
+    event->ccount = xthal_get_ccount();
+    event->data = data;
+    buffer->head++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+void IRAM_ATTR sched_trace_task_switched_in(void *task)
+{
+    record((uint32_t)task | EVENT_SWITCHED_IN);
+}
+
+void IRAM_ATTR sched_trace_task_switched_out(void *task)
+{
+    record((uint32_t)task | EVENT_SWITCHED_OUT);
+}
+
+void IRAM_ATTR sched_trace_isr_enter(int irq)
+{
+    record(((uint32_t)irq << 2) | EVENT_ISR_ENTER);
+}
+
+void IRAM_ATTR sched_trace_isr_exit(void)
+{
+    record(EVENT_ISR_EXIT);
+}
+
+//CCOUNT is per core and not synchronized, so each core is referenced to esp_timer
+static void sample_reference(void *arg)
+{
+    trace_buffer_t *buffer = &s_buffers[xPortGetCoreID()];
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    portENTER_CRITICAL(&lock);
+    buffer->ref_time = esp_timer_get_time();
+    buffer->ref_ccount = xthal_get_ccount();
+    portEXIT_CRITICAL(&lock);
+}
+
+esp_err_t sched_trace_init(void)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        if (s_buffers[core].events != NULL) {
+            continue;
+        }
+        s_buffers[core].events = heap_caps_malloc(EVENT_NUM * sizeof(trace_event_t), BUFFER_CAPS);
+        if (s_buffers[core].events == NULL) {
+            ESP_LOGE(TAG, "failed to allocate %d events for core %d", EVENT_NUM, core);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t sched_trace_start(void)
+{
+    esp_err_t err = sched_trace_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_enabled = false;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        s_buffers[core].head = 0;
+        s_buffers[core].cache_off = 0;
+        if (core == xPortGetCoreID()) {
+            sample_reference(NULL);
+        } else {
+            esp_ipc_call_blocking(core, sample_reference, NULL);
+        }
+    }
+    s_enabled = true;
+    ESP_LOGI(TAG, "started, %d events per core", EVENT_NUM);
+    return ESP_OK;
+}
+
+void sched_trace_stop(void)
+{
+    s_enabled = false;
+}
+
+static void dump_task_names(void)
+{
+    UBaseType_t array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
+    TaskStatus_t *array = malloc(sizeof(TaskStatus_t) * array_size);
+    if (array == NULL) {
+        return;
+    }
+    array_size = uxTaskGetSystemState(array, array_size, NULL);
+    for (int i = 0; i < array_size; i++) {
+        printf("SCHED_TRACE TASK 0x%08x %s\n", (uint32_t)array[i].xHandle, array[i].pcTaskName);
+    }
+    free(array);
+}
+
+void sched_trace_dump(void)
+{
+    sched_trace_stop();
+
+    printf("SCHED_TRACE BEGIN cores=%d cpu_mhz=%d\n", portNUM_PROCESSORS, esp_clk_cpu_freq() / 1000000);
+    dump_task_names();
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        trace_buffer_t *buffer = &s_buffers[core];
+        if (buffer->events == NULL) {
+            continue;
+        }
+        uint32_t first = (buffer->head > EVENT_NUM) ? buffer->head - EVENT_NUM : 0;
+        printf("SCHED_TRACE CORE %d ref_ccount=%u ref_time=%lld events=%u dropped=%u cache_off=%u\n",
+               core, buffer->ref_ccount, buffer->ref_time, buffer->head - first, first, buffer->cache_off);
+        for (uint32_t i = first; i < buffer->head; i++) {
+            const trace_event_t *event = &buffer->events[i % EVENT_NUM];
+            printf("E %d %u %d %08x\n", core, event->ccount, event->data & 3, event->data & ~3);
+        }
+    }
+    printf("SCHED_TRACE END\n");
+}
+
+#else // CONFIG_STATS_MONITOR_SCHED_TRACE
+
+esp_err_t sched_trace_init(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t sched_trace_start(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void sched_trace_stop(void)
+{
+}
+
+void sched_trace_dump(void)
+{
+}
+
+#endif // CONFIG_STATS_MONITOR_SCHED_TRACE
@@ -0,0 +1,278 @@
+/* Task starvation and priority inversion detector
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "starvation.h"
+
+#ifdef CONFIG_STATS_MONITOR_STARVATION
+
+#define MAX_TASKS           32          //Tasks tracked, the others are not checked
+#define RATE_PERIOD_US      60000000LL
+#define RATE_INTERVAL_US    (RATE_PERIOD_US / CONFIG_STATS_MONITOR_EVENTS_PER_MIN)
+
+typedef struct {
+    TaskHandle_t handle;
+    const TaskStatus_t *status;         //At the end of the window being checked
+    uint32_t run_time;                  //In the window being checked
+    uint32_t starved_windows;
+    uint32_t inherited_windows;
+    bool seen;
+} task_state_t;
+
+static const char *TAG = "starvation";
+//Only touched by the periodic sampler
+static task_state_t s_tasks[MAX_TASKS];
+static int64_t s_next_event_time;
+static uint32_t s_suppressed;
+static uint32_t s_counts[STARVATION_EVENT_MAX];
+static starvation_event_cb_t s_callback;
+static void *s_callback_arg;
+
+void starvation_set_callback(starvation_event_cb_t callback, void *arg)
+{
+    s_callback_arg = arg;
+    s_callback = callback;
+}
+
+uint32_t starvation_get_count(starvation_event_type_t type)
+{
+    return (type < STARVATION_EVENT_MAX) ? s_counts[type] : 0;
+}
+
+const char *starvation_event_name(starvation_event_type_t type)
+{
+    switch (type) {
+    case STARVATION_EVENT_STARVED:
+        return "starved";
+    case STARVATION_EVENT_INVERSION:
+        return "priority_inversion";
+    default:
+        return "unknown";
+    }
+}
+
+//Rate limit: up to a minute worth of events at once, then one every RATE_INTERVAL_US
+static bool take_event_slot(void)
+{
+    int64_t now = esp_timer_get_time();
+    if (s_next_event_time < now) {
+        s_next_event_time = now;
+    }
+    if (s_next_event_time - now >= RATE_PERIOD_US) {
+        return false;
+    }
+    s_next_event_time += RATE_INTERVAL_US;
+    return true;
+}
+
+static void report(starvation_event_t *event)
+{
+    s_counts[event->type]++;
+    if (!take_event_slot()) {
+        s_suppressed++;
+        return;
+    }
+    event->suppressed = s_suppressed;
+    s_suppressed = 0;
+    //One line of key=value pairs, easy to grep and parse from the console
+    ESP_LOGW(TAG, "event=%s seq=%u task=%s prio=%u base_prio=%u windows=%u %s=%s %s_prio=%u suppressed=%u",
+             starvation_event_name(event->type), event->seq, event->task, event->current_priority,
+             event->base_priority, event->windows,
+             event->type == STARVATION_EVENT_STARVED ? "culprit" : "waiter", event->other[0] ? event->other : "-",
+             event->type == STARVATION_EVENT_STARVED ? "culprit" : "waiter", event->other_priority, event->suppressed);
+    if (s_callback != NULL) {
+        s_callback(event, s_callback_arg);
+    }
+}
+
+//Report when a state reaches threshold windows, then each time its length doubles
+static bool is_report_point(uint32_t windows, uint32_t threshold)
+{
+    if (windows < threshold || windows % threshold != 0) {
+        return false;
+    }
+    uint32_t multiple = windows / threshold;
+    return (multiple & (multiple - 1)) == 0;
+}
+
+static task_state_t *get_state(TaskHandle_t handle)
+{
+    task_state_t *free_state = NULL;
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (s_tasks[i].handle == handle) {
+            return &s_tasks[i];
+        }
+        if (free_state == NULL && s_tasks[i].handle == NULL) {
+            free_state = &s_tasks[i];
+        }
+    }
+    if (free_state != NULL) {
+        memset(free_state, 0, sizeof(*free_state));
+        free_state->handle = handle;
+    }
+    return free_state;
+}
+
+static bool can_share_core(const TaskStatus_t *a, const TaskStatus_t *b)
+{
+#ifdef CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+    return a->xCoreID == b->xCoreID || a->xCoreID == tskNO_AFFINITY || b->xCoreID == tskNO_AFFINITY;
+#else
+    return true;
+#endif
+}
+
+static bool is_running(TaskHandle_t handle, const TaskHandle_t *running)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        if (running[core] == handle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fill_event(starvation_event_t *event, starvation_event_type_t type, const task_state_t *state,
+                       uint32_t windows, uint32_t seq)
+{
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->seq = seq;
+    event->windows = windows;
+    strlcpy(event->task, state->status->pcTaskName, sizeof(event->task));
+    event->base_priority = state->status->uxBasePriority;
+    event->current_priority = state->status->uxCurrentPriority;
+}
+
+static void set_other(starvation_event_t *event, const task_state_t *other)
+{
+    if (other != NULL) {
+        strlcpy(event->other, other->status->pcTaskName, sizeof(event->other));
+        event->other_priority = other->status->uxCurrentPriority;
+    }
+}
+
+static void report_starved(const task_state_t *state, uint32_t seq)
+{
+    starvation_event_t event;
+    fill_event(&event, STARVATION_EVENT_STARVED, state, state->starved_windows, seq);
+    //The task that ran the most in its place
+    const task_state_t *culprit = NULL;
+    for (int i = 0; i < MAX_TASKS; i++) {
+        const task_state_t *other = &s_tasks[i];
+        if (other->seen && other != state && other->run_time > 0
+                && other->status->uxCurrentPriority >= state->status->uxCurrentPriority
+                && can_share_core(other->status, state->status)
+                && (culprit == NULL || other->run_time > culprit->run_time)) {
+            culprit = other;
+        }
+    }
+    set_other(&event, culprit);
+    report(&event);
+}
+
+static void report_inversion(const task_state_t *state, uint32_t seq)
+{
+    starvation_event_t event;
+    fill_event(&event, STARVATION_EVENT_INVERSION, state, state->inherited_windows, seq);
+    //The holder inherits the priority of its highest priority waiter
+    const task_state_t *waiter = NULL;
+    for (int i = 0; i < MAX_TASKS && waiter == NULL; i++) {
+        const task_state_t *other = &s_tasks[i];
+        if (other->seen && other != state && other->status->eCurrentState == eBlocked
+                && other->status->uxCurrentPriority == state->status->uxCurrentPriority) {
+            waiter = other;
+        }
+    }
+    set_other(&event, waiter);
+    report(&event);
+}
+
+void starvation_check(const TaskStatus_t *start, UBaseType_t start_num, const TaskHandle_t *start_running,
+                      const TaskStatus_t *end, UBaseType_t end_num, const TaskHandle_t *end_running, uint32_t seq)
+{
+    for (int i = 0; i < MAX_TASKS; i++) {
+        s_tasks[i].seen = false;
+    }
+    for (int j = 0; j < end_num; j++) {
+        const TaskStatus_t *task_start = NULL;
+        for (int i = 0; i < start_num; i++) {
+            if (start[i].xHandle == end[j].xHandle) {
+                task_start = &start[i];
+                break;
+            }
+        }
+        if (task_start == NULL) {
+            continue;               //Created during the window
+        }
+        task_state_t *state = get_state(end[j].xHandle);
+        if (state == NULL) {
+            continue;
+        }
+        state->seen = true;
+        state->status = &end[j];
+        state->run_time = end[j].ulRunTimeCounter - task_start->ulRunTimeCounter;
+        //Ready at both ends without running: it could not have blocked in between. uxTaskGetSystemState()
+        //reports the task running on the other core as Ready, and its run time only advances when it is
+        //switched out, so a task running on either core at either end is not starved
+        bool starved = task_start->eCurrentState == eReady && end[j].eCurrentState == eReady && state->run_time == 0
+                       && !is_running(end[j].xHandle, start_running) && !is_running(end[j].xHandle, end_running);
+        state->starved_windows = starved ? state->starved_windows + 1 : 0;
+        state->inherited_windows = (end[j].uxCurrentPriority > end[j].uxBasePriority) ? state->inherited_windows + 1 : 0;
+    }
+
+    for (int i = 0; i < MAX_TASKS; i++) {
+        task_state_t *state = &s_tasks[i];
+        if (!state->seen) {
+            state->handle = NULL;   //Deleted, or created during the window
+            continue;
+        }
+        if (is_report_point(state->starved_windows, CONFIG_STATS_MONITOR_STARVATION_WINDOWS)) {
+            report_starved(state, seq);
+        }
+        if (is_report_point(state->inherited_windows, CONFIG_STATS_MONITOR_INVERSION_WINDOWS)) {
+            report_inversion(state, seq);
+        }
+#ifdef CONFIG_STATS_MONITOR_STARVATION_PANIC
+        //Same outcome as the task watchdog with ESP_TASK_WDT_PANIC: a backtrace and a reset
+        if (state->starved_windows == CONFIG_STATS_MONITOR_STARVATION_PANIC_WINDOWS) {
+            ESP_LOGE(TAG, "task %s starved for %u windows, aborting", state->status->pcTaskName, state->starved_windows);
+            abort();
+        }
+#endif
+    }
+}
+
+#else // CONFIG_STATS_MONITOR_STARVATION
+
+void starvation_set_callback(starvation_event_cb_t callback, void *arg)
+{
+}
+
+uint32_t starvation_get_count(starvation_event_type_t type)
+{
+    return 0;
+}
+
+const char *starvation_event_name(starvation_event_type_t type)
+{
+    return "unknown";
+}
+
+void starvation_check(const TaskStatus_t *start, UBaseType_t start_num, const TaskHandle_t *start_running,
+                      const TaskStatus_t *end, UBaseType_t end_num, const TaskHandle_t *end_running, uint32_t seq)
+{
+}
+
+#endif // CONFIG_STATS_MONITOR_STARVATION
\ No newline at end of file
@@ -0,0 +1,313 @@
+/* Synthetic workload generator
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp32/clk.h"
+#include "xtensa/hal.h"
+#include "workload.h"
+
+#define TASK_STACK_SIZE     2048
+#define CPU_OP_ITER         256
+#define FLASH_READ_SPAN     (256 * 1024)    //Reads cycle through the start of the app partition
+/*
+ * CCOUNT is per core. A task without affinity may migrate between two reads,
+ * which makes the difference meaningless, so implausibly long operations are
+ * not counted.
+ */
+#define OP_CYCLES_LIMIT     0x40000000
+
+typedef struct workload_group workload_group_t;
+
+typedef struct {
+    workload_group_t *group;
+    TaskHandle_t handle;
+    void *buf;              //Per task buffer for memory and flash profiles
+    QueueHandle_t rx;       //Queue profile: where this task receives
+    QueueHandle_t tx;       //Queue profile: where this task replies or sends
+    bool active;            //Queue profile: the sending side of the pair
+    uint32_t flash_offset;
+} workload_task_t;
+
+struct workload_group {
+    workload_config_t config;
+    SemaphoreHandle_t mutex;
+    workload_task_t *tasks;
+    int task_num;
+    //Counters, updated by all tasks of the group
+    portMUX_TYPE lock;
+    uint64_t ops;
+    uint64_t busy_cycles;
+    uint64_t wait_cycles;
+    uint32_t max_op_cycles;
+};
+
+static const char *TAG = "workload";
+static const char *s_profile_names[] = { "cpu", "memory", "flash_read", "mutex", "queue" };
+static workload_group_t s_groups[WORKLOAD_GROUP_MAX];
+static int s_group_num;
+static volatile uint32_t s_sink;
+
+//Operations return the cycles spent waiting on other tasks, if any
+
+static uint32_t op_cpu(workload_task_t *task)
+{
+    uint32_t x = s_sink | 1;
+    for (int i = 0; i < CPU_OP_ITER; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    s_sink = x;
+    return 0;
+}
+
+static uint32_t op_memory(workload_task_t *task)
+{
+    size_t size = task->group->config.op_size;
+    uint8_t *src = task->buf;
+    memcpy(src + size, src, size);
+    return 0;
+}
+
+static uint32_t op_flash_read(workload_task_t *task)
+{
+    size_t size = task->group->config.op_size;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_partition_read(running, task->flash_offset, task->buf, size);
+    task->flash_offset += size;
+    if (task->flash_offset + size > FLASH_READ_SPAN || task->flash_offset + size > running->size) {
+        task->flash_offset = 0;
+    }
+    return 0;
+}
+
+static uint32_t op_mutex(workload_task_t *task)
+{
+    uint32_t start = xthal_get_ccount();
+    xSemaphoreTake(task->group->mutex, portMAX_DELAY);
+    uint32_t wait = xthal_get_ccount() - start;
+    uint32_t hold_start = xthal_get_ccount();
+    while (xthal_get_ccount() - hold_start < task->group->config.op_size) {
+        ;
+    }
+    xSemaphoreGive(task->group->mutex);
+    return wait;
+}
+
+static uint32_t op_queue(workload_task_t *task)
+{
+    uint32_t sent = xthal_get_ccount();
+    uint32_t reply;
+    xQueueSend(task->tx, &sent, portMAX_DELAY);
+    xQueueReceive(task->rx, &reply, portMAX_DELAY);
+    return 0;
+}
+
+static void account(workload_group_t *group, uint32_t ops, uint32_t cycles, uint32_t wait, uint32_t max_op)
+{
+    portENTER_CRITICAL(&group->lock);
+    group->ops += ops;
+    group->busy_cycles += cycles;
+    group->wait_cycles += wait;
+    if (max_op > group->max_op_cycles) {
+        group->max_op_cycles = max_op;
+    }
+    portEXIT_CRITICAL(&group->lock);
+}
+
+static void workload_task(void *arg)
+{
+    workload_task_t *task = (workload_task_t *)arg;
+    workload_group_t *group = task->group;
+    uint32_t (*op)(workload_task_t *);
+
+    switch (group->config.profile) {
+    case WORKLOAD_CPU:          op = op_cpu; break;
+    case WORKLOAD_MEMORY:       op = op_memory; break;
+    case WORKLOAD_FLASH_READ:   op = op_flash_read; break;
+    case WORKLOAD_MUTEX:        op = op_mutex; break;
+    default:                    op = op_queue; break;
+    }
+    //Started once every task of the group exists, see workload_start()
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    if (group->config.profile == WORKLOAD_QUEUE && !task->active) {
+        //Passive side of a pair, echo everything back
+        uint32_t value;
+        while (1) {
+            xQueueReceive(task->rx, &value, portMAX_DELAY);
+            xQueueSend(task->tx, &value, portMAX_DELAY);
+        }
+    }
+
+    const TickType_t period = pdMS_TO_TICKS(group->config.period_ms);
+    const uint32_t busy_target = (uint64_t)group->config.period_ms * (esp_clk_cpu_freq() / 1000) * group->config.duty_percent / 100;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        uint32_t ops = 0, cycles = 0, wait = 0, max_op = 0;
+        while (cycles < busy_target) {
+            uint32_t start = xthal_get_ccount();
+            uint32_t op_wait = op(task);
+            uint32_t op_cycles = xthal_get_ccount() - start;
+            if (op_cycles >= OP_CYCLES_LIMIT) {
+                continue;
+            }
+            ops++;
+            cycles += op_cycles;
+            wait += op_wait;
+            if (op_cycles > max_op) {
+                max_op = op_cycles;
+            }
+        }
+        account(group, ops, cycles, wait, max_op);
+        vTaskDelayUntil(&last_wake, period);
+    }
+}
+
+//Frees what workload_start() allocated for a group. Its tasks must not have been started
+static void free_group(workload_group_t *group)
+{
+    for (int i = 0; i < group->task_num; i++) {
+        workload_task_t *task = &group->tasks[i];
+        if (task->handle != NULL) {
+            vTaskDelete(task->handle);
+        }
+        free(task->buf);
+        if (task->rx != NULL) {
+            vQueueDelete(task->rx);
+        }
+    }
+    if (group->mutex != NULL) {
+        vSemaphoreDelete(group->mutex);
+    }
+    free(group->tasks);
+    group->tasks = NULL;
+}
+
+esp_err_t workload_start(const workload_config_t *config)
+{
+    if (config->profile > WORKLOAD_QUEUE || config->count <= 0 || config->duty_percent == 0
+            || config->duty_percent > 100 || pdMS_TO_TICKS(config->period_ms) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((config->profile == WORKLOAD_MEMORY || config->profile == WORKLOAD_FLASH_READ) && config->op_size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_group_num >= WORKLOAD_GROUP_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    workload_group_t *group = &s_groups[s_group_num];
+    memset(group, 0, sizeof(*group));
+    group->config = *config;
+    group->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    group->task_num = (config->profile == WORKLOAD_QUEUE) ? config->count * 2 : config->count;
+    group->tasks = calloc(group->task_num, sizeof(workload_task_t));
+    if (group->tasks == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (config->profile == WORKLOAD_MUTEX) {
+        group->mutex = xSemaphoreCreateMutex();
+        if (group->mutex == NULL) {
+            free_group(group);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    for (int i = 0; i < group->task_num; i++) {
+        workload_task_t *task = &group->tasks[i];
+        task->group = group;
+        if (config->profile == WORKLOAD_MEMORY || config->profile == WORKLOAD_FLASH_READ) {
+            //Memory copies from the first half of the buffer to the second
+            task->buf = malloc(config->profile == WORKLOAD_MEMORY ? config->op_size * 2 : config->op_size);
+            if (task->buf == NULL) {
+                free_group(group);
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        if (config->profile == WORKLOAD_QUEUE) {
+            task->rx = xQueueCreate(1, sizeof(uint32_t));
+            if (task->rx == NULL) {
+                free_group(group);
+                return ESP_ERR_NO_MEM;
+            }
+            task->active = (i % 2 == 0);
+        }
+    }
+    if (config->profile == WORKLOAD_QUEUE) {
+        for (int i = 0; i < group->task_num; i += 2) {
+            group->tasks[i].tx = group->tasks[i + 1].rx;
+            group->tasks[i + 1].tx = group->tasks[i].rx;
+        }
+    }
+
+    for (int i = 0; i < group->task_num; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "%.5s%d_%d", s_profile_names[config->profile], s_group_num, i);
+        if (xTaskCreatePinnedToCore(workload_task, name, TASK_STACK_SIZE, &group->tasks[i],
+                                    config->priority, &group->tasks[i].handle, config->core_id) != pdPASS) {
+            ESP_LOGE(TAG, "failed to create task %s", name);
+            group->tasks[i].handle = NULL;
+            free_group(group);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    for (int i = 0; i < group->task_num; i++) {
+        xTaskNotifyGive(group->tasks[i].handle);
+    }
+    s_group_num++;
+    return ESP_OK;
+}
+
+void workload_reset(void)
+{
+    for (int i = 0; i < s_group_num; i++) {
+        workload_group_t *group = &s_groups[i];
+        portENTER_CRITICAL(&group->lock);
+        group->ops = 0;
+        group->busy_cycles = 0;
+        group->wait_cycles = 0;
+        group->max_op_cycles = 0;
+        portEXIT_CRITICAL(&group->lock);
+    }
+}
+
+void workload_print(void)
+{
+    printf("| Workload | Tasks | Ops | Busy cycles | Cycles/op | Max cycles/op | Wait cycles | Bytes/kcycle\n");
+    printf("| --- | --- | --- | --- | --- | --- | --- | ---\n");
+    for (int i = 0; i < s_group_num; i++) {
+        workload_group_t *group = &s_groups[i];
+        portENTER_CRITICAL(&group->lock);
+        uint64_t ops = group->ops;
+        uint64_t busy_cycles = group->busy_cycles;
+        uint64_t wait_cycles = group->wait_cycles;
+        uint32_t max_op_cycles = group->max_op_cycles;
+        portEXIT_CRITICAL(&group->lock);
+
+        uint64_t bytes = 0;
+        if (group->config.profile == WORKLOAD_MEMORY || group->config.profile == WORKLOAD_FLASH_READ) {
+            bytes = ops * group->config.op_size;
+        }
+        printf("| %s%d | %d | %llu | %llu | %llu | %u | %llu | %llu\n",
+               s_profile_names[group->config.profile], i, group->task_num, ops, busy_cycles,
+               ops ? busy_cycles / ops : 0, max_op_cycles, wait_cycles,
+               busy_cycles ? bytes * 1000 / busy_cycles : 0);
+    }
+}
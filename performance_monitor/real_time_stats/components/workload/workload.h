@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#define WORKLOAD_GROUP_MAX  8
+
+typedef enum {
+    WORKLOAD_CPU,           //Integer arithmetic in registers
+    WORKLOAD_MEMORY,        //memcpy between two buffers of op_size bytes
+    WORKLOAD_FLASH_READ,    //esp_partition_read of op_size bytes from the running app partition
+    WORKLOAD_MUTEX,         //Hold a mutex shared by the group for op_size cycles
+    WORKLOAD_QUEUE,         //Queue round trip between the tasks of a pair, counted as busy time
+} workload_profile_t;
+
+typedef struct {
+    workload_profile_t profile;
+    int count;              //Number of tasks, or of task pairs for WORKLOAD_QUEUE
+    UBaseType_t priority;
+    int core_id;            //Core to pin the tasks to, or tskNO_AFFINITY
+    uint32_t period_ms;     //Length of a duty cycle
+    uint32_t duty_percent;  //Share of each period spent running operations
+    size_t op_size;         //Bytes per operation, or cycles the mutex is held for WORKLOAD_MUTEX
+} workload_config_t;
+
+/**
+ * @brief   Create the tasks of a workload group.
+ *
+ * Each task runs operations of its profile until it has spent
+ * duty_percent of period_ms worth of CPU cycles in them, measured with CCOUNT,
+ * then sleeps until the next period. The amount of work is therefore the same
+ * whatever the compiler optimization.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_INVALID_ARG   Invalid profile, count or duty cycle
+ *  - ESP_ERR_NO_MEM        Out of group slots, memory or tasks
+ */
+esp_err_t workload_start(const workload_config_t *config);
+
+/**
+ * @brief   Print per group totals since the last reset: operations, busy
+ *          cycles, cycles per operation and contention.
+ */
+void workload_print(void);
+
+/**
+ * @brief   Clear the counters of all groups.
+ */
+void workload_reset(void);
@@ -13,42 +13,103 @@
 #include "freertos/task.h"
 #include "esp_err.h"
 #include "stats_monitor.h"
+#include "latency_probe.h"
+#include "sched_trace.h"
+#include "workload.h"
 
-#define NUM_OF_SPIN_TASKS   6
-#define SPIN_ITER           500000  //Actual CPU cycles used will depend on compiler optimization
-#define SPIN_TASK_PRIO      2
+#define PROBE_PERIOD_MS     10
+#define TRACE_DURATION_MS   500
+#define REPORT_PERIOD_MS    5000
 
-#ifdef CORE0_ONLY
-#define CORE_PINNED (0)
-#else
-#define CORE_PINNED tskNO_AFFINITY
-#endif
+#define CORE_AFFINITY(core) ((core) < 0 ? tskNO_AFFINITY : (core))
 
-static void spin_task(void *arg)
-{
-    while (1) {
-        //Consume CPU cycles
-        for (int i = 0; i < SPIN_ITER; i++) {
-            __asm__ __volatile__("NOP");
-        }
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-}
+//Workload groups, in the order of the Example Configuration menu
+static const workload_config_t s_workloads[] = {
+    {
+        .profile = WORKLOAD_CPU,
+        .count = CONFIG_WORKLOAD_CPU_COUNT,
+        .priority = CONFIG_WORKLOAD_CPU_PRIO,
+        .core_id = CORE_AFFINITY(CONFIG_WORKLOAD_CPU_CORE),
+        .period_ms = CONFIG_WORKLOAD_CPU_PERIOD_MS,
+        .duty_percent = CONFIG_WORKLOAD_CPU_DUTY,
+    },
+    {
+        .profile = WORKLOAD_MEMORY,
+        .count = CONFIG_WORKLOAD_MEMORY_COUNT,
+        .priority = CONFIG_WORKLOAD_MEMORY_PRIO,
+        .core_id = CORE_AFFINITY(CONFIG_WORKLOAD_MEMORY_CORE),
+        .period_ms = CONFIG_WORKLOAD_MEMORY_PERIOD_MS,
+        .duty_percent = CONFIG_WORKLOAD_MEMORY_DUTY,
+        .op_size = CONFIG_WORKLOAD_MEMORY_OP_SIZE,
+    },
+    {
+        .profile = WORKLOAD_FLASH_READ,
+        .count = CONFIG_WORKLOAD_FLASH_COUNT,
+        .priority = CONFIG_WORKLOAD_FLASH_PRIO,
+        .core_id = CORE_AFFINITY(CONFIG_WORKLOAD_FLASH_CORE),
+        .period_ms = CONFIG_WORKLOAD_FLASH_PERIOD_MS,
+        .duty_percent = CONFIG_WORKLOAD_FLASH_DUTY,
+        .op_size = CONFIG_WORKLOAD_FLASH_OP_SIZE,
+    },
+    {
+        .profile = WORKLOAD_MUTEX,
+        .count = CONFIG_WORKLOAD_MUTEX_COUNT,
+        .priority = CONFIG_WORKLOAD_MUTEX_PRIO,
+        .core_id = CORE_AFFINITY(CONFIG_WORKLOAD_MUTEX_CORE),
+        .period_ms = CONFIG_WORKLOAD_MUTEX_PERIOD_MS,
+        .duty_percent = CONFIG_WORKLOAD_MUTEX_DUTY,
+        .op_size = CONFIG_WORKLOAD_MUTEX_OP_SIZE,
+    },
+    {
+        .profile = WORKLOAD_QUEUE,
+        .count = CONFIG_WORKLOAD_QUEUE_COUNT,
+        .priority = CONFIG_WORKLOAD_QUEUE_PRIO,
+        .core_id = CORE_AFFINITY(CONFIG_WORKLOAD_QUEUE_CORE),
+        .period_ms = CONFIG_WORKLOAD_QUEUE_PERIOD_MS,
+        .duty_percent = CONFIG_WORKLOAD_QUEUE_DUTY,
+    },
+};
 
 void app_main()
 {
     //Allow other core to finish initialization
     vTaskDelay(pdMS_TO_TICKS(100));
 
-    char task_names[NUM_OF_SPIN_TASKS][configMAX_TASK_NAME_LEN];
+    //Create workload tasks
+    for (int i = 0; i < sizeof(s_workloads) / sizeof(s_workloads[0]); i++) {
+        if (s_workloads[i].count > 0) {
+            ESP_ERROR_CHECK(workload_start(&s_workloads[i]));
+        }
+    }
 
-    //Create spin tasks
-    for (int i = 0; i < NUM_OF_SPIN_TASKS; i++) {
-        snprintf(task_names[i], configMAX_TASK_NAME_LEN, "spin%d", i);
-        xTaskCreatePinnedToCore(spin_task, task_names[i], 1024, NULL, SPIN_TASK_PRIO, NULL, CORE_PINNED);
+    //Probe wake-up latency on each core, above and at the priority of the CPU workload
+    const UBaseType_t probe_prios[] = { 10, CONFIG_WORKLOAD_CPU_PRIO };
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        for (int i = 0; i < sizeof(probe_prios) / sizeof(probe_prios[0]); i++) {
+            latency_probe_config_t probe_config = {
+                .core_id = core,
+                .priority = probe_prios[i],
+                .period_ms = PROBE_PERIOD_MS,
+            };
+            ESP_ERROR_CHECK(latency_probe_start(&probe_config));
+        }
     }
 
     //Create and start stats task
     // xTaskCreatePinnedToCore(stats_task, "stats", 4096, NULL, STATS_TASK_PRIO, NULL, tskNO_AFFINITY);
     stats_monitor_init();
+
+#ifdef CONFIG_STATS_MONITOR_SCHED_TRACE
+    //Trace a short burst of scheduling and print it for sched_trace_to_json.py
+    ESP_ERROR_CHECK(sched_trace_start());
+    vTaskDelay(pdMS_TO_TICKS(TRACE_DURATION_MS));
+    sched_trace_dump();
+#endif
+
+    //Report the work done in cycles, which does not depend on compiler optimization
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(REPORT_PERIOD_MS));
+        workload_print();
+        workload_reset();
+    }
 }
@@ -0,0 +1,147 @@
+#!/usr/bin/env python
+#
+# Converts the console output of sched_trace_dump() into a Chrome trace
+# (JSON Object Format), which can be opened with chrome://tracing or
+# https://ui.perfetto.dev
+#
+# Usage:
+#   sched_trace_to_json.py monitor.log -o trace.json
+#
+from __future__ import print_function
+import argparse
+import json
+import re
+import sys
+
+EVENT_SWITCHED_IN = 0
+EVENT_SWITCHED_OUT = 1
+EVENT_ISR_ENTER = 2
+EVENT_ISR_EXIT = 3
+
+BEGIN_RE = re.compile(r"SCHED_TRACE BEGIN cores=(\d+) cpu_mhz=(\d+)")
+TASK_RE = re.compile(r"SCHED_TRACE TASK 0x([0-9a-fA-F]+) (.*)$")
+CORE_RE = re.compile(r"SCHED_TRACE CORE (\d+) ref_ccount=(\d+) ref_time=(-?\d+) events=(\d+) dropped=(\d+)"
+                     r"(?: cache_off=(\d+))?")
+EVENT_RE = re.compile(r"^E (\d+) (\d+) (\d) ([0-9a-fA-F]+)\s*$")
+
+
+class Trace(object):
+    def __init__(self):
+        self.cores = 0
+        self.cpu_mhz = 0
+        self.task_names = {}
+        self.refs = {}
+        self.dropped = {}
+        self.cache_off = {}
+        self.events = {}
+
+    def task_name(self, handle):
+        return self.task_names.get(handle, "task 0x%08x" % handle)
+
+
+def parse(lines):
+    """ Returns the last complete trace found in the console output """
+    trace = None
+    result = None
+    for line in lines:
+        # Console lines may carry a prefix such as a timestamp added by the monitor
+        match = BEGIN_RE.search(line)
+        if match:
+            trace = Trace()
+            trace.cores = int(match.group(1))
+            trace.cpu_mhz = int(match.group(2))
+            continue
+        if trace is None:
+            continue
+        if "SCHED_TRACE END" in line:
+            result = trace
+            trace = None
+            continue
+        match = TASK_RE.search(line)
+        if match:
+            trace.task_names[int(match.group(1), 16)] = match.group(2).strip()
+            continue
+        match = CORE_RE.search(line)
+        if match:
+            core = int(match.group(1))
+            trace.refs[core] = (int(match.group(2)), int(match.group(3)))
+            trace.dropped[core] = int(match.group(5))
+            trace.cache_off[core] = int(match.group(6) or 0)
+            trace.events[core] = []
+            continue
+        match = EVENT_RE.search(line)
+        if match:
+            core = int(match.group(1))
+            trace.events[core].append((int(match.group(2)), int(match.group(3)), int(match.group(4), 16)))
+    if result is None:
+        raise ValueError("no complete SCHED_TRACE BEGIN/END block found")
+    return result
+
+
+def to_chrome_events(trace):
+    chrome_events = []
+    for core, events in sorted(trace.events.items()):
+        ref_ccount, ref_time = trace.refs[core]
+        task_tid = core * 2
+        isr_tid = core * 2 + 1
+        chrome_events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": task_tid,
+                              "args": {"name": "Core %d" % core}})
+        chrome_events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": isr_tid,
+                              "args": {"name": "Core %d ISR" % core}})
+
+        # CCOUNT is a 32 bit counter, so unwrap it using the distance to the previous event.
+        # The first event may be older than the reference if the ring wrapped.
+        ccount = ref_ccount
+        cycles = 0
+        timestamps = []
+        for index, (event_ccount, _, _) in enumerate(events):
+            delta = (event_ccount - ccount) & 0xffffffff
+            if index == 0 and delta > 0x80000000:
+                delta -= 1 << 32
+            cycles += delta
+            ccount = event_ccount
+            timestamps.append(ref_time + float(cycles) / trace.cpu_mhz)
+
+        running = None
+        isr_stack = []
+        for ts, (_, event_type, arg) in zip(timestamps, events):
+            if event_type == EVENT_SWITCHED_IN:
+                running = (arg, ts)
+            elif event_type == EVENT_SWITCHED_OUT:
+                if running is not None and running[0] == arg:
+                    chrome_events.append({"ph": "X", "name": trace.task_name(arg), "cat": "task",
+                                          "pid": 0, "tid": task_tid, "ts": running[1], "dur": ts - running[1]})
+                running = None
+            elif event_type == EVENT_ISR_ENTER:
+                isr_stack.append((arg >> 2, ts))
+            elif event_type == EVENT_ISR_EXIT and isr_stack:
+                irq, start = isr_stack.pop()
+                chrome_events.append({"ph": "X", "name": "irq %d" % irq, "cat": "isr",
+                                      "pid": 0, "tid": isr_tid, "ts": start, "dur": ts - start})
+        if trace.dropped.get(core):
+            print("core %d: %d oldest events were overwritten" % (core, trace.dropped[core]), file=sys.stderr)
+        if trace.cache_off.get(core):
+            print("core %d: %d events not recorded while the flash cache was disabled" % (core, trace.cache_off[core]),
+                  file=sys.stderr)
+    return chrome_events
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a sched_trace dump to a Chrome trace")
+    parser.add_argument("input", help="console log containing the output of sched_trace_dump()")
+    parser.add_argument("--output", "-o", help="output JSON file, default is stdout")
+    args = parser.parse_args()
+
+    with open(args.input, "r") as f:
+        trace = parse(f)
+
+    output = {"traceEvents": to_chrome_events(trace), "displayTimeUnit": "ns"}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(output, f)
+    else:
+        json.dump(output, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,231 @@
+#!/usr/bin/env python
+#
+# Decodes the performance history of a device, kept in its perf_log partition
+# by the perf_log component (ota/components/perf_log), and compares the
+# firmware versions it ran.
+#
+# Input is either a dump of the partition:
+#   parttool.py --port /dev/ttyUSB0 read_partition --partition-name perf_log --output perf_log.bin
+# or the stream of perf_log_export(), e.g. served by the metrics server:
+#   curl -o perf_log.bin http://<device>:8080/perf_log
+#
+# Usage:
+#   perf_log_decode.py perf_log.bin              # every record, grouped by boot
+#   perf_log_decode.py perf_log.bin --summary    # one line per firmware version
+#   perf_log_decode.py perf_log.bin --json history.json
+#
+from __future__ import print_function, division
+import argparse
+import json
+import struct
+import sys
+
+# Layout of perf_log_store.h
+SECTOR_SIZE = 4096
+SECTOR_MAGIC = 0x474f4c50
+SECTOR_HEADER_LEN = 8
+RECORD_HEADER_LEN = 4
+RECORD_MAX_DATA = 248
+TYPE_ERASED = 0xff
+
+# Records of perf_log.h
+TYPE_BOOT = 1
+TYPE_OTA = 2
+TYPE_CPU = 3
+BOOT_FORMAT = "<IIB3x32s8s"
+OTA_FORMAT = "<iIIIIIIIII"
+PHASE_FORMAT = "<12sII"
+CPU_FORMAT = "<IIIIBBBx"
+TASK_FORMAT = "<16sI"
+OTA_PHASES = 4
+CPU_TASKS = 10
+
+# esp_reset_reason_t
+RESET_REASONS = ["unknown", "poweron", "ext", "sw", "panic", "int_wdt", "task_wdt", "wdt", "deepsleep", "brownout", "sdio"]
+
+
+def crc16(data, crc=0xffff):
+    """ CRC-16/CCITT-FALSE """
+    for byte in bytearray(data):
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xffff
+    return crc
+
+
+def padded(length):
+    return (length + 3) & ~3
+
+
+def parse_records(data, offset, end):
+    """ Yields (type, payload) of the records from offset, until the erased space or a corrupted record """
+    while offset + RECORD_HEADER_LEN <= end:
+        rtype, length, crc = struct.unpack_from("<BBH", data, offset)
+        if rtype == TYPE_ERASED or length > RECORD_MAX_DATA:
+            return
+        record_len = RECORD_HEADER_LEN + padded(length)
+        if offset + record_len > end:
+            return
+        payload = data[offset + RECORD_HEADER_LEN:offset + RECORD_HEADER_LEN + length]
+        if crc16(payload, crc16(data[offset:offset + 2])) != crc:
+            return
+        yield rtype, payload
+        offset += record_len
+
+
+def is_partition_dump(data):
+    if len(data) % SECTOR_SIZE:
+        return False
+    return any(struct.unpack_from("<I", data, sector)[0] == SECTOR_MAGIC for sector in range(0, len(data), SECTOR_SIZE))
+
+
+def read_partition(data):
+    """ Records of a partition dump, oldest first: sectors in the order of their sequence numbers """
+    sectors = []
+    for offset in range(0, len(data), SECTOR_SIZE):
+        magic, seq = struct.unpack_from("<II", data, offset)
+        if magic == SECTOR_MAGIC and seq != 0xffffffff:
+            sectors.append((seq, offset))
+    records = []
+    for _, offset in sorted(sectors):
+        records.extend(parse_records(data, offset + SECTOR_HEADER_LEN, offset + SECTOR_SIZE))
+    return records
+
+
+def text(raw):
+    return raw.split(b"\0")[0].decode("ascii", "replace")
+
+
+def unpack(fmt, payload):
+    # Records written by an older firmware may be shorter
+    size = struct.calcsize(fmt)
+    return struct.unpack_from(fmt, payload.ljust(size, b"\0"))
+
+
+def decode(rtype, payload):
+    if rtype == TYPE_BOOT:
+        boot, boot_us, reason, version, elf_sha = unpack(BOOT_FORMAT, payload)
+        return {"type": "boot", "boot": boot, "boot_us": boot_us,
+                "reset_reason": RESET_REASONS[reason] if reason < len(RESET_REASONS) else str(reason),
+                "version": text(version), "elf_sha256": "".join("%02x" % b for b in bytearray(elf_sha))}
+    if rtype == TYPE_OTA:
+        fields = unpack(OTA_FORMAT, payload)
+        record = dict(zip(("result", "image_len", "time_total_us", "time_http_us", "time_write_us", "time_process_us",
+                           "time_validate_us", "time_first_write_us", "heap_min_free"), fields))
+        record["type"] = "ota"
+        record["phases"] = []
+        base = struct.calcsize(OTA_FORMAT)
+        for i in range(min(fields[-1], OTA_PHASES)):
+            name, window_us, cpu_us = unpack(PHASE_FORMAT, payload[base + i * struct.calcsize(PHASE_FORMAT):])
+            record["phases"].append({"name": text(name), "window_us": window_us, "cpu_us": cpu_us})
+        return record
+    if rtype == TYPE_CPU:
+        uptime_s, windows, heap_free, heap_min_free, load0, load1, task_num = unpack(CPU_FORMAT, payload)
+        record = {"type": "cpu", "uptime_s": uptime_s, "windows": windows, "heap_free": heap_free,
+                  "heap_min_free": heap_min_free, "core_load": [load0, load1], "tasks": []}
+        base = struct.calcsize(CPU_FORMAT)
+        for i in range(min(task_num, CPU_TASKS)):
+            name, load_x100 = unpack(TASK_FORMAT, payload[base + i * struct.calcsize(TASK_FORMAT):])
+            record["tasks"].append({"name": text(name), "load_x100": load_x100})
+        return record
+    return {"type": "0x%02x" % rtype, "data": "".join("%02x" % b for b in bytearray(payload))}
+
+
+def group_by_boot(records):
+    """ [boot record with its "records"], the records before the first boot record go to a boot of version "?" """
+    boots = []
+    for record in records:
+        if record["type"] == "boot":
+            record["records"] = []
+            boots.append(record)
+        else:
+            if not boots:
+                boots.append({"type": "boot", "boot": 0, "version": "?", "reset_reason": "?", "boot_us": 0, "records": []})
+            boots[-1]["records"].append(record)
+    return boots
+
+
+def print_records(boots):
+    for boot in boots:
+        print("boot %u: %s (%s), reset %s, app started in %.1f ms" %
+              (boot["boot"], boot["version"], boot.get("elf_sha256", "?"), boot["reset_reason"], boot["boot_us"] / 1000))
+        for record in boot["records"]:
+            if record["type"] == "ota":
+                phases = " ".join("%s=%.0fms/%.0fms" % (p["name"], p["window_us"] / 1000, p["cpu_us"] / 1000) for p in record["phases"])
+                print("  ota result=0x%x image=%u total=%.0fms http=%.0fms write=%.0fms first_write=%.0fms heap_min=%u %s" %
+                      (record["result"] & 0xffffffff, record["image_len"], record["time_total_us"] / 1000,
+                       record["time_http_us"] / 1000, record["time_write_us"] / 1000, record["time_first_write_us"] / 1000,
+                       record["heap_min_free"], phases))
+            elif record["type"] == "cpu":
+                tasks = " ".join("%s=%.1f%%" % (t["name"], t["load_x100"] / 100) for t in record["tasks"])
+                print("  cpu uptime=%us cores=%u%%/%u%% heap=%u heap_min=%u %s" %
+                      (record["uptime_s"], record["core_load"][0], record["core_load"][1], record["heap_free"],
+                       record["heap_min_free"], tasks))
+            else:
+                print("  %s %s" % (record["type"], record.get("data", "")))
+
+
+def median(values):
+    values = sorted(values)
+    if not values:
+        return None
+    middle = len(values) // 2
+    return values[middle] if len(values) % 2 else (values[middle - 1] + values[middle]) / 2
+
+
+def print_summary(boots):
+    """ Medians per firmware version, in the order the versions first ran """
+    versions = []
+    by_version = {}
+    for boot in boots:
+        if boot["version"] not in by_version:
+            versions.append(boot["version"])
+            by_version[boot["version"]] = []
+        by_version[boot["version"]].append(boot)
+
+    def fmt(value, scale=1):
+        return "%10.0f" % (value / scale) if value is not None else "%10s" % "-"
+
+    print("%-24s %6s %10s %6s %10s %10s %10s %10s" %
+          ("version", "boots", "start_ms", "otas", "ota_ms", "write_ms", "cpu_load%", "heap_min"))
+    for version in versions:
+        version_boots = by_version[version]
+        records = [record for boot in version_boots for record in boot["records"]]
+        otas = [record for record in records if record["type"] == "ota" and record["result"] == 0]
+        cpus = [record for record in records if record["type"] == "cpu"]
+        heap_mins = [record["heap_min_free"] for record in records if "heap_min_free" in record]
+        print("%-24s %6d %s %6d %s %s %s %s" % (
+            version[:24], len(version_boots), fmt(median([boot["boot_us"] for boot in version_boots]), 1000),
+            len(otas), fmt(median([ota["time_total_us"] for ota in otas]), 1000),
+            fmt(median([ota["time_write_us"] for ota in otas]), 1000),
+            fmt(median([sum(cpu["core_load"]) / 2 for cpu in cpus])),
+            fmt(min(heap_mins) if heap_mins else None)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the perf_log partition or export of a device")
+    parser.add_argument("input", help="partition dump or perf_log_export() stream")
+    parser.add_argument("--summary", action="store_true", help="one line of medians per firmware version")
+    parser.add_argument("--json", help="write the decoded records, grouped by boot, to this file")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if is_partition_dump(data):
+        raw = read_partition(data)
+    else:
+        raw = list(parse_records(data, 0, len(data)))
+    boots = group_by_boot([decode(rtype, payload) for rtype, payload in raw])
+
+    if args.summary:
+        print_summary(boots)
+    else:
+        print_records(boots)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(boots, f, indent=1)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
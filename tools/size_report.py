@@ -0,0 +1,295 @@
+#!/usr/bin/env python
+#
+# Breaks an app image down by memory region, component and symbol from the
+# linker map file, compares it with the previous build and checks it against
+# size budgets. It also estimates what an OTA update to this build would
+# transfer: the image, the image compressed, and the chunks which changed
+# since the previous build (a delta update).
+#
+# The report is run by the build of the projects which include it (target
+# size_report); a budget exceeded fails the build.
+#
+# Usage:
+#   size_report.py --map build/native_ota.map --app build/native_ota.bin \
+#       --budget size_budget.json --history build/size_history
+#
+# Budget file, in bytes, every entry optional:
+#   {"image": 1572864, "compressed": 786432, "delta": 131072,
+#    "iram": 131072, "dram": 65536, "components": {"mbedtls": 262144}}
+#
+from __future__ import print_function, division
+import argparse
+import hashlib
+import json
+import os
+import re
+import shutil
+import sys
+import zlib
+
+# Output sections of the ESP-IDF linker scripts, by region. Only the image
+# regions take space in the image and in the OTA payload.
+REGIONS = [
+    ("iram", (".iram0.vectors", ".iram0.text")),
+    ("dram", (".dram0.data",)),
+    ("flash_code", (".flash.text",)),
+    ("flash_rodata", (".flash.appdesc", ".flash.rodata")),
+    ("rtc", (".rtc.text", ".rtc.data", ".rtc.force_fast", ".rtc.force_slow")),
+    ("bss", (".dram0.bss", ".dram0.noinit", ".noinit", ".rtc.bss", ".rtc_noinit")),
+]
+IMAGE_REGIONS = ["iram", "dram", "flash_code", "flash_rodata", "rtc"]
+REGION_OF_SECTION = dict((section, region) for region, sections in REGIONS for section in sections)
+
+# Prefixes of the input sections of -ffunction-sections / -fdata-sections,
+# what follows is the symbol
+SECTION_PREFIXES = (".text.", ".literal.", ".rodata.", ".data.", ".bss.", ".sbss.", ".sdata.",
+                    ".iram1.", ".dram1.", ".rtc.text.", ".rtc.data.")
+
+OUTPUT_SECTION_RE = re.compile(r"^(\.\S+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+))?")
+INPUT_SECTION_RE = re.compile(r"^ (\.\S+|COMMON|\*fill\*)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s*(.*))?$")
+CONTINUATION_RE = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s*(.*)$")
+ARCHIVE_RE = re.compile(r"(?:^|/)lib([^/]+)\.a\(([^)]+)\)$")
+
+# Content defined chunking of the delta estimate, a chunk ends where the
+# rolling hash has CHUNK_BITS low bits set: about 512 bytes per chunk,
+# independent of code moving around
+CHUNK_BITS = 9
+CHUNK_MIN = 64
+CHUNK_MAX = 4096
+
+
+def component_of(source):
+    """ Component of an input file: libmbedtls.a(sha256.o) -> mbedtls """
+    if not source:
+        return "(fill)"
+    match = ARCHIVE_RE.search(source)
+    if match:
+        return match.group(1)
+    return os.path.basename(source)
+
+
+def symbol_of(section):
+    for prefix in SECTION_PREFIXES:
+        if section.startswith(prefix):
+            return section[len(prefix):]
+    return section
+
+
+def parse_map(path):
+    """ Returns [(region, component, symbol, size)] of the input sections placed in known output sections """
+    entries = []
+    region = None
+    pending = None      # Input section whose address and size are on the next line
+    in_map = False
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if not in_map:
+                in_map = line.startswith("Linker script and memory map")
+                continue
+            if line.startswith("OUTPUT("):
+                break
+            if pending is not None:
+                match = CONTINUATION_RE.match(line)
+                if match and region is not None:
+                    entries.append((region, component_of(match.group(3)), symbol_of(pending), int(match.group(2), 16)))
+                pending = None
+                continue
+            match = OUTPUT_SECTION_RE.match(line)
+            if match:
+                region = REGION_OF_SECTION.get(match.group(1))
+                continue
+            match = INPUT_SECTION_RE.match(line)
+            if match is None or region is None:
+                continue
+            if match.group(2) is None:
+                pending = match.group(1)
+                continue
+            size = int(match.group(3), 16)
+            if size:
+                source = match.group(4) if match.group(1) != "*fill*" else None
+                entries.append((region, component_of(source), symbol_of(match.group(1)), size))
+    return entries
+
+
+def chunks(data):
+    """ Splits data at content defined boundaries, so an insertion only changes the chunks around it """
+    data = bytearray(data)
+    mask = (1 << CHUNK_BITS) - 1
+    start = 0
+    h = 0
+    for i in range(len(data)):
+        h = ((h << 1) + GEAR[data[i]]) & 0xffffffff
+        length = i + 1 - start
+        if (length >= CHUNK_MIN and (h & mask) == mask) or length >= CHUNK_MAX:
+            yield bytes(data[start:i + 1])
+            start = i + 1
+            h = 0
+    if start < len(data):
+        yield bytes(data[start:])
+
+
+def make_gear():
+    # Fixed pseudo random table, so chunks of two builds are comparable
+    return [int(hashlib.md5(bytes(bytearray([i]))).hexdigest()[:8], 16) for i in range(256)]
+
+
+GEAR = make_gear()
+
+
+def delta_estimate(old, new):
+    """ Returns (compressed bytes of the chunks of new missing in old, changed chunks, total chunks) """
+    known = set(hashlib.sha1(chunk).digest() for chunk in chunks(old))
+    changed = []
+    total = 0
+    for chunk in chunks(new):
+        total += 1
+        if hashlib.sha1(chunk).digest() not in known:
+            changed.append(chunk)
+    # Each changed chunk also needs its position in the image
+    payload = zlib.compress(b"".join(changed), 9)
+    return len(payload) + 8 * len(changed), len(changed), total
+
+
+def summarize(entries, image):
+    regions = dict((region, 0) for region, _ in REGIONS)
+    components = {}
+    symbols = {}
+    for region, component, symbol, size in entries:
+        regions[region] += size
+        sizes = components.setdefault(component, dict((r, 0) for r, _ in REGIONS))
+        sizes[region] += size
+        key = "%s:%s:%s" % (region, component, symbol)
+        symbols[key] = symbols.get(key, 0) + size
+    return {
+        "image": len(image),
+        "compressed": len(zlib.compress(image, 9)),
+        "regions": regions,
+        "components": components,
+        "symbols": symbols,
+    }
+
+
+def image_total(sizes):
+    return sum(sizes.get(region, 0) for region in IMAGE_REGIONS)
+
+
+def delta_text(new, old):
+    if old is None:
+        return ""
+    diff = new - old
+    return "%+d" % diff if diff else "0"
+
+
+def print_report(report, previous, top):
+    old_regions = previous["regions"] if previous else {}
+    print("%-14s %10s %8s" % ("Region", "Bytes", "Delta"))
+    for region, _ in REGIONS:
+        old = old_regions.get(region) if previous else None
+        print("%-14s %10d %8s" % (region, report["regions"][region], delta_text(report["regions"][region], old)))
+
+    old_components = previous["components"] if previous else {}
+    print("")
+    print("%-24s" % "Component" + "".join("%13s" % region for region in IMAGE_REGIONS) + "%10s %8s" % ("total", "delta"))
+    ranked = sorted(report["components"].items(), key=lambda item: image_total(item[1]), reverse=True)
+    for component, sizes in ranked[:top]:
+        old = image_total(old_components[component]) if component in old_components else (0 if previous else None)
+        print("%-24s" % component[:24] + "".join("%13d" % sizes[region] for region in IMAGE_REGIONS)
+              + "%10d %8s" % (image_total(sizes), delta_text(image_total(sizes), old)))
+
+    print("")
+    print("Largest symbols:")
+    ranked = sorted(report["symbols"].items(), key=lambda item: item[1], reverse=True)
+    for key, size in ranked[:top]:
+        region, component, symbol = key.split(":", 2)
+        print("%8d  %-12s %-20s %s" % (size, region, component[:20], symbol))
+
+    if previous:
+        old_symbols = previous["symbols"]
+        keys = set(report["symbols"]) | set(old_symbols)
+        changes = [(report["symbols"].get(key, 0) - old_symbols.get(key, 0), key) for key in keys]
+        changes = sorted((change for change in changes if change[0]), key=lambda change: abs(change[0]), reverse=True)
+        if changes:
+            print("")
+            print("Largest changes since the previous build:")
+            for diff, key in changes[:top]:
+                region, component, symbol = key.split(":", 2)
+                print("%+8d  %-12s %-20s %s" % (diff, region, component[:20], symbol))
+
+
+def check_budget(report, budget):
+    """ Returns the number of budgets exceeded """
+    checks = []
+    for name in ("image", "compressed", "delta"):
+        if name in budget and name in report:
+            checks.append((name, report[name], budget[name]))
+    for region in IMAGE_REGIONS + ["bss"]:
+        if region in budget:
+            checks.append((region, report["regions"][region], budget[region]))
+    for component, limit in budget.get("components", {}).items():
+        checks.append((component, image_total(report["components"].get(component, {})), limit))
+
+    errors = 0
+    for name, size, limit in checks:
+        if size > limit:
+            print("Error: %s is %d bytes, over its budget of %d bytes by %d" % (name, size, limit, size - limit))
+            errors += 1
+        elif size * 100 > limit * 95:
+            print("Warning: %s uses %d%% of its budget (%d of %d bytes)" % (name, size * 100 // limit, size, limit))
+    return errors
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the size of an app image and of its OTA payload")
+    parser.add_argument("--map", required=True, help="linker map file of the app")
+    parser.add_argument("--app", required=True, help="app image (.bin)")
+    parser.add_argument("--budget", help="JSON file of size budgets, exceeding one fails")
+    parser.add_argument("--history", help="directory keeping the previous build, to report deltas")
+    parser.add_argument("--top", type=int, default=15, help="number of components and symbols listed")
+    parser.add_argument("--json", help="also write the report to this file")
+    args = parser.parse_args()
+
+    with open(args.app, "rb") as f:
+        image = f.read()
+    report = summarize(parse_map(args.map), image)
+
+    previous = None
+    previous_image = None
+    if args.history:
+        try:
+            with open(os.path.join(args.history, "size_report.json")) as f:
+                previous = json.load(f)
+            with open(os.path.join(args.history, "app.bin"), "rb") as f:
+                previous_image = f.read()
+        except (IOError, OSError, ValueError):
+            previous = None
+
+    print_report(report, previous, args.top)
+    print("")
+    name = os.path.basename(args.app)
+    print("%s: %d bytes, %d compressed (zlib -9)%s" % (name, report["image"], report["compressed"],
+          ", %s since the previous build" % delta_text(report["image"], previous["image"]) if previous else ""))
+    if previous_image is not None:
+        report["delta"], changed, total = delta_estimate(previous_image, image)
+        print("OTA payload from the previous build: %d bytes full, %d compressed, about %d as a delta (%d of %d chunks changed)" %
+              (report["image"], report["compressed"], report["delta"], changed, total))
+
+    errors = 0
+    if args.budget:
+        with open(args.budget) as f:
+            errors = check_budget(report, json.load(f))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=1, sort_keys=True)
+    if args.history:
+        if not os.path.isdir(args.history):
+            os.makedirs(args.history)
+        with open(os.path.join(args.history, "size_report.json"), "w") as f:
+            json.dump(report, f, sort_keys=True)
+        shutil.copyfile(args.app, os.path.join(args.history, "app.bin"))
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())